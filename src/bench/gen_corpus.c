@@ -0,0 +1,68 @@
+// Generates a synthetic CIF image for the benchmark corpus.
+//
+// usage: gen_corpus <pattern> <channels> <width> <height> <output-file.cif>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libcifex.h"
+#include "synthetic.c"
+
+static uint32_t
+cxb_parse_uint32(const char *str, const char *what)
+{
+   char *end;
+   unsigned long value = strtoul(str, &end, 10);
+   if (*str == '\0' || *end != '\0' || value > UINT32_MAX) {
+      fprintf(stderr, "error: invalid %s: %s\n", what, str);
+      exit(-1);
+   }
+   return value;
+}
+
+int
+main(int argc, char *argv[])
+{
+   if (argc != 6) {
+      fprintf(
+         stderr, "usage: gen_corpus <pattern> <channels> <width> <height> <output-file.cif>\n");
+      return -1;
+   }
+
+   cxb_pattern_t pattern;
+   if (!cxb_parse_pattern(argv[1], &pattern)) {
+      fprintf(stderr, "error: unknown pattern: %s\n", argv[1]);
+      return -1;
+   }
+   uint32_t channels = cxb_parse_uint32(argv[2], "channel count");
+   if (channels != cifex_rgb && channels != cifex_rgba) {
+      fprintf(stderr, "error: the channel count must be 3 or 4\n");
+      return -1;
+   }
+   uint32_t width = cxb_parse_uint32(argv[3], "width");
+   uint32_t height = cxb_parse_uint32(argv[4], "height");
+
+   cifex_allocator_t allocator = cifex_libc_allocator();
+   cifex_image_t image;
+   cifex_result_t result = cifex_alloc_image(&image, &allocator, width, height, channels);
+   if (result == cifex_ok) {
+      cxb_fill_image(&image, pattern);
+
+      cifex_writer_t writer;
+      if ((result = cifex_fopen_write(&writer, argv[5])) == cifex_ok) {
+         result = cifex_encode(&writer, &image, NULL);
+         cifex_result_t close_result = cifex_fclose_write(&writer);
+         if (result == cifex_ok) {
+            result = close_result;
+         }
+      }
+      cifex_free_image(&image);
+   }
+
+   if (result != cifex_ok) {
+      fprintf(stderr, "error: %s: %s\n", argv[5], cifex_result_to_string(result));
+      remove(argv[5]);
+      return result;
+   }
+   return 0;
+}
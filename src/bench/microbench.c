@@ -0,0 +1,323 @@
+// Microbenchmarks of the decoder's and encoder's innermost loops, run on synthetic data.
+//
+// usage: microbench <benchmark> <pattern> [iterations]
+//
+// The library's sources are included directly, so that its internal functions can be called.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../libcifex/decode.c"
+#include "../libcifex/encode.c"
+#include "synthetic.c"
+
+// The amount of numbers parsed or written by the number benchmarks.
+#define CXB_NUMBER_COUNT (1 << 18)
+
+// The size of the image parsed by the pixel benchmark.
+#define CXB_PIXELS_WIDTH 512
+#define CXB_PIXELS_HEIGHT 256
+
+typedef enum cxb_benchmark
+{
+   // `cx_dec_parse_number_up_to_hundreds`, with every number on its own line.
+   cxb_bench_parse_number,
+   // `cx_dec_parse_pixels` over an RGBA image.
+   cxb_bench_parse_pixels,
+   // `cx_enc_write_number`, into a writer that discards its input.
+   cxb_bench_write_number,
+   cxb__bench_count,
+} cxb_benchmark_t;
+
+static const char *cxb_benchmark_names[] = {
+   [cxb_bench_parse_number] = "parse_number",
+   [cxb_bench_parse_pixels] = "parse_pixels",
+   [cxb_bench_write_number] = "write_number",
+};
+
+// Fills an array of numbers with values drawn from the given pattern.
+static void
+cxb_fill_values(uint8_t *values, size_t count, cxb_pattern_t pattern)
+{
+   cxb_rng_t rng = { CXB_SEED };
+   for (size_t i = 0; i < count; ++i) {
+      uint32_t position = i % 256;
+      values[i] = cxb_sample(pattern, &rng, position, position, i % 3);
+   }
+}
+
+// A writer collecting its input in memory.
+typedef struct cxb_memory_writer
+{
+   cifex_writer_t writer;
+   uint8_t *data;
+   size_t len;
+   size_t capacity;
+} cxb_memory_writer_t;
+
+static size_t
+cxb_memory_write(cifex_writer_t *writer, const void *in, size_t n_bytes)
+{
+   cxb_memory_writer_t *mw = writer->user_data;
+   if (mw->capacity - mw->len < n_bytes) {
+      size_t capacity = mw->capacity > 0 ? mw->capacity : 65536;
+      while (capacity - mw->len < n_bytes) {
+         capacity *= 2;
+      }
+      uint8_t *data = realloc(mw->data, capacity);
+      if (data == NULL) {
+         errno = ENOMEM;
+         return 0;
+      }
+      mw->data = data;
+      mw->capacity = capacity;
+   }
+   memcpy(&mw->data[mw->len], in, n_bytes);
+   mw->len += n_bytes;
+   return n_bytes;
+}
+
+// A writer that only counts the bytes written to it.
+static size_t
+cxb_discard_write(cifex_writer_t *writer, const void *in, size_t n_bytes)
+{
+   (void)in;
+   *(size_t *)writer->user_data += n_bytes;
+   return n_bytes;
+}
+
+// Pads the collected text the way `cx_read_all` does, so that the decoder can run over it.
+static void
+cxb_pad_for_decoder(cxb_memory_writer_t *mw)
+{
+   uint8_t zeros[CX_MAX_PATTERN_LEN] = { 0 };
+   if (cxb_memory_write(&mw->writer, zeros, sizeof zeros) != sizeof zeros) {
+      fprintf(stderr, "error: out of memory\n");
+      exit(-1);
+   }
+   mw->len -= sizeof zeros;
+}
+
+// Sets up a decoder over a complete input, as if it was read with `cx_read_all`.
+static cx_decoder_t
+cxb_whole_input_decoder(const cxb_memory_writer_t *mw)
+{
+   return (cx_decoder_t){
+      .buffer = mw->data,
+      .buffer_len = mw->len,
+      .line = 1,
+      .capacity = mw->len,
+      .eof = true,
+   };
+}
+
+// The data a benchmark runs over.
+typedef struct cxb_input
+{
+   cxb_memory_writer_t text;
+   uint8_t *values;
+   cifex_image_t image;
+} cxb_input_t;
+
+static cifex_allocator_t cxb_allocator;
+
+// Generates the input of a benchmark.
+static void
+cxb_prepare(cxb_input_t *input, cxb_benchmark_t benchmark, cxb_pattern_t pattern)
+{
+   *input = (cxb_input_t){ 0 };
+   input->text.writer = (cifex_writer_t){ .user_data = &input->text, .write = cxb_memory_write };
+   cx_encoder_t enc = { .writer = &input->text.writer };
+   cifex_result_t result = cifex_ok;
+
+   switch (benchmark) {
+      case cxb_bench_parse_number:
+      case cxb_bench_write_number:
+         input->values = malloc(CXB_NUMBER_COUNT);
+         if (input->values == NULL) {
+            result = cifex_out_of_memory;
+            break;
+         }
+         cxb_fill_values(input->values, CXB_NUMBER_COUNT, pattern);
+         for (size_t i = 0; i < CXB_NUMBER_COUNT && result == cifex_ok; ++i) {
+            if ((result = cx_enc_write_number(&enc, input->values[i])) == cifex_ok) {
+               result = cx_enc_write(&enc, cxstr("\n"));
+            }
+         }
+         break;
+
+      case cxb_bench_parse_pixels:
+         result = cifex_alloc_image(
+            &input->image, &cxb_allocator, CXB_PIXELS_WIDTH, CXB_PIXELS_HEIGHT, cifex_rgba);
+         if (result != cifex_ok) {
+            break;
+         }
+         cxb_fill_image(&input->image, pattern);
+         result = cx_enc_dump_pixels(&enc, &input->image, NULL, 1);
+         break;
+
+      case cxb__bench_count:
+         break;
+   }
+   if (result == cifex_ok) {
+      result = cx_enc_flush(&enc);
+   }
+   if (result != cifex_ok) {
+      fprintf(stderr, "error: cannot prepare the input: %s\n", cifex_result_to_string(result));
+      exit(-1);
+   }
+   cxb_pad_for_decoder(&input->text);
+}
+
+// Runs a benchmark once. Returns `false` if the benchmarked code failed.
+//
+// The checksum keeps the compiler from optimizing the work away.
+static bool
+cxb_run(cxb_benchmark_t benchmark, cxb_input_t *input, uint64_t *inout_checksum)
+{
+   switch (benchmark) {
+      case cxb_bench_parse_number: {
+         cx_decoder_t dec = cxb_whole_input_decoder(&input->text);
+         for (size_t i = 0; i < CXB_NUMBER_COUNT; ++i) {
+            uint32_t number;
+            if (
+               !cx_dec_parse_number_up_to_hundreds(&dec, &number, false) ||
+               !cx_dec_match_lf(&dec, false)) {
+               return false;
+            }
+            *inout_checksum += number;
+         }
+         return true;
+      }
+
+      case cxb_bench_parse_pixels: {
+         cx_decoder_t dec = cxb_whole_input_decoder(&input->text);
+         size_t error_line;
+         if (cx_dec_parse_pixels(&dec, &input->image, &error_line) != cifex_ok) {
+            return false;
+         }
+         *inout_checksum += input->image.data[dec.position % CXB_PIXELS_WIDTH];
+         return true;
+      }
+
+      case cxb_bench_write_number: {
+         size_t written = 0;
+         cifex_writer_t writer = { .user_data = &written, .write = cxb_discard_write };
+         cx_encoder_t enc = { .writer = &writer };
+         for (size_t i = 0; i < CXB_NUMBER_COUNT; ++i) {
+            if (cx_enc_write_number(&enc, input->values[i]) != cifex_ok) {
+               return false;
+            }
+         }
+         if (cx_enc_flush(&enc) != cifex_ok) {
+            return false;
+         }
+         *inout_checksum += written;
+         return true;
+      }
+
+      case cxb__bench_count:
+         break;
+   }
+   return false;
+}
+
+static int
+cxb_compare_u64(const void *a, const void *b)
+{
+   uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+   return (x > y) - (x < y);
+}
+
+int
+main(int argc, char *argv[])
+{
+   if (argc < 3 || argc > 4) {
+      fprintf(stderr, "usage: microbench <benchmark> <pattern> [iterations]\n");
+      fprintf(stderr, "benchmarks:");
+      for (int i = 0; i < cxb__bench_count; ++i) {
+         fprintf(stderr, " %s", cxb_benchmark_names[i]);
+      }
+      fprintf(stderr, "\npatterns:");
+      for (int i = 0; i < cxb__pattern_count; ++i) {
+         fprintf(stderr, " %s", cxb_pattern_names[i]);
+      }
+      fprintf(stderr, "\n");
+      return -1;
+   }
+
+   int benchmark = 0;
+   while (benchmark < cxb__bench_count && strcmp(argv[1], cxb_benchmark_names[benchmark]) != 0) {
+      ++benchmark;
+   }
+   if (benchmark == cxb__bench_count) {
+      fprintf(stderr, "error: unknown benchmark: %s\n", argv[1]);
+      return -1;
+   }
+   cxb_pattern_t pattern;
+   if (!cxb_parse_pattern(argv[2], &pattern)) {
+      fprintf(stderr, "error: unknown pattern: %s\n", argv[2]);
+      return -1;
+   }
+   uint32_t iterations = 25;
+   if (argc == 4) {
+      char *end;
+      unsigned long value = strtoul(argv[3], &end, 10);
+      if (*argv[3] == '\0' || *end != '\0' || value == 0 || value > UINT32_MAX) {
+         fprintf(stderr, "error: invalid iteration count: %s\n", argv[3]);
+         return -1;
+      }
+      iterations = value;
+   }
+
+   cxb_allocator = cifex_libc_allocator();
+   cxb_input_t input;
+   cxb_prepare(&input, benchmark, pattern);
+   uint64_t *samples = malloc(iterations * sizeof(uint64_t));
+   if (samples == NULL) {
+      fprintf(stderr, "error: out of memory\n");
+      return -1;
+   }
+
+   // One warmup run, so that the input is in the cache and the allocations are paged in.
+   uint64_t checksum = 0;
+   bool ok = cxb_run(benchmark, &input, &checksum);
+   for (uint32_t i = 0; i < iterations && ok; ++i) {
+      uint64_t start = cx_now_ns();
+      ok = cxb_run(benchmark, &input, &checksum);
+      samples[i] = cx_now_ns() - start;
+   }
+   if (!ok) {
+      fprintf(stderr, "error: %s failed on the %s pattern\n", argv[1], argv[2]);
+      return -1;
+   }
+
+   qsort(samples, iterations, sizeof(uint64_t), cxb_compare_u64);
+   uint64_t median_ns = samples[iterations / 2];
+   size_t n_ops = benchmark == cxb_bench_parse_pixels
+      ? (size_t)CXB_PIXELS_WIDTH * CXB_PIXELS_HEIGHT
+      : CXB_NUMBER_COUNT;
+   const char *op = benchmark == cxb_bench_parse_pixels ? "pixel" : "number";
+   double seconds = median_ns / 1e9;
+
+   printf(
+      "%s %s: %.2f ns/%s, %.1f MB/s of text (min %.3f ms, median %.3f ms, checksum %llu)\n",
+      argv[1],
+      argv[2],
+      (double)median_ns / n_ops,
+      op,
+      input.text.len / seconds / 1e6,
+      samples[0] / 1e6,
+      median_ns / 1e6,
+      (unsigned long long)checksum);
+
+   free(samples);
+   free(input.text.data);
+   free(input.values);
+   if (input.image.data != NULL) {
+      cifex_free_image(&input.image);
+   }
+
+   return 0;
+}
@@ -0,0 +1,130 @@
+// Synthetic image data for benchmarks. All of it is generated from a fixed seed, so that the same
+// data is produced on every run and every machine.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "libcifex.h"
+
+// The seed all generators start out from.
+#define CXB_SEED 0x9E3779B97F4A7C15u
+
+// How the channel values of an image are distributed. The decoder's speed depends heavily on which
+// Polish words make up the numbers it parses, so the patterns cover a range of word lengths and
+// predictabilities.
+typedef enum cxb_pattern
+{
+   // Every pixel is the same.
+   cxb_pattern_solid,
+   // Smooth horizontal and vertical ramps.
+   cxb_pattern_gradient,
+   // Uniformly distributed values: high entropy, and every word of the number grammar.
+   cxb_pattern_noise,
+   // Mostly zeros and 255s with a sprinkle of small values, like masks and line art.
+   cxb_pattern_low_entropy,
+   // Values whose spellings are the longest in the 0..255 range.
+   cxb_pattern_long_words,
+   cxb__pattern_count,
+} cxb_pattern_t;
+
+static const char *cxb_pattern_names[] = {
+   [cxb_pattern_solid] = "solid",
+   [cxb_pattern_gradient] = "gradient",
+   [cxb_pattern_noise] = "noise",
+   [cxb_pattern_low_entropy] = "low-entropy",
+   [cxb_pattern_long_words] = "long-words",
+};
+
+static const uint8_t cxb_low_entropy_values[] = {
+   0, 0, 0, 0, 0, 0, 0, 0, 255, 255, 255, 255, 1, 2, 3, 128,
+};
+
+// Values spelled with three long words: hundreds, tens, and ones. The tens are mostly the
+// `-dziesiąt` ones, except for the `-dzieści` ones of 227-229, 237-239, and 246-249.
+static const uint8_t cxb_long_word_values[] = {
+   157, 158, 159, 167, 168, 169, 177, 178, 179, 187, 188, 189, 197, 198, 199, 247,
+   248, 249, 237, 238, 239, 227, 228, 229, 253, 254, 196, 186, 176, 166, 156, 246,
+};
+
+// Parses a pattern name. Returns `false` if the name is not known.
+static bool
+cxb_parse_pattern(const char *name, cxb_pattern_t *out_pattern)
+{
+   for (int pattern = 0; pattern < cxb__pattern_count; ++pattern) {
+      if (strcmp(name, cxb_pattern_names[pattern]) == 0) {
+         *out_pattern = pattern;
+         return true;
+      }
+   }
+   return false;
+}
+
+// A xorshift64* random number generator.
+typedef struct cxb_rng
+{
+   uint64_t state;
+} cxb_rng_t;
+
+static uint64_t
+cxb_next(cxb_rng_t *rng)
+{
+   rng->state ^= rng->state >> 12;
+   rng->state ^= rng->state << 25;
+   rng->state ^= rng->state >> 27;
+   return rng->state * 0x2545F4914F6CDD1Du;
+}
+
+// Generates the value of a single channel. `x` and `y` are scaled to 0..255 across the image by
+// the caller.
+static uint8_t
+cxb_sample(cxb_pattern_t pattern, cxb_rng_t *rng, uint32_t x, uint32_t y, int channel)
+{
+   switch (pattern) {
+      case cxb_pattern_solid: {
+         static const uint8_t color[4] = { 32, 128, 224, 255 };
+         return color[channel];
+      }
+      case cxb_pattern_gradient:
+         switch (channel) {
+            case 0:
+               return x;
+            case 1:
+               return y;
+            case 2:
+               return (x + y) / 2;
+            default:
+               return 255;
+         }
+      case cxb_pattern_noise:
+         return cxb_next(rng) >> 56;
+      case cxb_pattern_low_entropy:
+         return cxb_low_entropy_values[cxb_next(rng) >> 60];
+      case cxb_pattern_long_words:
+         return cxb_long_word_values[cxb_next(rng) >> 59];
+      case cxb__pattern_count:
+         break;
+   }
+   return 0;
+}
+
+// Fills an allocated image with the given pattern.
+static void
+cxb_fill_image(cifex_image_t *image, cxb_pattern_t pattern)
+{
+   cxb_rng_t rng = { CXB_SEED };
+   uint32_t x_max = image->width > 1 ? image->width - 1 : 1;
+   uint32_t y_max = image->height > 1 ? image->height - 1 : 1;
+
+   size_t offset = 0;
+   for (uint32_t y = 0; y < image->height; ++y) {
+      for (uint32_t x = 0; x < image->width; ++x) {
+         uint32_t scaled_x = (uint64_t)x * 255 / x_max;
+         uint32_t scaled_y = (uint64_t)y * 255 / y_max;
+         for (int channel = 0; channel < image->channels; ++channel) {
+            image->data[offset++] = cxb_sample(pattern, &rng, scaled_x, scaled_y, channel);
+         }
+      }
+   }
+}
+
@@ -1,6 +1,8 @@
+#include <errno.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -95,8 +97,49 @@ cxc_positional_args(cxc_arg_parser_t *ap, size_t n_positional, char ***out_strin
 typedef enum cxc_arg_type
 {
    cxc_bool,
+   // Takes the next argument as a decimal `uint32_t`.
+   cxc_uint32,
+   // Takes the next argument as a `char *`.
+   cxc_string,
 } cxc_arg_type_t;
 
+// Parses the value of the named argument at the current position. For arguments that take a value,
+// this also moves the parser past the value.
+static void
+cxc_arg_value(cxc_arg_parser_t *ap, cxc_arg_type_t type, void *out_value)
+{
+   const char *option = ap->argv[ap->position];
+   if (type == cxc_bool) {
+      *((bool *)out_value) = true;
+      return;
+   }
+
+   if (ap->position + 1 >= ap->argc) {
+      fprintf(stderr, "error: option %s expects a value\n", option);
+      exit(-1);
+   }
+   ++ap->position;
+   char *str = ap->argv[ap->position];
+   switch (type) {
+      case cxc_bool:
+         break;
+      case cxc_uint32: {
+         char *end;
+         errno = 0;
+         unsigned long long value = strtoull(str, &end, 10);
+         if (errno != 0 || end == str || *end != '\0' || str[0] == '-' || value > UINT32_MAX) {
+            fprintf(stderr, "error: invalid value for option %s: %s\n", option, str);
+            exit(-1);
+         }
+         *((uint32_t *)out_value) = (uint32_t)value;
+         break;
+      }
+      case cxc_string:
+         *((char **)out_value) = str;
+         break;
+   }
+}
+
 static void
 cxc_named_arg(
    cxc_arg_parser_t *ap,
@@ -110,20 +153,14 @@ cxc_named_arg(
    if (
       short_name != 0 && cxc_is_short_option(ap, ap->position) &&
       ap->argv[ap->position][1] == short_name) {
-      switch (type) {
-         case cxc_bool:
-            *((bool *)out_value) = true;
-            goto success;
-      }
+      cxc_arg_value(ap, type, out_value);
+      goto success;
    }
    if (
       long_name != NULL && cxc_is_long_option(ap, ap->position) &&
       strcmp(&ap->argv[ap->position][2], long_name) == 0) {
-      switch (type) {
-         case cxc_bool:
-            *((bool *)out_value) = true;
-            goto success;
-      }
+      cxc_arg_value(ap, type, out_value);
+      goto success;
    }
    return;
 
@@ -0,0 +1,234 @@
+// Batch processing: running a command over a list of files on a pool of worker threads, within a
+// single process.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "libcifex.h"
+
+// The most bytes of free image and input buffers kept around in the pool shared by all workers.
+#define CXC_BATCH_POOL_RETAINED ((size_t)1 << 30)
+
+// Processes a single file of a batch, allocating memory from `allocator`. Errors are expected to be
+// reported by the function itself.
+typedef cifex_result_t (*cxc_batch_fn)(
+   void *user_data,
+   cifex_allocator_t *allocator,
+   const char *input_file_name,
+   const char *output_file_name);
+
+typedef struct cxc_batch_config
+{
+   // The file listing the files to process, one per line, or `-` to read the list from stdin.
+   //
+   // Every line is either an input file name, or an input and output file name separated by a tab.
+   // When no output file name is given, it's derived from the input file name by replacing its
+   // extension with `output_extension`, and placing it in `output_dir` if one was given.
+   const char *list_file_name;
+   const char *output_dir;
+   const char *output_extension;
+
+   // The number of worker threads, or `0` to use one per online CPU.
+   uint32_t jobs;
+
+   cxc_batch_fn fn;
+   void *user_data;
+} cxc_batch_config_t;
+
+// The state shared between the workers.
+typedef struct cxc_batch
+{
+   const cxc_batch_config_t *config;
+   cifex_pool_t *pool;
+
+   pthread_mutex_t mutex;
+   // Everything below is guarded by `mutex`.
+   FILE *list;
+   size_t n_files;
+   size_t n_failed;
+} cxc_batch_t;
+
+// Derives an output file name from the input file name. Returns `NULL` if out of memory.
+static char *
+cxc_batch_output_name(const cxc_batch_config_t *config, const char *input_file_name)
+{
+   const char *base_name = strrchr(input_file_name, '/');
+   base_name = base_name != NULL ? base_name + 1 : input_file_name;
+   const char *extension = strrchr(base_name, '.');
+   int stem_len = extension != NULL && extension != base_name ? (int)(extension - base_name)
+                                                               : (int)strlen(base_name);
+
+   // Without an output directory, the output is placed next to the input.
+   const char *dir = "", *separator = "", *prefix = input_file_name;
+   int prefix_len = (int)(base_name - input_file_name) + stem_len;
+   if (config->output_dir != NULL) {
+      dir = config->output_dir;
+      separator = "/";
+      prefix = base_name;
+      prefix_len = stem_len;
+   }
+
+   const char *extension_name = config->output_extension;
+   size_t size = strlen(dir) + strlen(separator) + prefix_len + strlen(extension_name) + 2;
+   char *output = malloc(size);
+   if (output != NULL) {
+      snprintf(output, size, "%s%s%.*s.%s", dir, separator, prefix_len, prefix, extension_name);
+   }
+   return output;
+}
+
+// Processes a single line of the list. Returns whether it was successful.
+static bool
+cxc_batch_process_line(const cxc_batch_config_t *config, cifex_allocator_t *allocator, char *line)
+{
+   char *input_file_name = line;
+   char *output_file_name = NULL;
+   char *derived_name = NULL;
+
+   char *tab = strchr(line, '\t');
+   if (tab != NULL) {
+      *tab = '\0';
+      output_file_name = tab + 1;
+   } else {
+      if ((derived_name = cxc_batch_output_name(config, input_file_name)) == NULL) {
+         cxc_file_error(input_file_name, cifex_result_to_string(cifex_out_of_memory));
+         return false;
+      }
+      output_file_name = derived_name;
+   }
+
+   bool ok;
+   if (strcmp(input_file_name, output_file_name) == 0) {
+      cxc_file_error(input_file_name, "the output file would overwrite the input file");
+      ok = false;
+   } else {
+      ok = config->fn(config->user_data, allocator, input_file_name, output_file_name) == cifex_ok;
+   }
+
+   free(derived_name);
+   return ok;
+}
+
+static void *
+cxc_batch_worker(void *user_data)
+{
+   cxc_batch_t *batch = user_data;
+
+   // Every worker has its own cache in front of the shared pool, so that a worker processing
+   // similarly sized images keeps reusing the same buffers.
+   cifex_pool_cache_t cache = cifex_pool_cache(batch->pool);
+
+   char *line = NULL;
+   size_t line_capacity = 0;
+   size_t n_files = 0, n_failed = 0;
+   while (true) {
+      pthread_mutex_lock(&batch->mutex);
+      ssize_t len = getline(&line, &line_capacity, batch->list);
+      pthread_mutex_unlock(&batch->mutex);
+      if (len < 0) {
+         break;
+      }
+
+      while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+         line[--len] = '\0';
+      }
+      if (len == 0) {
+         continue;
+      }
+
+      ++n_files;
+      if (!cxc_batch_process_line(batch->config, &cache.allocator, line)) {
+         ++n_failed;
+      }
+   }
+
+   free(line);
+   cifex_free_pool_cache(&cache);
+
+   pthread_mutex_lock(&batch->mutex);
+   batch->n_files += n_files;
+   batch->n_failed += n_failed;
+   pthread_mutex_unlock(&batch->mutex);
+
+   return NULL;
+}
+
+// Processes all files in the batch. A file failing to process doesn't stop the others from being
+// processed; the number of failed files is reported at the end.
+//
+// Returns `EXIT_SUCCESS` if all files were processed successfully, and `EXIT_FAILURE` otherwise.
+static int
+cxc_run_batch(const cxc_batch_config_t *config)
+{
+   cxc_batch_t batch = {
+      .config = config,
+      .mutex = PTHREAD_MUTEX_INITIALIZER,
+   };
+
+   uint32_t jobs = config->jobs;
+   if (jobs == 0) {
+      long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      jobs = n_cpus > 0 ? (uint32_t)n_cpus : 1;
+   }
+
+   cifex_allocator_t libc_allocator = cifex_libc_allocator();
+   cifex_result_t result = cifex_create_pool(&batch.pool, &libc_allocator, CXC_BATCH_POOL_RETAINED);
+   pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+   if (result == cifex_ok && threads == NULL) {
+      result = cifex_out_of_memory;
+   }
+   if (result != cifex_ok) {
+      fprintf(stderr, "error: %s\n", cifex_result_to_string(result));
+      free(threads);
+      cifex_destroy_pool(batch.pool);
+      return EXIT_FAILURE;
+   }
+
+   errno = 0;
+   if (strcmp(config->list_file_name, "-") == 0) {
+      batch.list = stdin;
+   } else if ((batch.list = fopen(config->list_file_name, "r")) == NULL) {
+      cxc_file_error(config->list_file_name, cifex_result_to_string(cxc_errno_result()));
+      free(threads);
+      cifex_destroy_pool(batch.pool);
+      return EXIT_FAILURE;
+   }
+
+   uint32_t n_threads = 0;
+   for (; n_threads < jobs; ++n_threads) {
+      if (pthread_create(&threads[n_threads], NULL, cxc_batch_worker, &batch) != 0) {
+         break;
+      }
+   }
+   if (n_threads == 0) {
+      // Couldn't start any threads, so do all the work on this one.
+      cxc_batch_worker(&batch);
+   }
+   for (uint32_t i = 0; i < n_threads; ++i) {
+      pthread_join(threads[i], NULL);
+   }
+   free(threads);
+
+   bool read_error = ferror(batch.list);
+   if (batch.list != stdin) {
+      fclose(batch.list);
+   }
+   cifex_destroy_pool(batch.pool);
+
+   if (read_error) {
+      cxc_file_error(config->list_file_name, "could not read the file list");
+      return EXIT_FAILURE;
+   }
+   if (batch.n_failed > 0) {
+      fprintf(stderr, "%zu of %zu files failed\n", batch.n_failed, batch.n_files);
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
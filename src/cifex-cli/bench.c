@@ -0,0 +1,384 @@
+// The `bench` mode: decoding and encoding an image repeatedly within a single process, and
+// reporting how long every phase took.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libcifex.h"
+
+// The optimizations the binary was built with, as reported alongside the results.
+#ifndef CXC_BUILD_FLAVOR
+# define CXC_BUILD_FLAVOR "unknown"
+#endif
+
+// Returns the current time of a monotonic clock, in nanoseconds.
+static uint64_t
+cxc_now_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+typedef enum cxc_bench_phase
+{
+   cxc_phase_read_all,
+   cxc_phase_header,
+   cxc_phase_metadata,
+   cxc_phase_pixels,
+   // The whole decoding run, including opening the file.
+   cxc_phase_decode,
+   // Serializing the image, not counting the time spent in the writer.
+   cxc_phase_encode_pixels,
+   // The time spent in the writer.
+   cxc_phase_flush,
+   // The whole encoding run.
+   cxc_phase_encode,
+   cxc__phase_count,
+} cxc_bench_phase_t;
+
+static const char *cxc_bench_phase_names[] = {
+   [cxc_phase_read_all] = "read_all",
+   [cxc_phase_header] = "header",
+   [cxc_phase_metadata] = "metadata",
+   [cxc_phase_pixels] = "pixels",
+   [cxc_phase_decode] = "decode",
+   [cxc_phase_encode_pixels] = "encode_pixels",
+   [cxc_phase_flush] = "flush",
+   [cxc_phase_encode] = "encode",
+};
+
+typedef struct cxc_bench_config
+{
+   const char *input_file_name;
+   uint32_t iterations;
+   uint32_t warmup;
+   bool decode;
+   bool encode;
+   // The window size used for streaming, or `0` to decode the file as a whole.
+   size_t stream_buffer_size;
+   bool json;
+} cxc_bench_config_t;
+
+// A writer which collects the output in memory. The buffer is reused between runs.
+typedef struct cxc_memory_writer
+{
+   cifex_writer_t writer;
+   uint8_t *data;
+   size_t len;
+   size_t capacity;
+} cxc_memory_writer_t;
+
+static size_t
+cxc_memory_write(cifex_writer_t *writer, const void *in, size_t n_bytes)
+{
+   cxc_memory_writer_t *mw = writer->user_data;
+   if (mw->capacity - mw->len < n_bytes) {
+      size_t capacity = mw->capacity > 0 ? mw->capacity : 65536;
+      while (capacity - mw->len < n_bytes) {
+         capacity *= 2;
+      }
+      uint8_t *data = realloc(mw->data, capacity);
+      if (data == NULL) {
+         errno = ENOMEM;
+         return 0;
+      }
+      mw->data = data;
+      mw->capacity = capacity;
+   }
+   memcpy(&mw->data[mw->len], in, n_bytes);
+   mw->len += n_bytes;
+   return n_bytes;
+}
+
+static int
+cxc_compare_u64(const void *a, const void *b)
+{
+   uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+   return (x > y) - (x < y);
+}
+
+// Summarized timings of a single phase.
+typedef struct cxc_bench_summary
+{
+   uint64_t min_ns, median_ns, p99_ns;
+   // Throughput at the median time.
+   double mb_per_s, pixels_per_s;
+} cxc_bench_summary_t;
+
+// Summarizes the samples of a phase, sorting them in the process.
+static cxc_bench_summary_t
+cxc_summarize(uint64_t *samples, uint32_t n, size_t n_bytes, uint64_t n_pixels)
+{
+   qsort(samples, n, sizeof(uint64_t), cxc_compare_u64);
+   cxc_bench_summary_t summary = {
+      .min_ns = samples[0],
+      .median_ns = samples[(n - 1) / 2],
+      // Nearest-rank percentile.
+      .p99_ns = samples[(n * 99 + 99) / 100 - 1],
+   };
+   if (summary.median_ns > 0) {
+      double seconds = summary.median_ns / 1e9;
+      summary.mb_per_s = n_bytes / 1e6 / seconds;
+      summary.pixels_per_s = n_pixels / seconds;
+   }
+   return summary;
+}
+
+// Decodes the input file once, recording the timings of the run into `samples` if not `NULL`.
+static cifex_decode_result_t
+cxc_bench_decode(
+   const cxc_bench_config_t *c,
+   cifex_allocator_t *allocator,
+   cifex_image_t *image,
+   cifex_image_info_t *image_info,
+   cifex_stats_t *stats,
+   uint64_t *samples[cxc__phase_count],
+   uint32_t i)
+{
+   uint64_t start = cxc_now_ns();
+
+   cifex_reader_t reader;
+   cifex_result_t result = cifex_fopen_read(&reader, c->input_file_name);
+   if (result != cifex_ok) {
+      return (cifex_decode_result_t){ .result = result };
+   }
+   cifex_decode_config_t decode_config = cifex_default_decode_config(allocator, &reader);
+   decode_config.stream_buffer_size = c->stream_buffer_size;
+   decode_config.stats = stats;
+   cifex_free_image_info(image_info);
+   cifex_decode_result_t decode_result = cifex_decode(decode_config, image, image_info);
+   cifex_fclose_read(&reader);
+
+   if (samples != NULL) {
+      samples[cxc_phase_read_all][i] = stats->read_ns;
+      samples[cxc_phase_header][i] = stats->header_ns;
+      samples[cxc_phase_metadata][i] = stats->metadata_ns;
+      samples[cxc_phase_pixels][i] = stats->pixels_ns;
+      samples[cxc_phase_decode][i] = cxc_now_ns() - start;
+   }
+   return decode_result;
+}
+
+// Encodes the image once, recording the timings of the run into `samples` if not `NULL`.
+static cifex_result_t
+cxc_bench_encode(
+   cxc_memory_writer_t *mw,
+   const cifex_image_t *image,
+   const cifex_image_info_t *image_info,
+   uint64_t *samples[cxc__phase_count],
+   uint32_t i)
+{
+   mw->len = 0;
+
+   cifex_stats_t stats;
+   cifex_encode_config_t encode_config = cifex_default_encode_config(&mw->writer);
+   encode_config.stats = &stats;
+   uint64_t start = cxc_now_ns();
+   cifex_result_t result = cifex_encode_with_config(encode_config, image, image_info);
+   uint64_t total = cxc_now_ns() - start;
+
+   if (samples != NULL) {
+      uint64_t serializing = stats.header_ns + stats.metadata_ns + stats.pixels_ns;
+      samples[cxc_phase_encode_pixels][i] = serializing - stats.write_ns;
+      samples[cxc_phase_flush][i] = stats.write_ns;
+      samples[cxc_phase_encode][i] = total;
+   }
+   return result;
+}
+
+// Prints a string as a JSON string literal.
+static void
+cxc_print_json_string(const char *str)
+{
+   putchar('"');
+   for (const unsigned char *c = (const unsigned char *)str; *c != '\0'; ++c) {
+      if (*c == '"' || *c == '\\') {
+         printf("\\%c", *c);
+      } else if (*c < 0x20) {
+         printf("\\u%04x", *c);
+      } else {
+         putchar(*c);
+      }
+   }
+   putchar('"');
+}
+
+static void
+cxc_print_bench_results(
+   const cxc_bench_config_t *c,
+   const cifex_image_t *image,
+   size_t input_size,
+   size_t encoded_size,
+   uint64_t *samples[cxc__phase_count])
+{
+   uint64_t n_pixels = (uint64_t)image->width * image->height;
+
+   if (c->json) {
+      printf("{\"file\":");
+      cxc_print_json_string(c->input_file_name);
+      printf(
+         ",\"build\":\"%s\",\"iterations\":%u,\"warmup\":%u,\"stream\":%s,"
+         "\"width\":%u,\"height\":%u,\"channels\":%d,\"input_bytes\":%zu,\"encoded_bytes\":%zu,"
+         "\"phases\":{",
+         CXC_BUILD_FLAVOR,
+         c->iterations,
+         c->warmup,
+         c->stream_buffer_size != 0 ? "true" : "false",
+         image->width,
+         image->height,
+         (int)image->channels,
+         input_size,
+         encoded_size);
+   } else {
+      printf(
+         "%s: %ux%u, %d channels, %zu bytes; %u iterations after %u warm-up, %s build\n",
+         c->input_file_name,
+         image->width,
+         image->height,
+         (int)image->channels,
+         input_size,
+         c->iterations,
+         c->warmup,
+         CXC_BUILD_FLAVOR);
+      printf(
+         "%-14s %12s %12s %12s %10s %10s\n",
+         "phase",
+         "min ms",
+         "median ms",
+         "p99 ms",
+         "MB/s",
+         "Mpx/s");
+   }
+
+   bool first = true;
+   for (int phase = 0; phase < cxc__phase_count; ++phase) {
+      if (samples[phase] == NULL) {
+         continue;
+      }
+      // Decoding phases are measured against the size of the input, and encoding phases against the
+      // size of the output.
+      size_t n_bytes = phase <= cxc_phase_decode ? input_size : encoded_size;
+      cxc_bench_summary_t s = cxc_summarize(samples[phase], c->iterations, n_bytes, n_pixels);
+      // The header and metadata take up a tiny, fixed part of the file, so their throughput
+      // wouldn't mean anything.
+      bool has_throughput = phase != cxc_phase_header && phase != cxc_phase_metadata;
+      if (c->json) {
+         printf(
+            "%s\"%s\":{\"min_ns\":%llu,\"median_ns\":%llu,\"p99_ns\":%llu",
+            first ? "" : ",",
+            cxc_bench_phase_names[phase],
+            (unsigned long long)s.min_ns,
+            (unsigned long long)s.median_ns,
+            (unsigned long long)s.p99_ns);
+         if (has_throughput) {
+            printf(",\"mb_per_s\":%.3f,\"pixels_per_s\":%.0f", s.mb_per_s, s.pixels_per_s);
+         }
+         printf("}");
+      } else {
+         printf(
+            "%-14s %12.3f %12.3f %12.3f",
+            cxc_bench_phase_names[phase],
+            s.min_ns / 1e6,
+            s.median_ns / 1e6,
+            s.p99_ns / 1e6);
+         if (has_throughput) {
+            printf(" %10.1f %10.2f", s.mb_per_s, s.pixels_per_s / 1e6);
+         }
+         printf("\n");
+      }
+      first = false;
+   }
+
+   if (c->json) {
+      printf("}}\n");
+   }
+}
+
+static cifex_result_t
+cxc_bench(cxc_bench_config_t c)
+{
+   if (c.input_file_name == NULL) {
+      fprintf(
+         stderr,
+         "error: no input filename provided.\n"
+         "usage: cifex bench <input-file.cif> [--iterations N] [--warmup N] [--only decode|encode]"
+         " [--stream] [--json]\n");
+      exit(-1);
+   }
+   if (c.iterations == 0) {
+      fprintf(stderr, "error: the number of iterations must be at least 1\n");
+      exit(-1);
+   }
+
+   cifex_allocator_t allocator = cifex_libc_allocator();
+   cifex_image_t image = { 0 };
+   cifex_image_info_t image_info = { 0 };
+   cifex_stats_t decode_stats = { 0 };
+   cxc_memory_writer_t mw = { .writer = { .user_data = &mw, .write = cxc_memory_write } };
+
+   uint64_t *samples[cxc__phase_count] = { 0 };
+   cifex_result_t result = cifex_ok;
+   for (int phase = 0; phase < cxc__phase_count; ++phase) {
+      bool is_decode_phase = phase <= cxc_phase_decode;
+      if (is_decode_phase ? c.decode : c.encode) {
+         if ((samples[phase] = calloc(c.iterations, sizeof(uint64_t))) == NULL) {
+            result = cifex_out_of_memory;
+            fprintf(stderr, "error: %s\n", cifex_result_to_string(result));
+            goto cleanup;
+         }
+      }
+   }
+
+   // Even when only encoding is benchmarked, the image has to be decoded once to have something to
+   // encode.
+   uint32_t decode_runs = c.decode ? c.warmup + c.iterations : 1;
+   for (uint32_t i = 0; i < decode_runs; ++i) {
+      bool measured = c.decode && i >= c.warmup;
+      cifex_decode_result_t decode_result = cxc_bench_decode(
+         &c,
+         &allocator,
+         &image,
+         &image_info,
+         &decode_stats,
+         measured ? samples : NULL,
+         i - c.warmup);
+      if ((result = decode_result.result) != cifex_ok) {
+         fprintf(
+            stderr,
+            "error: %s: line %lu (byte %lu): %s\n",
+            c.input_file_name,
+            decode_result.line,
+            decode_result.position,
+            cifex_result_to_string(result));
+         goto cleanup;
+      }
+   }
+
+   // The image is encoded once even when encoding isn't benchmarked, to know its canonical size.
+   uint32_t encode_runs = c.encode ? c.warmup + c.iterations : 1;
+   for (uint32_t i = 0; i < encode_runs; ++i) {
+      bool measured = c.encode && i >= c.warmup;
+      result = cxc_bench_encode(&mw, &image, &image_info, measured ? samples : NULL, i - c.warmup);
+      if (result != cifex_ok) {
+         fprintf(stderr, "error: encoding failed: %s\n", cifex_result_to_string(result));
+         goto cleanup;
+      }
+   }
+
+   cxc_print_bench_results(&c, &image, decode_stats.bytes_read, mw.len, samples);
+
+cleanup:
+   for (int phase = 0; phase < cxc__phase_count; ++phase) {
+      free(samples[phase]);
+   }
+   free(mw.data);
+   cifex_free_image(&image);
+   cifex_free_image_info(&image_info);
+   return result;
+}
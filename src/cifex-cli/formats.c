@@ -0,0 +1,305 @@
+// Writers for simple uncompressed (or nearly so) image formats. These are much cheaper to produce
+// than PNG, and all of them can be written out row by row as the image is being decoded.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libcifex.h"
+
+// The size of the stdio buffer used for output files.
+#define CXC_OUTPUT_BUFFER_SIZE (1 << 20)
+
+// Turns the current `errno` into a result, for functions that don't always set it.
+static cifex_result_t
+cxc_errno_result(void)
+{
+   return cifex_errno_result(errno != 0 ? errno : EIO);
+}
+
+// Reports an error concerning the given file.
+static void
+cxc_file_error(const char *file_name, const char *message)
+{
+   fprintf(stderr, "error: %s: %s\n", file_name, message);
+}
+
+static void
+cxc_put_be32(uint8_t *out, uint32_t value)
+{
+   out[0] = value >> 24;
+   out[1] = value >> 16;
+   out[2] = value >> 8;
+   out[3] = value;
+}
+
+typedef enum cxc_row_format
+{
+   // Tightly packed pixels with no header.
+   cxc_format_raw,
+   // Binary PPM (P6). The alpha channel of RGBA images is dropped, since PPM doesn't support it.
+   cxc_format_ppm,
+   // PAM (P7), with the RGB or RGB_ALPHA tuple type.
+   cxc_format_pam,
+   // The Quite OK Image format.
+   cxc_format_qoi,
+} cxc_row_format_t;
+
+// The state of the QOI encoder.
+typedef struct cxc_qoi_state
+{
+   uint8_t previous[4];
+   uint8_t index[64][4];
+   uint32_t run;
+} cxc_qoi_state_t;
+
+// A row sink which writes the rows into a file in one of the `cxc_row_format_t` formats.
+typedef struct cxc_file_sink
+{
+   cifex_row_sink_t sink;
+   const char *file_name;
+   cxc_row_format_t format;
+
+   FILE *file;
+   cifex_channels_t channels;
+   uint32_t width;
+   // Scratch space for converting rows, used by PPM and QOI.
+   uint8_t *scratch;
+
+   cxc_qoi_state_t qoi;
+} cxc_file_sink_t;
+
+#define CXC_QOI_OP_INDEX 0x00
+#define CXC_QOI_OP_DIFF 0x40
+#define CXC_QOI_OP_LUMA 0x80
+#define CXC_QOI_OP_RUN 0xC0
+#define CXC_QOI_OP_RGB 0xFE
+#define CXC_QOI_OP_RGBA 0xFF
+
+// The longest run a single QOI_OP_RUN can encode.
+#define CXC_QOI_MAX_RUN 62
+
+// The most bytes a single QOI pixel can take up.
+#define CXC_QOI_MAX_PIXEL_SIZE 5
+
+static void
+cxc_init_qoi(cxc_qoi_state_t *qoi)
+{
+   *qoi = (cxc_qoi_state_t){ .previous = { 0, 0, 0, 255 } };
+}
+
+// Encodes a row of pixels into `out`, which must have room for `CXC_QOI_MAX_PIXEL_SIZE` bytes per
+// pixel. Returns the number of bytes written.
+static size_t
+cxc_qoi_encode_row(
+   cxc_qoi_state_t *qoi,
+   const uint8_t *row,
+   uint32_t width,
+   cifex_channels_t channels,
+   uint8_t *out)
+{
+   uint8_t *start = out;
+
+   for (uint32_t x = 0; x < width; ++x) {
+      const uint8_t *source = &row[(size_t)x * channels];
+      uint8_t pixel[4] = {
+         source[0], source[1], source[2], channels == cifex_rgba ? source[3] : 255
+      };
+
+      if (memcmp(pixel, qoi->previous, 4) == 0) {
+         if (++qoi->run == CXC_QOI_MAX_RUN) {
+            *out++ = CXC_QOI_OP_RUN | (qoi->run - 1);
+            qoi->run = 0;
+         }
+         continue;
+      }
+
+      if (qoi->run > 0) {
+         *out++ = CXC_QOI_OP_RUN | (qoi->run - 1);
+         qoi->run = 0;
+      }
+
+      uint32_t hash = (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64;
+      if (memcmp(qoi->index[hash], pixel, 4) == 0) {
+         *out++ = CXC_QOI_OP_INDEX | hash;
+      } else {
+         memcpy(qoi->index[hash], pixel, 4);
+
+         if (pixel[3] == qoi->previous[3]) {
+            int8_t dr = pixel[0] - qoi->previous[0];
+            int8_t dg = pixel[1] - qoi->previous[1];
+            int8_t db = pixel[2] - qoi->previous[2];
+            int8_t dr_dg = dr - dg;
+            int8_t db_dg = db - dg;
+
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+               *out++ = CXC_QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+            } else if (
+               dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+               *out++ = CXC_QOI_OP_LUMA | (dg + 32);
+               *out++ = (dr_dg + 8) << 4 | (db_dg + 8);
+            } else {
+               *out++ = CXC_QOI_OP_RGB;
+               *out++ = pixel[0];
+               *out++ = pixel[1];
+               *out++ = pixel[2];
+            }
+         } else {
+            *out++ = CXC_QOI_OP_RGBA;
+            memcpy(out, pixel, 4);
+            out += 4;
+         }
+      }
+
+      memcpy(qoi->previous, pixel, 4);
+   }
+
+   return out - start;
+}
+
+static cifex_result_t
+cxc_file_sink_begin(
+   cifex_row_sink_t *sink,
+   uint32_t width,
+   uint32_t height,
+   cifex_channels_t channels,
+   const cifex_image_info_t *image_info)
+{
+   cxc_file_sink_t *fs = sink->user_data;
+   fs->width = width;
+   fs->channels = channels;
+
+   size_t scratch_size = 0;
+   if (fs->format == cxc_format_ppm) {
+      scratch_size = (size_t)width * 3;
+   } else if (fs->format == cxc_format_qoi) {
+      scratch_size = (size_t)width * CXC_QOI_MAX_PIXEL_SIZE;
+   }
+   if (scratch_size > 0 && (fs->scratch = malloc(scratch_size)) == NULL) {
+      return cifex_out_of_memory;
+   }
+
+   errno = 0;
+   if ((fs->file = fopen(fs->file_name, "wb")) == NULL) {
+      return cxc_errno_result();
+   }
+   setvbuf(fs->file, NULL, _IOFBF, CXC_OUTPUT_BUFFER_SIZE);
+
+   int written = 0;
+   switch (fs->format) {
+      case cxc_format_raw:
+         break;
+      case cxc_format_ppm:
+         written = fprintf(fs->file, "P6\n%u %u\n255\n", width, height);
+         break;
+      case cxc_format_pam:
+         written = fprintf(
+            fs->file,
+            "P7\nWIDTH %u\nHEIGHT %u\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+            width,
+            height,
+            (int)channels,
+            channels == cifex_rgba ? "RGB_ALPHA" : "RGB");
+         break;
+      case cxc_format_qoi: {
+         uint8_t header[14] = { 'q', 'o', 'i', 'f' };
+         cxc_put_be32(&header[4], width);
+         cxc_put_be32(&header[8], height);
+         header[12] = channels;
+         header[13] = 0; // sRGB with linear alpha
+         written = fwrite(header, 1, sizeof(header), fs->file) == sizeof(header) ? 1 : -1;
+         cxc_init_qoi(&fs->qoi);
+         break;
+      }
+   }
+   if (written < 0) {
+      return cxc_errno_result();
+   }
+
+   return cifex_ok;
+}
+
+static cifex_result_t
+cxc_file_sink_row(cifex_row_sink_t *sink, uint32_t y, const uint8_t *row)
+{
+   cxc_file_sink_t *fs = sink->user_data;
+
+   const uint8_t *data = row;
+   size_t len = (size_t)fs->width * fs->channels;
+   switch (fs->format) {
+      case cxc_format_raw:
+      case cxc_format_pam:
+         break;
+      case cxc_format_ppm:
+         if (fs->channels == cifex_rgba) {
+            for (uint32_t x = 0; x < fs->width; ++x) {
+               memcpy(&fs->scratch[(size_t)x * 3], &row[(size_t)x * 4], 3);
+            }
+            data = fs->scratch;
+            len = (size_t)fs->width * 3;
+         }
+         break;
+      case cxc_format_qoi:
+         len = cxc_qoi_encode_row(&fs->qoi, row, fs->width, fs->channels, fs->scratch);
+         data = fs->scratch;
+         break;
+   }
+
+   errno = 0;
+   if (fwrite(data, 1, len, fs->file) != len) {
+      return cxc_errno_result();
+   }
+   return cifex_ok;
+}
+
+// Initializes a sink which writes rows into the given file. The file is only created once the
+// decoder reaches the pixel data.
+static void
+cxc_init_file_sink(cxc_file_sink_t *fs, const char *file_name, cxc_row_format_t format)
+{
+   *fs = (cxc_file_sink_t){
+      .sink = {
+         .user_data = fs,
+         .begin = cxc_file_sink_begin,
+         .row = cxc_file_sink_row,
+      },
+      .file_name = file_name,
+      .format = format,
+   };
+}
+
+// Finishes writing the file if decoding was successful. Otherwise, the incomplete file is removed.
+static cifex_result_t
+cxc_finish_file_sink(cxc_file_sink_t *fs, cifex_result_t decode_result)
+{
+   cifex_result_t result = decode_result;
+
+   if (result == cifex_ok && fs->format == cxc_format_qoi) {
+      uint8_t end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+      errno = 0;
+      if (
+         (fs->qoi.run > 0 && fputc(CXC_QOI_OP_RUN | (fs->qoi.run - 1), fs->file) == EOF) ||
+         fwrite(end, 1, sizeof(end), fs->file) != sizeof(end)) {
+         result = cxc_errno_result();
+      }
+   }
+
+   if (fs->file != NULL) {
+      errno = 0;
+      if (fclose(fs->file) != 0 && result == cifex_ok) {
+         result = cxc_errno_result();
+      }
+      if (result != cifex_ok) {
+         remove(fs->file_name);
+      }
+   }
+
+   free(fs->scratch);
+   fs->scratch = NULL;
+   fs->file = NULL;
+
+   return result;
+}
@@ -0,0 +1,304 @@
+// Input files for the encoder, and parsers for the uncompressed formats that can be encoded without
+// copying the pixels anywhere: headerless raw pixels, PPM, and PAM.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+# define CXC_HAVE_MMAP
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+#include "libcifex.h"
+
+// The initial size of the buffer that unmappable input files are read into.
+#define CXC_INPUT_CHUNK_SIZE (1 << 20)
+
+// An input file, either memory-mapped or read into memory as a whole.
+typedef struct cxc_input_file
+{
+   const uint8_t *data;
+   size_t len;
+   bool mapped;
+} cxc_input_file_t;
+
+// Reads the rest of a file into memory.
+static cifex_result_t
+cxc_read_whole_file(cxc_input_file_t *in, FILE *file)
+{
+   size_t capacity = CXC_INPUT_CHUNK_SIZE;
+   size_t len = 0;
+   uint8_t *data = malloc(capacity);
+   if (data == NULL) {
+      return cifex_out_of_memory;
+   }
+
+   while (true) {
+      if (len == capacity) {
+         uint8_t *grown = realloc(data, capacity * 2);
+         if (grown == NULL) {
+            free(data);
+            return cifex_out_of_memory;
+         }
+         data = grown;
+         capacity *= 2;
+      }
+      errno = 0;
+      size_t n_read = fread(&data[len], 1, capacity - len, file);
+      len += n_read;
+      if (n_read == 0) {
+         if (ferror(file)) {
+            free(data);
+            return cxc_errno_result();
+         }
+         break;
+      }
+   }
+
+   in->data = data;
+   in->len = len;
+   in->mapped = false;
+   return cifex_ok;
+}
+
+// Opens an input file. If the file name is `-`, stdin is read instead.
+//
+// Regular files are memory-mapped where possible, so that their contents are only paged in as the
+// encoder gets to them.
+static cifex_result_t
+cxc_open_input(cxc_input_file_t *in, const char *file_name)
+{
+   if (strcmp(file_name, "-") == 0) {
+      return cxc_read_whole_file(in, stdin);
+   }
+
+#ifdef CXC_HAVE_MMAP
+   int fd = open(file_name, O_RDONLY);
+   if (fd < 0) {
+      return cifex_errno_result(errno);
+   }
+   struct stat st;
+   if (fstat(fd, &st) != 0) {
+      int err = errno;
+      close(fd);
+      return cifex_errno_result(err);
+   }
+   if (S_ISREG(st.st_mode) && st.st_size > 0) {
+      void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+      if (data == MAP_FAILED) {
+         return cifex_errno_result(errno);
+      }
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      in->data = data;
+      in->len = st.st_size;
+      in->mapped = true;
+      return cifex_ok;
+   }
+   close(fd);
+#endif
+
+   // Pipes and other files which can't be mapped are read into memory instead.
+   errno = 0;
+   FILE *file = fopen(file_name, "rb");
+   if (file == NULL) {
+      return cxc_errno_result();
+   }
+   cifex_result_t result = cxc_read_whole_file(in, file);
+   fclose(file);
+   return result;
+}
+
+static void
+cxc_close_input(cxc_input_file_t *in)
+{
+#ifdef CXC_HAVE_MMAP
+   if (in->mapped) {
+      munmap((void *)in->data, in->len);
+      in->data = NULL;
+      return;
+   }
+#endif
+   free((void *)in->data);
+   in->data = NULL;
+}
+
+// Points the image at pixel data inside the input file, checking that there's enough of it.
+static const char *
+cxc_image_from_input(
+   const cxc_input_file_t *in,
+   size_t offset,
+   uint32_t width,
+   uint32_t height,
+   uint32_t channels,
+   cifex_image_t *out_image)
+{
+   if (channels != cifex_rgb && channels != cifex_rgba) {
+      return "only RGB and RGBA images (3 or 4 channels) are supported";
+   }
+   size_t size = cifex_image_storage_size(width, height, channels);
+   if (size == SIZE_MAX || offset > in->len || in->len - offset < size) {
+      return "the file is too short for the given image dimensions";
+   }
+
+   // The encoder never writes to the image, so it's safe to cast away the const here.
+   *out_image = (cifex_image_t){
+      .allocator = NULL,
+      .width = width,
+      .height = height,
+      .channels = channels,
+      .data = (uint8_t *)&in->data[offset],
+   };
+   return NULL;
+}
+
+// Uses the input file as headerless pixel data of the given dimensions.
+// Returns an error message, or `NULL` on success.
+static const char *
+cxc_parse_raw(
+   const cxc_input_file_t *in,
+   uint32_t width,
+   uint32_t height,
+   uint32_t channels,
+   cifex_image_t *out_image)
+{
+   const char *error = cxc_image_from_input(in, 0, width, height, channels, out_image);
+   if (error == NULL && in->len != cifex_image_storage_size(width, height, channels)) {
+      return "the file's size does not match the given image dimensions";
+   }
+   return error;
+}
+
+// A cursor over a Netpbm header.
+typedef struct cxc_netpbm_reader
+{
+   const uint8_t *data;
+   size_t len;
+   size_t position;
+} cxc_netpbm_reader_t;
+
+static bool
+cxc_netpbm_is_space(uint8_t c)
+{
+   return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Skips whitespace and `#` comments.
+static void
+cxc_netpbm_skip_space(cxc_netpbm_reader_t *r)
+{
+   while (r->position < r->len) {
+      if (r->data[r->position] == '#') {
+         while (r->position < r->len && r->data[r->position] != '\n') {
+            ++r->position;
+         }
+      } else if (cxc_netpbm_is_space(r->data[r->position])) {
+         ++r->position;
+      } else {
+         break;
+      }
+   }
+}
+
+static bool
+cxc_netpbm_number(cxc_netpbm_reader_t *r, uint32_t *out_number)
+{
+   cxc_netpbm_skip_space(r);
+   uint64_t number = 0;
+   size_t start = r->position;
+   while (r->position < r->len && r->data[r->position] >= '0' && r->data[r->position] <= '9') {
+      number = number * 10 + (r->data[r->position] - '0');
+      if (number > UINT32_MAX) {
+         return false;
+      }
+      ++r->position;
+   }
+   *out_number = number;
+   return r->position > start;
+}
+
+// Matches a whole token, such as a PAM header keyword.
+static bool
+cxc_netpbm_token(cxc_netpbm_reader_t *r, const char *token)
+{
+   cxc_netpbm_skip_space(r);
+   size_t len = strlen(token);
+   if (
+      r->len - r->position < len || memcmp(&r->data[r->position], token, len) != 0 ||
+      (r->len - r->position > len && !cxc_netpbm_is_space(r->data[r->position + len]))) {
+      return false;
+   }
+   r->position += len;
+   return true;
+}
+
+// Parses a binary PPM (P6) or PAM (P7) file with a maximum value of 255.
+// Returns an error message, or `NULL` on success.
+static const char *
+cxc_parse_netpbm(const cxc_input_file_t *in, cifex_image_t *out_image)
+{
+   cxc_netpbm_reader_t r = { .data = in->data, .len = in->len, .position = 2 };
+   uint32_t width = 0, height = 0, channels = 0, maxval = 0;
+
+   if (in->len >= 2 && memcmp(in->data, "P6", 2) == 0) {
+      channels = 3;
+      if (
+         !cxc_netpbm_number(&r, &width) || !cxc_netpbm_number(&r, &height) ||
+         !cxc_netpbm_number(&r, &maxval)) {
+         return "invalid PPM header";
+      }
+      // Exactly one whitespace character separates the header from the pixels.
+      if (r.position >= r.len || !cxc_netpbm_is_space(r.data[r.position])) {
+         return "invalid PPM header";
+      }
+      ++r.position;
+   } else if (in->len >= 2 && memcmp(in->data, "P7", 2) == 0) {
+      while (!cxc_netpbm_token(&r, "ENDHDR")) {
+         bool ok = true;
+         if (cxc_netpbm_token(&r, "WIDTH")) {
+            ok = cxc_netpbm_number(&r, &width);
+         } else if (cxc_netpbm_token(&r, "HEIGHT")) {
+            ok = cxc_netpbm_number(&r, &height);
+         } else if (cxc_netpbm_token(&r, "DEPTH")) {
+            ok = cxc_netpbm_number(&r, &channels);
+         } else if (cxc_netpbm_token(&r, "MAXVAL")) {
+            ok = cxc_netpbm_number(&r, &maxval);
+         } else if (cxc_netpbm_token(&r, "TUPLTYPE")) {
+            // The tuple type is implied by the depth.
+            while (r.position < r.len && r.data[r.position] != '\n') {
+               ++r.position;
+            }
+         } else {
+            ok = false;
+         }
+         if (!ok) {
+            return "invalid PAM header";
+         }
+      }
+      if (r.position >= r.len || r.data[r.position] != '\n') {
+         return "invalid PAM header";
+      }
+      ++r.position;
+   } else {
+      return "not a PPM or PAM file";
+   }
+
+   if (maxval != 255) {
+      return "only 8-bit PPM and PAM files (with a maximum value of 255) are supported";
+   }
+   return cxc_image_from_input(in, r.position, width, height, channels, out_image);
+}
+
+// Returns whether the input looks like a PPM or PAM file.
+static bool
+cxc_is_netpbm(const cxc_input_file_t *in)
+{
+   return in->len >= 2 && (memcmp(in->data, "P6", 2) == 0 || memcmp(in->data, "P7", 2) == 0);
+}
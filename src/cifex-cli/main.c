@@ -1,5 +1,8 @@
 #include "libcifex.h"
 
+#include <limits.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,6 +13,14 @@
 #include "vendor/stb_image_write.h"
 
 #include "argparse.c"
+#include "formats.c"
+#include "rowindex.c"
+#include "input.c"
+#include "batch.c"
+#include "bench.c"
+#ifdef CXC_HAVE_ZLIB
+# include "pngstream.c"
+#endif
 
 static void
 cxc_try(cifex_result_t result)
@@ -20,69 +31,416 @@ cxc_try(cifex_result_t result)
    }
 }
 
+// Prints the statistics gathered by a tracking allocator to stderr.
+static void
+cxc_print_mem_stats(const cifex_tracking_allocator_t *tracking)
+{
+   const cifex_alloc_counters_t *total = &tracking->total;
+   fprintf(
+      stderr,
+      "memory statistics:\n"
+      "  peak:  %zu bytes\n"
+      "  total: %zu bytes in %zu allocations, %zu reallocations, %zu deallocations\n"
+      "  live:  %zu bytes\n",
+      total->peak_bytes,
+      total->total_bytes,
+      total->allocations,
+      total->reallocations,
+      total->deallocations,
+      total->live_bytes);
+
+   fprintf(stderr, "by tag:\n");
+   for (int tag = 0; tag < cifex__tag_count; ++tag) {
+      const cifex_alloc_counters_t *counters = &tracking->by_tag[tag];
+      if (counters->allocations == 0) {
+         continue;
+      }
+      fprintf(
+         stderr,
+         "  %-14s peak %zu bytes, total %zu bytes in %zu allocations\n",
+         cifex_alloc_tag_to_string(tag),
+         counters->peak_bytes,
+         counters->total_bytes,
+         counters->allocations);
+   }
+
+   fprintf(stderr, "size histogram:\n");
+   for (int bucket = 0; bucket < CIFEX_ALLOC_HISTOGRAM_BUCKETS; ++bucket) {
+      if (tracking->histogram[bucket] == 0) {
+         continue;
+      }
+      fprintf(
+         stderr, "  2^%-2d bytes and up: %zu\n", bucket, tracking->histogram[bucket]);
+   }
+}
+
+typedef enum cxc_output_format
+{
+   cxc_output_png,
+   cxc_output_raw,
+   cxc_output_ppm,
+   cxc_output_pam,
+   cxc_output_bmp,
+   cxc_output_tga,
+   cxc_output_qoi,
+   cxc__output_format_count,
+} cxc_output_format_t;
+
+static const char *cxc_output_format_names[] = {
+   [cxc_output_png] = "png",
+   [cxc_output_raw] = "raw",
+   [cxc_output_ppm] = "ppm",
+   [cxc_output_pam] = "pam",
+   [cxc_output_bmp] = "bmp",
+   [cxc_output_tga] = "tga",
+   [cxc_output_qoi] = "qoi",
+};
+
+// Passes an already decoded image to a row sink, as if it was being decoded row by row.
+static cifex_result_t
+cxc_sink_image(
+   cifex_row_sink_t *sink,
+   const cifex_image_t *image,
+   const cifex_image_info_t *image_info)
+{
+   cifex_result_t result;
+   if (
+      (result = sink->begin(sink, image->width, image->height, image->channels, image_info)) !=
+      cifex_ok) {
+      return result;
+   }
+   size_t row_size = (size_t)image->width * image->channels;
+   for (uint32_t y = 0; y < image->height; ++y) {
+      if ((result = sink->row(sink, y, &image->data[y * row_size])) != cifex_ok) {
+         return result;
+      }
+   }
+   return cifex_ok;
+}
+
 typedef struct cxc_decode_config
 {
    const char *input_file_name, *output_file_name;
    bool dry_run;
+   bool mem_stats;
+   bool huge_pages;
+   bool stream;
+   // Print how far decoding has gotten to stderr.
+   bool progress;
+   // Downscaling options. The image is only downscaled if `reduce` or `max_size` is nonzero.
+   uint32_t reduce;
+   uint32_t max_size;
+   bool subsample;
+   // When `row_count` is nonzero, only that many rows starting at `first_row` are decoded, using
+   // the image's row index.
+   uint32_t first_row, row_count;
+   cxc_output_format_t format;
+   // The PNG compression level, or `CXC_DEFAULT_PNG_LEVEL`.
+   uint32_t png_level;
+   // Limits on the size of the input images, or `0` for no limit.
+   uint32_t max_pixels, max_input_size;
 } cxc_decode_config_t;
 
+// The `png_level` that selects the default compression level of the PNG writer in use.
+#define CXC_DEFAULT_PNG_LEVEL UINT32_MAX
+
+// The window size used for `--stream`.
+#define CXC_STREAM_BUFFER_SIZE (1 << 20)
+
+// The zlib compression level used for streamed PNGs. zlib's higher levels are a lot slower than
+// stb_image_write's compressor, while level 1 is both faster and still compresses better.
+#define CXC_STREAM_PNG_LEVEL 1
+
+// Set by the first SIGINT, which cancels decoding. The second one terminates the process.
+static atomic_bool cxc_cancel;
+
+static void
+cxc_handle_sigint(int signal_number)
+{
+   atomic_store(&cxc_cancel, true);
+   signal(signal_number, SIG_DFL);
+}
+
+// The number of rows between progress reports.
+#define CXC_PROGRESS_INTERVAL 256
+
+// Prints the percentage of rows decoded so far, overwriting the previous report. The `bool`
+// pointed to by the `user_data` is set while a report is on stderr without a line break after it.
 static cifex_result_t
-cxc_decode(cxc_decode_config_t c)
+cxc_report_progress(
+   cifex_progress_t *progress,
+   uint32_t rows_done,
+   uint32_t row_count,
+   uint64_t bytes_consumed)
+{
+   (void)bytes_consumed;
+   bool *line_open = progress->user_data;
+   *line_open = rows_done != row_count;
+   fprintf(
+      stderr,
+      "\r%3u%% (%u/%u rows)%s",
+      (unsigned)((uint64_t)rows_done * 100 / row_count),
+      rows_done,
+      row_count,
+      rows_done == row_count ? "\n" : "");
+   return cifex_ok;
+}
+
+// Decodes a single file using the given allocator. Errors are reported on stderr and returned.
+static cifex_result_t
+cxc_decode_file(
+   const cxc_decode_config_t *c,
+   cifex_allocator_t *allocator,
+   const char *input_file_name,
+   const char *output_file_name)
 {
-   cifex_allocator_t allocator = cifex_libc_allocator();
    cifex_reader_t reader = { 0 };
    cifex_image_t image = { 0 };
    cifex_image_info_t image_info = { 0 };
-   cifex_result_t result = cifex_ok;
 
-   if (c.input_file_name == NULL || c.output_file_name == NULL) {
-      fprintf(
-         stderr,
-         "error: no input or output filename provided.\n"
-         "usage: cifex decode <input-file.cif> <output-file.png>\n");
-      exit(-1);
+   cifex_result_t open_result = cifex_fopen_read(&reader, input_file_name);
+   if (open_result != cifex_ok) {
+      cxc_file_error(input_file_name, cifex_result_to_string(open_result));
+      return open_result;
    }
 
-   cxc_try(cifex_fopen_read(&reader, c.input_file_name));
-
-   cifex_decode_result_t decode_result = cifex_decode(
-      (cifex_decode_config_t){
-         .allocator = &allocator,
-         .reader = &reader,
-         .load_metadata = true,
+   cifex_decode_config_t decode_config = {
+      .allocator = allocator,
+      .reader = &reader,
+      .load_metadata = true,
+      .stream_buffer_size = c->stream ? CXC_STREAM_BUFFER_SIZE : 0,
+      .cancel = &cxc_cancel,
+      .limits = {
+         .max_pixels = c->max_pixels,
+         .max_input_size = c->max_input_size,
       },
-      &image,
-      &image_info);
+   };
+   bool progress_line_open = false;
+   cifex_progress_t progress = {
+      .user_data = &progress_line_open,
+      .report = cxc_report_progress,
+      .interval = CXC_PROGRESS_INTERVAL,
+   };
+   if (c->progress) {
+      decode_config.progress = &progress;
+   }
+   bool downscale = c->reduce != 0 || c->max_size != 0;
+   bool band = c->row_count != 0;
+   cifex_row_index_t index;
+   if (band) {
+      cifex_result_t index_result = cxc_read_index_file(&index, allocator, input_file_name);
+      if (index_result != cifex_ok) {
+         cifex_fclose_read(&reader);
+         return index_result;
+      }
+      if (c->first_row > index.height || c->row_count > index.height - c->first_row) {
+         fprintf(
+            stderr,
+            "error: %s: rows %u..%u are out of the image's %u rows\n",
+            input_file_name,
+            c->first_row,
+            c->first_row + c->row_count - 1,
+            index.height);
+         cifex_free_row_index(&index);
+         cifex_fclose_read(&reader);
+         return cifex_row_index_mismatch;
+      }
+   }
+
+   // Formats which can be written row by row are, so that full size images never have to be in
+   // memory all at once. Thumbnails and bands of rows are decoded as a whole and then passed to
+   // the sink.
+   cifex_row_sink_t *sink = NULL;
+   cxc_file_sink_t file_sink;
+#ifdef CXC_HAVE_ZLIB
+   cxc_png_pipe_t png_pipe;
+#endif
+   if (!c->dry_run) {
+      switch (c->format) {
+         case cxc_output_png:
+#ifdef CXC_HAVE_ZLIB
+            cxc_init_png_pipe(
+               &png_pipe,
+               output_file_name,
+               c->png_level != CXC_DEFAULT_PNG_LEVEL ? (int)c->png_level : CXC_STREAM_PNG_LEVEL);
+            sink = &png_pipe.sink;
+#endif
+            break;
+         case cxc_output_raw:
+            cxc_init_file_sink(&file_sink, output_file_name, cxc_format_raw);
+            sink = &file_sink.sink;
+            break;
+         case cxc_output_ppm:
+            cxc_init_file_sink(&file_sink, output_file_name, cxc_format_ppm);
+            sink = &file_sink.sink;
+            break;
+         case cxc_output_pam:
+            cxc_init_file_sink(&file_sink, output_file_name, cxc_format_pam);
+            sink = &file_sink.sink;
+            break;
+         case cxc_output_qoi:
+            cxc_init_file_sink(&file_sink, output_file_name, cxc_format_qoi);
+            sink = &file_sink.sink;
+            break;
+         case cxc_output_bmp:
+         case cxc_output_tga:
+         case cxc__output_format_count:
+            break;
+      }
+   }
+
+   cifex_decode_result_t decode_result;
+   if (band) {
+      decode_result =
+         cifex_decode_band(decode_config, &index, c->first_row, c->row_count, &image);
+      cifex_free_row_index(&index);
+   } else if (sink != NULL && !downscale) {
+      decode_result = cifex_decode_rows(decode_config, sink, &image_info);
+   } else if (downscale) {
+      decode_result = cifex_decode_downscaled(
+         decode_config,
+         (cifex_downscale_config_t){
+            .factor = c->reduce,
+            .max_width = c->max_size,
+            .max_height = c->max_size,
+            .filter = c->subsample ? cifex_downscale_subsample : cifex_downscale_box,
+         },
+         &image,
+         &image_info);
+   } else {
+      decode_result = cifex_decode(decode_config, &image, &image_info);
+   }
+   cifex_fclose_read(&reader);
+
+   cifex_result_t write_result = cifex_ok;
+   if (sink != NULL) {
+      if (decode_result.result == cifex_ok && (downscale || band)) {
+         write_result = cxc_sink_image(sink, &image, &image_info);
+      }
+      cifex_result_t sink_result =
+         decode_result.result != cifex_ok ? decode_result.result : write_result;
+      if (sink == &file_sink.sink) {
+         sink_result = cxc_finish_file_sink(&file_sink, sink_result);
+      }
+#ifdef CXC_HAVE_ZLIB
+      if (sink == &png_pipe.sink) {
+         sink_result = cxc_finish_png_pipe(&png_pipe, sink_result);
+      }
+#endif
+      // Errors from writing rows during decoding are reported as decoding errors; only report the
+      // ones that happened afterwards separately.
+      if (decode_result.result != cifex_ok) {
+         decode_result.result = sink_result;
+      } else {
+         write_result = sink_result;
+      }
+   }
+
    if (decode_result.result != cifex_ok) {
+      if (progress_line_open) {
+         fputc('\n', stderr);
+      }
       fprintf(
          stderr,
-         "line %lu (byte %lu): %s\n",
+         "error: %s: line %lu (byte %lu): %s\n",
+         input_file_name,
          decode_result.line,
          decode_result.position,
          cifex_result_to_string(decode_result.result));
-      exit(cifex_syntax_error);
+      cifex_free_image(&image);
+      return decode_result.result;
    }
 
-   if (!c.dry_run) {
-      stbi_write_png(
-         c.output_file_name,
-         image.width,
-         image.height,
-         image.channels,
-         image.data,
-         image.width * image.channels);
+   if (!c->dry_run && sink == NULL) {
+      int stride = image.width * image.channels;
+      int ok = 0;
+      switch (c->format) {
+         case cxc_output_png:
+            ok = stbi_write_png(
+               output_file_name, image.width, image.height, image.channels, image.data, stride);
+            break;
+         case cxc_output_bmp:
+            ok = stbi_write_bmp(
+               output_file_name, image.width, image.height, image.channels, image.data);
+            break;
+         case cxc_output_tga:
+            ok = stbi_write_tga(
+               output_file_name, image.width, image.height, image.channels, image.data);
+            break;
+         default:
+            break;
+      }
+      if (!ok) {
+         write_result = cxc_errno_result();
+      }
+   }
+   if (write_result != cifex_ok) {
+      fprintf(
+         stderr,
+         "error: could not write %s: %s\n",
+         output_file_name,
+         cifex_result_to_string(write_result));
    }
 
    cifex_free_image(&image);
    cifex_free_image_info(&image_info);
-   cifex_fclose_read(&reader);
+
+   return write_result;
+}
+
+static cifex_result_t
+cxc_decode(cxc_decode_config_t c)
+{
+   cifex_allocator_t libc_allocator = cifex_libc_allocator();
+   cifex_allocator_t *allocator = &libc_allocator;
+   cifex_huge_page_allocator_t huge_pages =
+      cifex_huge_page_allocator(allocator, CIFEX_DEFAULT_HUGE_PAGE_THRESHOLD, true);
+   if (c.huge_pages) {
+      allocator = &huge_pages.allocator;
+   }
+   cifex_tracking_allocator_t tracking = cifex_tracking_allocator(allocator);
+   if (c.mem_stats) {
+      allocator = &tracking.allocator;
+   }
+
+   if (c.input_file_name == NULL || c.output_file_name == NULL) {
+      fprintf(
+         stderr,
+         "error: no input or output filename provided.\n"
+         "usage: cifex decode <input-file.cif> <output-file.png> [--first-row N --row-count N]\n"
+         "       cifex decode --batch <list-file> [-j jobs] [--output-dir dir]\n");
+      exit(-1);
+   }
+
+   cifex_result_t result = cxc_decode_file(&c, allocator, c.input_file_name, c.output_file_name);
+
+   if (c.mem_stats) {
+      cxc_print_mem_stats(&tracking);
+   }
 
    return result;
 }
 
+// Adapts `cxc_decode_file` to `cxc_batch_fn`.
+static cifex_result_t
+cxc_decode_batch_file(
+   void *user_data,
+   cifex_allocator_t *allocator,
+   const char *input_file_name,
+   const char *output_file_name)
+{
+   return cxc_decode_file(user_data, allocator, input_file_name, output_file_name);
+}
+
 typedef struct cxc_encode_config
 {
    const char *input_file_name, *output_file_name;
+   // The dimensions of headerless raw input. If any of these is set, the input is treated as raw
+   // pixel data.
+   uint32_t width, height, channels;
+   // Whether to write a row index next to the output, and how many rows apart its entries are.
+   bool index;
+   uint32_t stride;
 } cxc_encode_config_t;
 
 static cifex_result_t
@@ -96,37 +454,164 @@ cxc_encode(cxc_encode_config_t c)
       fprintf(
          stderr,
          "error: no input or output filename provided.\n"
-         "usage: cifex encode <input-file.png> <output-file.cif>\n");
+         "usage: cifex encode <input-file> <output-file.cif> [--index] [--stride N]\n"
+         "       cifex encode --width W --height H --channels 3|4 <input-file.raw> "
+         "<output-file.cif>\n"
+         "the input file may be - to read from stdin\n");
       exit(-1);
    }
 
-   int image_width, image_height, image_channels;
-   image.data = stbi_load(c.input_file_name, &image_width, &image_height, &image_channels, 0);
-   if (image.data == NULL) {
-      fprintf(stderr, "error: could not load image\n");
-      return cifex_out_of_memory;
+   cxc_input_file_t input;
+   cxc_try(cxc_open_input(&input, c.input_file_name));
+
+   // Raw, PPM, and PAM pixels are encoded straight out of the input file. Anything else goes
+   // through stb_image.
+   bool raw = c.width != 0 || c.height != 0 || c.channels != 0;
+   uint8_t *decoded = NULL;
+   const char *error = NULL;
+   if (raw) {
+      error = cxc_parse_raw(&input, c.width, c.height, c.channels, &image);
+   } else if (cxc_is_netpbm(&input)) {
+      error = cxc_parse_netpbm(&input, &image);
+   } else if (input.len > INT_MAX) {
+      error = "the image file is too large";
+   } else {
+      int image_width, image_height, image_channels;
+      decoded = stbi_load_from_memory(
+         input.data, input.len, &image_width, &image_height, &image_channels, 0);
+      if (decoded == NULL) {
+         error = "could not load image";
+      } else if (image_channels < 3) {
+         error = "non-RGB(A) images are not yet supported";
+      }
+      image.width = image_width;
+      image.height = image_height;
+      image.channels = image_channels;
+      image.data = decoded;
    }
-   if (image_channels < 3) {
-      fprintf(stderr, "error: non-RGB(A) images are not yet supported.\n");
+   if (error != NULL) {
+      fprintf(stderr, "error: %s\n", error);
       exit(-2);
    }
-   image.width = image_width;
-   image.height = image_height;
-   image.channels = image_channels;
+
+   cifex_allocator_t allocator = cifex_libc_allocator();
+   cifex_row_index_t index;
+   cifex_init_row_index(&index, &allocator, c.stride);
+   cifex_encode_config_t encode_config = cifex_default_encode_config(&writer);
+   if (c.index) {
+      encode_config.index = &index;
+   }
 
    cxc_try(cifex_fopen_write(&writer, c.output_file_name));
-   cxc_try(cifex_encode(&writer, &image, NULL));
+   cxc_try(cifex_encode_with_config(encode_config, &image, NULL));
 
-   stbi_image_free(image.data);
+   stbi_image_free(decoded);
+   cxc_close_input(&input);
    cifex_fclose_write(&writer);
 
+   if (c.index) {
+      char *index_file_name = cxc_index_file_name(c.output_file_name);
+      if (index_file_name == NULL) {
+         result = cifex_out_of_memory;
+      } else if ((result = cxc_write_index_file(&index, index_file_name)) != cifex_ok) {
+         cxc_file_error(index_file_name, cifex_result_to_string(result));
+      }
+      free(index_file_name);
+      cifex_free_row_index(&index);
+   }
+
    return result;
 }
 
+typedef struct cxc_canonicalize_config
+{
+   const char *input_file_name, *output_file_name;
+} cxc_canonicalize_config_t;
+
+// Canonicalizes a single file using the given allocator. Errors are reported on stderr and
+// returned.
+static cifex_result_t
+cxc_canonicalize_file(
+   cifex_allocator_t *allocator,
+   const char *input_file_name,
+   const char *output_file_name)
+{
+   cifex_reader_t reader = { 0 };
+   cifex_writer_t writer = { 0 };
+
+   cifex_result_t open_result = cifex_fopen_read(&reader, input_file_name);
+   if (open_result != cifex_ok) {
+      cxc_file_error(input_file_name, cifex_result_to_string(open_result));
+      return open_result;
+   }
+   if ((open_result = cifex_fopen_write(&writer, output_file_name)) != cifex_ok) {
+      cifex_fclose_read(&reader);
+      cxc_file_error(output_file_name, cifex_result_to_string(open_result));
+      return open_result;
+   }
+
+   // The input is always streamed, so that memory usage stays bounded for arbitrarily large files.
+   cifex_decode_config_t decode_config = cifex_default_decode_config(allocator, &reader);
+   decode_config.stream_buffer_size = CXC_STREAM_BUFFER_SIZE;
+   decode_config.cancel = &cxc_cancel;
+   cifex_decode_result_t result = cifex_canonicalize(decode_config, &writer);
+
+   cifex_fclose_read(&reader);
+   cifex_result_t close_result = cifex_fclose_write(&writer);
+   if (result.result == cifex_ok) {
+      result.result = close_result;
+   }
+
+   if (result.result != cifex_ok) {
+      remove(output_file_name);
+      fprintf(
+         stderr,
+         "error: %s: line %lu (byte %lu): %s\n",
+         input_file_name,
+         result.line,
+         result.position,
+         cifex_result_to_string(result.result));
+   }
+
+   return result.result;
+}
+
+static cifex_result_t
+cxc_canonicalize(cxc_canonicalize_config_t c)
+{
+   cifex_allocator_t allocator = cifex_libc_allocator();
+
+   if (c.input_file_name == NULL || c.output_file_name == NULL) {
+      fprintf(
+         stderr,
+         "error: no input or output filename provided.\n"
+         "usage: cifex canonicalize <input-file.cif> <output-file.cif>\n"
+         "       cifex canonicalize --batch <list-file> [-j jobs] [--output-dir dir]\n");
+      exit(-1);
+   }
+
+   return cxc_canonicalize_file(&allocator, c.input_file_name, c.output_file_name);
+}
+
+// Adapts `cxc_canonicalize_file` to `cxc_batch_fn`.
+static cifex_result_t
+cxc_canonicalize_batch_file(
+   void *user_data,
+   cifex_allocator_t *allocator,
+   const char *input_file_name,
+   const char *output_file_name)
+{
+   (void)user_data;
+   return cxc_canonicalize_file(allocator, input_file_name, output_file_name);
+}
+
 typedef enum cxc_mode
 {
    cxc_mode_decode,
    cxc_mode_encode,
+   cxc_mode_canonicalize,
+   cxc_mode_bench,
+   cxc_mode_index,
 } cxc_mode_t;
 
 int
@@ -135,6 +620,27 @@ main(int argc, char *argv[])
    cxc_arg_parser_t argp = cxc_init_arg_parser(argc, argv);
    char *mode_str = NULL, *input_file_name = NULL, *output_file_name = NULL;
    bool dry_run = false;
+   bool mem_stats = false;
+   bool huge_pages = false;
+   bool stream = false;
+   bool progress = false;
+   uint32_t reduce = 0;
+   uint32_t max_size = 0;
+   uint32_t max_pixels = 0, max_input_size = 0;
+   bool subsample = false;
+   char *format_name = NULL;
+   uint32_t png_level = CXC_DEFAULT_PNG_LEVEL;
+   uint32_t width = 0, height = 0, channels = 0;
+   bool index = false;
+   uint32_t stride = CIFEX_DEFAULT_ROW_INDEX_STRIDE;
+   uint32_t first_row = 0, row_count = 0;
+   char *batch_file_name = NULL;
+   uint32_t jobs = 0;
+   char *output_dir = NULL;
+   uint32_t iterations = 10;
+   uint32_t warmup = 1;
+   char *only = NULL;
+   bool json = false;
 
    char **positional_args[] = {
       &mode_str,
@@ -145,6 +651,31 @@ main(int argc, char *argv[])
       cxc_positional_args(
          &argp, sizeof(positional_args) / sizeof(positional_args[0]), positional_args);
       cxc_named_arg(&argp, 0, "dry-run", cxc_bool, &dry_run);
+      cxc_named_arg(&argp, 0, "mem-stats", cxc_bool, &mem_stats);
+      cxc_named_arg(&argp, 0, "huge-pages", cxc_bool, &huge_pages);
+      cxc_named_arg(&argp, 0, "stream", cxc_bool, &stream);
+      cxc_named_arg(&argp, 0, "progress", cxc_bool, &progress);
+      cxc_named_arg(&argp, 0, "reduce", cxc_uint32, &reduce);
+      cxc_named_arg(&argp, 0, "max-size", cxc_uint32, &max_size);
+      cxc_named_arg(&argp, 0, "subsample", cxc_bool, &subsample);
+      cxc_named_arg(&argp, 0, "max-pixels", cxc_uint32, &max_pixels);
+      cxc_named_arg(&argp, 0, "max-input-size", cxc_uint32, &max_input_size);
+      cxc_named_arg(&argp, 0, "format", cxc_string, &format_name);
+      cxc_named_arg(&argp, 0, "png-level", cxc_uint32, &png_level);
+      cxc_named_arg(&argp, 0, "width", cxc_uint32, &width);
+      cxc_named_arg(&argp, 0, "height", cxc_uint32, &height);
+      cxc_named_arg(&argp, 0, "channels", cxc_uint32, &channels);
+      cxc_named_arg(&argp, 0, "index", cxc_bool, &index);
+      cxc_named_arg(&argp, 0, "stride", cxc_uint32, &stride);
+      cxc_named_arg(&argp, 0, "first-row", cxc_uint32, &first_row);
+      cxc_named_arg(&argp, 0, "row-count", cxc_uint32, &row_count);
+      cxc_named_arg(&argp, 0, "batch", cxc_string, &batch_file_name);
+      cxc_named_arg(&argp, 'j', "jobs", cxc_uint32, &jobs);
+      cxc_named_arg(&argp, 0, "output-dir", cxc_string, &output_dir);
+      cxc_named_arg(&argp, 0, "iterations", cxc_uint32, &iterations);
+      cxc_named_arg(&argp, 0, "warmup", cxc_uint32, &warmup);
+      cxc_named_arg(&argp, 0, "only", cxc_string, &only);
+      cxc_named_arg(&argp, 0, "json", cxc_bool, &json);
       cxc_finish_arg(&argp);
    }
    cxc_free_arg_parser(&argp);
@@ -153,7 +684,7 @@ main(int argc, char *argv[])
       fprintf(
          stderr,
          "error: no mode provided.\n"
-         "usage: cifex decode|encode\n");
+         "usage: cifex decode|encode|canonicalize|bench|index\n");
       exit(-1);
    }
 
@@ -162,26 +693,155 @@ main(int argc, char *argv[])
       mode = cxc_mode_decode;
    } else if (strcmp(mode_str, "encode") == 0) {
       mode = cxc_mode_encode;
+   } else if (strcmp(mode_str, "canonicalize") == 0) {
+      mode = cxc_mode_canonicalize;
+   } else if (strcmp(mode_str, "bench") == 0) {
+      mode = cxc_mode_bench;
+   } else if (strcmp(mode_str, "index") == 0) {
+      mode = cxc_mode_index;
    } else {
       fprintf(
          stderr,
          "error: invalid mode: %s\n"
-         "usage: cifex {decode,encode} <arguments...>\n",
+         "usage: cifex {decode,encode,canonicalize,bench,index} <arguments...>\n",
          mode_str);
       exit(-1);
    }
 
+   cxc_output_format_t format = cxc_output_png;
+   if (format_name != NULL) {
+      for (format = 0; format < cxc__output_format_count; ++format) {
+         if (strcmp(format_name, cxc_output_format_names[format]) == 0) {
+            break;
+         }
+      }
+      if (format == cxc__output_format_count) {
+         fprintf(
+            stderr,
+            "error: invalid output format: %s\n"
+            "supported formats: png, raw, ppm, pam, bmp, tga, qoi\n",
+            format_name);
+         exit(-1);
+      }
+   }
+   if (png_level != CXC_DEFAULT_PNG_LEVEL && png_level > 9) {
+      fprintf(stderr, "error: PNG compression level must be in 0..9\n");
+      exit(-1);
+   }
+
+   if (row_count != 0 && (reduce != 0 || max_size != 0)) {
+      fprintf(stderr, "error: bands of rows cannot be downscaled\n");
+      exit(-1);
+   }
+   if (stride == 0) {
+      fprintf(stderr, "error: the stride must be at least 1\n");
+      exit(-1);
+   }
+
+   cxc_decode_config_t decode_config = {
+      .input_file_name = input_file_name,
+      .output_file_name = output_file_name,
+      .dry_run = dry_run,
+      .mem_stats = mem_stats,
+      .huge_pages = huge_pages,
+      .stream = stream,
+      .progress = progress,
+      .reduce = reduce,
+      .max_size = max_size,
+      .subsample = subsample,
+      .first_row = first_row,
+      .row_count = row_count,
+      .format = format,
+      .png_level = png_level,
+      .max_pixels = max_pixels,
+      .max_input_size = max_input_size,
+   };
+
+   // Interrupting a decode stops it at the next row, so that partially written outputs can be
+   // removed.
+   if (mode == cxc_mode_decode || mode == cxc_mode_canonicalize) {
+      signal(SIGINT, cxc_handle_sigint);
+   }
+
+   // stb_image_write's compression level is a global shared by the whole process. It's set once
+   // here, before any batch workers are started, and is never written to while they're encoding.
+   if (png_level != CXC_DEFAULT_PNG_LEVEL) {
+      stbi_write_png_compression_level = png_level;
+   }
+
+   if (batch_file_name != NULL) {
+      if (input_file_name != NULL || output_file_name != NULL) {
+         fprintf(stderr, "error: input and output files cannot be given together with --batch\n");
+         exit(-1);
+      }
+      if (mem_stats || huge_pages || progress) {
+         fprintf(
+            stderr,
+            "error: --mem-stats, --huge-pages, and --progress are not supported with --batch\n");
+         exit(-1);
+      }
+
+      cxc_batch_config_t batch = {
+         .list_file_name = batch_file_name,
+         .output_dir = output_dir,
+         .jobs = jobs,
+      };
+      switch (mode) {
+         case cxc_mode_decode:
+            batch.output_extension = cxc_output_format_names[format];
+            batch.fn = cxc_decode_batch_file;
+            batch.user_data = &decode_config;
+            break;
+         case cxc_mode_canonicalize:
+            batch.output_extension = "cif";
+            batch.fn = cxc_canonicalize_batch_file;
+            break;
+         case cxc_mode_encode:
+         case cxc_mode_bench:
+         case cxc_mode_index:
+            fprintf(stderr, "error: --batch is only supported by decode and canonicalize\n");
+            exit(-1);
+      }
+      return cxc_run_batch(&batch);
+   }
+
    switch (mode) {
       case cxc_mode_decode:
-         return cxc_decode((cxc_decode_config_t){
+         return cxc_decode(decode_config);
+      case cxc_mode_encode:
+         return cxc_encode((cxc_encode_config_t){
             .input_file_name = input_file_name,
             .output_file_name = output_file_name,
-            .dry_run = dry_run,
+            .width = width,
+            .height = height,
+            .channels = channels,
+            .index = index,
+            .stride = stride,
          });
-      case cxc_mode_encode:
-         return cxc_encode((cxc_encode_config_t){
+      case cxc_mode_canonicalize:
+         return cxc_canonicalize((cxc_canonicalize_config_t){
+            .input_file_name = input_file_name,
+            .output_file_name = output_file_name,
+         });
+      case cxc_mode_bench:
+         if (only != NULL && strcmp(only, "decode") != 0 && strcmp(only, "encode") != 0) {
+            fprintf(stderr, "error: --only must be either decode or encode\n");
+            exit(-1);
+         }
+         return cxc_bench((cxc_bench_config_t){
+            .input_file_name = input_file_name,
+            .iterations = iterations,
+            .warmup = warmup,
+            .decode = only == NULL || strcmp(only, "decode") == 0,
+            .encode = only == NULL || strcmp(only, "encode") == 0,
+            .stream_buffer_size = stream ? CXC_STREAM_BUFFER_SIZE : 0,
+            .json = json,
+         });
+      case cxc_mode_index:
+         return cxc_index((cxc_index_config_t){
             .input_file_name = input_file_name,
             .output_file_name = output_file_name,
+            .stride = stride,
          });
    }
 }
@@ -0,0 +1,439 @@
+// A streaming PNG writer, used for transcoding CIF to PNG without ever holding the whole image in
+// memory. Rows are filtered and deflated as they come in, and written out as IDAT chunks as soon as
+// the compressor fills one up.
+//
+// Decoding and compression run on separate threads, connected by a small ring of rows; see
+// `cxc_png_pipe_t`.
+//
+// This relies on the helpers from formats.c.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "libcifex.h"
+
+// The size of the compressor's output buffer, and thus the maximum size of an IDAT chunk.
+#define CXC_PNG_CHUNK_SIZE 65536
+
+// The number of PNG filter types.
+#define CXC_PNG_FILTERS 5
+
+typedef struct cxc_png_writer
+{
+   FILE *file;
+   z_stream deflate;
+   bool deflate_initialized;
+
+   size_t row_size;
+   // The previously written row, which some filters refer to. All zeroes before the first row.
+   uint8_t *previous_row;
+   // The current row filtered with each of the filter types, each prefixed with the filter type
+   // byte.
+   uint8_t *filtered_rows;
+
+   uint8_t chunk[CXC_PNG_CHUNK_SIZE];
+} cxc_png_writer_t;
+
+// Writes a single PNG chunk.
+static cifex_result_t
+cxc_png_write_chunk(FILE *file, const char *type, const uint8_t *data, uint32_t len)
+{
+   uint8_t header[8];
+   cxc_put_be32(header, len);
+   memcpy(&header[4], type, 4);
+
+   uint8_t footer[4];
+   uLong crc = crc32(0, &header[4], 4);
+   crc = crc32(crc, data, len);
+   cxc_put_be32(footer, crc);
+
+   errno = 0;
+   if (
+      fwrite(header, 1, sizeof(header), file) != sizeof(header) ||
+      (len > 0 && fwrite(data, 1, len, file) != len) ||
+      fwrite(footer, 1, sizeof(footer), file) != sizeof(footer)) {
+      return cxc_errno_result();
+   }
+   return cifex_ok;
+}
+
+// Feeds data to the compressor, writing out an IDAT chunk every time the output buffer fills up.
+// With `Z_FINISH`, the rest of the compressed stream is written out too.
+static cifex_result_t
+cxc_png_deflate(cxc_png_writer_t *png, const uint8_t *data, size_t len, int flush)
+{
+   cifex_result_t result;
+
+   png->deflate.next_in = (Bytef *)data;
+   png->deflate.avail_in = len;
+   while (true) {
+      int status = deflate(&png->deflate, flush);
+      if (status == Z_STREAM_ERROR) {
+         return cifex_out_of_memory;
+      }
+
+      bool chunk_full = png->deflate.avail_out == 0;
+      bool finished = flush == Z_FINISH && status == Z_STREAM_END;
+      if (chunk_full || finished) {
+         uint32_t chunk_len = CXC_PNG_CHUNK_SIZE - png->deflate.avail_out;
+         if (
+            chunk_len > 0 &&
+            (result = cxc_png_write_chunk(png->file, "IDAT", png->chunk, chunk_len)) != cifex_ok) {
+            return result;
+         }
+         png->deflate.next_out = png->chunk;
+         png->deflate.avail_out = CXC_PNG_CHUNK_SIZE;
+      }
+      // Without `Z_FINISH`, all input has been consumed once there's space left in the output.
+      if (finished || (flush != Z_FINISH && !chunk_full)) {
+         return cifex_ok;
+      }
+   }
+}
+
+// Frees the writer's resources and closes its file.
+static void
+cxc_png_close(cxc_png_writer_t *png)
+{
+   if (png->deflate_initialized) {
+      deflateEnd(&png->deflate);
+   }
+   free(png->previous_row);
+   free(png->filtered_rows);
+   if (png->file != NULL) {
+      fclose(png->file);
+   }
+   png->deflate_initialized = false;
+   png->previous_row = NULL;
+   png->filtered_rows = NULL;
+   png->file = NULL;
+}
+
+// Creates the PNG file and writes out its header.
+static cifex_result_t
+cxc_png_open(
+   cxc_png_writer_t *png,
+   const char *file_name,
+   uint32_t width,
+   uint32_t height,
+   cifex_channels_t channels,
+   int level)
+{
+   cifex_result_t result;
+
+   png->row_size = (size_t)width * channels;
+   png->previous_row = calloc(png->row_size + 1, 1);
+   png->filtered_rows = malloc((png->row_size + 1) * CXC_PNG_FILTERS);
+   if (png->previous_row == NULL || png->filtered_rows == NULL) {
+      cxc_png_close(png);
+      return cifex_out_of_memory;
+   }
+
+   png->deflate = (z_stream){ 0 };
+   if (deflateInit(&png->deflate, level) != Z_OK) {
+      cxc_png_close(png);
+      return cifex_out_of_memory;
+   }
+   png->deflate_initialized = true;
+   png->deflate.next_out = png->chunk;
+   png->deflate.avail_out = CXC_PNG_CHUNK_SIZE;
+
+   errno = 0;
+   if ((png->file = fopen(file_name, "wb")) == NULL) {
+      result = cxc_errno_result();
+      cxc_png_close(png);
+      return result;
+   }
+
+   static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+   uint8_t ihdr[13];
+   cxc_put_be32(&ihdr[0], width);
+   cxc_put_be32(&ihdr[4], height);
+   ihdr[8] = 8;                                 // bit depth
+   ihdr[9] = channels == cifex_rgba ? 6 : 2;    // color type: RGB(A)
+   ihdr[10] = 0;                                // compression method
+   ihdr[11] = 0;                                // filter method
+   ihdr[12] = 0;                                // interlace method
+
+   errno = 0;
+   if (fwrite(signature, 1, sizeof(signature), png->file) != sizeof(signature)) {
+      result = cxc_errno_result();
+      cxc_png_close(png);
+      return result;
+   }
+   if ((result = cxc_png_write_chunk(png->file, "IHDR", ihdr, sizeof(ihdr))) != cifex_ok) {
+      cxc_png_close(png);
+      return result;
+   }
+
+   return cifex_ok;
+}
+
+static uint8_t
+cxc_paeth(int a, int b, int c)
+{
+   int p = a + b - c;
+   int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+   if (pa <= pb && pa <= pc) {
+      return a;
+   }
+   if (pb <= pc) {
+      return b;
+   }
+   return c;
+}
+
+// Filters and compresses a single row.
+//
+// Like stb_image_write, each row is filtered with all filter types, and the one with the smallest
+// sum of absolute (signed) differences is picked.
+static cifex_result_t
+cxc_png_write_row(cxc_png_writer_t *png, size_t bytes_per_pixel, const uint8_t *row)
+{
+   const uint8_t *up = png->previous_row;
+   size_t stride = png->row_size + 1;
+   uint8_t *best = NULL;
+   uint64_t best_estimate = UINT64_MAX;
+
+   for (int filter = 0; filter < CXC_PNG_FILTERS; ++filter) {
+      uint8_t *out = &png->filtered_rows[filter * stride];
+      out[0] = filter;
+      for (size_t i = 0; i < png->row_size; ++i) {
+         int left = i >= bytes_per_pixel ? row[i - bytes_per_pixel] : 0;
+         int up_left = i >= bytes_per_pixel ? up[i - bytes_per_pixel] : 0;
+         switch (filter) {
+            case 0:
+               out[i + 1] = row[i];
+               break;
+            case 1:
+               out[i + 1] = row[i] - left;
+               break;
+            case 2:
+               out[i + 1] = row[i] - up[i];
+               break;
+            case 3:
+               out[i + 1] = row[i] - ((left + up[i]) >> 1);
+               break;
+            case 4:
+               out[i + 1] = row[i] - cxc_paeth(left, up[i], up_left);
+               break;
+         }
+      }
+
+      uint64_t estimate = 0;
+      for (size_t i = 1; i < stride; ++i) {
+         estimate += abs((signed char)out[i]);
+      }
+      if (estimate < best_estimate) {
+         best_estimate = estimate;
+         best = out;
+      }
+   }
+
+   memcpy(png->previous_row, row, png->row_size);
+   return cxc_png_deflate(png, best, stride, Z_NO_FLUSH);
+}
+
+// Finishes the compressed stream, writes the IEND chunk, and closes the writer.
+static cifex_result_t
+cxc_png_finish(cxc_png_writer_t *png)
+{
+   cifex_result_t result = cxc_png_deflate(png, NULL, 0, Z_FINISH);
+   if (result == cifex_ok) {
+      result = cxc_png_write_chunk(png->file, "IEND", NULL, 0);
+   }
+   if (result == cifex_ok) {
+      errno = 0;
+      if (fclose(png->file) != 0) {
+         result = cxc_errno_result();
+      }
+      png->file = NULL;
+   }
+   cxc_png_close(png);
+   return result;
+}
+
+// The number of rows that can be in flight between the decoder and the PNG writer.
+#define CXC_PIPE_ROWS 64
+
+// A row sink which hands rows over to a thread that writes them out into a PNG file.
+typedef struct cxc_png_pipe
+{
+   cifex_row_sink_t sink;
+   const char *file_name;
+   int level;
+   cxc_png_writer_t png;
+   size_t bytes_per_pixel;
+
+   bool file_created;
+   pthread_t thread;
+   bool thread_started;
+   pthread_mutex_t mutex;
+   pthread_cond_t row_produced;
+   pthread_cond_t row_consumed;
+
+   uint8_t *rows;
+   // Counts of rows produced by the decoder and consumed by the writer. Row `n` lives in slot
+   // `n % CXC_PIPE_ROWS` of `rows`.
+   uint64_t produced, consumed;
+   // Set once the decoder is done producing rows.
+   bool done;
+   // The first error the writer encountered.
+   cifex_result_t writer_result;
+} cxc_png_pipe_t;
+
+static void *
+cxc_png_pipe_thread(void *user_data)
+{
+   cxc_png_pipe_t *pipe = user_data;
+   cifex_result_t result = cifex_ok;
+
+   pthread_mutex_lock(&pipe->mutex);
+   while (true) {
+      while (pipe->consumed == pipe->produced && !pipe->done) {
+         pthread_cond_wait(&pipe->row_produced, &pipe->mutex);
+      }
+      if (pipe->consumed == pipe->produced) {
+         break;
+      }
+      const uint8_t *row = &pipe->rows[(pipe->consumed % CXC_PIPE_ROWS) * pipe->png.row_size];
+      pthread_mutex_unlock(&pipe->mutex);
+
+      // The slot can't be overwritten until `consumed` is bumped, so it's safe to read unlocked.
+      result = cxc_png_write_row(&pipe->png, pipe->bytes_per_pixel, row);
+
+      pthread_mutex_lock(&pipe->mutex);
+      ++pipe->consumed;
+      if (result != cifex_ok) {
+         pipe->writer_result = result;
+         pthread_cond_signal(&pipe->row_consumed);
+         break;
+      }
+      pthread_cond_signal(&pipe->row_consumed);
+   }
+   pthread_mutex_unlock(&pipe->mutex);
+
+   return NULL;
+}
+
+static cifex_result_t
+cxc_png_pipe_begin(
+   cifex_row_sink_t *sink,
+   uint32_t width,
+   uint32_t height,
+   cifex_channels_t channels,
+   const cifex_image_info_t *image_info)
+{
+   cxc_png_pipe_t *pipe = sink->user_data;
+   cifex_result_t result;
+
+   if (
+      (result = cxc_png_open(&pipe->png, pipe->file_name, width, height, channels, pipe->level)) !=
+      cifex_ok) {
+      return result;
+   }
+   pipe->file_created = true;
+   pipe->bytes_per_pixel = channels;
+   pipe->rows = malloc(pipe->png.row_size * CXC_PIPE_ROWS + 1);
+   if (pipe->rows == NULL) {
+      return cifex_out_of_memory;
+   }
+
+   int err = pthread_create(&pipe->thread, NULL, cxc_png_pipe_thread, pipe);
+   if (err != 0) {
+      return cifex_errno_result(err);
+   }
+   pipe->thread_started = true;
+
+   return cifex_ok;
+}
+
+static cifex_result_t
+cxc_png_pipe_row(cifex_row_sink_t *sink, uint32_t y, const uint8_t *row)
+{
+   cxc_png_pipe_t *pipe = sink->user_data;
+
+   pthread_mutex_lock(&pipe->mutex);
+   while (pipe->produced - pipe->consumed == CXC_PIPE_ROWS && pipe->writer_result == cifex_ok) {
+      pthread_cond_wait(&pipe->row_consumed, &pipe->mutex);
+   }
+   cifex_result_t result = pipe->writer_result;
+   pthread_mutex_unlock(&pipe->mutex);
+   if (result != cifex_ok) {
+      return result;
+   }
+
+   // The slot is free until `produced` is bumped, so it's safe to write unlocked.
+   size_t slot = pipe->produced % CXC_PIPE_ROWS;
+   memcpy(&pipe->rows[slot * pipe->png.row_size], row, pipe->png.row_size);
+
+   pthread_mutex_lock(&pipe->mutex);
+   ++pipe->produced;
+   pthread_cond_signal(&pipe->row_produced);
+   pthread_mutex_unlock(&pipe->mutex);
+
+   return cifex_ok;
+}
+
+// Initializes a pipe which writes rows into the given PNG file, compressed with the given zlib
+// compression level. The file is only created once the decoder reaches the pixel data.
+static void
+cxc_init_png_pipe(cxc_png_pipe_t *pipe, const char *file_name, int level)
+{
+   *pipe = (cxc_png_pipe_t){
+      .sink = {
+         .user_data = pipe,
+         .begin = cxc_png_pipe_begin,
+         .row = cxc_png_pipe_row,
+      },
+      .file_name = file_name,
+      .level = level,
+      .writer_result = cifex_ok,
+   };
+   pthread_mutex_init(&pipe->mutex, NULL);
+   pthread_cond_init(&pipe->row_produced, NULL);
+   pthread_cond_init(&pipe->row_consumed, NULL);
+}
+
+// Waits for the writer to catch up, and finishes the PNG file if decoding was successful.
+// Otherwise, the incomplete file is removed.
+static cifex_result_t
+cxc_finish_png_pipe(cxc_png_pipe_t *pipe, cifex_result_t decode_result)
+{
+   if (pipe->thread_started) {
+      pthread_mutex_lock(&pipe->mutex);
+      pipe->done = true;
+      pthread_cond_signal(&pipe->row_produced);
+      pthread_mutex_unlock(&pipe->mutex);
+      pthread_join(pipe->thread, NULL);
+   }
+
+   cifex_result_t result = decode_result;
+   if (result == cifex_ok) {
+      result = pipe->writer_result;
+   }
+   if (result == cifex_ok) {
+      result = cxc_png_finish(&pipe->png);
+   }
+   if (result != cifex_ok) {
+      cxc_png_close(&pipe->png);
+      if (pipe->file_created) {
+         remove(pipe->file_name);
+      }
+   }
+
+   free(pipe->rows);
+   pipe->rows = NULL;
+   pthread_mutex_destroy(&pipe->mutex);
+   pthread_cond_destroy(&pipe->row_produced);
+   pthread_cond_destroy(&pipe->row_consumed);
+
+   return result;
+}
@@ -0,0 +1,134 @@
+// Row index sidecar files, and the `index` mode which builds them for existing images.
+//
+// The row index of `image.cif` is stored next to it in `image.cifidx`.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libcifex.h"
+
+// Derives the name of an image's row index file. Returns `NULL` if out of memory.
+static char *
+cxc_index_file_name(const char *image_file_name)
+{
+   const char *base_name = strrchr(image_file_name, '/');
+   base_name = base_name != NULL ? base_name + 1 : image_file_name;
+   const char *extension = strrchr(base_name, '.');
+   int stem_len = extension != NULL && extension != base_name
+      ? (int)(extension - image_file_name)
+      : (int)strlen(image_file_name);
+
+   size_t size = stem_len + sizeof(".cifidx");
+   char *index_file_name = malloc(size);
+   if (index_file_name != NULL) {
+      snprintf(index_file_name, size, "%.*s.cifidx", stem_len, image_file_name);
+   }
+   return index_file_name;
+}
+
+// Writes a row index to the given file.
+static cifex_result_t
+cxc_write_index_file(const cifex_row_index_t *index, const char *file_name)
+{
+   cifex_writer_t writer;
+   cifex_result_t result = cifex_fopen_write(&writer, file_name);
+   if (result != cifex_ok) {
+      return result;
+   }
+   result = cifex_write_row_index(&writer, index);
+   cifex_result_t close_result = cifex_fclose_write(&writer);
+   if (result == cifex_ok) {
+      result = close_result;
+   }
+   if (result != cifex_ok) {
+      remove(file_name);
+   }
+   return result;
+}
+
+// Reads the row index of an image from its sidecar file.
+static cifex_result_t
+cxc_read_index_file(
+   cifex_row_index_t *out_index,
+   cifex_allocator_t *allocator,
+   const char *image_file_name)
+{
+   char *file_name = cxc_index_file_name(image_file_name);
+   if (file_name == NULL) {
+      return cifex_out_of_memory;
+   }
+   cifex_reader_t reader;
+   cifex_result_t result = cifex_fopen_read(&reader, file_name);
+   if (result == cifex_ok) {
+      result = cifex_read_row_index(&reader, allocator, out_index);
+      cifex_fclose_read(&reader);
+   }
+   if (result != cifex_ok) {
+      cxc_file_error(file_name, cifex_result_to_string(result));
+   }
+   free(file_name);
+   return result;
+}
+
+typedef struct cxc_index_config
+{
+   const char *input_file_name, *output_file_name;
+   uint32_t stride;
+} cxc_index_config_t;
+
+static cifex_result_t
+cxc_index(cxc_index_config_t c)
+{
+   if (c.input_file_name == NULL) {
+      fprintf(
+         stderr,
+         "error: no input filename provided.\n"
+         "usage: cifex index <input-file.cif> [output-file.cifidx] [--stride N]\n");
+      exit(-1);
+   }
+   if (c.stride == 0) {
+      fprintf(stderr, "error: the stride must be at least 1\n");
+      exit(-1);
+   }
+
+   char *default_output_file_name = NULL;
+   if (c.output_file_name == NULL) {
+      if ((default_output_file_name = cxc_index_file_name(c.input_file_name)) == NULL) {
+         cxc_file_error(c.input_file_name, cifex_result_to_string(cifex_out_of_memory));
+         return cifex_out_of_memory;
+      }
+      c.output_file_name = default_output_file_name;
+   }
+
+   cifex_allocator_t allocator = cifex_libc_allocator();
+   cifex_reader_t reader;
+   cifex_result_t result = cifex_fopen_read(&reader, c.input_file_name);
+   if (result != cifex_ok) {
+      cxc_file_error(c.input_file_name, cifex_result_to_string(result));
+      free(default_output_file_name);
+      return result;
+   }
+
+   cifex_row_index_t index;
+   cifex_init_row_index(&index, &allocator, c.stride);
+   cifex_decode_result_t decode_result =
+      cifex_build_row_index(cifex_default_decode_config(&allocator, &reader), &index);
+   cifex_fclose_read(&reader);
+
+   if ((result = decode_result.result) != cifex_ok) {
+      fprintf(
+         stderr,
+         "error: %s: line %lu (byte %lu): %s\n",
+         c.input_file_name,
+         decode_result.line,
+         decode_result.position,
+         cifex_result_to_string(result));
+   } else if ((result = cxc_write_index_file(&index, c.output_file_name)) != cifex_ok) {
+      cxc_file_error(c.output_file_name, cifex_result_to_string(result));
+   }
+
+   cifex_free_row_index(&index);
+   free(default_output_file_name);
+   return result;
+}
@@ -1,9 +1,41 @@
+#ifdef __linux__
+// Needed for `mremap`.
+# define _GNU_SOURCE
+#endif
+
 #include "public/libcifex.h"
 
+#include "cxalloc.h"
 #include "cxensure.h"
+#include "cxutil.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __linux__
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
+
+static const char *cx_alloc_tag_strings[] = {
+   [cifex_tag_other] = "other",
+   [cifex_tag_input_buffer] = "input buffer",
+   [cifex_tag_image] = "image",
+   [cifex_tag_metadata] = "metadata",
+};
+
+const char *
+cifex_alloc_tag_to_string(cifex_alloc_tag_t tag)
+{
+   if (tag < cifex__tag_count) {
+      return cx_alloc_tag_strings[tag];
+   } else {
+      return "<invalid tag>";
+   }
+}
+
 void *
 cifex_alloc(cifex_allocator_t *allocator, size_t size)
 {
@@ -20,6 +52,78 @@ cifex_free(cifex_allocator_t *allocator, void *ptr)
    }
 }
 
+static inline size_t
+cx_align_up(size_t value, size_t alignment)
+{
+   return (value + alignment - 1) & ~(alignment - 1);
+}
+
+void *
+cifex_realloc(cifex_allocator_t *allocator, void *ptr, size_t old_size, size_t new_size)
+{
+   cx_ensure(allocator != NULL, "allocator must not be NULL");
+   if (ptr == NULL) {
+      return cifex_alloc(allocator, new_size);
+   }
+   if (allocator->realloc != NULL) {
+      return allocator->realloc(allocator, ptr, old_size, new_size);
+   }
+
+   void *new_ptr = allocator->malloc(allocator, new_size);
+   if (new_ptr == NULL) {
+      return NULL;
+   }
+   memcpy(new_ptr, ptr, cx_min(old_size, new_size));
+   allocator->free(allocator, ptr);
+   return new_ptr;
+}
+
+void *
+cifex_aligned_alloc(cifex_allocator_t *allocator, size_t alignment, size_t size)
+{
+   cx_ensure(allocator != NULL, "allocator must not be NULL");
+   cx_ensure(
+      alignment != 0 && (alignment & (alignment - 1)) == 0, "alignment must be a power of 2");
+
+   if (allocator->aligned_alloc != NULL) {
+      return allocator->aligned_alloc(allocator, alignment, size);
+   }
+
+   // Over-allocate, and stash the pointer to the actual allocation right before the aligned
+   // region, so that it can be found again by `cifex_free_aligned`.
+   if (alignment < sizeof(void *)) {
+      alignment = sizeof(void *);
+   }
+   size_t padding = alignment - 1 + sizeof(void *);
+   if (size > SIZE_MAX - padding) {
+      return NULL;
+   }
+   uint8_t *base = allocator->malloc(allocator, size + padding);
+   if (base == NULL) {
+      return NULL;
+   }
+   uintptr_t address = cx_align_up((uintptr_t)base + sizeof(void *), alignment);
+   uint8_t *aligned = base + (address - (uintptr_t)base);
+   memcpy(aligned - sizeof(void *), &base, sizeof(void *));
+   return aligned;
+}
+
+void
+cifex_free_aligned(cifex_allocator_t *allocator, void *ptr)
+{
+   if (allocator == NULL || ptr == NULL) {
+      return;
+   }
+   if (allocator->aligned_alloc != NULL) {
+      allocator->free(allocator, ptr);
+      return;
+   }
+
+   void *base;
+   memcpy(&base, (uint8_t *)ptr - sizeof(void *), sizeof(void *));
+   allocator->free(allocator, base);
+}
+
 static void *
 cx_libc_malloc_adapter(cifex_allocator_t *allocator, size_t size)
 {
@@ -34,11 +138,1061 @@ cx_libc_free_adapter(cifex_allocator_t *allocator, void *ptr)
    return free(ptr);
 }
 
+static void *
+cx_libc_realloc_adapter(cifex_allocator_t *allocator, void *ptr, size_t old_size, size_t new_size)
+{
+   (void)allocator;
+   (void)old_size;
+   return realloc(ptr, new_size);
+}
+
+static void *
+cx_libc_aligned_alloc_adapter(cifex_allocator_t *allocator, size_t alignment, size_t size)
+{
+   (void)allocator;
+   // C11 requires the size passed to `aligned_alloc` to be a multiple of the alignment.
+   if (alignment < sizeof(void *)) {
+      alignment = sizeof(void *);
+   }
+   if (size > SIZE_MAX - alignment) {
+      return NULL;
+   }
+   return aligned_alloc(alignment, cx_align_up(size, alignment));
+}
+
 cifex_allocator_t
 cifex_libc_allocator(void)
 {
    return (cifex_allocator_t){
       .malloc = cx_libc_malloc_adapter,
       .free = cx_libc_free_adapter,
+      .realloc = cx_libc_realloc_adapter,
+      .aligned_alloc = cx_libc_aligned_alloc_adapter,
+   };
+}
+
+// All arena allocations are aligned to this.
+#define CX_ARENA_ALIGNMENT _Alignof(max_align_t)
+
+struct cifex_arena_block
+{
+   cifex_arena_block_t *next;
+   size_t capacity;
+   size_t used;
+   // Whether the block was allocated from the backing allocator, as opposed to being provided by
+   // the user.
+   bool owned;
+};
+
+// The size of the block header, padded such that the block's data is aligned.
+static const size_t cx_arena_header_size =
+   (sizeof(cifex_arena_block_t) + CX_ARENA_ALIGNMENT - 1) & ~(CX_ARENA_ALIGNMENT - 1);
+
+static inline uint8_t *
+cx_arena_block_data(cifex_arena_block_t *block)
+{
+   return (uint8_t *)block + cx_arena_header_size;
+}
+
+// Bumps the block's pointer by `size` bytes, such that the returned pointer is aligned to
+// `alignment`. Returns `NULL` if there's not enough space left.
+static inline void *
+cx_arena_block_bump(cifex_arena_block_t *block, size_t alignment, size_t size)
+{
+   uint8_t *data = cx_arena_block_data(block);
+   size_t offset = cx_align_up((uintptr_t)data + block->used, alignment) - (uintptr_t)data;
+   if (offset > block->capacity || block->capacity - offset < size) {
+      return NULL;
+   }
+   block->used = offset + size;
+   return data + offset;
+}
+
+static void *
+cx_arena_alloc(cifex_arena_t *arena, size_t alignment, size_t size)
+{
+   if (alignment < CX_ARENA_ALIGNMENT) {
+      alignment = CX_ARENA_ALIGNMENT;
+   }
+
+   // Try the current block first, then any blocks left over from before the last reset.
+   cifex_arena_block_t *last = NULL;
+   for (cifex_arena_block_t *block = arena->current; block != NULL; block = block->next) {
+      void *ptr = cx_arena_block_bump(block, alignment, size);
+      if (ptr != NULL) {
+         arena->current = block;
+         arena->last_allocation = ptr;
+         return ptr;
+      }
+      last = block;
+   }
+
+   if (arena->backing == NULL) {
+      return NULL;
+   }
+
+   // Leave room for aligning the allocation within the new block.
+   if (size > SIZE_MAX - alignment - cx_arena_header_size) {
+      return NULL;
+   }
+   size_t capacity = cx_max(arena->block_size, size + alignment);
+   cifex_arena_block_t *block = cifex_alloc(arena->backing, cx_arena_header_size + capacity);
+   if (block == NULL) {
+      return NULL;
+   }
+   *block = (cifex_arena_block_t){
+      .next = NULL,
+      .capacity = capacity,
+      .used = 0,
+      .owned = true,
+   };
+   if (last != NULL) {
+      last->next = block;
+   } else {
+      arena->first = block;
+   }
+   arena->current = block;
+
+   void *ptr = cx_arena_block_bump(block, alignment, size);
+   arena->last_allocation = ptr;
+   return ptr;
+}
+
+static void *
+cx_arena_malloc(cifex_allocator_t *allocator, size_t size)
+{
+   return cx_arena_alloc((cifex_arena_t *)allocator, CX_ARENA_ALIGNMENT, size);
+}
+
+static void *
+cx_arena_aligned_alloc(cifex_allocator_t *allocator, size_t alignment, size_t size)
+{
+   return cx_arena_alloc((cifex_arena_t *)allocator, alignment, size);
+}
+
+static void *
+cx_arena_realloc(cifex_allocator_t *allocator, void *ptr, size_t old_size, size_t new_size)
+{
+   cifex_arena_t *arena = (cifex_arena_t *)allocator;
+
+   // The most recent allocation can be grown or shrunk in place, as long as it still fits in its
+   // block.
+   if (ptr == arena->last_allocation) {
+      cifex_arena_block_t *block = arena->current;
+      size_t offset = (uint8_t *)ptr - cx_arena_block_data(block);
+      if (block->capacity - offset >= new_size) {
+         block->used = offset + new_size;
+         return ptr;
+      }
+   }
+
+   void *new_ptr = cx_arena_alloc(arena, CX_ARENA_ALIGNMENT, new_size);
+   if (new_ptr != NULL) {
+      memcpy(new_ptr, ptr, cx_min(old_size, new_size));
+   }
+   return new_ptr;
+}
+
+static void
+cx_arena_free(cifex_allocator_t *allocator, void *ptr)
+{
+   cifex_arena_t *arena = (cifex_arena_t *)allocator;
+
+   // Only the most recent allocation can be undone; everything else waits for a reset.
+   if (ptr == arena->last_allocation) {
+      arena->current->used = (uint8_t *)ptr - cx_arena_block_data(arena->current);
+      arena->last_allocation = NULL;
+   }
+}
+
+cifex_arena_t
+cifex_arena_allocator(void *buffer, size_t capacity, cifex_allocator_t *backing)
+{
+   cifex_arena_t arena = {
+      .allocator = {
+         .malloc = cx_arena_malloc,
+         .free = cx_arena_free,
+         .realloc = cx_arena_realloc,
+         .aligned_alloc = cx_arena_aligned_alloc,
+      },
+      .backing = backing,
+      .block_size = capacity,
+      .first = NULL,
+      .current = NULL,
+      .last_allocation = NULL,
+   };
+
+   if (buffer != NULL) {
+      // Place the header of the first block at the first suitably aligned address in the buffer.
+      uintptr_t start = cx_align_up((uintptr_t)buffer, _Alignof(cifex_arena_block_t));
+      size_t padding = start - (uintptr_t)buffer;
+      if (capacity > padding + cx_arena_header_size) {
+         cifex_arena_block_t *block = (cifex_arena_block_t *)start;
+         *block = (cifex_arena_block_t){
+            .next = NULL,
+            .capacity = capacity - padding - cx_arena_header_size,
+            .used = 0,
+            .owned = false,
+         };
+         arena.first = block;
+         arena.current = block;
+      }
+   }
+
+   return arena;
+}
+
+void
+cifex_reset_arena(cifex_arena_t *arena)
+{
+   cx_ensure(arena != NULL, "arena must not be NULL");
+
+   for (cifex_arena_block_t *block = arena->first; block != NULL; block = block->next) {
+      block->used = 0;
+   }
+   arena->current = arena->first;
+   arena->last_allocation = NULL;
+}
+
+void
+cifex_free_arena(cifex_arena_t *arena)
+{
+   cx_ensure(arena != NULL, "arena must not be NULL");
+
+   cifex_arena_block_t *block = arena->first, *kept = NULL;
+   while (block != NULL) {
+      cifex_arena_block_t *next = block->next;
+      if (block->owned) {
+         cifex_free(arena->backing, block);
+      } else {
+         // Only the user-provided block can survive, and it is always the first one.
+         kept = block;
+         kept->next = NULL;
+         kept->used = 0;
+      }
+      block = next;
+   }
+   arena->first = kept;
+   arena->current = kept;
+   arena->last_allocation = NULL;
+}
+
+// Wrapping allocators store this header right before every allocation they hand out, so that they
+// can tell how an allocation was made when it's resized or freed.
+typedef struct cx_wrapped_header
+{
+   // The size of the allocation, as requested by the user.
+   size_t size;
+   // The distance between the start of the inner allocation and the user's pointer.
+   size_t offset;
+   cifex_alloc_tag_t tag;
+   // How the memory behind the allocation was obtained.
+   enum
+   {
+      // Using `cifex_alloc` on the inner allocator.
+      cx_wrapped_malloc,
+      // Using `cifex_aligned_alloc` on the inner allocator.
+      cx_wrapped_aligned,
+      // Directly from the operating system, using `cx_map_huge`.
+      cx_wrapped_mapped,
+   } kind;
+   // The pool size class the allocation belongs to, or `CX_NO_SIZE_CLASS`.
+   uint32_t size_class;
+} cx_wrapped_header_t;
+
+#define CX_NO_SIZE_CLASS UINT32_MAX
+
+// The size of the header, padded such that the allocations following it remain aligned.
+static const size_t cx_wrapped_header_size =
+   (sizeof(cx_wrapped_header_t) + CX_ARENA_ALIGNMENT - 1) & ~(CX_ARENA_ALIGNMENT - 1);
+
+static inline cx_wrapped_header_t *
+cx_wrapped_header(void *ptr)
+{
+   return (cx_wrapped_header_t *)((uint8_t *)ptr - cx_wrapped_header_size);
+}
+
+// Allocates a region with a header from the inner allocator.
+static void *
+cx_wrapped_alloc(
+   cifex_allocator_t *inner,
+   size_t alignment,
+   size_t size,
+   cifex_alloc_tag_t tag)
+{
+   bool aligned = alignment > CX_ARENA_ALIGNMENT;
+   size_t offset =
+      aligned ? cx_align_up(cx_wrapped_header_size, alignment) : cx_wrapped_header_size;
+   if (size > SIZE_MAX - offset) {
+      return NULL;
+   }
+
+   cx_tag_next_alloc(inner, tag);
+   uint8_t *base = aligned ? cifex_aligned_alloc(inner, alignment, offset + size)
+                           : cifex_alloc(inner, offset + size);
+   if (base == NULL) {
+      return NULL;
+   }
+
+   uint8_t *ptr = base + offset;
+   *cx_wrapped_header(ptr) = (cx_wrapped_header_t){
+      .size = size,
+      .offset = offset,
+      .tag = tag,
+      .kind = aligned ? cx_wrapped_aligned : cx_wrapped_malloc,
+      .size_class = CX_NO_SIZE_CLASS,
+   };
+   return ptr;
+}
+
+#ifdef __linux__
+
+// The size of a transparent huge page on most architectures.
+# define CX_HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+// Returns the length of the mapping behind an allocation made with `cx_map_huge`.
+static inline size_t
+cx_mapping_len(size_t offset, size_t size)
+{
+   return cx_align_up(offset + size, CX_HUGE_PAGE_SIZE);
+}
+
+// Faults in all pages of a mapping.
+static void
+cx_populate(uint8_t *base, size_t len)
+{
+# ifdef MADV_POPULATE_WRITE
+   if (madvise(base, len, MADV_POPULATE_WRITE) == 0) {
+      return;
+   }
+# endif
+   // Older kernels don't support MADV_POPULATE_WRITE, so touch every page by hand. We can't use
+   // MAP_POPULATE for this, as that would fault the memory in before the kernel gets to know we'd
+   // like it to be backed by huge pages.
+   size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+   for (size_t i = 0; i < len; i += page_size) {
+      ((volatile uint8_t *)base)[i] = 0;
+   }
+}
+
+// Maps a region of memory with a header, aligned to the huge page size and backed by transparent
+// huge pages if the system allows it.
+static void *
+cx_map_huge(size_t alignment, size_t size, bool populate, cifex_alloc_tag_t tag)
+{
+   size_t offset = cx_align_up(cx_wrapped_header_size, cx_max(alignment, CX_ARENA_ALIGNMENT));
+   if (size > SIZE_MAX - offset - 2 * CX_HUGE_PAGE_SIZE) {
+      return NULL;
+   }
+   size_t len = cx_mapping_len(offset, size);
+
+   // Map an extra huge page, such that the mapping can be trimmed down to an aligned one.
+   // Huge pages can only be used for aligned regions of memory.
+   uint8_t *raw = mmap(
+      NULL, len + CX_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (raw == MAP_FAILED) {
+      return NULL;
+   }
+   size_t head = cx_align_up((uintptr_t)raw, CX_HUGE_PAGE_SIZE) - (uintptr_t)raw;
+   uint8_t *base = raw + head;
+   if (head > 0) {
+      munmap(raw, head);
+   }
+   if (CX_HUGE_PAGE_SIZE - head > 0) {
+      munmap(base + len, CX_HUGE_PAGE_SIZE - head);
+   }
+
+   // Failure here is not fatal; the memory simply remains backed by regular pages.
+   madvise(base, len, MADV_HUGEPAGE);
+   if (populate) {
+      cx_populate(base, len);
+   }
+
+   uint8_t *ptr = base + offset;
+   *cx_wrapped_header(ptr) = (cx_wrapped_header_t){
+      .size = size,
+      .offset = offset,
+      .tag = tag,
+      .kind = cx_wrapped_mapped,
+      .size_class = CX_NO_SIZE_CLASS,
+   };
+   return ptr;
+}
+
+// Resizes a region allocated with `cx_map_huge`. The mapping is grown in place when the address
+// space after it is free. Otherwise the region is moved into a new mapping made by `cx_map_huge`,
+// since letting the kernel move it would lose the huge page alignment.
+static void *
+cx_remap_huge(void *ptr, size_t new_size, bool populate)
+{
+   cx_wrapped_header_t *header = cx_wrapped_header(ptr);
+   uint8_t *base = (uint8_t *)ptr - header->offset;
+   if (new_size > SIZE_MAX - header->offset - 2 * CX_HUGE_PAGE_SIZE) {
+      return NULL;
+   }
+
+   size_t old_len = cx_mapping_len(header->offset, header->size);
+   size_t new_len = cx_mapping_len(header->offset, new_size);
+   if (new_len < old_len) {
+      munmap(base + new_len, old_len - new_len);
+   } else if (new_len > old_len) {
+      if (mremap(base, old_len, new_len, 0) == MAP_FAILED) {
+         // Passing the offset as the alignment gives the new region the same offset.
+         uint8_t *new_ptr = cx_map_huge(header->offset, new_size, populate, header->tag);
+         if (new_ptr == NULL) {
+            return NULL;
+         }
+         memcpy(new_ptr, ptr, header->size);
+         munmap(base, old_len);
+         return new_ptr;
+      }
+      madvise(base + old_len, new_len - old_len, MADV_HUGEPAGE);
+      if (populate) {
+         cx_populate(base + old_len, new_len - old_len);
+      }
+   }
+
+   header->size = new_size;
+   return ptr;
+}
+
+#endif
+
+// Resizes a region allocated with `cx_wrapped_alloc`.
+static void *
+cx_wrapped_realloc(cifex_allocator_t *inner, void *ptr, size_t new_size)
+{
+   cx_wrapped_header_t header = *cx_wrapped_header(ptr);
+   uint8_t *base = (uint8_t *)ptr - header.offset;
+   if (new_size > SIZE_MAX - header.offset) {
+      return NULL;
+   }
+
+   // Mapped regions are only ever made by the huge page allocator, which resizes them with
+   // `cx_remap_huge` itself.
+   uint8_t *new_ptr;
+   if (header.kind == cx_wrapped_aligned) {
+      // There's no way of resizing aligned allocations, so fall back to copying.
+      // The offset of aligned allocations is always equal to their alignment.
+      new_ptr = cx_wrapped_alloc(inner, header.offset, new_size, header.tag);
+      if (new_ptr == NULL) {
+         return NULL;
+      }
+      memcpy(new_ptr, ptr, cx_min(header.size, new_size));
+      cifex_free_aligned(inner, base);
+   } else {
+      cx_tag_next_alloc(inner, header.tag);
+      uint8_t *new_base =
+         cifex_realloc(inner, base, header.offset + header.size, header.offset + new_size);
+      if (new_base == NULL) {
+         return NULL;
+      }
+      new_ptr = new_base + header.offset;
+   }
+
+   cx_wrapped_header(new_ptr)->size = new_size;
+   return new_ptr;
+}
+
+// Frees a region allocated with `cx_wrapped_alloc`.
+static void
+cx_wrapped_free(cifex_allocator_t *inner, void *ptr)
+{
+   cx_wrapped_header_t *header = cx_wrapped_header(ptr);
+   uint8_t *base = (uint8_t *)ptr - header->offset;
+   switch (header->kind) {
+      case cx_wrapped_malloc:
+         cifex_free(inner, base);
+         break;
+      case cx_wrapped_aligned:
+         cifex_free_aligned(inner, base);
+         break;
+      case cx_wrapped_mapped:
+#ifdef __linux__
+         munmap(base, cx_mapping_len(header->offset, header->size));
+#endif
+         break;
+   }
+}
+
+static inline size_t
+cx_histogram_bucket(size_t size)
+{
+   size_t bucket = 0;
+   while (size > 1 && bucket < CIFEX_ALLOC_HISTOGRAM_BUCKETS - 1) {
+      size >>= 1;
+      ++bucket;
+   }
+   return bucket;
+}
+
+static inline void
+cx_counters_add(cifex_alloc_counters_t *counters, size_t size)
+{
+   counters->live_bytes += size;
+   counters->total_bytes += size;
+   if (counters->live_bytes > counters->peak_bytes) {
+      counters->peak_bytes = counters->live_bytes;
+   }
+}
+
+static void *
+cx_tracking_alloc(cifex_tracking_allocator_t *tracking, size_t alignment, size_t size)
+{
+   cifex_alloc_tag_t tag = tracking->next_tag;
+   tracking->next_tag = cifex_tag_other;
+
+   void *ptr = cx_wrapped_alloc(tracking->inner, alignment, size, tag);
+   if (ptr != NULL) {
+      cx_counters_add(&tracking->total, size);
+      cx_counters_add(&tracking->by_tag[tag], size);
+      ++tracking->total.allocations;
+      ++tracking->by_tag[tag].allocations;
+      ++tracking->histogram[cx_histogram_bucket(size)];
+   }
+   return ptr;
+}
+
+static void *
+cx_tracking_malloc(cifex_allocator_t *allocator, size_t size)
+{
+   return cx_tracking_alloc((cifex_tracking_allocator_t *)allocator, CX_ARENA_ALIGNMENT, size);
+}
+
+static void *
+cx_tracking_aligned_alloc(cifex_allocator_t *allocator, size_t alignment, size_t size)
+{
+   return cx_tracking_alloc((cifex_tracking_allocator_t *)allocator, alignment, size);
+}
+
+static void *
+cx_tracking_realloc(cifex_allocator_t *allocator, void *ptr, size_t old_size, size_t new_size)
+{
+   cifex_tracking_allocator_t *tracking = (cifex_tracking_allocator_t *)allocator;
+   tracking->next_tag = cifex_tag_other;
+
+   // The size in the header is what was accounted for when the region was allocated, which is not
+   // necessarily the `old_size` the caller passes in.
+   (void)old_size;
+   cifex_alloc_tag_t tag = cx_wrapped_header(ptr)->tag;
+   size_t allocated_size = cx_wrapped_header(ptr)->size;
+   void *new_ptr = cx_wrapped_realloc(tracking->inner, ptr, new_size);
+   if (new_ptr != NULL) {
+      tracking->total.live_bytes -= allocated_size;
+      tracking->by_tag[tag].live_bytes -= allocated_size;
+      cx_counters_add(&tracking->total, new_size);
+      cx_counters_add(&tracking->by_tag[tag], new_size);
+      ++tracking->total.reallocations;
+      ++tracking->by_tag[tag].reallocations;
+      ++tracking->histogram[cx_histogram_bucket(new_size)];
+   }
+   return new_ptr;
+}
+
+static void
+cx_tracking_free(cifex_allocator_t *allocator, void *ptr)
+{
+   cifex_tracking_allocator_t *tracking = (cifex_tracking_allocator_t *)allocator;
+
+   cx_wrapped_header_t *header = cx_wrapped_header(ptr);
+   tracking->total.live_bytes -= header->size;
+   tracking->by_tag[header->tag].live_bytes -= header->size;
+   ++tracking->total.deallocations;
+   ++tracking->by_tag[header->tag].deallocations;
+
+   cx_wrapped_free(tracking->inner, ptr);
+}
+
+static void
+cx_tracking_tag(cifex_allocator_t *allocator, cifex_alloc_tag_t tag)
+{
+   cifex_tracking_allocator_t *tracking = (cifex_tracking_allocator_t *)allocator;
+   tracking->next_tag = tag;
+}
+
+cifex_tracking_allocator_t
+cifex_tracking_allocator(cifex_allocator_t *inner)
+{
+   cx_ensure(inner != NULL, "inner allocator must not be NULL");
+
+   return (cifex_tracking_allocator_t){
+      .allocator = {
+         .malloc = cx_tracking_malloc,
+         .free = cx_tracking_free,
+         .realloc = cx_tracking_realloc,
+         .aligned_alloc = cx_tracking_aligned_alloc,
+         .tag = cx_tracking_tag,
+      },
+      .inner = inner,
+      .total = { 0 },
+      .by_tag = { { 0 } },
+      .histogram = { 0 },
+      .next_tag = cifex_tag_other,
+   };
+}
+
+static void *
+cx_huge_page_alloc(cifex_huge_page_allocator_t *huge, size_t alignment, size_t size)
+{
+   cifex_alloc_tag_t tag = huge->next_tag;
+   huge->next_tag = cifex_tag_other;
+
+#ifdef __linux__
+   if (size >= huge->threshold && alignment <= CX_HUGE_PAGE_SIZE) {
+      void *ptr = cx_map_huge(alignment, size, huge->populate, tag);
+      if (ptr != NULL) {
+         return ptr;
+      }
+      // If mapping failed, try our luck with the inner allocator.
+   }
+#endif
+
+   return cx_wrapped_alloc(huge->inner, alignment, size, tag);
+}
+
+static void *
+cx_huge_page_malloc(cifex_allocator_t *allocator, size_t size)
+{
+   return cx_huge_page_alloc((cifex_huge_page_allocator_t *)allocator, CX_ARENA_ALIGNMENT, size);
+}
+
+static void *
+cx_huge_page_aligned_alloc(cifex_allocator_t *allocator, size_t alignment, size_t size)
+{
+   return cx_huge_page_alloc((cifex_huge_page_allocator_t *)allocator, alignment, size);
+}
+
+static void *
+cx_huge_page_realloc(cifex_allocator_t *allocator, void *ptr, size_t old_size, size_t new_size)
+{
+   cifex_huge_page_allocator_t *huge = (cifex_huge_page_allocator_t *)allocator;
+   huge->next_tag = cifex_tag_other;
+
+   cx_wrapped_header_t *header = cx_wrapped_header(ptr);
+   if (header->kind != cx_wrapped_mapped && new_size >= huge->threshold) {
+      // Buffers that grow past the threshold are moved into their own mapping, after which they
+      // can keep growing without being copied.
+      huge->next_tag = header->tag;
+      void *new_ptr = cx_huge_page_alloc(huge, CX_ARENA_ALIGNMENT, new_size);
+      if (new_ptr == NULL) {
+         return NULL;
+      }
+      memcpy(new_ptr, ptr, cx_min(old_size, new_size));
+      cx_wrapped_free(huge->inner, ptr);
+      return new_ptr;
+   }
+#ifdef __linux__
+   if (header->kind == cx_wrapped_mapped) {
+      return cx_remap_huge(ptr, new_size, huge->populate);
+   }
+#endif
+
+   return cx_wrapped_realloc(huge->inner, ptr, new_size);
+}
+
+static void
+cx_huge_page_free(cifex_allocator_t *allocator, void *ptr)
+{
+   cifex_huge_page_allocator_t *huge = (cifex_huge_page_allocator_t *)allocator;
+   cx_wrapped_free(huge->inner, ptr);
+}
+
+static void
+cx_huge_page_tag(cifex_allocator_t *allocator, cifex_alloc_tag_t tag)
+{
+   cifex_huge_page_allocator_t *huge = (cifex_huge_page_allocator_t *)allocator;
+   huge->next_tag = tag;
+}
+
+cifex_huge_page_allocator_t
+cifex_huge_page_allocator(cifex_allocator_t *inner, size_t threshold, bool populate)
+{
+   cx_ensure(inner != NULL, "inner allocator must not be NULL");
+
+   return (cifex_huge_page_allocator_t){
+      .allocator = {
+         .malloc = cx_huge_page_malloc,
+         .free = cx_huge_page_free,
+         .realloc = cx_huge_page_realloc,
+         .aligned_alloc = cx_huge_page_aligned_alloc,
+         .tag = cx_huge_page_tag,
+      },
+      .inner = inner,
+      .threshold = threshold,
+      .populate = populate,
+      .next_tag = cifex_tag_other,
    };
 }
+
+// The smallest pooled allocation is 2^CX_POOL_MIN_SHIFT bytes large.
+#define CX_POOL_MIN_SHIFT 16
+// Each power of two is split into this many size classes.
+#define CX_POOL_SUBCLASSES 4
+
+typedef struct cx_pool_class
+{
+   // Protects `head`. The critical sections only ever swap a couple of pointers, so a spin lock is
+   // plenty.
+   atomic_flag lock;
+   // The stack of free buffers. Each free buffer stores the pointer to the next one in its data.
+   void *head;
+} cx_pool_class_t;
+
+struct cifex_pool
+{
+   // Must remain the first field; see `cifex_pool_allocator`.
+   cifex_allocator_t allocator;
+   cifex_allocator_t *inner;
+
+   size_t max_retained;
+   // The total capacity of free buffers held by the pool and its caches.
+   atomic_size_t retained;
+
+   cx_pool_class_t classes[CIFEX_POOL_SIZE_CLASSES];
+};
+
+static inline size_t
+cx_log2(size_t value)
+{
+   size_t result = 0;
+   while (value > 1) {
+      value >>= 1;
+      ++result;
+   }
+   return result;
+}
+
+// Finds the size class for an allocation. Returns `false` if the allocation should not be pooled.
+static inline bool
+cx_pool_size_class(size_t size, uint32_t *out_class)
+{
+   if (size < ((size_t)1 << CX_POOL_MIN_SHIFT)) {
+      return false;
+   }
+
+   size_t shift = cx_log2(size);
+   size_t granule = (size_t)1 << (shift - 2);
+   if (size > SIZE_MAX - granule) {
+      return false;
+   }
+   // Rounding up can carry over into the next power of two, so the shift is computed again.
+   size_t capacity = cx_align_up(size, granule);
+   shift = cx_log2(capacity);
+   size_t subclass = (capacity >> (shift - 2)) - CX_POOL_SUBCLASSES;
+   size_t size_class = (shift - CX_POOL_MIN_SHIFT) * CX_POOL_SUBCLASSES + subclass;
+   if (size_class >= CIFEX_POOL_SIZE_CLASSES) {
+      return false;
+   }
+
+   *out_class = (uint32_t)size_class;
+   return true;
+}
+
+// Returns the capacity of buffers belonging to the given size class.
+static inline size_t
+cx_pool_class_capacity(uint32_t size_class)
+{
+   size_t shift = size_class / CX_POOL_SUBCLASSES + CX_POOL_MIN_SHIFT;
+   size_t subclass = size_class % CX_POOL_SUBCLASSES;
+   return (CX_POOL_SUBCLASSES + subclass) << (shift - 2);
+}
+
+static inline void
+cx_pool_lock(cx_pool_class_t *pool_class)
+{
+   while (atomic_flag_test_and_set_explicit(&pool_class->lock, memory_order_acquire))
+      ;
+}
+
+static inline void
+cx_pool_unlock(cx_pool_class_t *pool_class)
+{
+   atomic_flag_clear_explicit(&pool_class->lock, memory_order_release);
+}
+
+// Pops a free buffer off the size class's stack. Returns `NULL` if there are no free buffers.
+static void *
+cx_pool_pop(cifex_pool_t *pool, uint32_t size_class)
+{
+   cx_pool_class_t *pool_class = &pool->classes[size_class];
+   cx_pool_lock(pool_class);
+   void *ptr = pool_class->head;
+   if (ptr != NULL) {
+      memcpy(&pool_class->head, ptr, sizeof(void *));
+   }
+   cx_pool_unlock(pool_class);
+   return ptr;
+}
+
+// Pushes a free buffer onto the size class's stack.
+static void
+cx_pool_push(cifex_pool_t *pool, uint32_t size_class, void *ptr)
+{
+   cx_pool_class_t *pool_class = &pool->classes[size_class];
+   cx_pool_lock(pool_class);
+   memcpy(ptr, &pool_class->head, sizeof(void *));
+   pool_class->head = ptr;
+   cx_pool_unlock(pool_class);
+}
+
+// Reserves space for a free buffer in the pool's retention budget. Returns `false` if the buffer
+// would not fit.
+static inline bool
+cx_pool_retain(cifex_pool_t *pool, size_t capacity)
+{
+   size_t retained = atomic_fetch_add_explicit(&pool->retained, capacity, memory_order_relaxed);
+   if (retained + capacity > pool->max_retained) {
+      atomic_fetch_sub_explicit(&pool->retained, capacity, memory_order_relaxed);
+      return false;
+   }
+   return true;
+}
+
+static inline void
+cx_pool_release(cifex_pool_t *pool, size_t capacity)
+{
+   atomic_fetch_sub_explicit(&pool->retained, capacity, memory_order_relaxed);
+}
+
+static void *
+cx_pool_alloc(cifex_pool_t *pool, size_t alignment, size_t size, cifex_alloc_tag_t tag)
+{
+   // Pooled buffers are always aligned to `CIFEX_BUFFER_ALIGNMENT`, so they can serve requests for
+   // any smaller alignment.
+   uint32_t size_class;
+   if (alignment > CIFEX_BUFFER_ALIGNMENT || !cx_pool_size_class(size, &size_class)) {
+      return cx_wrapped_alloc(pool->inner, alignment, size, tag);
+   }
+
+   size_t capacity = cx_pool_class_capacity(size_class);
+   void *ptr = cx_pool_pop(pool, size_class);
+   if (ptr != NULL) {
+      cx_pool_release(pool, capacity);
+   } else {
+      ptr = cx_wrapped_alloc(pool->inner, CIFEX_BUFFER_ALIGNMENT, capacity, tag);
+      if (ptr == NULL) {
+         return NULL;
+      }
+   }
+
+   cx_wrapped_header_t *header = cx_wrapped_header(ptr);
+   header->size = size;
+   header->tag = tag;
+   header->size_class = size_class;
+   return ptr;
+}
+
+static void
+cx_pool_free(cifex_pool_t *pool, void *ptr)
+{
+   uint32_t size_class = cx_wrapped_header(ptr)->size_class;
+   if (size_class != CX_NO_SIZE_CLASS && cx_pool_retain(pool, cx_pool_class_capacity(size_class))) {
+      cx_pool_push(pool, size_class, ptr);
+   } else {
+      cx_wrapped_free(pool->inner, ptr);
+   }
+}
+
+static void *
+cx_pool_realloc(cifex_pool_t *pool, void *ptr, size_t new_size, cifex_alloc_tag_t tag)
+{
+   cx_wrapped_header_t *header = cx_wrapped_header(ptr);
+   if (header->size_class == CX_NO_SIZE_CLASS) {
+      uint32_t size_class;
+      if (!cx_pool_size_class(new_size, &size_class)) {
+         return cx_wrapped_realloc(pool->inner, ptr, new_size);
+      }
+   } else if (new_size <= cx_pool_class_capacity(header->size_class)) {
+      // The buffer's size class leaves some room for growing in place.
+      header->size = new_size;
+      return ptr;
+   }
+
+   void *new_ptr = cx_pool_alloc(pool, CX_ARENA_ALIGNMENT, new_size, tag);
+   if (new_ptr == NULL) {
+      return NULL;
+   }
+   memcpy(new_ptr, ptr, cx_min(header->size, new_size));
+   cx_pool_free(pool, ptr);
+   return new_ptr;
+}
+
+static void *
+cx_pool_malloc_adapter(cifex_allocator_t *allocator, size_t size)
+{
+   return cx_pool_alloc((cifex_pool_t *)allocator, CX_ARENA_ALIGNMENT, size, cifex_tag_other);
+}
+
+static void *
+cx_pool_aligned_alloc_adapter(cifex_allocator_t *allocator, size_t alignment, size_t size)
+{
+   return cx_pool_alloc((cifex_pool_t *)allocator, alignment, size, cifex_tag_other);
+}
+
+static void *
+cx_pool_realloc_adapter(cifex_allocator_t *allocator, void *ptr, size_t old_size, size_t new_size)
+{
+   (void)old_size;
+   return cx_pool_realloc((cifex_pool_t *)allocator, ptr, new_size, cifex_tag_other);
+}
+
+static void
+cx_pool_free_adapter(cifex_allocator_t *allocator, void *ptr)
+{
+   cx_pool_free((cifex_pool_t *)allocator, ptr);
+}
+
+cifex_result_t
+cifex_create_pool(cifex_pool_t **out_pool, cifex_allocator_t *inner, size_t max_retained)
+{
+   cx_ensure(out_pool != NULL, "output pool must not be NULL");
+   cx_ensure(inner != NULL, "inner allocator must not be NULL");
+
+   cifex_pool_t *pool = cifex_alloc(inner, sizeof(cifex_pool_t));
+   if (pool == NULL) {
+      return cifex_out_of_memory;
+   }
+
+   // The pool's allocator does not implement tagging, as the tag would have to be shared between
+   // threads. Use caches for that.
+   pool->allocator = (cifex_allocator_t){
+      .malloc = cx_pool_malloc_adapter,
+      .free = cx_pool_free_adapter,
+      .realloc = cx_pool_realloc_adapter,
+      .aligned_alloc = cx_pool_aligned_alloc_adapter,
+      .tag = NULL,
+   };
+   pool->inner = inner;
+   pool->max_retained = max_retained;
+   atomic_init(&pool->retained, 0);
+   for (size_t i = 0; i < CIFEX_POOL_SIZE_CLASSES; ++i) {
+      atomic_flag_clear(&pool->classes[i].lock);
+      pool->classes[i].head = NULL;
+   }
+
+   *out_pool = pool;
+   return cifex_ok;
+}
+
+void
+cifex_destroy_pool(cifex_pool_t *pool)
+{
+   if (pool == NULL) {
+      return;
+   }
+
+   for (uint32_t size_class = 0; size_class < CIFEX_POOL_SIZE_CLASSES; ++size_class) {
+      void *ptr;
+      while ((ptr = cx_pool_pop(pool, size_class)) != NULL) {
+         cx_wrapped_free(pool->inner, ptr);
+      }
+   }
+   cifex_free(pool->inner, pool);
+}
+
+cifex_allocator_t *
+cifex_pool_allocator(cifex_pool_t *pool)
+{
+   cx_ensure(pool != NULL, "pool must not be NULL");
+   return &pool->allocator;
+}
+
+static void *
+cx_pool_cache_alloc(cifex_pool_cache_t *cache, size_t alignment, size_t size)
+{
+   cifex_alloc_tag_t tag = cache->next_tag;
+   cache->next_tag = cifex_tag_other;
+
+   uint32_t size_class;
+   if (
+      alignment <= CIFEX_BUFFER_ALIGNMENT && cx_pool_size_class(size, &size_class) &&
+      cache->slots[size_class] != NULL) {
+      void *ptr = cache->slots[size_class];
+      cache->slots[size_class] = NULL;
+      cx_pool_release(cache->pool, cx_pool_class_capacity(size_class));
+
+      cx_wrapped_header_t *header = cx_wrapped_header(ptr);
+      header->size = size;
+      header->tag = tag;
+      return ptr;
+   }
+
+   return cx_pool_alloc(cache->pool, alignment, size, tag);
+}
+
+static void
+cx_pool_cache_free(cifex_allocator_t *allocator, void *ptr)
+{
+   cifex_pool_cache_t *cache = (cifex_pool_cache_t *)allocator;
+
+   uint32_t size_class = cx_wrapped_header(ptr)->size_class;
+   if (
+      size_class != CX_NO_SIZE_CLASS && cache->slots[size_class] == NULL &&
+      cx_pool_retain(cache->pool, cx_pool_class_capacity(size_class))) {
+      cache->slots[size_class] = ptr;
+      return;
+   }
+
+   cx_pool_free(cache->pool, ptr);
+}
+
+static void *
+cx_pool_cache_malloc(cifex_allocator_t *allocator, size_t size)
+{
+   return cx_pool_cache_alloc((cifex_pool_cache_t *)allocator, CX_ARENA_ALIGNMENT, size);
+}
+
+static void *
+cx_pool_cache_aligned_alloc(cifex_allocator_t *allocator, size_t alignment, size_t size)
+{
+   return cx_pool_cache_alloc((cifex_pool_cache_t *)allocator, alignment, size);
+}
+
+static void *
+cx_pool_cache_realloc(cifex_allocator_t *allocator, void *ptr, size_t old_size, size_t new_size)
+{
+   (void)old_size;
+   cifex_pool_cache_t *cache = (cifex_pool_cache_t *)allocator;
+   cache->next_tag = cifex_tag_other;
+   return cx_pool_realloc(cache->pool, ptr, new_size, cx_wrapped_header(ptr)->tag);
+}
+
+static void
+cx_pool_cache_tag(cifex_allocator_t *allocator, cifex_alloc_tag_t tag)
+{
+   cifex_pool_cache_t *cache = (cifex_pool_cache_t *)allocator;
+   cache->next_tag = tag;
+}
+
+cifex_pool_cache_t
+cifex_pool_cache(cifex_pool_t *pool)
+{
+   cx_ensure(pool != NULL, "pool must not be NULL");
+
+   return (cifex_pool_cache_t){
+      .allocator = {
+         .malloc = cx_pool_cache_malloc,
+         .free = cx_pool_cache_free,
+         .realloc = cx_pool_cache_realloc,
+         .aligned_alloc = cx_pool_cache_aligned_alloc,
+         .tag = cx_pool_cache_tag,
+      },
+      .pool = pool,
+      .slots = { NULL },
+      .next_tag = cifex_tag_other,
+   };
+}
+
+void
+cifex_free_pool_cache(cifex_pool_cache_t *cache)
+{
+   cx_ensure(cache != NULL, "cache must not be NULL");
+
+   // Buffers in the cache are already accounted for in the pool's retention budget.
+   for (uint32_t size_class = 0; size_class < CIFEX_POOL_SIZE_CLASSES; ++size_class) {
+      if (cache->slots[size_class] != NULL) {
+         cx_pool_push(cache->pool, size_class, cache->slots[size_class]);
+         cache->slots[size_class] = NULL;
+      }
+   }
+}
@@ -1,4 +1,5 @@
 import argparse
+import struct
 
 def truefalse(s):
    if s == "true": return True
@@ -9,14 +10,32 @@ ap.add_argument("in_file_name")
 ap.add_argument("out_file_name")
 ap.add_argument("--bytewise", type=truefalse)
 ap.add_argument("--endianness", type=str, choices=["little", "big"])
+ap.add_argument(
+   "--profile",
+   type=str,
+   default="",
+   help="a profile written by a build with count_strconsts, used to order the number matchers",
+)
 args = ap.parse_args()
 
+# Wide loads go through `memcpy`, which compilers turn into a single load on targets with cheap
+# unaligned access, without the alignment and strict aliasing issues of dereferencing a cast
+# pointer.
 generated = """
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include "cxcompilers.h"
 
+static cx_inline uint64_t
+cx_sc_load64(const uint8_t *input)
+{
+   uint64_t value;
+   memcpy(&value, input, sizeof value);
+   return value;
+}
+
 """
 
 def generate_code_for_strconst(ident, string):
@@ -29,14 +48,14 @@ def generate_code_for_strconst(ident, string):
       for i in range(0, len(string), n_bytes):
          chunk = string[i : (i + n_bytes)]
          chunk_iter = chunk if args.endianness == "big" else reversed(chunk)
-         hex_bytes = "".join([f"{x:x}" for x in chunk_iter])
+         hex_bytes = "".join([f"{x:02x}" for x in chunk_iter])
          mask = "0x" + "FF" * len(chunk)
          if args.endianness == "big":
             zeroes = "00" * (n_bytes - len(chunk))
             mask += zeroes
             hex_bytes += zeroes
          hex_bytes = "0x" + hex_bytes
-         conds.append(f"((wide_input[{i // n_bytes}] & {mask}) == {hex_bytes})")
+         conds.append(f"((cx_sc_load64(&input[{i}]) & {mask}u) == {hex_bytes}u)")
    else:
       for i in range(0, len(string)):
          c = string[i]
@@ -44,21 +63,228 @@ def generate_code_for_strconst(ident, string):
    cond = " && ".join(conds)
 
    result += f"""static cx_inline bool cx_sc_{ident}_match(const uint8_t *input) {{
-      const uint64_t *wide_input = (const uint64_t *)input;
-      return {cond};
+      return cx_sc_count(cx_sc_id_{ident}, {cond});
    }}
 """
    result += f"static size_t cx_sc_{ident}_len = {len(string)};\n"
    return result
 
+# Every strconst gets an ID, so that builds with `LIBCIFEX_COUNT_STRCONSTS` defined can count how
+# many times each of them was matched. Images may be decoded on several threads at once, so the
+# counters are atomic. Relaxed ordering is enough, as they're only read once the program exits.
+def generate_counters(idents):
+   result = "typedef enum cx_sc_id\n{\n"
+   for ident in idents:
+      result += f"   cx_sc_id_{ident},\n"
+   result += "   cx_sc__id_count,\n} cx_sc_id_t;\n\n"
+
+   result += "#ifdef LIBCIFEX_COUNT_STRCONSTS\n"
+   result += "# include <stdatomic.h>\n\n"
+   result += "static const char *cx_sc_names[] = {\n"
+   for ident in idents:
+      result += f"   [cx_sc_id_{ident}] = \"{ident}\",\n"
+   result += "};\n\n"
+
+   result += """static _Atomic uint64_t cx_sc_counts[cx_sc__id_count];
+
+static cx_inline bool
+cx_sc_count(cx_sc_id_t id, bool matched)
+{
+   if (matched) {
+      atomic_fetch_add_explicit(&cx_sc_counts[id], 1, memory_order_relaxed);
+   }
+   return matched;
+}
+#else
+# define cx_sc_count(id, matched) (matched)
+#endif
+
+"""
+   return result
+
+# Reads a profile of `<ident> <count>` lines.
+def read_profile(file_name):
+   profile = {}
+   if file_name != "":
+      with open(file_name, "r") as profile_file:
+         for line in profile_file.read().splitlines():
+            fields = line.split(' ')
+            if len(fields) == 2:
+               profile[fields[0]] = int(fields[1])
+   return profile
+
+# The words numbers up to hundreds are made of, along with their values and kinds. The kinds are
+# bit flags, so that the kinds of words a word may follow can be stored as a mask.
+number_word_kinds = {
+   "hundreds": (1, []),
+   "tens": (2, ["hundreds"]),
+   "ones": (4, ["hundreds", "tens"]),
+   "teens": (8, ["hundreds"]),
+   "zero": (16, []),
+}
+number_words = {"zero": (0, "zero")}
+for i, name in enumerate(["one", "two", "three", "four", "five", "six", "seven", "eight", "nine"]):
+   number_words[name] = (i + 1, "ones")
+   number_words[f"{name}_hundred"] = ((i + 1) * 100, "hundreds")
+for i, name in enumerate([
+   "ten", "eleven", "twelve", "thirteen", "fourteen",
+   "fifteen", "sixteen", "seventeen", "eighteen", "nineteen",
+]):
+   number_words[name] = (i + 10, "teens")
+for i, name in enumerate([
+   "twenty", "thirty", "fourty", "fifty", "sixty", "seventy", "eighty", "ninety",
+]):
+   number_words[name] = ((i + 2) * 10, "tens")
+
+# The groups of words matched one after another by the decoder's general number parser. The order
+# of the groups is fixed, because some words are prefixes of words in earlier groups (such as
+# `jeden` and `jedenaście`), but no word is a prefix of another word in the same group. That leaves
+# the order within each group free to follow the profile, with the most common words first. Words
+# the profile doesn't count, or all of them without a profile, are matched in numeric order.
+number_word_groups = ["hundreds", "teens", "tens", "ones"]
+
+def generate_group_matchers(profile):
+   result = ""
+   for group in number_word_groups:
+      idents = [ident for ident, (_, kind) in number_words.items() if kind == group]
+      idents.sort(key=lambda ident: (-profile.get(ident, 0), number_words[ident][0]))
+      result += f"""// Matches one of the {group}, setting `*out_len` to its length. Returns its value, or 0 if
+// none of them match.
+static cx_inline uint32_t
+cx_sc_match_{group}(const uint8_t *input, size_t *out_len)
+{{
+"""
+      for ident in idents:
+         result += f"""   if (cx_sc_{ident}_match(input)) {{
+      *out_len = cx_sc_{ident}_len;
+      return {number_words[ident][0]};
+   }}
+"""
+      result += "   return 0;\n}\n\n"
+   return result
+
+def load64(string, offset):
+   chunk = (string[offset : (offset + 8)] + bytes(8))[:8]
+   return struct.unpack("<Q" if args.endianness == "little" else ">Q", chunk)[0]
+
+def number_word_hash(string, multiplier, shift):
+   return (((load64(string, 0) ^ len(string)) * multiplier) & 0xFFFFFFFFFFFFFFFF) >> shift
+
+# Finds a multiplier that hashes every number word to a different slot of the smallest possible
+# table. The search is deterministic, so that the generated header is the same on every build.
+def find_number_word_hash(strings):
+   table_bits = 6
+   while True:
+      state = 1
+      for _ in range(100000):
+         state = (state * 6364136223846793005 + 1442695040888963407) & 0xFFFFFFFFFFFFFFFF
+         multiplier = state | 1
+         shift = 64 - table_bits
+         slots = {number_word_hash(string, multiplier, shift) for string in strings}
+         if len(slots) == len(strings):
+            return multiplier, table_bits
+      table_bits += 1
+
+def generate_number_word_table(strconsts):
+   words = {strconsts[ident]: (ident, *number_words[ident]) for ident in number_words}
+   strings = [bytes(string, "UTF-8") for string in words]
+   max_len = max(len(string) for string in strings)
+   assert max_len <= 24
+   multiplier, table_bits = find_number_word_hash(strings)
+
+   slots = [None] * (1 << table_bits)
+   for string, word in zip(strings, words.values()):
+      slots[number_word_hash(string, multiplier, 64 - table_bits)] = (string, *word)
+
+   result = "// Kinds of number words.\n"
+   result += "typedef enum cx_sc_number_word_kind\n{\n"
+   for kind, (flag, _) in number_word_kinds.items():
+      result += f"   cx_sc_{kind} = {flag},\n"
+   result += "} cx_sc_number_word_kind_t;\n\n"
+
+   result += f"""// A number word, as stored in the number word table.
+typedef struct cx_sc_number_word
+{{
+   // The word's bytes as loaded by `cx_sc_load64`, zero-padded to 24 bytes.
+   uint64_t bytes[3];
+   uint8_t len;
+   // The word's kind, and the kinds of words it may follow within a number.
+   uint8_t kind;
+   uint8_t follows;
+   uint8_t id;
+   uint16_t value;
+}} cx_sc_number_word_t;
+
+#define CX_SC_NUMBER_WORD_MAX_LEN {max_len}
+
+// A perfect hash table of number words, keyed by their first 8 bytes and their length.
+static const cx_sc_number_word_t cx_sc_number_words[{1 << table_bits}] = {{
+"""
+   for slot, word in enumerate(slots):
+      if word is None:
+         continue
+      string, ident, value, kind = word
+      flag, follows = number_word_kinds[kind]
+      follows = " | ".join(f"cx_sc_{k}" for k in follows) or "0"
+      loads = ", ".join(f"0x{load64(string, offset):016x}u" for offset in (0, 8, 16))
+      result += f"""   [{slot}] = {{ /* '{string.decode("UTF-8")}' */
+      .bytes = {{ {loads} }},
+      .len = {len(string)},
+      .kind = cx_sc_{kind},
+      .follows = {follows},
+      .id = cx_sc_id_{ident},
+      .value = {value},
+   }},
+"""
+   result += "};\n\n"
+
+   def prefix_mask(n):
+      n = max(0, min(n, 8))
+      mask = bytes([0xFF] * n + [0] * (8 - n))
+      return struct.unpack("<Q" if args.endianness == "little" else ">Q", mask)[0]
+
+   result += "// The masks of each word length's bytes, in each of the 8-byte parts of a word.\n"
+   result += f"static const uint64_t cx_sc_number_word_masks[{max_len + 1}][3] = {{\n"
+   for n in range(max_len + 1):
+      masks = ", ".join(f"0x{prefix_mask(n - offset):016x}u" for offset in (0, 8, 16))
+      result += f"   {{ {masks} }},\n"
+   result += "};\n\n"
+
+   result += f"""\
+// Looks up the number word that's exactly `len` bytes long at `input`, where `len` is between 1
+// and `CX_SC_NUMBER_WORD_MAX_LEN`. At least 24 bytes must be readable at `input`. Returns `NULL`
+// if the bytes aren't a number word.
+static cx_inline const cx_sc_number_word_t *
+cx_sc_find_number_word(const uint8_t *input, size_t len)
+{{
+   const uint64_t *masks = cx_sc_number_word_masks[len];
+   uint64_t prefix = cx_sc_load64(input) & masks[0];
+   const cx_sc_number_word_t *word =
+      &cx_sc_number_words[((prefix ^ len) * 0x{multiplier:016x}u) >> {64 - table_bits}];
+   uint64_t diff = (prefix ^ word->bytes[0]) |
+      ((cx_sc_load64(&input[8]) ^ word->bytes[1]) & masks[1]) |
+      ((cx_sc_load64(&input[16]) ^ word->bytes[2]) & masks[2]);
+   return cx_sc_count(word->id, diff == 0 && word->len == len) ? word : NULL;
+}}
+"""
+   return result
+
 in_file_name = args.in_file_name
 out_file_name = args.out_file_name
 
+strconsts = {}
 with open(in_file_name, "r") as in_file:
    for line in in_file.read().splitlines():
       pair = line.split(' ')
-      generated += generate_code_for_strconst(pair[0], pair[1])
-      generated += "\n"
+      strconsts[pair[0]] = pair[1]
+
+generated += generate_counters(strconsts.keys())
+for ident, string in strconsts.items():
+   generated += generate_code_for_strconst(ident, string)
+   generated += "\n"
+
+generated += generate_group_matchers(read_profile(args.profile))
+generated += generate_number_word_table(strconsts)
 
 with open(out_file_name, "w") as out_file:
    out_file.write(generated)
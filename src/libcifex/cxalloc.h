@@ -0,0 +1,15 @@
+#ifndef LIBCIFEX_ALLOC_H
+#define LIBCIFEX_ALLOC_H
+
+#include "public/libcifex.h"
+
+// Tags the next allocation made with the allocator.
+static inline void
+cx_tag_next_alloc(cifex_allocator_t *allocator, cifex_alloc_tag_t tag)
+{
+   if (allocator->tag != NULL) {
+      allocator->tag(allocator, tag);
+   }
+}
+
+#endif
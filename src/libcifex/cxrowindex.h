@@ -0,0 +1,53 @@
+#ifndef LIBCIFEX_ROW_INDEX_H
+#define LIBCIFEX_ROW_INDEX_H
+
+#include "public/libcifex.h"
+
+#include <stdint.h>
+
+// Returns the number of entries in the row index of an image `height` rows tall.
+static inline uint32_t
+cx_row_index_entries(uint32_t height, uint32_t stride)
+{
+   return height / stride + (height % stride != 0);
+}
+
+// Records the dimensions of the indexed image, and allocates the index's entries. Any entries left
+// over from indexing another image are freed first.
+static inline cifex_result_t
+cx_begin_row_index(
+   cifex_row_index_t *index,
+   uint32_t width,
+   uint32_t height,
+   cifex_channels_t channels)
+{
+   cifex_free_row_index(index);
+
+   uint32_t row_count = cx_row_index_entries(height, index->stride);
+   if (row_count != 0 && SIZE_MAX / row_count < sizeof(cifex_row_offset_t)) {
+      return cifex_image_too_large;
+   }
+   if (row_count > 0) {
+      index->rows = cifex_alloc(index->allocator, row_count * sizeof(cifex_row_offset_t));
+      if (index->rows == NULL) {
+         return cifex_out_of_memory;
+      }
+   }
+   index->row_count = row_count;
+   index->width = width;
+   index->height = height;
+   index->channels = channels;
+
+   return cifex_ok;
+}
+
+// Records where the `y`th row starts, if it's one of the rows kept in the index.
+static inline void
+cx_record_row(cifex_row_index_t *index, uint32_t y, uint64_t position, uint64_t line)
+{
+   if (y % index->stride == 0) {
+      index->rows[y / index->stride] = (cifex_row_offset_t){ .position = position, .line = line };
+   }
+}
+
+#endif
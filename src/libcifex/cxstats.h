@@ -0,0 +1,195 @@
+#ifndef LIBCIFEX_STATS_H
+#define LIBCIFEX_STATS_H
+
+#include "public/libcifex.h"
+
+#include "cxtime.h"
+
+// Statistics are gathered by wrapping the reader, writer, and allocator given to the library with
+// ones that count the calls made through them. The wrappers are only put in place when statistics
+// were asked for, so runs without them take the exact same code paths as before.
+
+// Adds the time elapsed since `*phase_start` to the given phase's time, and starts the next phase.
+static inline void
+cx_end_phase(uint64_t *phase_start, uint64_t *phase_ns)
+{
+   uint64_t now = cx_now_ns();
+   *phase_ns += now - *phase_start;
+   *phase_start = now;
+}
+
+// Ends the current phase if statistics are being gathered.
+#define cx_stats_phase(stats, phase_start, phase) \
+ if ((stats) != NULL) \
+ cx_end_phase(&(phase_start), &(stats)->phase)
+
+// A reader counting the bytes read through it.
+typedef struct cx_counting_reader
+{
+   cifex_reader_t reader;
+   cifex_reader_t *inner;
+   cifex_stats_t *stats;
+} cx_counting_reader_t;
+
+static inline size_t
+cx_counting_read(cifex_reader_t *reader, void *out, size_t n_bytes)
+{
+   cx_counting_reader_t *counting = reader->user_data;
+   size_t n_read = counting->inner->read(counting->inner, out, n_bytes);
+   counting->stats->bytes_read += n_read;
+   ++counting->stats->read_calls;
+   return n_read;
+}
+
+static inline int
+cx_counting_seek(cifex_reader_t *reader, long offset, int whence)
+{
+   cx_counting_reader_t *counting = reader->user_data;
+   return counting->inner->seek(counting->inner, offset, whence);
+}
+
+static inline long
+cx_counting_tell(cifex_reader_t *reader)
+{
+   cx_counting_reader_t *counting = reader->user_data;
+   return counting->inner->tell(counting->inner);
+}
+
+// Wraps `inner` in a counting reader. `out_counting` must not be moved while the reader is in use.
+static inline cifex_reader_t *
+cx_counting_reader(cx_counting_reader_t *out_counting, cifex_reader_t *inner, cifex_stats_t *stats)
+{
+   *out_counting = (cx_counting_reader_t){
+      .reader = {
+         .user_data = out_counting,
+         .read = cx_counting_read,
+         // Seeking is only forwarded when the inner reader supports it, so that unseekable readers
+         // stay unseekable.
+         .seek = inner->seek != NULL ? cx_counting_seek : NULL,
+         .tell = inner->tell != NULL ? cx_counting_tell : NULL,
+      },
+      .inner = inner,
+      .stats = stats,
+   };
+   return &out_counting->reader;
+}
+
+// A writer counting the bytes written through it, and the time spent writing them.
+typedef struct cx_counting_writer
+{
+   cifex_writer_t writer;
+   cifex_writer_t *inner;
+   cifex_stats_t *stats;
+} cx_counting_writer_t;
+
+static inline size_t
+cx_counting_write(cifex_writer_t *writer, const void *in, size_t n_bytes)
+{
+   cx_counting_writer_t *counting = writer->user_data;
+   uint64_t start = cx_now_ns();
+   size_t n_written = counting->inner->write(counting->inner, in, n_bytes);
+   counting->stats->write_ns += cx_now_ns() - start;
+   counting->stats->bytes_written += n_written;
+   ++counting->stats->write_calls;
+   return n_written;
+}
+
+// Wraps `inner` in a counting writer. `out_counting` must not be moved while the writer is in use.
+static inline cifex_writer_t *
+cx_counting_writer(cx_counting_writer_t *out_counting, cifex_writer_t *inner, cifex_stats_t *stats)
+{
+   *out_counting = (cx_counting_writer_t){
+      .writer = { .user_data = out_counting, .write = cx_counting_write },
+      .inner = inner,
+      .stats = stats,
+   };
+   return &out_counting->writer;
+}
+
+// An allocator counting the allocations made through it.
+//
+// Unlike the tracking allocator, this doesn't add anything to the allocations, so memory allocated
+// with it can be freed with the inner allocator. That's what lets the decoder hand the image it
+// allocated over to the caller, with the image's allocator set back to the inner one.
+typedef struct cx_counting_allocator
+{
+   // This must remain the first field, as the callbacks cast the allocator pointer back to the
+   // counting allocator.
+   cifex_allocator_t allocator;
+   cifex_allocator_t *inner;
+   cifex_stats_t *stats;
+} cx_counting_allocator_t;
+
+static inline void
+cx_count_alloc(cx_counting_allocator_t *counting, void *ptr, size_t size)
+{
+   if (ptr != NULL) {
+      ++counting->stats->alloc_count;
+      counting->stats->alloc_bytes += size;
+   }
+}
+
+static inline void *
+cx_counting_malloc(cifex_allocator_t *allocator, size_t size)
+{
+   cx_counting_allocator_t *counting = (cx_counting_allocator_t *)allocator;
+   void *ptr = counting->inner->malloc(counting->inner, size);
+   cx_count_alloc(counting, ptr, size);
+   return ptr;
+}
+
+static inline void
+cx_counting_free(cifex_allocator_t *allocator, void *ptr)
+{
+   cx_counting_allocator_t *counting = (cx_counting_allocator_t *)allocator;
+   counting->inner->free(counting->inner, ptr);
+}
+
+static inline void *
+cx_counting_realloc(cifex_allocator_t *allocator, void *ptr, size_t old_size, size_t new_size)
+{
+   cx_counting_allocator_t *counting = (cx_counting_allocator_t *)allocator;
+   void *new_ptr = counting->inner->realloc(counting->inner, ptr, old_size, new_size);
+   cx_count_alloc(counting, new_ptr, new_size);
+   return new_ptr;
+}
+
+static inline void *
+cx_counting_aligned_alloc(cifex_allocator_t *allocator, size_t alignment, size_t size)
+{
+   cx_counting_allocator_t *counting = (cx_counting_allocator_t *)allocator;
+   void *ptr = counting->inner->aligned_alloc(counting->inner, alignment, size);
+   cx_count_alloc(counting, ptr, size);
+   return ptr;
+}
+
+static inline void
+cx_counting_tag(cifex_allocator_t *allocator, cifex_alloc_tag_t tag)
+{
+   cx_counting_allocator_t *counting = (cx_counting_allocator_t *)allocator;
+   counting->inner->tag(counting->inner, tag);
+}
+
+// Wraps `inner` in a counting allocator. The optional functions are only provided when the inner
+// allocator provides them, so that the fallbacks used for `inner` are used for the wrapper too.
+static inline cifex_allocator_t *
+cx_counting_allocator(
+   cx_counting_allocator_t *out_counting,
+   cifex_allocator_t *inner,
+   cifex_stats_t *stats)
+{
+   *out_counting = (cx_counting_allocator_t){
+      .allocator = {
+         .malloc = cx_counting_malloc,
+         .free = cx_counting_free,
+         .realloc = inner->realloc != NULL ? cx_counting_realloc : NULL,
+         .aligned_alloc = inner->aligned_alloc != NULL ? cx_counting_aligned_alloc : NULL,
+         .tag = inner->tag != NULL ? cx_counting_tag : NULL,
+      },
+      .inner = inner,
+      .stats = stats,
+   };
+   return &out_counting->allocator;
+}
+
+#endif
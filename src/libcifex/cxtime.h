@@ -0,0 +1,20 @@
+#ifndef LIBCIFEX_TIME_H
+#define LIBCIFEX_TIME_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Returns the current time of a monotonic clock, in nanoseconds.
+static inline uint64_t
+cx_now_ns(void)
+{
+   struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+   timespec_get(&ts, TIME_UTC);
+#endif
+   return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+#endif
@@ -4,4 +4,22 @@
 #define cx_min(a, b) a < b ? a : b
 #define cx_max(a, b) a < b ? b : a
 
+#include <stdint.h>
+
+// Returns the index of the lowest set bit in `x`, which must not be zero.
+static inline int
+cx_ctz64(uint64_t x)
+{
+#ifdef __GNUC__
+   return __builtin_ctzll(x);
+#else
+   int n = 0;
+   while ((x & 1) == 0) {
+      x >>= 1;
+      ++n;
+   }
+   return n;
+#endif
+}
+
 #endif
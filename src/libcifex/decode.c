@@ -1,26 +1,113 @@
 #include "public/libcifex.h"
 
 #include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#include "cxalloc.h"
 #include "cxcompilers.h"
 #include "cxensure.h"
+#include "cxrowindex.h"
 #include "cxstrconsts.h"
+#include "cxstats.h"
 #include "cxstrings.h"
+#include "cxutil.h"
 
 #define CX_MAX_PATTERN_LEN 32
 
+// The size of the first buffer allocated for readers that don't support seeking.
+#define CX_READ_CHUNK_SIZE 65536
+
+// Reads all the data from a reader that doesn't support seeking, growing the buffer as data comes
+// in. The buffer never grows much larger than `max_size`, since reading stops right after the
+// input is found to be larger than that.
+static cifex_result_t
+cx_read_all_unseekable(
+   cifex_reader_t *reader,
+   cifex_allocator_t *allocator,
+   size_t max_size,
+   uint8_t **out_buffer_ptr,
+   size_t *out_buffer_len)
+{
+   size_t capacity = CX_READ_CHUNK_SIZE;
+   size_t len = 0;
+   cx_tag_next_alloc(allocator, cifex_tag_input_buffer);
+   uint8_t *buffer = cifex_alloc(allocator, capacity);
+   if (buffer == NULL) {
+      return cifex_out_of_memory;
+   }
+
+   while (true) {
+      if (capacity - len <= CX_MAX_PATTERN_LEN) {
+         if (capacity > SIZE_MAX / 2) {
+            cifex_free(allocator, buffer);
+            return cifex_out_of_memory;
+         }
+         size_t new_capacity = capacity * 2;
+         if (max_size <= SIZE_MAX / 2) {
+            new_capacity = (cx_min(new_capacity, max_size + 1 + CX_MAX_PATTERN_LEN));
+         }
+         cx_tag_next_alloc(allocator, cifex_tag_input_buffer);
+         uint8_t *grown = cifex_realloc(allocator, buffer, capacity, new_capacity);
+         if (grown == NULL) {
+            cifex_free(allocator, buffer);
+            return cifex_out_of_memory;
+         }
+         buffer = grown;
+         capacity = new_capacity;
+      }
+
+      errno = 0;
+      size_t n_read = reader->read(reader, &buffer[len], capacity - len - CX_MAX_PATTERN_LEN);
+      len += n_read;
+      if (len > max_size) {
+         cifex_free(allocator, buffer);
+         return cifex_input_too_large;
+      }
+      if (n_read == 0) {
+         if (errno != 0) {
+            cifex_free(allocator, buffer);
+            return cifex_errno_result(errno);
+         }
+         break;
+      }
+   }
+
+   memset(&buffer[len], 0, CX_MAX_PATTERN_LEN);
+   *out_buffer_ptr = buffer;
+   *out_buffer_len = len;
+
+   return cifex_ok;
+}
+
 // Reads all the data from the reader, and allocates it into a buffer.
+//
+// If the reader supports seeking, the buffer is allocated up front with the right size and aligned
+// to `CIFEX_BUFFER_ALIGNMENT`. Otherwise it is grown using `cifex_realloc`, and `*out_aligned` is
+// set to `false`.
+//
+// In both cases the buffer is padded with `CX_MAX_PATTERN_LEN` zeroes, so that patterns can be
+// matched without bounds checks. Inputs larger than `max_size` are rejected.
 static cifex_result_t
 cx_read_all(
    cifex_reader_t *reader,
    cifex_allocator_t *allocator,
+   size_t max_size,
    uint8_t **out_buffer_ptr,
-   size_t *out_buffer_len)
+   size_t *out_buffer_len,
+   bool *out_aligned)
 {
    long file_size;
+   if (reader->seek == NULL || reader->tell == NULL) {
+      *out_aligned = false;
+      return cx_read_all_unseekable(reader, allocator, max_size, out_buffer_ptr, out_buffer_len);
+   }
    if (reader->seek(reader, 0, SEEK_END) != 0) {
       return cifex_errno_result(errno);
    }
@@ -30,23 +117,54 @@ cx_read_all(
    if (reader->seek(reader, 0, SEEK_SET) != 0) {
       return cifex_errno_result(errno);
    }
+   if ((uint64_t)file_size > max_size) {
+      return cifex_input_too_large;
+   }
 
-   uint8_t *buffer = cifex_alloc(allocator, (size_t)file_size + CX_MAX_PATTERN_LEN);
+   cx_tag_next_alloc(allocator, cifex_tag_input_buffer);
+   uint8_t *buffer = cifex_aligned_alloc(
+      allocator, CIFEX_BUFFER_ALIGNMENT, (size_t)file_size + CX_MAX_PATTERN_LEN);
    if (buffer == NULL) {
       return cifex_out_of_memory;
    }
 
    errno = 0;
-   if (reader->read(reader, buffer, (size_t)file_size) < file_size && errno != 0) {
+   size_t n_read = reader->read(reader, buffer, (size_t)file_size);
+   if (n_read < (size_t)file_size && errno != 0) {
+      cifex_free_aligned(allocator, buffer);
       return cifex_errno_result(errno);
    }
+   memset(&buffer[n_read], 0, CX_MAX_PATTERN_LEN);
 
    *out_buffer_ptr = buffer;
-   *out_buffer_len = file_size;
+   *out_buffer_len = n_read;
+   *out_aligned = true;
 
    return cifex_ok;
 }
 
+// Frees a buffer allocated by `cx_read_all`.
+static void
+cx_free_input(cifex_allocator_t *allocator, uint8_t *buffer, bool aligned)
+{
+   if (aligned) {
+      cifex_free_aligned(allocator, buffer);
+   } else {
+      cifex_free(allocator, buffer);
+   }
+}
+
+// In streaming mode, the amount of bytes the decoder makes available past the current position
+// after every run of white space or line feeds. Each token is preceded by such a run and is much
+// shorter than this, so tokens never cross the end of the window.
+#define CX_DEC_LOOKAHEAD 256
+
+// The smallest window the decoder will stream through.
+#define CX_MIN_STREAM_BUFFER_SIZE (4 * CX_DEC_LOOKAHEAD)
+
+// The window used by `cifex_decode_band` when no window size is given.
+#define CX_BAND_STREAM_BUFFER_SIZE 65536
+
 // The decoder state.
 typedef struct cx_decoder
 {
@@ -54,12 +172,173 @@ typedef struct cx_decoder
    size_t buffer_len;
    size_t position;
    size_t line;
+
+   // In streaming mode, `buffer` is a window of `capacity` bytes that's refilled from `reader`.
+   // Otherwise it holds the entire input, `reader` is `NULL`, and `eof` is always `true`.
+   cifex_reader_t *reader;
+   cifex_allocator_t *allocator;
+   size_t capacity;
+   // The offset of `buffer[0]` in the input.
+   size_t consumed;
+   bool eof;
+   // Whether the last read returned less than was asked for. With pipes and sockets, that means the
+   // rest of the input hasn't arrived yet, so the decoder parses what it has before waiting for it.
+   bool short_read;
+   // The `errno` of a failed read, or `0`.
+   int read_error;
+   // In streaming mode, how many more pixels the pixel parsers are going to parse or skip. The line
+   // feeds after the last one are matched without looking ahead, so that an image is done as soon
+   // as it has arrived, rather than when the input following it does.
+   uint64_t pixels_left;
+
+   // Where progress is reported to, and the flag cancelling decoding. Both are optional.
+   cifex_progress_t *progress;
+   const atomic_bool *cancel;
+   // Whether decoding was stopped by the cancellation flag or by the progress callback.
+   bool stopped;
+
+   // The offset of the image's first byte in the input, and the limits on the input, with `0`s
+   // replaced by `SIZE_MAX`. In streaming mode, reading stops one byte past `max_input_size`, so
+   // that an image going over the limit can be told apart from one ending right at it.
+   // `at_input_limit` is set if that's what `eof` was set for.
+   size_t image_start;
+   size_t max_input_size;
+   size_t max_line_length;
+   bool at_input_limit;
 } cx_decoder_t;
 
 #define cx_dec_try(expr) \
  if (!(expr)) \
   return cifex_syntax_error;
 
+// Discards the already parsed part of the window, and reads more data into the rest of it. Only one
+// read is made, so this returns as soon as the reader has some data. Returns whether any new data
+// was read.
+static bool
+cx_dec_refill(cx_decoder_t *dec)
+{
+   size_t remaining = dec->buffer_len - dec->position;
+   memmove(dec->buffer, &dec->buffer[dec->position], remaining);
+   dec->consumed += dec->position;
+   dec->position = 0;
+   dec->buffer_len = remaining;
+
+   bool read_any = false;
+   if (dec->buffer_len < dec->capacity) {
+      size_t n_wanted = dec->capacity - dec->buffer_len;
+      size_t n_left = SIZE_MAX;
+      if (dec->max_input_size != SIZE_MAX) {
+         n_left = dec->max_input_size + 1 - (dec->consumed + dec->buffer_len - dec->image_start);
+      }
+      if (n_left == 0) {
+         dec->eof = true;
+         dec->at_input_limit = true;
+      } else {
+         n_wanted = cx_min(n_wanted, n_left);
+         errno = 0;
+         size_t n_read = dec->reader->read(dec->reader, &dec->buffer[dec->buffer_len], n_wanted);
+         if (n_read == 0) {
+            dec->eof = true;
+            dec->read_error = errno;
+         }
+         dec->buffer_len += n_read;
+         dec->short_read = n_read < n_wanted;
+         read_any = n_read > 0;
+      }
+   }
+   memset(&dec->buffer[dec->buffer_len], 0, CX_MAX_PATTERN_LEN);
+
+   return read_any;
+}
+
+// Makes sure at least `n` bytes are available past the current position, unless the end of the
+// input is reached. Returns whether any new data was read.
+//
+// After a short read, this only waits for more data if the rest of the current line hasn't arrived
+// yet. No token spans a line feed, so the line can be parsed up to its end without the lookahead.
+static cx_inline bool
+cx_dec_ensure(cx_decoder_t *dec, size_t n)
+{
+   size_t available = dec->buffer_len - dec->position;
+   if (available >= n || dec->eof) {
+      return false;
+   }
+   bool read_any = false;
+   while (
+      available < n && available < dec->capacity && !dec->eof &&
+      !(dec->short_read && memchr(&dec->buffer[dec->position], '\n', available) != NULL)) {
+      read_any |= cx_dec_refill(dec);
+      available = dec->buffer_len;
+   }
+   return read_any;
+}
+
+// Returns whether the decoder streams its input through a window.
+static cx_inline bool
+cx_dec_streaming(const cx_decoder_t *dec)
+{
+   return dec->reader != NULL;
+}
+
+// Makes sure the rest of the line starting at the offset `line_start` of the input is inside the
+// window, growing the window if the line does not fit.
+static cifex_result_t
+cx_dec_ensure_line(cx_decoder_t *dec, size_t line_start)
+{
+   size_t scanned = 0;
+   while (
+      !dec->eof &&
+      memchr(
+         &dec->buffer[dec->position + scanned],
+         '\n',
+         dec->buffer_len - dec->position - scanned) == NULL) {
+      if (dec->consumed + dec->buffer_len - line_start > dec->max_line_length) {
+         return cifex_line_too_long;
+      }
+      scanned = dec->buffer_len - dec->position;
+      if (dec->position == 0 && dec->buffer_len == dec->capacity) {
+         if (dec->capacity > SIZE_MAX / 2 - CX_MAX_PATTERN_LEN) {
+            return cifex_out_of_memory;
+         }
+         cx_tag_next_alloc(dec->allocator, cifex_tag_input_buffer);
+         uint8_t *grown = cifex_realloc(
+            dec->allocator,
+            dec->buffer,
+            dec->capacity + CX_MAX_PATTERN_LEN,
+            dec->capacity * 2 + CX_MAX_PATTERN_LEN);
+         if (grown == NULL) {
+            return cifex_out_of_memory;
+         }
+         dec->buffer = grown;
+         dec->capacity *= 2;
+      }
+      cx_dec_refill(dec);
+   }
+
+   return cifex_ok;
+}
+
+// Moves a streaming decoder to the given position and line of its input, discarding the window.
+static cifex_result_t
+cx_dec_seek(cx_decoder_t *dec, uint64_t position, uint64_t line)
+{
+   if (position > LONG_MAX) {
+      return cifex_errno_result(EOVERFLOW);
+   }
+   if (dec->reader->seek(dec->reader, (long)position, SEEK_SET) != 0) {
+      return cifex_errno_result(errno);
+   }
+   dec->consumed = position;
+   dec->position = 0;
+   dec->buffer_len = 0;
+   dec->line = line;
+   dec->eof = false;
+   dec->short_read = false;
+   cx_dec_ensure(dec, CX_DEC_LOOKAHEAD);
+
+   return cifex_ok;
+}
+
 // Matches a single character.
 static cx_inline bool
 cx_dec_match(cx_decoder_t *dec, uint8_t byte)
@@ -71,9 +350,9 @@ cx_dec_match(cx_decoder_t *dec, uint8_t byte)
    return true;
 }
 
-// Matches one or more of the provided character.
+// Matches a run of the provided character, without refilling the window.
 static cx_inline size_t
-cx_dec_match_one_or_more(cx_decoder_t *dec, uint8_t byte)
+cx_dec_match_run(cx_decoder_t *dec, uint8_t byte)
 {
    size_t matched = 0;
    while (cx_dec_match(dec, byte)) {
@@ -82,18 +361,35 @@ cx_dec_match_one_or_more(cx_decoder_t *dec, uint8_t byte)
    return matched;
 }
 
+// Matches one or more of the provided character.
+//
+// In streaming mode, this refills the window so that the next token can be matched. The pixel
+// parsers pass `streaming` as a constant, so that whole-file decoding, where the window never
+// refills, doesn't check for it after every word.
+static cx_inline size_t
+cx_dec_match_one_or_more(cx_decoder_t *dec, uint8_t byte, bool streaming)
+{
+   size_t matched = cx_dec_match_run(dec, byte);
+   if (streaming) {
+      while (cx_dec_ensure(dec, CX_DEC_LOOKAHEAD)) {
+         matched += cx_dec_match_run(dec, byte);
+      }
+   }
+   return matched;
+}
+
 // Matches white space.
 static cx_inline bool
-cx_dec_match_ws(cx_decoder_t *dec)
+cx_dec_match_ws(cx_decoder_t *dec, bool streaming)
 {
-   return cx_dec_match_one_or_more(dec, ' ');
+   return cx_dec_match_one_or_more(dec, ' ', streaming);
 }
 
 // Matches a line feed.
 static cx_inline bool
-cx_dec_match_lf(cx_decoder_t *dec)
+cx_dec_match_lf(cx_decoder_t *dec, bool streaming)
 {
-   size_t line_breaks = cx_dec_match_one_or_more(dec, '\n');
+   size_t line_breaks = cx_dec_match_one_or_more(dec, '\n', streaming);
    dec->line += line_breaks;
    return line_breaks > 0;
 }
@@ -111,18 +407,32 @@ cx_dec_match_strconst__impl(cx_decoder_t *dec, size_t len, bool (*match)(const u
 #define cx_dec_match_strconst(dec, strconst) \
  cx_dec_match_strconst__impl(dec, cx_sc_##strconst##_len, cx_sc_##strconst##_match)
 
+// Matches one of a group of number words, using one of the generated `cx_sc_match_*` functions.
+// Returns the word's value, or 0 if none of the words matched.
+static cx_inline uint32_t
+cx_dec_match_number_group(cx_decoder_t *dec, uint32_t (*match)(const uint8_t *, size_t *))
+{
+   size_t len;
+   uint32_t value = match(&dec->buffer[dec->position], &len);
+   if (value != 0) {
+      dec->position += len;
+   }
+   return value;
+}
+
 // Parses a number.
+//
+// Whitespace after the hundreds or tens is consumed speculatively; if no further words follow it,
+// `*out_trailing_ws` is set to `true`.
 static cx_inline bool
-cx_dec_parse_number_up_to_hundreds__inline(cx_decoder_t *dec, uint32_t *out_number)
+cx_dec_parse_number_up_to_hundreds__inline(
+   cx_decoder_t *dec,
+   uint32_t *out_number,
+   bool *out_trailing_ws,
+   bool streaming)
 {
-   // NOTE(liquidev): Yes, this function is a giant chain of if-else statements, but there are a few
-   // things that are keeping it from becoming less terrible:
-   //  - such chains combined with cx_dec_match_string being always_inline, generates the fastest
-   //    possible assembly
-   //  - C has no sugar for such repeated if-elses so we're largely stuck with this unless somebody
-   //    comes (haha) in and creates a code generator for this, which I think is more trouble than
-   //    it's worth.
-   // Had I used a more modern language like Zig this wouldn't be a problem, but alas, here we are.
+   // The words of each group are tried one after another by generated chains of comparisons.
+   // Their order within a group comes from the profile given to `generate_strconsts.py`, if any.
 
    // Check for zero.
    if (cx_dec_match_strconst(dec, zero)) {
@@ -130,166 +440,169 @@ cx_dec_parse_number_up_to_hundreds__inline(cx_decoder_t *dec, uint32_t *out_numb
    }
 
    // Check for hundreds.
-   bool hundreds = true;
-   if (cx_dec_match_strconst(dec, one_hundred)) {
-      *out_number += 100;
-   } else if (cx_dec_match_strconst(dec, two_hundred)) {
-      *out_number += 200;
-   } else if (cx_dec_match_strconst(dec, three_hundred)) {
-      *out_number += 300;
-   } else if (cx_dec_match_strconst(dec, four_hundred)) {
-      *out_number += 400;
-   } else if (cx_dec_match_strconst(dec, five_hundred)) {
-      *out_number += 500;
-   } else if (cx_dec_match_strconst(dec, six_hundred)) {
-      *out_number += 600;
-   } else if (cx_dec_match_strconst(dec, seven_hundred)) {
-      *out_number += 700;
-   } else if (cx_dec_match_strconst(dec, eight_hundred)) {
-      *out_number += 800;
-   } else if (cx_dec_match_strconst(dec, nine_hundred)) {
-      *out_number += 900;
-   } else {
-      hundreds = false;
-   }
-   if (hundreds && !cx_dec_match_ws(dec)) {
+   uint32_t hundreds = cx_dec_match_number_group(dec, cx_sc_match_hundreds);
+   *out_number += hundreds;
+   if (hundreds != 0 && !cx_dec_match_ws(dec, streaming)) {
       return true;
    }
 
    // Check for ten and n-teens.
-   bool nteens = true;
-   if (cx_dec_match_strconst(dec, ten)) {
-      *out_number += 10;
-   } else if (cx_dec_match_strconst(dec, eleven)) {
-      *out_number += 11;
-   } else if (cx_dec_match_strconst(dec, twelve)) {
-      *out_number += 12;
-   } else if (cx_dec_match_strconst(dec, thirteen)) {
-      *out_number += 13;
-   } else if (cx_dec_match_strconst(dec, fourteen)) {
-      *out_number += 14;
-   } else if (cx_dec_match_strconst(dec, fifteen)) {
-      *out_number += 15;
-   } else if (cx_dec_match_strconst(dec, sixteen)) {
-      *out_number += 16;
-   } else if (cx_dec_match_strconst(dec, seventeen)) {
-      *out_number += 17;
-   } else if (cx_dec_match_strconst(dec, eighteen)) {
-      *out_number += 18;
-   } else if (cx_dec_match_strconst(dec, nineteen)) {
-      *out_number += 19;
-   } else {
-      nteens = false;
-   }
+   uint32_t nteens = cx_dec_match_number_group(dec, cx_sc_match_teens);
    // If a match was found, there can't be any words afterwards.
-   if (nteens) {
+   if (nteens != 0) {
+      *out_number += nteens;
       return true;
    }
 
    // Check for tens.
-   bool tens = true;
-   if (cx_dec_match_strconst(dec, twenty)) {
-      *out_number += 20;
-   } else if (cx_dec_match_strconst(dec, thirty)) {
-      *out_number += 30;
-   } else if (cx_dec_match_strconst(dec, fourty)) {
-      *out_number += 40;
-   } else if (cx_dec_match_strconst(dec, fifty)) {
-      *out_number += 50;
-   } else if (cx_dec_match_strconst(dec, sixty)) {
-      *out_number += 60;
-   } else if (cx_dec_match_strconst(dec, seventy)) {
-      *out_number += 70;
-   } else if (cx_dec_match_strconst(dec, eighty)) {
-      *out_number += 80;
-   } else if (cx_dec_match_strconst(dec, ninety)) {
-      *out_number += 90;
-   } else {
-      tens = false;
-   }
-   if (tens && !cx_dec_match_ws(dec)) {
+   uint32_t tens = cx_dec_match_number_group(dec, cx_sc_match_tens);
+   *out_number += tens;
+   if (tens != 0 && !cx_dec_match_ws(dec, streaming)) {
       return true;
    }
 
    // Check for ones.
-   if (cx_dec_match_strconst(dec, one)) {
-      *out_number += 1;
-   } else if (cx_dec_match_strconst(dec, two)) {
-      *out_number += 2;
-   } else if (cx_dec_match_strconst(dec, three)) {
-      *out_number += 3;
-   } else if (cx_dec_match_strconst(dec, four)) {
-      *out_number += 4;
-   } else if (cx_dec_match_strconst(dec, five)) {
-      *out_number += 5;
-   } else if (cx_dec_match_strconst(dec, six)) {
-      *out_number += 6;
-   } else if (cx_dec_match_strconst(dec, seven)) {
-      *out_number += 7;
-   } else if (cx_dec_match_strconst(dec, eight)) {
-      *out_number += 8;
-   } else if (cx_dec_match_strconst(dec, nine)) {
-      *out_number += 9;
+   uint32_t ones = cx_dec_match_number_group(dec, cx_sc_match_ones);
+   *out_number += ones;
+   if (ones == 0) {
+      *out_trailing_ws = hundreds != 0 || tens != 0;
    }
 
    return *out_number != 0;
 }
 
+// Matches the name of thousands that agrees with the given amount.
+// For simplicity's sake, the plural forms are matched somewhat leniently.
+static cx_inline bool
+cx_dec_match_thousands(cx_decoder_t *dec, uint32_t amount)
+{
+   uint32_t ones = amount % 10;
+   return (amount == 1 && cx_dec_match_strconst(dec, thousand)) ||
+      (ones >= 2 && ones <= 4 && cx_dec_match_strconst(dec, thousands1)) ||
+      cx_dec_match_strconst(dec, thousands2);
+}
+
+// Matches the name of millions that agrees with the given amount.
+static cx_inline bool
+cx_dec_match_millions(cx_decoder_t *dec, uint32_t amount)
+{
+   uint32_t ones = amount % 10;
+   // "milion" is a prefix of the other two forms, so it must only be tried for an amount of 1.
+   return (amount == 1 && cx_dec_match_strconst(dec, million)) ||
+      (amount != 1 && ones >= 2 && ones <= 4 && cx_dec_match_strconst(dec, millions1)) ||
+      (amount != 1 && cx_dec_match_strconst(dec, millions2));
+}
+
+// Parses a number up to 999 999 999.
+//
+// The number consists of up to three groups: millions, thousands, and the rest. Each group is a
+// number up to the hundreds, followed by the name of its scale.
 static bool
 cx_dec_parse_number(cx_decoder_t *dec, uint32_t *out_number)
 {
-   // Use a temporary variable to avoid pointer indirections.
+   // Use temporary variables to avoid pointer indirections.
    // The calls to `cx_dec_parse_number_up_to_hundreds` are inlined so the compiler will optimize
-   // the pointer away in its IR.
+   // the pointers away in its IR.
    uint32_t number = 0;
-   if (cx_dec_match_strconst(dec, thousand)) {
-      number = 1000;
-      if (!cx_dec_match_ws(dec)) {
+   uint32_t group = 0;
+   bool ws = false;
+   bool streaming = cx_dec_streaming(dec);
+
+   // Millions.
+   if (cx_dec_match_strconst(dec, million)) {
+      number = 1000000;
+      if (!cx_dec_match_ws(dec, streaming)) {
+         goto out;
+      }
+   } else if (cx_dec_parse_number_up_to_hundreds__inline(dec, &group, &ws, streaming)) {
+      if (!(ws || cx_dec_match_ws(dec, streaming))) {
+         number = group;
+         goto out;
+      }
+      if (!cx_dec_match_millions(dec, group)) {
+         // The group we just parsed is not millions; it could still be thousands though.
+         goto thousands_name;
+      }
+      number = group * 1000000;
+      group = 0;
+      if (!cx_dec_match_ws(dec, streaming)) {
          goto out;
       }
    }
-   bool ok = cx_dec_parse_number_up_to_hundreds__inline(dec, &number);
-   if (ok && cx_dec_match_ws(dec)) {
-      uint32_t ones = number % 10;
-      bool thousand = (number == 1 && cx_dec_match_strconst(dec, thousand)) ||
-         (ones >= 2 && ones <= 4 && cx_dec_match_strconst(dec, thousands1)) ||
-         cx_dec_match_strconst(dec, thousands2);
-      if (thousand) {
-         number *= 1000;
+
+   // Thousands.
+   if (cx_dec_match_strconst(dec, thousand)) {
+      number += 1000;
+      if (!cx_dec_match_ws(dec, streaming)) {
+         goto out;
       }
-      uint32_t rest = 0;
-      if (!thousand || cx_dec_match_ws(dec)) {
-         ok = cx_dec_parse_number_up_to_hundreds__inline(dec, &rest);
-         if (ok) {
-            number += rest;
-         }
+   } else {
+      ws = false;
+      if (
+         !cx_dec_parse_number_up_to_hundreds__inline(dec, &group, &ws, streaming) ||
+         !(ws || cx_dec_match_ws(dec, streaming))) {
+         number += group;
+         goto out;
+      }
+   thousands_name:
+      if (!cx_dec_match_thousands(dec, group)) {
+         number += group;
+         goto out;
+      }
+      number += group * 1000;
+      group = 0;
+      if (!cx_dec_match_ws(dec, streaming)) {
+         goto out;
       }
    }
 
+   // The rest.
+   cx_dec_parse_number_up_to_hundreds__inline(dec, &group, &ws, streaming);
+   number += group;
+
 out:
    *out_number = number;
    return true;
 }
 
-// Non-inline version of `cx_dec_parse_number_up_to_hundreds__inline`.
+// Non-inline versions of `cx_dec_parse_number_up_to_hundreds__inline`, for whole-file decoding
+// and for streaming.
+static bool
+cx_dec_parse_number_up_to_hundreds_whole(cx_decoder_t *dec, uint32_t *out_number)
+{
+   uint32_t number = 0;
+   bool trailing_ws = false;
+   bool ok = cx_dec_parse_number_up_to_hundreds__inline(dec, &number, &trailing_ws, false);
+   *out_number = number;
+   return ok;
+}
+
 static bool
-cx_dec_parse_number_up_to_hundreds(cx_decoder_t *dec, uint32_t *out_number)
+cx_dec_parse_number_up_to_hundreds_streaming(cx_decoder_t *dec, uint32_t *out_number)
 {
    uint32_t number = 0;
-   bool ok = cx_dec_parse_number_up_to_hundreds__inline(dec, &number);
+   bool trailing_ws = false;
+   bool ok = cx_dec_parse_number_up_to_hundreds__inline(dec, &number, &trailing_ws, true);
    *out_number = number;
    return ok;
 }
 
+static cx_inline bool
+cx_dec_parse_number_up_to_hundreds(cx_decoder_t *dec, uint32_t *out_number, bool streaming)
+{
+   return streaming ? cx_dec_parse_number_up_to_hundreds_streaming(dec, out_number)
+                    : cx_dec_parse_number_up_to_hundreds_whole(dec, out_number);
+}
+
 // Parses the `CIF: polish` flags.
 static cx_inline cifex_result_t
 cx_dec_parse_flags(cx_decoder_t *dec, cifex_flags_t *out_flags)
 {
    cx_dec_try(cx_dec_match_strconst(dec, k_header));
-   cx_dec_try(cx_dec_match_ws(dec));
+   cx_dec_try(cx_dec_match_ws(dec, cx_dec_streaming(dec)));
    // TODO: support for other flags, such as `english`, `compact`, `quadtree`.
    cx_dec_try(cx_dec_match_strconst(dec, flag_polish));
-   cx_dec_try(cx_dec_match_lf(dec));
+   cx_dec_try(cx_dec_match_lf(dec, cx_dec_streaming(dec)));
    *out_flags |= cifex_flag_polish;
 
    return cifex_ok;
@@ -300,51 +613,58 @@ static cx_inline cifex_result_t
 cx_dec_parse_version(cx_decoder_t *dec, uint32_t *out_version)
 {
    cx_dec_try(cx_dec_match_strconst(dec, k_version));
-   cx_dec_try(cx_dec_match_ws(dec));
+   cx_dec_try(cx_dec_match_ws(dec, cx_dec_streaming(dec)));
    cx_dec_try(cx_dec_parse_number(dec, out_version));
-   cx_dec_try(cx_dec_match_lf(dec));
+   cx_dec_try(cx_dec_match_lf(dec, cx_dec_streaming(dec)));
 
    return cifex_ok;
 }
 
-// Parses the `ROZMIAR` dimensions header and allocates memory in the provided image.
+// Parses the `ROZMIAR` dimensions header, rejecting images with more than `max_pixels` pixels.
 static cx_inline cifex_result_t
-cx_dec_parse_dimensions(cx_decoder_t *dec, cifex_image_t *out_image, cifex_allocator_t *allocator)
+cx_dec_parse_dimensions(
+   cx_decoder_t *dec,
+   uint64_t max_pixels,
+   uint32_t *out_width,
+   uint32_t *out_height,
+   cifex_channels_t *out_channels)
 {
-   uint32_t width, height;
    uint32_t bpp;
 
    cx_dec_try(cx_dec_match_strconst(dec, k_dimensions));
-   cx_dec_try(cx_dec_match_ws(dec));
+   cx_dec_try(cx_dec_match_ws(dec, cx_dec_streaming(dec)));
 
    cx_dec_try(cx_dec_match_strconst(dec, k_width));
-   cx_dec_try(cx_dec_match_ws(dec));
-   cx_dec_try(cx_dec_parse_number(dec, &width));
+   cx_dec_try(cx_dec_match_ws(dec, cx_dec_streaming(dec)));
+   cx_dec_try(cx_dec_parse_number(dec, out_width));
    cx_dec_try(cx_dec_match(dec, ','));
-   cx_dec_try(cx_dec_match_ws(dec));
+   cx_dec_try(cx_dec_match_ws(dec, cx_dec_streaming(dec)));
 
    cx_dec_try(cx_dec_match_strconst(dec, k_height));
-   cx_dec_try(cx_dec_match_ws(dec));
-   cx_dec_try(cx_dec_parse_number(dec, &height));
+   cx_dec_try(cx_dec_match_ws(dec, cx_dec_streaming(dec)));
+   cx_dec_try(cx_dec_parse_number(dec, out_height));
    cx_dec_try(cx_dec_match(dec, ','));
-   cx_dec_try(cx_dec_match_ws(dec));
+   cx_dec_try(cx_dec_match_ws(dec, cx_dec_streaming(dec)));
 
    cx_dec_try(cx_dec_match_strconst(dec, k_bpp));
-   cx_dec_try(cx_dec_match_ws(dec));
+   cx_dec_try(cx_dec_match_ws(dec, cx_dec_streaming(dec)));
    cx_dec_try(cx_dec_parse_number(dec, &bpp));
-   cx_dec_try(cx_dec_match_lf(dec));
-
-   cifex_channels_t channels = bpp / 8;
-   cifex_result_t result;
-   if ((result = cifex_alloc_image(out_image, allocator, width, height, channels)) != cifex_ok) {
-      return result;
+   if (bpp != 24 && bpp != 32) {
+      return cifex_invalid_bpp;
    }
+   if (max_pixels != 0 && (uint64_t)*out_width * *out_height > max_pixels) {
+      return cifex_too_many_pixels;
+   }
+   cx_dec_try(cx_dec_match_lf(dec, cx_dec_streaming(dec)));
+
+   *out_channels = bpp / 8;
 
    return cifex_ok;
 }
 
-// Parses a single metadata field.
-// This does not perform any allocations, but the output strings are NOT null-terminated.
+// Parses a single metadata field, up to but not including the line feed ending it.
+// This does not perform any allocations, but the output strings are NOT null-terminated, and they
+// point into the window, so they're only valid until the next line feed is matched.
 static cx_inline cifex_result_t
 cx_dec_parse_metadata_field(
    cx_decoder_t *dec,
@@ -353,22 +673,30 @@ cx_dec_parse_metadata_field(
    uint8_t **out_value,
    size_t *out_value_len)
 {
+   cifex_result_t result;
+   size_t line_start = dec->consumed + dec->position;
+
    cx_dec_try(cx_dec_match_strconst(dec, k_metadata));
-   cx_dec_try(cx_dec_match_ws(dec));
+   cx_dec_try(cx_dec_match_ws(dec, cx_dec_streaming(dec)));
+   if ((result = cx_dec_ensure_line(dec, line_start)) != cifex_ok) {
+      return result;
+   }
 
    size_t key_start = dec->position;
    while (dec->position < dec->buffer_len && dec->buffer[dec->position] != ' ') {
       ++dec->position;
    }
    size_t key_end = dec->position;
-   cx_dec_try(cx_dec_match_ws(dec));
+   cx_dec_try(cx_dec_match_run(dec, ' '));
 
    size_t value_start = dec->position;
    while (dec->position < dec->buffer_len && dec->buffer[dec->position] != '\n') {
       ++dec->position;
    }
    size_t value_end = dec->position;
-   cx_dec_try(cx_dec_match_lf(dec));
+   if (dec->consumed + value_end - line_start > dec->max_line_length) {
+      return cifex_line_too_long;
+   }
 
    *out_key = &dec->buffer[key_start];
    *out_key_len = key_end - key_start;
@@ -384,173 +712,1304 @@ cx_dec_parse_metadata_field(
 static cx_inline cifex_result_t
 cx_dec_parse_metadata(
    cx_decoder_t *dec,
+   const cifex_decode_limits_t *limits,
    cifex_image_info_t *out_image_info,
    cifex_allocator_t *allocator)
 {
+   cifex_result_t result;
    uint8_t *key, *value;
    size_t key_len, value_len;
-
-   if (allocator != NULL) {
-      while (cx_dec_parse_metadata_field(dec, &key, &key_len, &value, &value_len) == cifex_ok) {
+   size_t field_count = 0, size = 0;
+
+   while (
+      (result = cx_dec_parse_metadata_field(dec, &key, &key_len, &value, &value_len)) ==
+      cifex_ok) {
+      ++field_count;
+      size += key_len + value_len;
+      if (
+         (limits->max_metadata_fields != 0 && field_count > limits->max_metadata_fields) ||
+         (limits->max_metadata_size != 0 && size > limits->max_metadata_size)) {
+         return cifex_too_much_metadata;
+      }
+      if (allocator != NULL) {
          // Casting through the signedness here is safe because in the end it's all just characters.
          // I just use `uint8_t` in the decoder because `char`s stink, but that's what string
          // literals are so storing them in metadata that way makes more sense.
-         cifex_append_metadata_len(out_image_info, key_len, (char *)key, value_len, (char *)value);
+         if (
+            (result = cifex_append_metadata_len(
+                out_image_info, key_len, (char *)key, value_len, (char *)value)) != cifex_ok) {
+            return result;
+         }
+      }
+      if (!cx_dec_match_lf(dec, cx_dec_streaming(dec))) {
+         break;
       }
-   } else {
-      while (cx_dec_parse_metadata_field(dec, &key, &key_len, &value, &value_len) == cifex_ok)
-         ;
+   }
+   if (result == cifex_out_of_memory || result == cifex_line_too_long) {
+      return result;
    }
 
    return cifex_ok;
 }
 
-// Parses all the pixels in an image. The amount of pixels to be parsed is taken from the
-// `out_image`.
-static cx_inline cifex_result_t
-cx_dec_parse_pixels(cx_decoder_t *dec, cifex_image_t *inout_image, size_t *out_error_line)
+// The pixel section is parsed in two stages, like simdjson does with JSON. The first one indexes a
+// block of the input by finding all the separators (spaces, semicolons, and line feeds) in it at
+// once, and listing where each word begins and ends. The second one walks over the list, and since
+// the length of every word is known up front, looks the words up in a perfect hash table instead of
+// trying every word in turn. Neither stage has to branch on the input byte by byte, and the words'
+// boundaries don't depend on each other, so the second stage can work on several words at once.
+//
+// The second stage only handles pixels written the usual way. Anything else, including every
+// error, is left to the regular parser, which starts over from the beginning of the pixel. This
+// keeps the lenient corners of the syntax and the reported error lines exactly as they were.
+//
+// Files written by `cifex_encode` separate their words with exactly one space, their channels with
+// exactly one semicolon and space, and their pixels with exactly one line feed. As long as that
+// holds, the first stage only has to list where the words end, since the length of the separators
+// following them is known. The first stage checks that it holds for a whole block at once, and the
+// first time it doesn't, the index switches to listing both ends of every word for the rest of the
+// file.
+
+// The amount of bytes indexed at once.
+#define CX_DEC_INDEX_SIZE 4096
+
+// The most pixels that are parsed without checking whether they repeat the last one.
+#define CX_DEC_MAX_REPEAT_BACKOFF 63
+
+// An index of the words in a block of the decoder's buffer.
+typedef struct cx_dec_index
 {
-   size_t syntax_error = 0;
-   size_t range_error = 0;
-
-   switch (inout_image->channels) {
-      case cifex_rgb:
-         for (uint32_t y = 0; y < inout_image->height; ++y) {
-            for (uint32_t x = 0; x < inout_image->width; ++x) {
-               size_t offset =
-                  ((size_t)x + (size_t)y * (size_t)inout_image->width) * inout_image->channels;
-
-               // Parse the pixel.
-               uint32_t r, g, b;
-               bool syntax = false;
-               syntax |= !cx_dec_parse_number_up_to_hundreds(dec, &r);
-               syntax |= !cx_dec_match(dec, ';');
-               syntax |= !cx_dec_match_ws(dec);
-               syntax |= !cx_dec_parse_number_up_to_hundreds(dec, &g);
-               syntax |= !cx_dec_match(dec, ';');
-               syntax |= !cx_dec_match_ws(dec);
-               syntax |= !cx_dec_parse_number_up_to_hundreds(dec, &b);
-               syntax |= !cx_dec_match_lf(dec);
-               if (syntax != 0) {
-                  syntax_error = dec->line;
-               }
-
-               // Check if all channels are in the correct range.
-               if (r > 255 || g > 255 || b > 255) {
-                  range_error = dec->line;
-               }
+   // The decoder's `consumed` at the time the index was built. The index is stale once the window
+   // moves.
+   size_t consumed;
+   // The indexed part of the buffer.
+   size_t start;
+   size_t end;
+   // Whether a block with separators other than those written by `cifex_encode` was seen.
+   bool general;
+   // In general mode, the offsets from `start` at which the words begin and end, alternately.
+   // Otherwise, only the offsets at which the words end. A word's end is the offset of the
+   // separator following it.
+   uint16_t boundaries[CX_DEC_INDEX_SIZE];
+   size_t boundary_count;
+   // The boundary at which the next pixel is expected to begin.
+   size_t cursor;
+
+   // The last pixel parsed without errors: the offset in the input it starts at, the amount of
+   // bytes and lines it spans, and its channels. `last_len` is `0` if there is no such pixel.
+   size_t last_start;
+   size_t last_len;
+   size_t last_lines;
+   uint32_t last_pixel[4];
+   // How many pixels to parse before comparing against the last one again, and how many to wait
+   // after the next failed comparison.
+   uint32_t repeat_wait;
+   uint32_t repeat_backoff;
+} cx_dec_index_t;
+
+// The separators in a chunk of 64 bytes, one bit per byte.
+typedef struct cx_dec_chunk
+{
+   uint64_t spaces;
+   uint64_t semicolons;
+   uint64_t lfs;
+} cx_dec_chunk_t;
+
+// Finds the separators in the 64 bytes at `bytes`.
+static cx_inline cx_dec_chunk_t
+cx_dec_classify_chunk(const uint8_t *bytes)
+{
+   cx_dec_chunk_t chunk = { 0 };
+#ifdef __SSE2__
+   __m128i space = _mm_set1_epi8(' ');
+   __m128i semicolon = _mm_set1_epi8(';');
+   __m128i lf = _mm_set1_epi8('\n');
+   for (int i = 0; i < 4; ++i) {
+      __m128i part = _mm_loadu_si128((const __m128i *)&bytes[i * 16]);
+      chunk.spaces |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(part, space))
+         << (i * 16);
+      chunk.semicolons |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(part, semicolon))
+         << (i * 16);
+      chunk.lfs |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(part, lf)) << (i * 16);
+   }
+#else
+   for (int i = 0; i < 64; ++i) {
+      chunk.spaces |= (uint64_t)(bytes[i] == ' ') << i;
+      chunk.semicolons |= (uint64_t)(bytes[i] == ';') << i;
+      chunk.lfs |= (uint64_t)(bytes[i] == '\n') << i;
+   }
+#endif
+   return chunk;
+}
 
-               // Set the pixel.
-               inout_image->data[offset] = r;
-               inout_image->data[offset + 1] = g;
-               inout_image->data[offset + 2] = b;
-            }
-         }
-         break;
-      case cifex_rgba:
-         for (uint32_t y = 0; y < inout_image->height; ++y) {
-            for (uint32_t x = 0; x < inout_image->width; ++x) {
-               size_t offset =
-                  ((size_t)x + (size_t)y * (size_t)inout_image->width) * inout_image->channels;
-
-               // Parse the pixel.
-               uint32_t r, g, b, a;
-               bool syntax = false;
-               syntax |= !cx_dec_parse_number_up_to_hundreds(dec, &r);
-               syntax |= !cx_dec_match(dec, ';');
-               syntax |= !cx_dec_match_ws(dec);
-               syntax |= !cx_dec_parse_number_up_to_hundreds(dec, &g);
-               syntax |= !cx_dec_match(dec, ';');
-               syntax |= !cx_dec_match_ws(dec);
-               syntax |= !cx_dec_parse_number_up_to_hundreds(dec, &b);
-               syntax |= !cx_dec_match(dec, ';');
-               syntax |= !cx_dec_match_ws(dec);
-               syntax |= !cx_dec_parse_number_up_to_hundreds(dec, &a);
-               syntax |= !cx_dec_match_lf(dec);
-               if (syntax) {
-                  syntax_error = dec->line;
-               }
+// Indexes the block of the buffer starting at the current position.
+static void
+cx_dec_build_index(cx_decoder_t *dec, cx_dec_index_t *index)
+{
+   size_t len = cx_min(dec->buffer_len - dec->position, CX_DEC_INDEX_SIZE);
+   const uint8_t *block = &dec->buffer[dec->position];
+   index->consumed = dec->consumed;
+   index->start = dec->position;
+   index->end = dec->position + len;
+   index->boundary_count = 0;
+   index->cursor = 0;
+
+   // The block is treated as if it was preceded by a line feed, so that the boundaries always
+   // start with the beginning of a word.
+   uint64_t after_separator = 1;
+   uint64_t after_word = 0;
+   uint64_t after_semicolon = 0;
+   uint64_t deviations = 0;
+   for (size_t offset = 0; offset < len; offset += 64) {
+      cx_dec_chunk_t chunk;
+      uint64_t valid = ~(uint64_t)0;
+      if (len - offset >= 64) {
+         chunk = cx_dec_classify_chunk(&block[offset]);
+      } else {
+         // The last chunk is copied out, as it may extend past the buffer's padding.
+         uint8_t last[64] = { 0 };
+         memcpy(last, &block[offset], len - offset);
+         chunk = cx_dec_classify_chunk(last);
+         valid = ((uint64_t)1 << (len - offset)) - 1;
+      }
 
-               // Check if all channels are in the correct range.
-               if (r > 255 || g > 255 || b > 255 || a > 255) {
-                  range_error = dec->line;
-               }
+      uint64_t separators = chunk.spaces | chunk.semicolons | chunk.lfs;
+      uint64_t words = ~separators & valid;
+      uint64_t bits;
+      if (index->general) {
+         // Words begin and end wherever a separator follows a non-separator, or the other way
+         // round.
+         bits = (separators ^ ((separators << 1) | after_separator)) & valid;
+      } else {
+         uint64_t follows_word = (words << 1) | after_word;
+         uint64_t follows_semicolon = (chunk.semicolons << 1) | after_semicolon;
+         deviations |= (chunk.spaces & ~(follows_word | follows_semicolon)) |
+            ((chunk.semicolons | chunk.lfs) & ~follows_word) | (words & follows_semicolon);
+         bits = separators & follows_word;
+      }
+      after_separator = separators >> 63;
+      after_word = words >> 63;
+      after_semicolon = chunk.semicolons >> 63;
 
-               // Set the pixel.
-               inout_image->data[offset] = r;
-               inout_image->data[offset + 1] = g;
-               inout_image->data[offset + 2] = b;
-               inout_image->data[offset + 3] = a;
-            }
-         }
-         break;
+      while (bits != 0) {
+         index->boundaries[index->boundary_count++] = offset + cx_ctz64(bits);
+         bits &= bits - 1;
+      }
    }
 
-   if (syntax_error != 0) {
-      *out_error_line = syntax_error;
-      return cifex_syntax_error;
-   }
-   if (range_error > 0) {
-      *out_error_line = range_error;
-      return cifex_channel_out_of_range;
+   if (deviations != 0) {
+      index->general = true;
+      cx_dec_build_index(dec, index);
    }
-
-   return cifex_ok;
 }
 
-// Constructs a decoding error.
-static cx_inline cifex_decode_result_t
-cx_dec_error(const cx_decoder_t *dec, cifex_result_t result)
+// Rebuilds the index if it's stale, or if the current position is too close to its end for a pixel
+// to fit in it.
+static cx_inline void
+cx_dec_refresh_index(cx_decoder_t *dec, cx_dec_index_t *index)
 {
-   return (cifex_decode_result_t){
-      .result = result,
-      .position = dec->position,
-      .line = dec->line,
-   };
+   if (index->consumed == dec->consumed && dec->position >= index->start) {
+      if (dec->position + CX_DEC_LOOKAHEAD <= index->end) {
+         return;
+      }
+      // Near the end of the input, or of what has arrived of it, there's nothing more to index.
+      if (index->end == dec->buffer_len && (dec->eof || dec->short_read)) {
+         return;
+      }
+   }
+   cx_dec_ensure(dec, CX_DEC_INDEX_SIZE);
+   cx_dec_build_index(dec, index);
 }
 
-cifex_decode_result_t
-cifex_decode(
-   cifex_decode_config_t config,
-   cifex_image_t *out_image,
-   cifex_image_info_t *out_image_info)
+// Returns whether all the bytes in the given range are `byte`.
+static cx_inline bool
+cx_all_bytes(const uint8_t *bytes, size_t len, uint8_t byte)
 {
-   cx_ensure(config.allocator != NULL, "decoding allocator cannot be NULL");
-   cx_ensure(config.reader != NULL, "decoding reader cannot be NULL");
-   cx_ensure(out_image != NULL, "output image cannot be NULL");
-
-   cifex_result_t result;
+   for (size_t i = 0; i < len; ++i) {
+      if (bytes[i] != byte) {
+         return false;
+      }
+   }
+   return true;
+}
 
-   // Reading all the data at once is faster than having to seek around and all that.
-   // It also lets us seek throughout the whole file however we see fit.
-   uint8_t *buffer = NULL;
-   size_t buffer_len = 0;
-   if ((result = cx_read_all(config.reader, config.allocator, &buffer, &buffer_len)) != cifex_ok) {
-      return (cifex_decode_result_t){ .result = result, .line = 0, .position = 0 };
+// Parses a single pixel using a general mode index. Returns `false` without consuming anything if
+// the pixel isn't written the usual way, or doesn't fit in the indexed block.
+static cx_inline bool
+cx_dec_parse_pixel_indexed(
+   cx_decoder_t *dec,
+   cx_dec_index_t *index,
+   cifex_channels_t channels,
+   uint32_t *out_pixel)
+{
+   // Catch up with the regular parser, if it was used for the previous pixels.
+   const uint16_t *boundaries = index->boundaries;
+   size_t count = index->boundary_count;
+   size_t offset = dec->position - index->start;
+   size_t k = index->cursor;
+   while (k < count && boundaries[k] < offset) {
+      k += 2;
+   }
+   if (k >= count || boundaries[k] != offset) {
+      return false;
    }
 
-   cx_decoder_t dec = {
-      .buffer = buffer,
-      .buffer_len = buffer_len,
-      .position = 0,
-      .line = 1,
-   };
+   // Every word is followed by a gap of separators, which ends where the next word begins.
+   const uint8_t *block = &dec->buffer[index->start];
+   size_t gap_start, gap_len;
+   uint8_t misplaced = 0;
+   for (int i = 0; i < channels; ++i) {
+      // Words must come in the right order, which is checked against the kinds of the words that
+      // came before them.
+      uint32_t number = 0;
+      uint8_t kinds = 0;
+      while (true) {
+         if (k + 2 >= count) {
+            return false;
+         }
+         size_t word_start = boundaries[k];
+         size_t len = boundaries[k + 1] - word_start;
+         gap_start = boundaries[k + 1];
+         gap_len = boundaries[k + 2] - gap_start;
+         k += 2;
+
+         if (len > CX_SC_NUMBER_WORD_MAX_LEN) {
+            return false;
+         }
+         const cx_sc_number_word_t *word = cx_sc_find_number_word(&block[word_start], len);
+         if (word == NULL) {
+            return false;
+         }
+         misplaced |= kinds & ~word->follows;
+         kinds |= word->kind;
+         number += word->value;
 
-   cifex_image_info_t image_info = {
-      .allocator = config.allocator,
-      .version = 0,
-      .flags = 0,
-      .metadata = NULL,
-   };
+         if (block[gap_start] != ' ') {
+            break;
+         }
+         if (gap_len != 1 && !cx_all_bytes(&block[gap_start + 1], gap_len - 1, ' ')) {
+            return false;
+         }
+      }
+      out_pixel[i] = number;
 
-   if ((result = cx_dec_parse_flags(&dec, &image_info.flags)) != cifex_ok) {
-      goto err;
+      if (i == channels - 1) {
+         break;
+      }
+      if (block[gap_start] != ';' || block[gap_start + 1] != ' ' ||
+          (gap_len != 2 && !cx_all_bytes(&block[gap_start + 2], gap_len - 2, ' '))) {
+         return false;
+      }
    }
 
-   if ((result = cx_dec_parse_version(&dec, &image_info.version)) != cifex_ok) {
-      goto err;
+   if (misplaced != 0 || block[gap_start] != '\n' ||
+       (gap_len != 1 && !cx_all_bytes(&block[gap_start + 1], gap_len - 1, '\n'))) {
+      return false;
    }
-   if (image_info.version < 1) {
+
+   index->cursor = k;
+   dec->position = index->start + gap_start + gap_len;
+   dec->line += gap_len;
+   return true;
+}
+
+// Parses a single pixel using a canonical mode index. Returns `false` without consuming anything
+// if the pixel isn't written the usual way, or doesn't fit in the indexed block.
+static cx_inline bool
+cx_dec_parse_pixel_canonical(
+   cx_decoder_t *dec,
+   cx_dec_index_t *index,
+   cifex_channels_t channels,
+   uint32_t *out_pixel)
+{
+   // Catch up with the regular parser, if it was used for the previous pixels.
+   const uint16_t *ends = index->boundaries;
+   size_t count = index->boundary_count;
+   size_t word_start = dec->position - index->start;
+   size_t k = index->cursor;
+   while (k < count && ends[k] < word_start) {
+      ++k;
+   }
+
+   const uint8_t *block = &dec->buffer[index->start];
+   uint8_t separator;
+   uint8_t misplaced = 0;
+   for (int i = 0; i < channels; ++i) {
+      uint32_t number = 0;
+      uint8_t kinds = 0;
+      do {
+         if (k >= count) {
+            return false;
+         }
+         size_t word_end = ends[k++];
+         size_t len = word_end - word_start;
+         if (len - 1 >= CX_SC_NUMBER_WORD_MAX_LEN) {
+            return false;
+         }
+         const cx_sc_number_word_t *word = cx_sc_find_number_word(&block[word_start], len);
+         if (word == NULL) {
+            return false;
+         }
+         misplaced |= kinds & ~word->follows;
+         kinds |= word->kind;
+         number += word->value;
+
+         separator = block[word_end];
+         word_start = word_end + 1;
+      } while (separator == ' ');
+      out_pixel[i] = number;
+
+      if (i == channels - 1) {
+         break;
+      }
+      if (separator != ';') {
+         return false;
+      }
+      ++word_start;
+   }
+
+   // A line feed at the very end of the block may be followed by more of them, which the block
+   // was not checked for.
+   if (misplaced != 0 || separator != '\n' || index->start + word_start >= index->end) {
+      return false;
+   }
+
+   index->cursor = k;
+   dec->position = index->start + word_start;
+   ++dec->line;
+   return true;
+}
+
+// Parses a pixel that's spelled exactly like the last one, by copying the last one's channels.
+// Returns `false` without consuming anything if the pixel is spelled differently.
+//
+// Runs of identical pixels are common in flat areas of images. Comparing their bytes is a lot
+// cheaper than indexing and looking up their words again. Where pixels vary, failed comparisons
+// cost mispredicted branches, so after each one, the comparisons are backed off for twice as many
+// pixels as the last time.
+static cx_inline bool
+cx_dec_parse_repeated_pixel(
+   cx_decoder_t *dec,
+   cx_dec_index_t *index,
+   cifex_channels_t channels,
+   uint32_t *out_pixel)
+{
+   size_t len = index->last_len;
+   size_t available = dec->buffer_len - dec->position;
+   // The last pixel must still be in the window, and so must the byte following this one, which
+   // is checked so that the pixel doesn't end in the middle of a longer run of line feeds.
+   if (
+      len == 0 || index->last_start < dec->consumed || available < len ||
+      (available == len && !dec->eof)) {
+      return false;
+   }
+   const uint8_t *last = &dec->buffer[index->last_start - dec->consumed];
+   const uint8_t *next = &dec->buffer[dec->position];
+   // Pixels are always longer than 8 bytes. Comparing their beginnings first rejects most pixels
+   // that differ without calling `memcmp`.
+   if (memcmp(next, last, 8) != 0 || memcmp(next, last, len) != 0 || next[len] == '\n') {
+      index->repeat_backoff = cx_min(index->repeat_backoff * 2 + 1, CX_DEC_MAX_REPEAT_BACKOFF);
+      index->repeat_wait = index->repeat_backoff;
+      return false;
+   }
+   index->repeat_backoff = 0;
+
+   for (int i = 0; i < channels; ++i) {
+      out_pixel[i] = index->last_pixel[i];
+   }
+   index->last_start = dec->consumed + dec->position;
+   dec->position += len;
+   dec->line += index->last_lines;
+   return true;
+}
+
+// Parses a single pixel with the regular parser, trying every word in turn.
+static cx_inline bool
+cx_dec_parse_pixel_scalar(
+   cx_decoder_t *dec,
+   cifex_channels_t channels,
+   uint32_t *out_pixel,
+   bool streaming)
+{
+   bool syntax = false;
+   syntax |= !cx_dec_parse_number_up_to_hundreds(dec, &out_pixel[0], streaming);
+   for (int i = 1; i < channels; ++i) {
+      syntax |= !cx_dec_match(dec, ';');
+      syntax |= !cx_dec_match_ws(dec, streaming);
+      syntax |= !cx_dec_parse_number_up_to_hundreds(dec, &out_pixel[i], streaming);
+   }
+   syntax |= !cx_dec_match_lf(dec, streaming && dec->pixels_left != 0);
+   return !syntax;
+}
+
+// Parses a single pixel with the given amount of channels, and the line feed after it.
+// Returns `false` on syntax errors. Checking whether the channels are in range is left to the
+// caller.
+static cx_inline bool
+cx_dec_parse_pixel(
+   cx_decoder_t *dec,
+   cx_dec_index_t *index,
+   cifex_channels_t channels,
+   uint32_t *out_pixel,
+   bool streaming)
+{
+   if (streaming) {
+      --dec->pixels_left;
+   }
+   if (index->repeat_wait != 0) {
+      --index->repeat_wait;
+   } else if (cx_dec_parse_repeated_pixel(dec, index, channels, out_pixel)) {
+      return true;
+   }
+
+   size_t start = dec->consumed + dec->position;
+   size_t line = dec->line;
+   cx_dec_refresh_index(dec, index);
+   bool parsed = index->general
+      ? cx_dec_parse_pixel_indexed(dec, index, channels, out_pixel)
+      : cx_dec_parse_pixel_canonical(dec, index, channels, out_pixel);
+   // After a short read, the index may end partway through the pixel, and the scalar parser needs
+   // the rest of its line to have arrived.
+   if (!parsed && streaming) {
+      cx_dec_ensure(dec, CX_DEC_LOOKAHEAD);
+   }
+   if (!parsed && !cx_dec_parse_pixel_scalar(dec, channels, out_pixel, streaming)) {
+      index->last_len = 0;
+      return false;
+   }
+
+   // The pixel only needs to be remembered if the next one is going to be compared against it.
+   if (index->repeat_wait != 0) {
+      return true;
+   }
+   index->last_start = start;
+   index->last_len = dec->consumed + dec->position - start;
+   index->last_lines = dec->line - line;
+   for (int i = 0; i < channels; ++i) {
+      index->last_pixel[i] = out_pixel[i];
+   }
+   return true;
+}
+
+// Returns whether all of the pixel's channels are in the 0..255 range.
+static cx_inline bool
+cx_pixel_in_range(cifex_channels_t channels, const uint32_t *pixel)
+{
+   uint32_t all = 0;
+   for (int i = 0; i < channels; ++i) {
+      all |= pixel[i];
+   }
+   return all <= 255;
+}
+
+// Skips a pixel without parsing it, by scanning for the end of its line.
+static cx_inline bool
+cx_dec_skip_line(cx_decoder_t *dec, bool streaming)
+{
+   if (streaming) {
+      --dec->pixels_left;
+   }
+   const uint8_t *lf;
+   while (
+      (lf = memchr(&dec->buffer[dec->position], '\n', dec->buffer_len - dec->position)) == NULL) {
+      dec->position = dec->buffer_len;
+      if (!streaming || !cx_dec_ensure(dec, CX_DEC_LOOKAHEAD)) {
+         return false;
+      }
+   }
+   dec->position = lf - dec->buffer;
+   return cx_dec_match_lf(dec, streaming && dec->pixels_left != 0);
+}
+
+// Returns whether decoding was cancelled.
+static cx_inline bool
+cx_dec_cancelled(const cx_decoder_t *dec)
+{
+   return dec->cancel != NULL && atomic_load_explicit(dec->cancel, memory_order_relaxed);
+}
+
+// Called after each of `row_count` rows is parsed. Checks whether decoding was cancelled, and
+// reports progress every so often.
+static cx_inline cifex_result_t
+cx_dec_end_row(cx_decoder_t *dec, uint32_t rows_done, uint32_t row_count)
+{
+   cifex_result_t result = cifex_ok;
+   if (cx_dec_cancelled(dec)) {
+      result = cifex_cancelled;
+   } else {
+      cifex_progress_t *progress = dec->progress;
+      if (progress != NULL && (rows_done % progress->interval == 0 || rows_done == row_count)) {
+         result = progress->report(progress, rows_done, row_count, dec->consumed + dec->position);
+      }
+   }
+   dec->stopped = result != cifex_ok;
+   return result;
+}
+
+// Turns the line numbers of the last syntax and range errors into a result.
+static cx_inline cifex_result_t
+cx_dec_pixel_errors(size_t syntax_error, size_t range_error, size_t *out_error_line)
+{
+   if (syntax_error != 0) {
+      *out_error_line = syntax_error;
+      return cifex_syntax_error;
+   }
+   if (range_error > 0) {
+      *out_error_line = range_error;
+      return cifex_channel_out_of_range;
+   }
+   return cifex_ok;
+}
+
+static cx_inline cifex_result_t
+cx_dec_parse_pixels__inline(
+   cx_decoder_t *dec,
+   cifex_image_t *inout_image,
+   cifex_channels_t channels,
+   bool streaming,
+   size_t *out_error_line)
+{
+   size_t syntax_error = 0;
+   size_t range_error = 0;
+   cx_dec_index_t index = { 0 };
+   cifex_result_t result;
+
+   for (uint32_t y = 0; y < inout_image->height; ++y) {
+      for (uint32_t x = 0; x < inout_image->width; ++x) {
+         size_t offset = ((size_t)x + (size_t)y * (size_t)inout_image->width) * channels;
+
+         // Parse the pixel.
+         uint32_t pixel[4];
+         if (!cx_dec_parse_pixel(dec, &index, channels, pixel, streaming)) {
+            syntax_error = dec->line;
+         }
+
+         // Check if all channels are in the correct range.
+         if (!cx_pixel_in_range(channels, pixel)) {
+            range_error = dec->line;
+         }
+
+         // Set the pixel.
+         for (int i = 0; i < channels; ++i) {
+            inout_image->data[offset + i] = pixel[i];
+         }
+      }
+
+      if ((result = cx_dec_end_row(dec, y + 1, inout_image->height)) != cifex_ok) {
+         return result;
+      }
+   }
+
+   return cx_dec_pixel_errors(syntax_error, range_error, out_error_line);
+}
+
+// Parses all the pixels in an image. The amount of pixels to be parsed is taken from the
+// `out_image`.
+static cifex_result_t
+cx_dec_parse_pixels(cx_decoder_t *dec, cifex_image_t *inout_image, size_t *out_error_line)
+{
+   // Dispatching on the channel count and the decoding mode outside the loop lets the compiler
+   // specialize the loop for each of them.
+   bool streaming = cx_dec_streaming(dec);
+   switch (inout_image->channels) {
+      case cifex_rgb:
+         return streaming
+            ? cx_dec_parse_pixels__inline(dec, inout_image, cifex_rgb, true, out_error_line)
+            : cx_dec_parse_pixels__inline(dec, inout_image, cifex_rgb, false, out_error_line);
+      case cifex_rgba:
+         return streaming
+            ? cx_dec_parse_pixels__inline(dec, inout_image, cifex_rgba, true, out_error_line)
+            : cx_dec_parse_pixels__inline(dec, inout_image, cifex_rgba, false, out_error_line);
+   }
+   return cifex_ok;
+}
+
+static cx_inline cifex_result_t
+cx_dec_parse_rows__inline(
+   cx_decoder_t *dec,
+   cifex_image_t *row_image,
+   cifex_channels_t channels,
+   uint32_t height,
+   cifex_row_sink_t *sink,
+   cifex_row_index_t *row_index,
+   bool streaming,
+   size_t *out_error_line)
+{
+   size_t syntax_error = 0;
+   size_t range_error = 0;
+   cx_dec_index_t index = { 0 };
+   cifex_result_t result;
+
+   for (uint32_t y = 0; y < height; ++y) {
+      if (row_index != NULL) {
+         cx_record_row(row_index, y, dec->consumed + dec->position, dec->line);
+      }
+      for (uint32_t x = 0; x < row_image->width; ++x) {
+         size_t offset = (size_t)x * channels;
+
+         uint32_t pixel[4];
+         if (!cx_dec_parse_pixel(dec, &index, channels, pixel, streaming)) {
+            syntax_error = dec->line;
+         }
+         if (!cx_pixel_in_range(channels, pixel)) {
+            range_error = dec->line;
+         }
+
+         for (int i = 0; i < channels; ++i) {
+            row_image->data[offset + i] = pixel[i];
+         }
+      }
+
+      // Unlike when decoding into an image, errors are checked after every row so that the sink
+      // never sees invalid rows.
+      if (syntax_error != 0 || range_error != 0) {
+         break;
+      }
+      if ((result = sink->row(sink, y, row_image->data)) != cifex_ok) {
+         return result;
+      }
+      if ((result = cx_dec_end_row(dec, y + 1, height)) != cifex_ok) {
+         return result;
+      }
+   }
+
+   return cx_dec_pixel_errors(syntax_error, range_error, out_error_line);
+}
+
+// Parses all the pixels in an image row by row into `row_image`, which is one row tall, passing
+// each row to the sink. If `row_index` is not `NULL`, where the rows start is recorded into it.
+static cifex_result_t
+cx_dec_parse_rows(
+   cx_decoder_t *dec,
+   cifex_image_t *row_image,
+   uint32_t height,
+   cifex_row_sink_t *sink,
+   cifex_row_index_t *row_index,
+   size_t *out_error_line)
+{
+   bool streaming = cx_dec_streaming(dec);
+   switch (row_image->channels) {
+      case cifex_rgb:
+         return streaming
+            ? cx_dec_parse_rows__inline(
+                 dec, row_image, cifex_rgb, height, sink, row_index, true, out_error_line)
+            : cx_dec_parse_rows__inline(
+                 dec, row_image, cifex_rgb, height, sink, row_index, false, out_error_line);
+      case cifex_rgba:
+         return streaming
+            ? cx_dec_parse_rows__inline(
+                 dec, row_image, cifex_rgba, height, sink, row_index, true, out_error_line)
+            : cx_dec_parse_rows__inline(
+                 dec, row_image, cifex_rgba, height, sink, row_index, false, out_error_line);
+   }
+   return cifex_ok;
+}
+
+// Decoding with a row index.
+typedef struct cx_dec_rows
+{
+   // When not `NULL`, this index is filled in as the image is decoded row by row.
+   cifex_row_index_t *build;
+   // When not `NULL`, only `row_count` rows starting at `first_row` are decoded, after seeking
+   // straight to them with this index.
+   const cifex_row_index_t *seek;
+   uint32_t first_row, row_count;
+} cx_dec_rows_t;
+
+// Parses a band of rows into `out_image`, seeking to the closest indexed row above it. The rows
+// between that one and the band are skipped without being parsed.
+static cifex_result_t
+cx_dec_parse_band(
+   cx_decoder_t *dec,
+   const cx_dec_rows_t *rows,
+   cifex_image_t *out_image,
+   size_t *out_error_line)
+{
+   const cifex_row_index_t *index = rows->seek;
+   if (rows->row_count == 0) {
+      return cifex_ok;
+   }
+   const cifex_row_offset_t *start = &index->rows[rows->first_row / index->stride];
+
+   cifex_result_t result;
+   if ((result = cx_dec_seek(dec, start->position, start->line)) != cifex_ok) {
+      return result;
+   }
+   uint64_t skipped = (uint64_t)(rows->first_row % index->stride) * index->width;
+   dec->pixels_left = skipped + (uint64_t)rows->row_count * index->width;
+   for (uint64_t i = 0; i < skipped; ++i) {
+      if (!cx_dec_skip_line(dec, true)) {
+         *out_error_line = dec->line;
+         return cifex_syntax_error;
+      }
+   }
+   return cx_dec_parse_pixels(dec, out_image, out_error_line);
+}
+
+// Gets the size of a seekable input, leaving the reader at its start.
+static cifex_result_t
+cx_reader_size(cifex_reader_t *reader, uint64_t *out_size)
+{
+   if (reader->seek == NULL || reader->tell == NULL) {
+      return cifex_errno_result(ESPIPE);
+   }
+   long size;
+   if (
+      reader->seek(reader, 0, SEEK_END) != 0 || (size = reader->tell(reader)) < 0 ||
+      reader->seek(reader, 0, SEEK_SET) != 0) {
+      return cifex_errno_result(errno);
+   }
+   *out_size = size;
+   return cifex_ok;
+}
+
+// Returns how many pixels the `block`th block of `factor` pixels spans, along a dimension of `size`
+// pixels. Only the last block can be shorter than `factor`.
+static cx_inline uint32_t
+cx_block_size(uint32_t size, uint32_t factor, uint32_t block)
+{
+   uint32_t start = block * factor;
+   return size - start < factor ? size - start : factor;
+}
+
+static cx_inline cifex_result_t
+cx_dec_parse_pixels_box__inline(
+   cx_decoder_t *dec,
+   uint32_t width,
+   uint32_t height,
+   cifex_channels_t channels,
+   uint32_t factor,
+   uint64_t *accumulators,
+   cifex_image_t *out_image,
+   bool streaming,
+   size_t *out_error_line)
+{
+   size_t syntax_error = 0;
+   size_t range_error = 0;
+   cx_dec_index_t index = { 0 };
+
+   cifex_result_t result;
+
+   size_t row_size = (size_t)out_image->width * channels;
+   memset(accumulators, 0, row_size * sizeof(uint64_t));
+
+   uint32_t out_y = 0;
+   uint32_t rows_in_block = 0;
+   for (uint32_t y = 0; y < height; ++y) {
+      uint64_t *block = accumulators;
+      uint32_t columns_in_block = 0;
+      for (uint32_t x = 0; x < width; ++x) {
+         uint32_t pixel[4];
+         if (!cx_dec_parse_pixel(dec, &index, channels, pixel, streaming)) {
+            syntax_error = dec->line;
+         }
+         if (!cx_pixel_in_range(channels, pixel)) {
+            range_error = dec->line;
+         }
+
+         for (int i = 0; i < channels; ++i) {
+            block[i] += pixel[i];
+         }
+         if (++columns_in_block == factor) {
+            columns_in_block = 0;
+            block += channels;
+         }
+      }
+
+      // Once a row of blocks is complete, average it into the output image.
+      if (++rows_in_block == factor || y == height - 1) {
+         uint8_t *out_row = &out_image->data[(size_t)out_y * row_size];
+         for (uint32_t out_x = 0; out_x < out_image->width; ++out_x) {
+            uint64_t area = (uint64_t)cx_block_size(width, factor, out_x) * rows_in_block;
+            for (int i = 0; i < channels; ++i) {
+               size_t offset = (size_t)out_x * channels + i;
+               out_row[offset] = (accumulators[offset] + area / 2) / area;
+            }
+         }
+         memset(accumulators, 0, row_size * sizeof(uint64_t));
+         rows_in_block = 0;
+         ++out_y;
+      }
+
+      if ((result = cx_dec_end_row(dec, y + 1, height)) != cifex_ok) {
+         return result;
+      }
+   }
+
+   return cx_dec_pixel_errors(syntax_error, range_error, out_error_line);
+}
+
+// Parses all the pixels of a `width` by `height` image, averaging blocks of `factor` by `factor`
+// pixels into single pixels of `out_image`. `accumulators` must have room for one row of
+// `out_image`'s channels.
+static cifex_result_t
+cx_dec_parse_pixels_box(
+   cx_decoder_t *dec,
+   uint32_t width,
+   uint32_t height,
+   uint32_t factor,
+   uint64_t *accumulators,
+   cifex_image_t *out_image,
+   size_t *out_error_line)
+{
+   bool streaming = cx_dec_streaming(dec);
+   switch (out_image->channels) {
+      case cifex_rgb:
+         return streaming
+            ? cx_dec_parse_pixels_box__inline(
+                 dec,
+                 width,
+                 height,
+                 cifex_rgb,
+                 factor,
+                 accumulators,
+                 out_image,
+                 true,
+                 out_error_line)
+            : cx_dec_parse_pixels_box__inline(
+                 dec,
+                 width,
+                 height,
+                 cifex_rgb,
+                 factor,
+                 accumulators,
+                 out_image,
+                 false,
+                 out_error_line);
+      case cifex_rgba:
+         return streaming
+            ? cx_dec_parse_pixels_box__inline(
+                 dec,
+                 width,
+                 height,
+                 cifex_rgba,
+                 factor,
+                 accumulators,
+                 out_image,
+                 true,
+                 out_error_line)
+            : cx_dec_parse_pixels_box__inline(
+                 dec,
+                 width,
+                 height,
+                 cifex_rgba,
+                 factor,
+                 accumulators,
+                 out_image,
+                 false,
+                 out_error_line);
+   }
+   return cifex_ok;
+}
+
+static cx_inline cifex_result_t
+cx_dec_parse_pixels_subsample__inline(
+   cx_decoder_t *dec,
+   uint32_t width,
+   uint32_t height,
+   cifex_channels_t channels,
+   uint32_t factor,
+   cifex_image_t *out_image,
+   bool streaming,
+   size_t *out_error_line)
+{
+   size_t syntax_error = 0;
+   size_t range_error = 0;
+   cx_dec_index_t index = { 0 };
+
+   cifex_result_t result;
+
+   uint8_t *out_pixel = out_image->data;
+   uint32_t row_in_block = 0;
+   for (uint32_t y = 0; y < height; ++y) {
+      if (row_in_block != 0) {
+         for (uint32_t x = 0; x < width; ++x) {
+            if (!cx_dec_skip_line(dec, streaming)) {
+               syntax_error = dec->line;
+            }
+         }
+      } else {
+         uint32_t column_in_block = 0;
+         for (uint32_t x = 0; x < width; ++x) {
+            if (column_in_block == 0) {
+               uint32_t pixel[4];
+               if (!cx_dec_parse_pixel(dec, &index, channels, pixel, streaming)) {
+                  syntax_error = dec->line;
+               }
+               if (!cx_pixel_in_range(channels, pixel)) {
+                  range_error = dec->line;
+               }
+               for (int i = 0; i < channels; ++i) {
+                  out_pixel[i] = pixel[i];
+               }
+               out_pixel += channels;
+            } else if (!cx_dec_skip_line(dec, streaming)) {
+               syntax_error = dec->line;
+            }
+            if (++column_in_block == factor) {
+               column_in_block = 0;
+            }
+         }
+      }
+      if (++row_in_block == factor) {
+         row_in_block = 0;
+      }
+
+      if ((result = cx_dec_end_row(dec, y + 1, height)) != cifex_ok) {
+         return result;
+      }
+   }
+
+   return cx_dec_pixel_errors(syntax_error, range_error, out_error_line);
+}
+
+// Parses the top left pixel of every block of `factor` by `factor` pixels of a `width` by `height`
+// image into `out_image`. The rest of the pixels are skipped over without being parsed.
+static cifex_result_t
+cx_dec_parse_pixels_subsample(
+   cx_decoder_t *dec,
+   uint32_t width,
+   uint32_t height,
+   uint32_t factor,
+   cifex_image_t *out_image,
+   size_t *out_error_line)
+{
+   bool streaming = cx_dec_streaming(dec);
+   switch (out_image->channels) {
+      case cifex_rgb:
+         return streaming
+            ? cx_dec_parse_pixels_subsample__inline(
+                 dec, width, height, cifex_rgb, factor, out_image, true, out_error_line)
+            : cx_dec_parse_pixels_subsample__inline(
+                 dec, width, height, cifex_rgb, factor, out_image, false, out_error_line);
+      case cifex_rgba:
+         return streaming
+            ? cx_dec_parse_pixels_subsample__inline(
+                 dec, width, height, cifex_rgba, factor, out_image, true, out_error_line)
+            : cx_dec_parse_pixels_subsample__inline(
+                 dec, width, height, cifex_rgba, factor, out_image, false, out_error_line);
+   }
+   return cifex_ok;
+}
+
+// Calculates the reduction factor to use for an image of the given size.
+static uint32_t
+cx_downscale_factor(const cifex_downscale_config_t *downscale, uint32_t width, uint32_t height)
+{
+   if (width == 0 || height == 0) {
+      // There is nothing to downscale.
+      return 1;
+   }
+   if (downscale->factor != 0) {
+      return downscale->factor;
+   }
+
+   uint32_t factor = 1;
+   if (downscale->max_width != 0 && width > downscale->max_width) {
+      uint32_t needed = (width - 1) / downscale->max_width + 1;
+      factor = cx_max(factor, needed);
+   }
+   if (downscale->max_height != 0 && height > downscale->max_height) {
+      uint32_t needed = (height - 1) / downscale->max_height + 1;
+      factor = cx_max(factor, needed);
+   }
+   return factor;
+}
+
+// Divides an image dimension by a reduction factor, rounding up.
+static cx_inline uint32_t
+cx_downscaled_size(uint32_t size, uint32_t factor)
+{
+   return size == 0 ? 0 : (size - 1) / factor + 1;
+}
+
+// Returns the limit the decoder works with for a limit in `cifex_decode_limits_t`.
+static cx_inline size_t
+cx_limit(size_t limit)
+{
+   return limit != 0 ? limit : SIZE_MAX;
+}
+
+// Sets up a decoder for the given configuration, either reading the whole input into memory or
+// allocating the window it's streamed through.
+static cifex_result_t
+cx_dec_open(cx_decoder_t *dec, cifex_decode_config_t config, bool *out_aligned)
+{
+   *dec = (cx_decoder_t){
+      .buffer = NULL,
+      .buffer_len = 0,
+      .position = 0,
+      .line = 1,
+      .reader = NULL,
+      .allocator = config.allocator,
+      .capacity = 0,
+      .consumed = 0,
+      .eof = true,
+      .short_read = false,
+      .read_error = 0,
+      .pixels_left = 0,
+      .progress = config.progress,
+      .cancel = config.cancel,
+      .stopped = false,
+      .image_start = 0,
+      .max_input_size = cx_limit(config.limits.max_input_size),
+      .max_line_length = cx_limit(config.limits.max_line_length),
+      .at_input_limit = false,
+   };
+   *out_aligned = false;
+
+   if (config.stream_buffer_size == 0) {
+      // Reading all the data at once is faster than having to seek around and all that.
+      // It also lets us seek throughout the whole file however we see fit.
+      cifex_result_t result = cx_read_all(
+         config.reader,
+         config.allocator,
+         dec->max_input_size,
+         &dec->buffer,
+         &dec->buffer_len,
+         out_aligned);
+      dec->capacity = dec->buffer_len;
+      return result;
+   }
+
+   // Otherwise only a window of the input is kept in memory, and it's refilled as parsing
+   // progresses.
+   dec->reader = config.reader;
+   dec->capacity = cx_max(config.stream_buffer_size, CX_MIN_STREAM_BUFFER_SIZE);
+   dec->eof = false;
+   cx_tag_next_alloc(config.allocator, cifex_tag_input_buffer);
+   dec->buffer = cifex_alloc(config.allocator, dec->capacity + CX_MAX_PATTERN_LEN);
+   if (dec->buffer == NULL) {
+      return cifex_out_of_memory;
+   }
+   cx_dec_ensure(dec, CX_DEC_LOOKAHEAD);
+   return cifex_ok;
+}
+
+// Returns whether the image took up more input than `max_input_size` allows.
+static cx_inline bool
+cx_dec_over_input_limit(const cx_decoder_t *dec)
+{
+   return dec->consumed + dec->position - dec->image_start > dec->max_input_size;
+}
+
+// Constructs a decoding error.
+static cx_inline cifex_decode_result_t
+cx_dec_error(const cx_decoder_t *dec, cifex_result_t result)
+{
+   return (cifex_decode_result_t){
+      .result = result,
+      .position = dec->consumed + dec->position,
+      .line = dec->line,
+   };
+}
+
+cifex_decode_config_t
+cifex_default_decode_config(cifex_allocator_t *allocator, cifex_reader_t *reader)
+{
+   return (cifex_decode_config_t){
+      .allocator = allocator,
+      .reader = reader,
+      .load_metadata = true,
+      .stream_buffer_size = 0,
+      .stats = NULL,
+      .progress = NULL,
+      .cancel = NULL,
+      .limits = { 0 },
+   };
+}
+
+#ifdef LIBCIFEX_COUNT_STRCONSTS
+
+// Adds the strconst match counts to the profile named by the `CIFEX_STRCONST_PROFILE` environment
+// variable, so that several runs over a training corpus can accumulate into the same profile.
+static void
+cx_write_strconst_profile(void)
+{
+   const char *path = getenv("CIFEX_STRCONST_PROFILE");
+   if (path == NULL) {
+      return;
+   }
+
+   uint64_t counts[cx_sc__id_count];
+   for (size_t id = 0; id < cx_sc__id_count; ++id) {
+      counts[id] = atomic_load_explicit(&cx_sc_counts[id], memory_order_relaxed);
+   }
+   FILE *file = fopen(path, "r");
+   if (file != NULL) {
+      char ident[64];
+      unsigned long long count;
+      while (fscanf(file, "%63s %llu", ident, &count) == 2) {
+         for (size_t id = 0; id < cx_sc__id_count; ++id) {
+            if (strcmp(ident, cx_sc_names[id]) == 0) {
+               counts[id] += count;
+            }
+         }
+      }
+      fclose(file);
+   }
+
+   if ((file = fopen(path, "w")) == NULL) {
+      fprintf(stderr, "libcifex: cannot write the strconst profile to %s\n", path);
+      return;
+   }
+   for (size_t id = 0; id < cx_sc__id_count; ++id) {
+      fprintf(file, "%s %llu\n", cx_sc_names[id], (unsigned long long)counts[id]);
+   }
+   fclose(file);
+}
+
+// Makes sure the profile is written when the program exits. Images may start decoding on several
+// threads at once, and only the first of them registers the writer.
+static void
+cx_register_strconst_profile(void)
+{
+   static atomic_flag registered = ATOMIC_FLAG_INIT;
+   if (!atomic_flag_test_and_set(&registered)) {
+      atexit(cx_write_strconst_profile);
+   }
+}
+
+#endif
+
+// Decodes an image, downscaling it if `downscale` is not `NULL`.
+//
+// If `sink` is not `NULL`, `out_image` only holds a single row, and the image's rows are passed to
+// the sink as they're decoded. Downscaling is not supported in that case.
+//
+// If `rows` is not `NULL`, a row index is either built, which requires a sink, or used to decode
+// a band of rows, which can't be combined with a sink or downscaling.
+//
+// If `resume` is not `NULL`, the image is decoded from where the decoder it points to left off, and
+// the decoder is saved back into it instead of being freed. `cifex_end_of_stream` is returned if
+// no image is left.
+static cifex_decode_result_t
+cx_decode(
+   cifex_decode_config_t config,
+   const cifex_downscale_config_t *downscale,
+   cifex_row_sink_t *sink,
+   const cx_dec_rows_t *rows,
+   cx_decoder_t *resume,
+   cifex_image_t *out_image,
+   cifex_image_info_t *out_image_info)
+{
+   cx_ensure(config.allocator != NULL, "decoding allocator cannot be NULL");
+   cx_ensure(config.reader != NULL, "decoding reader cannot be NULL");
+   cx_ensure(out_image != NULL, "output image cannot be NULL");
+   cx_ensure(sink == NULL || downscale == NULL, "row sinks do not support downscaling");
+   cx_ensure(
+      rows == NULL || rows->build == NULL || sink != NULL, "row indices are built with row sinks");
+   cx_ensure(
+      rows == NULL || rows->seek == NULL || (sink == NULL && downscale == NULL),
+      "bands of rows cannot be decoded with row sinks or downscaled");
+   cx_ensure(resume == NULL || rows == NULL, "row indices cannot be used with image streams");
+   cx_ensure(
+      config.progress == NULL || config.progress->interval > 0,
+      "progress must be reported at an interval of at least one row");
+
+#ifdef LIBCIFEX_COUNT_STRCONSTS
+   cx_register_strconst_profile();
+#endif
+
+   cifex_result_t result;
+
+   // Row indices are tied to the size of the file they were made for. Seeking with one needs the
+   // input to be streamed, so that only the part of the file that's needed is read.
+   cifex_row_index_t *build_index = rows != NULL ? rows->build : NULL;
+   const cifex_row_index_t *seek_index = rows != NULL ? rows->seek : NULL;
+   if (rows != NULL) {
+      uint64_t file_size;
+      if ((result = cx_reader_size(config.reader, &file_size)) != cifex_ok) {
+         return (cifex_decode_result_t){ .result = result, .line = 0, .position = 0 };
+      }
+      if (build_index != NULL) {
+         build_index->file_size = file_size;
+      }
+      if (file_size > cx_limit(config.limits.max_input_size)) {
+         return (cifex_decode_result_t){
+            .result = cifex_input_too_large,
+            .line = 0,
+            .position = 0,
+         };
+      }
+      if (seek_index != NULL) {
+         if (file_size != seek_index->file_size) {
+            return (cifex_decode_result_t){
+               .result = cifex_row_index_mismatch,
+               .line = 0,
+               .position = 0,
+            };
+         }
+         if (config.stream_buffer_size == 0) {
+            config.stream_buffer_size = CX_BAND_STREAM_BUFFER_SIZE;
+         }
+      }
+   }
+
+   // When gathering statistics, everything goes through counting wrappers. The image and image
+   // info are handed over to the caller with the caller's allocator, which can free memory
+   // allocated through the wrapper.
+   cifex_allocator_t *caller_allocator = config.allocator;
+   cx_counting_allocator_t counting_allocator;
+   cx_counting_reader_t counting_reader;
+   uint64_t phase_start = 0;
+   if (config.stats != NULL) {
+      *config.stats = (cifex_stats_t){ 0 };
+      config.allocator = cx_counting_allocator(&counting_allocator, config.allocator, config.stats);
+      config.reader = cx_counting_reader(&counting_reader, config.reader, config.stats);
+      phase_start = cx_now_ns();
+   }
+
+   cx_decoder_t dec;
+   bool buffer_aligned = false;
+   uint64_t *accumulators = NULL;
+   size_t accumulators_size = 0;
+   bool image_replaced = false;
+   cifex_image_info_t image_info = {
+      .allocator = config.allocator,
+      .version = 0,
+      .flags = 0,
+      .metadata = NULL,
+   };
+
+   if (resume != NULL) {
+      // The window and its position carry over from the previous image. The reader and allocator
+      // are set again, as they may be wrapped differently on every call.
+      dec = *resume;
+      dec.allocator = config.allocator;
+      dec.stopped = false;
+      if (dec.reader != NULL) {
+         dec.reader = config.reader;
+      }
+      // The limits apply to every image separately.
+      dec.max_input_size = cx_limit(config.limits.max_input_size);
+      dec.max_line_length = cx_limit(config.limits.max_line_length);
+      dec.image_start = dec.consumed + dec.position;
+      if (dec.at_input_limit) {
+         dec.eof = false;
+         dec.at_input_limit = false;
+      }
+      // Images may be separated by blank lines. Nothing but those left means the stream ended.
+      cx_dec_match_lf(&dec, cx_dec_streaming(&dec));
+      dec.image_start = dec.consumed + dec.position;
+      dec.line = 1;
+      if (dec.position == dec.buffer_len && dec.eof) {
+         result = cifex_end_of_stream;
+         goto err;
+      }
+   } else if ((result = cx_dec_open(&dec, config, &buffer_aligned)) != cifex_ok) {
+      return (cifex_decode_result_t){ .result = result, .line = 0, .position = 0 };
+   }
+   cx_stats_phase(config.stats, phase_start, read_ns);
+
+   if ((result = cx_dec_parse_flags(&dec, &image_info.flags)) != cifex_ok) {
+      goto err;
+   }
+
+   if ((result = cx_dec_parse_version(&dec, &image_info.version)) != cifex_ok) {
+      goto err;
+   }
+   if (image_info.version < 1) {
       result = cifex_invalid_version;
       goto err;
    } else if (image_info.version > CIFEX_FORMAT_VERSION) {
@@ -558,34 +2017,322 @@ cifex_decode(
       goto err;
    }
 
-   if ((result = cx_dec_parse_dimensions(&dec, out_image, config.allocator)) != cifex_ok) {
+   uint32_t width, height;
+   cifex_channels_t channels;
+   if (
+      (result = cx_dec_parse_dimensions(
+          &dec, config.limits.max_pixels, &width, &height, &channels)) != cifex_ok) {
+      goto err;
+   }
+   cx_stats_phase(config.stats, phase_start, header_ns);
+   if (config.stats != NULL) {
+      config.stats->pixel_count = (uint64_t)width * height;
+   }
+   if (
+      seek_index != NULL &&
+      (width != seek_index->width || height != seek_index->height ||
+       channels != seek_index->channels)) {
+      result = cifex_row_index_mismatch;
+      goto err;
+   }
+   if (build_index != NULL) {
+      if ((result = cx_begin_row_index(build_index, width, height, channels)) != cifex_ok) {
+         goto err;
+      }
+      build_index->metadata_position = dec.consumed + dec.position;
+   }
+
+   // When decoding a band, the metadata is skipped over by seeking to the band.
+   if (seek_index == NULL) {
+      bool load_metadata = (config.load_metadata && out_image_info != NULL);
+      if (
+         (result = cx_dec_parse_metadata(
+             &dec, &config.limits, &image_info, load_metadata ? config.allocator : NULL)) !=
+         cifex_ok) {
+         goto err;
+      }
+   }
+   cx_stats_phase(config.stats, phase_start, metadata_ns);
+   if (build_index != NULL) {
+      build_index->pixels_position = dec.consumed + dec.position;
+   }
+
+   // There's no point in allocating the image if decoding was cancelled while reading the header.
+   if (cx_dec_cancelled(&dec)) {
+      result = cifex_cancelled;
       goto err;
    }
 
-   bool load_metadata = (config.load_metadata && out_image_info != NULL);
+   // If decoding is stopped, storage allocated for the image by this call is freed. Storage the
+   // caller passed in, such as a stream decoder's previous image, is left alone, unless it had to
+   // be replaced or resized.
+   cifex_image_t previous_image = *out_image;
+
+   uint32_t factor = downscale != NULL ? cx_downscale_factor(downscale, width, height) : 1;
+   uint32_t out_height = cx_downscaled_size(height, factor);
+   if (sink != NULL) {
+      out_height = height > 0 ? 1 : 0;
+   } else if (seek_index != NULL) {
+      out_height = rows->row_count;
+   }
    if (
-      (result = cx_dec_parse_metadata(
-          &dec, &image_info, load_metadata ? config.allocator : NULL)) != cifex_ok) {
+      (result = cifex_alloc_image(
+          out_image,
+          config.allocator,
+          cx_downscaled_size(width, factor),
+          out_height,
+          channels)) != cifex_ok) {
       goto err;
    }
+   out_image->allocator = caller_allocator;
+   image_replaced = out_image->data != previous_image.data ||
+      out_image->width != previous_image.width || out_image->height != previous_image.height ||
+      out_image->channels != previous_image.channels;
+   if (factor > 1 && downscale->filter == cifex_downscale_box) {
+      accumulators_size = (size_t)out_image->width * channels * sizeof(uint64_t);
+      accumulators = cifex_alloc(config.allocator, accumulators_size);
+      if (accumulators == NULL) {
+         result = cifex_out_of_memory;
+         goto err;
+      }
+   }
+
+   if (sink != NULL) {
+      if ((result = sink->begin(sink, width, height, channels, &image_info)) != cifex_ok) {
+         goto err;
+      }
+   }
 
    size_t error_line = 0;
-   if ((result = cx_dec_parse_pixels(&dec, out_image, &error_line)) != cifex_ok) {
-      dec.line = error_line;
+   dec.pixels_left = (uint64_t)width * height;
+   if (sink != NULL) {
+      result = cx_dec_parse_rows(&dec, out_image, height, sink, build_index, &error_line);
+   } else if (seek_index != NULL) {
+      result = cx_dec_parse_band(&dec, rows, out_image, &error_line);
+   } else if (factor == 1) {
+      result = cx_dec_parse_pixels(&dec, out_image, &error_line);
+   } else if (downscale->filter == cifex_downscale_box) {
+      result = cx_dec_parse_pixels_box(
+         &dec, width, height, factor, accumulators, out_image, &error_line);
+   } else {
+      result = cx_dec_parse_pixels_subsample(&dec, width, height, factor, out_image, &error_line);
+   }
+   cx_stats_phase(config.stats, phase_start, pixels_ns);
+   if (result != cifex_ok) {
+      if (error_line != 0) {
+         dec.line = error_line;
+      }
+      goto err;
+   }
+
+   // The last byte read in streaming mode may still be parsed when the image goes over the limit
+   // by exactly one byte.
+   if (cx_dec_over_input_limit(&dec)) {
+      result = cifex_input_too_large;
       goto err;
    }
 
    if (out_image_info != NULL) {
+      image_info.allocator = caller_allocator;
       *out_image_info = image_info;
    }
 
    goto ok;
 
 err:
-   cifex_free(config.allocator, dec.buffer);
-   return cx_dec_error(&dec, result);
+   cifex_free_image_info(&image_info);
+   cifex_free(config.allocator, accumulators);
+   if (dec.stopped && image_replaced) {
+      cifex_free_image(out_image);
+   }
+   // Reaching the limit cuts the input off, which is what most likely made parsing fail.
+   if (dec.at_input_limit || cx_dec_over_input_limit(&dec)) {
+      result = cifex_input_too_large;
+   }
+   if (resume != NULL) {
+      *resume = dec;
+   } else {
+      cx_free_input(config.allocator, dec.buffer, buffer_aligned);
+   }
+   if (dec.read_error != 0) {
+      result = cifex_errno_result(dec.read_error);
+   }
+   cifex_decode_result_t error = cx_dec_error(&dec, result);
+   if (config.stats != NULL) {
+      config.stats->error_position = error.position;
+      config.stats->error_line = error.line;
+   }
+   return error;
 
 ok:
-   cifex_free(config.allocator, dec.buffer);
+   cifex_free(config.allocator, accumulators);
+   if (resume != NULL) {
+      *resume = dec;
+      return (cifex_decode_result_t){
+         .result = cifex_ok,
+         .position = dec.consumed + dec.position,
+         .line = 0,
+      };
+   }
+   cx_free_input(config.allocator, dec.buffer, buffer_aligned);
    return (cifex_decode_result_t){ .result = cifex_ok, .position = 0, .line = 0 };
 }
+
+cifex_decode_result_t
+cifex_decode(
+   cifex_decode_config_t config,
+   cifex_image_t *out_image,
+   cifex_image_info_t *out_image_info)
+{
+   return cx_decode(config, NULL, NULL, NULL, NULL, out_image, out_image_info);
+}
+
+cifex_decode_result_t
+cifex_decode_downscaled(
+   cifex_decode_config_t config,
+   cifex_downscale_config_t downscale,
+   cifex_image_t *out_image,
+   cifex_image_info_t *out_image_info)
+{
+   return cx_decode(config, &downscale, NULL, NULL, NULL, out_image, out_image_info);
+}
+
+cifex_decode_result_t
+cifex_decode_rows(
+   cifex_decode_config_t config,
+   cifex_row_sink_t *sink,
+   cifex_image_info_t *out_image_info)
+{
+   cx_ensure(sink != NULL, "row sink cannot be NULL");
+
+   cifex_image_t row = { 0 };
+   cifex_decode_result_t result = cx_decode(config, NULL, sink, NULL, NULL, &row, out_image_info);
+   cifex_free_image(&row);
+   return result;
+}
+
+struct cifex_stream_decoder
+{
+   cifex_decode_config_t config;
+   // The decoder, whose window and position are kept from one image to the next.
+   cx_decoder_t dec;
+   bool buffer_aligned;
+   // The result that ended the stream, after which no more images are decoded.
+   cifex_decode_result_t end;
+};
+
+cifex_result_t
+cifex_create_stream_decoder(cifex_stream_decoder_t **out_decoder, cifex_decode_config_t config)
+{
+   cx_ensure(out_decoder != NULL, "output stream decoder must not be NULL");
+   cx_ensure(config.allocator != NULL, "decoding allocator cannot be NULL");
+   cx_ensure(config.reader != NULL, "decoding reader cannot be NULL");
+
+   cifex_stream_decoder_t *decoder = cifex_alloc(config.allocator, sizeof(cifex_stream_decoder_t));
+   if (decoder == NULL) {
+      return cifex_out_of_memory;
+   }
+   decoder->config = config;
+   decoder->end = (cifex_decode_result_t){ .result = cifex_ok, .position = 0, .line = 0 };
+
+   // The input size limit applies to every image separately, and is set again for each of them, so
+   // the stream as a whole may be larger.
+   cifex_decode_config_t open_config = config;
+   open_config.limits.max_input_size = 0;
+   cifex_result_t result = cx_dec_open(&decoder->dec, open_config, &decoder->buffer_aligned);
+   if (result != cifex_ok) {
+      cifex_free(config.allocator, decoder);
+      return result;
+   }
+
+   *out_decoder = decoder;
+   return cifex_ok;
+}
+
+cifex_decode_result_t
+cifex_decode_next(
+   cifex_stream_decoder_t *decoder,
+   cifex_image_t *inout_image,
+   cifex_image_info_t *out_image_info)
+{
+   cx_ensure(decoder != NULL, "stream decoder cannot be NULL");
+
+   if (decoder->end.result != cifex_ok) {
+      return decoder->end;
+   }
+   cifex_decode_result_t result =
+      cx_decode(decoder->config, NULL, NULL, NULL, &decoder->dec, inout_image, out_image_info);
+   if (result.result != cifex_ok) {
+      decoder->end = result;
+   }
+   return result;
+}
+
+void
+cifex_destroy_stream_decoder(cifex_stream_decoder_t *decoder)
+{
+   if (decoder == NULL) {
+      return;
+   }
+   cifex_allocator_t *allocator = decoder->config.allocator;
+   cx_free_input(allocator, decoder->dec.buffer, decoder->buffer_aligned);
+   cifex_free(allocator, decoder);
+}
+
+static cifex_result_t
+cx_ignore_begin(
+   cifex_row_sink_t *sink,
+   uint32_t width,
+   uint32_t height,
+   cifex_channels_t channels,
+   const cifex_image_info_t *image_info)
+{
+   (void)sink, (void)width, (void)height, (void)channels, (void)image_info;
+   return cifex_ok;
+}
+
+static cifex_result_t
+cx_ignore_row(cifex_row_sink_t *sink, uint32_t y, const uint8_t *row)
+{
+   (void)sink, (void)y, (void)row;
+   return cifex_ok;
+}
+
+cifex_decode_result_t
+cifex_build_row_index(cifex_decode_config_t config, cifex_row_index_t *inout_index)
+{
+   cx_ensure(inout_index != NULL, "row index cannot be NULL");
+   cx_ensure(inout_index->stride > 0, "the row index must be initialized");
+
+   // Streaming keeps memory usage bounded by the image's width rather than its size.
+   if (config.stream_buffer_size == 0) {
+      config.stream_buffer_size = CX_BAND_STREAM_BUFFER_SIZE;
+   }
+   config.load_metadata = false;
+   cifex_row_sink_t sink = { .begin = cx_ignore_begin, .row = cx_ignore_row };
+   cx_dec_rows_t rows = { .build = inout_index };
+   cifex_image_t row = { 0 };
+   cifex_decode_result_t result = cx_decode(config, NULL, &sink, &rows, NULL, &row, NULL);
+   cifex_free_image(&row);
+   if (result.result != cifex_ok) {
+      cifex_free_row_index(inout_index);
+   }
+   return result;
+}
+
+cifex_decode_result_t
+cifex_decode_band(
+   cifex_decode_config_t config,
+   const cifex_row_index_t *index,
+   uint32_t first_row,
+   uint32_t row_count,
+   cifex_image_t *out_image)
+{
+   cx_ensure(index != NULL, "row index cannot be NULL");
+   cx_ensure(
+      first_row <= index->height && row_count <= index->height - first_row,
+      "the band of rows must lie within the image");
+
+   cx_dec_rows_t rows = { .seek = index, .first_row = first_row, .row_count = row_count };
+   return cx_decode(config, NULL, NULL, &rows, NULL, out_image, NULL);
+}
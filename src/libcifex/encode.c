@@ -7,6 +7,8 @@
 
 #include "cxcompilers.h"
 #include "cxensure.h"
+#include "cxrowindex.h"
+#include "cxstats.h"
 #include "cxutil.h"
 
 #define CX_BUFFER_SIZE 256
@@ -17,6 +19,8 @@ typedef struct cx_encoder
    cifex_writer_t *writer;
    uint8_t write_buffer[CX_BUFFER_SIZE];
    size_t write_buffer_len;
+   // The amount of bytes flushed to the writer so far.
+   uint64_t flushed;
 } cx_encoder_t;
 
 #define cx_enc_try(expr) \
@@ -34,6 +38,7 @@ cx_enc_flush(cx_encoder_t *enc)
       errno != 0) {
       return cifex_errno_result(errno);
    }
+   enc->flushed += enc->write_buffer_len;
    enc->write_buffer_len = 0;
 
    return cifex_ok;
@@ -238,35 +243,69 @@ cx_enc_write_number_up_to_hundreds(cx_encoder_t *enc, uint32_t number)
    return cifex_ok;
 }
 
+// Writes an amount of thousands or millions into the encoder, followed by the scale's name in the
+// grammatical form agreeing with the amount (`one` for 1, `few` for amounts ending with 2..4 other
+// than 12..14, `many` for everything else).
+static cifex_result_t
+cx_enc_write_scaled(
+   cx_encoder_t *enc,
+   uint32_t amount,
+   size_t one_len,
+   const char *one,
+   size_t few_len,
+   const char *few,
+   size_t many_len,
+   const char *many)
+{
+   cifex_result_t result;
+
+   if (amount == 1) {
+      return cx_enc_write(enc, one_len, one);
+   }
+
+   cx_enc_try(cx_enc_write_number_up_to_hundreds(enc, amount));
+   cx_try_write_string(enc, " ");
+   uint32_t ones = amount % 10;
+   uint32_t tens = amount % 100 / 10;
+   if (ones >= 2 && ones <= 4 && tens != 1) {
+      return cx_enc_write(enc, few_len, few);
+   } else {
+      return cx_enc_write(enc, many_len, many);
+   }
+}
+
 // Writes an arbitrary number into the encoder.
 static cifex_result_t
 cx_enc_write_number(cx_encoder_t *enc, uint32_t number)
 {
-   if (number > 999999) {
+   if (number > 999999999) {
       return cifex_number_too_large;
    }
 
    cifex_result_t result;
 
-   uint32_t hundreds_of_thousands = number / 1000;
-   bool had_thousands = true;
-   if (hundreds_of_thousands == 1) {
-      cx_try_write_string(enc, "tysiąc");
-   } else if (hundreds_of_thousands > 1) {
-      uint32_t thousands = hundreds_of_thousands % 10;
-      cx_enc_try(cx_enc_write_number_up_to_hundreds(enc, hundreds_of_thousands));
-      if (thousands >= 2 && thousands <= 4) {
-         cx_try_write_string(enc, " tysiące");
-      } else {
-         cx_try_write_string(enc, " tysięcy");
+   uint32_t millions = number / 1000000;
+   uint32_t thousands = number / 1000 % 1000;
+   uint32_t hundreds = number % 1000;
+
+   bool had_previous = false;
+   if (millions > 0) {
+      cx_enc_try(cx_enc_write_scaled(
+         enc, millions, cxstr("milion"), cxstr("miliony"), cxstr("milionów")));
+      had_previous = true;
+   }
+
+   if (thousands > 0) {
+      if (had_previous) {
+         cx_try_write_string(enc, " ");
       }
-   } else {
-      had_thousands = false;
+      cx_enc_try(cx_enc_write_scaled(
+         enc, thousands, cxstr("tysiąc"), cxstr("tysiące"), cxstr("tysięcy")));
+      had_previous = true;
    }
 
-   uint32_t hundreds = number % 1000;
-   if (hundreds > 0 || (hundreds_of_thousands == 0 && hundreds == 0)) {
-      if (had_thousands) {
+   if (hundreds > 0 || number == 0) {
+      if (had_previous) {
          cx_try_write_string(enc, " ");
       }
       cx_enc_try(cx_enc_write_number_up_to_hundreds(enc, hundreds));
@@ -303,16 +342,20 @@ cx_enc_dump_version(cx_encoder_t *enc, uint32_t version)
 
 // Encodes the `ROZMIAR` dimensions header.
 static cx_inline cifex_result_t
-cx_enc_dump_dimensions(cx_encoder_t *enc, const cifex_image_t *image)
+cx_enc_dump_dimensions(
+   cx_encoder_t *enc,
+   uint32_t width,
+   uint32_t height,
+   cifex_channels_t channels)
 {
    cifex_result_t result;
 
    cx_try_write_string(enc, "ROZMIAR szerokość: ");
-   cx_enc_try(cx_enc_write_number(enc, image->width));
+   cx_enc_try(cx_enc_write_number(enc, width));
    cx_try_write_string(enc, ", wysokość: ");
-   cx_enc_try(cx_enc_write_number(enc, image->height));
+   cx_enc_try(cx_enc_write_number(enc, height));
    cx_try_write_string(enc, ", bitów_na_piksel: ");
-   cx_enc_try(cx_enc_write_number(enc, image->channels * 8));
+   cx_enc_try(cx_enc_write_number(enc, channels * 8));
    cx_try_write_string(enc, "\n");
 
    return cifex_ok;
@@ -362,9 +405,13 @@ cx_enc_dump_metadata(cx_encoder_t *enc, const cifex_metadata_pair_t *first)
    return cifex_ok;
 }
 
-// Encodes the pixel data.
+// Encodes a single row of pixels.
 static cx_inline cifex_result_t
-cx_enc_dump_pixels(cx_encoder_t *enc, const cifex_image_t *image)
+cx_enc_dump_row(
+   cx_encoder_t *enc,
+   const uint8_t *row,
+   uint32_t width,
+   cifex_channels_t channels)
 {
    cifex_result_t result = cifex_ok;
    cifex_result_t expr_result;
@@ -373,35 +420,29 @@ cx_enc_dump_pixels(cx_encoder_t *enc, const cifex_image_t *image)
  if ((expr_result = (expr))) \
   result = expr_result;
 
-   switch (image->channels) {
+   switch (channels) {
       case cifex_rgb:
-         for (uint32_t y = 0; y < image->height; ++y) {
-            for (uint32_t x = 0; x < image->width; ++x) {
-               size_t offset =
-                  ((size_t)x + ((size_t)y * (size_t)image->width)) * (size_t)image->channels;
-               cx_try_branchless(cx_enc_write_number(enc, image->data[offset]));
-               cx_try_branchless(cx_enc_write(enc, cxstr("; ")));
-               cx_try_branchless(cx_enc_write_number(enc, image->data[offset + 1]));
-               cx_try_branchless(cx_enc_write(enc, cxstr("; ")));
-               cx_try_branchless(cx_enc_write_number(enc, image->data[offset + 2]));
-               cx_try_branchless(cx_enc_write(enc, cxstr("\n")));
-            }
+         for (uint32_t x = 0; x < width; ++x) {
+            const uint8_t *pixel = &row[(size_t)x * cifex_rgb];
+            cx_try_branchless(cx_enc_write_number(enc, pixel[0]));
+            cx_try_branchless(cx_enc_write(enc, cxstr("; ")));
+            cx_try_branchless(cx_enc_write_number(enc, pixel[1]));
+            cx_try_branchless(cx_enc_write(enc, cxstr("; ")));
+            cx_try_branchless(cx_enc_write_number(enc, pixel[2]));
+            cx_try_branchless(cx_enc_write(enc, cxstr("\n")));
          }
          break;
       case cifex_rgba:
-         for (uint32_t y = 0; y < image->height; ++y) {
-            for (uint32_t x = 0; x < image->width; ++x) {
-               size_t offset =
-                  ((size_t)x + ((size_t)y * (size_t)image->width)) * (size_t)image->channels;
-               cx_try_branchless(cx_enc_write_number(enc, image->data[offset]));
-               cx_try_branchless(cx_enc_write(enc, cxstr("; ")));
-               cx_try_branchless(cx_enc_write_number(enc, image->data[offset + 1]));
-               cx_try_branchless(cx_enc_write(enc, cxstr("; ")));
-               cx_try_branchless(cx_enc_write_number(enc, image->data[offset + 2]));
-               cx_try_branchless(cx_enc_write(enc, cxstr("; ")));
-               cx_try_branchless(cx_enc_write_number(enc, image->data[offset + 3]));
-               cx_try_branchless(cx_enc_write(enc, cxstr("\n")));
-            }
+         for (uint32_t x = 0; x < width; ++x) {
+            const uint8_t *pixel = &row[(size_t)x * cifex_rgba];
+            cx_try_branchless(cx_enc_write_number(enc, pixel[0]));
+            cx_try_branchless(cx_enc_write(enc, cxstr("; ")));
+            cx_try_branchless(cx_enc_write_number(enc, pixel[1]));
+            cx_try_branchless(cx_enc_write(enc, cxstr("; ")));
+            cx_try_branchless(cx_enc_write_number(enc, pixel[2]));
+            cx_try_branchless(cx_enc_write(enc, cxstr("; ")));
+            cx_try_branchless(cx_enc_write_number(enc, pixel[3]));
+            cx_try_branchless(cx_enc_write(enc, cxstr("\n")));
          }
          break;
    }
@@ -411,6 +452,40 @@ cx_enc_dump_pixels(cx_encoder_t *enc, const cifex_image_t *image)
    return result;
 }
 
+// Returns the offset of the next byte written by the encoder.
+static cx_inline uint64_t
+cx_enc_position(const cx_encoder_t *enc)
+{
+   return enc->flushed + enc->write_buffer_len;
+}
+
+// Encodes the pixel data, recording where the rows start into `index` if it's not `NULL`. The pixel
+// data starts on line `first_line`.
+static cx_inline cifex_result_t
+cx_enc_dump_pixels(
+   cx_encoder_t *enc,
+   const cifex_image_t *image,
+   cifex_row_index_t *index,
+   uint64_t first_line)
+{
+   cifex_result_t result = cifex_ok;
+
+   size_t row_size = (size_t)image->width * (size_t)image->channels;
+   for (uint32_t y = 0; y < image->height; ++y) {
+      // Every pixel is written on its own line.
+      if (index != NULL) {
+         cx_record_row(index, y, cx_enc_position(enc), first_line + (uint64_t)y * image->width);
+      }
+      cifex_result_t row_result =
+         cx_enc_dump_row(enc, &image->data[y * row_size], image->width, image->channels);
+      if (row_result != cifex_ok) {
+         result = row_result;
+      }
+   }
+
+   return result;
+}
+
 // Not too happy about this not being const. But it's not like it's public interface anyways,
 // so who cares.
 //
@@ -433,33 +508,176 @@ static const cifex_image_info_t cx_default_image_info = {
    .metadata_last = &cx_encoder_pair,
 };
 
+cifex_encode_config_t
+cifex_default_encode_config(cifex_writer_t *writer)
+{
+   return (cifex_encode_config_t){
+      .writer = writer,
+      .stats = NULL,
+      .index = NULL,
+   };
+}
+
+// Encodes all parts of an image, timing them if `stats` is not `NULL`, and filling in `index` if
+// it's not `NULL`.
+static cifex_result_t
+cx_enc_dump_image(
+   cx_encoder_t *enc,
+   const cifex_image_t *image,
+   const cifex_image_info_t *image_info,
+   cifex_stats_t *stats,
+   cifex_row_index_t *index)
+{
+   uint64_t phase_start = stats != NULL ? cx_now_ns() : 0;
+
+   cifex_result_t result = cifex_ok;
+   if (index != NULL) {
+      cx_enc_try(cx_begin_row_index(index, image->width, image->height, image->channels));
+   }
+   cx_enc_try(cx_enc_dump_flags(enc, image_info->flags));
+   cx_enc_try(cx_enc_dump_version(enc, image_info->version));
+   cx_enc_try(cx_enc_dump_dimensions(enc, image->width, image->height, image->channels));
+   cx_stats_phase(stats, phase_start, header_ns);
+   uint64_t metadata_position = cx_enc_position(enc);
+   cx_enc_try(cx_enc_dump_metadata(enc, image_info->metadata));
+   cx_stats_phase(stats, phase_start, metadata_ns);
+
+   // The flags, version, and dimensions take up a line each, followed by a line per metadata pair.
+   uint64_t pixels_line = 4;
+   for (const cifex_metadata_pair_t *pair = image_info->metadata; pair != NULL; pair = pair->next) {
+      ++pixels_line;
+   }
+   if (index != NULL) {
+      index->metadata_position = metadata_position;
+      index->pixels_position = cx_enc_position(enc);
+   }
+   cx_enc_try(cx_enc_dump_pixels(enc, image, index, pixels_line));
+   result = cx_enc_flush(enc);
+   cx_stats_phase(stats, phase_start, pixels_ns);
+   if (index != NULL) {
+      index->file_size = enc->flushed;
+   }
+
+   return result;
+}
+
 cifex_result_t
 cifex_encode(
    cifex_writer_t *writer,
    const cifex_image_t *image,
    const cifex_image_info_t *image_info)
 {
-   cx_ensure(writer != NULL, "writer cannot be NULL");
+   return cifex_encode_with_config(cifex_default_encode_config(writer), image, image_info);
+}
+
+cifex_result_t
+cifex_encode_with_config(
+   cifex_encode_config_t config,
+   const cifex_image_t *image,
+   const cifex_image_info_t *image_info)
+{
+   cx_ensure(config.writer != NULL, "writer cannot be NULL");
    cx_ensure(image != NULL, "input image cannot be NULL");
 
    if (image_info == NULL) {
       image_info = &cx_default_image_info;
    }
 
+   cx_counting_writer_t counting_writer;
+   if (config.stats != NULL) {
+      *config.stats = (cifex_stats_t){
+         .pixel_count = (uint64_t)image->width * image->height,
+      };
+      config.writer = cx_counting_writer(&counting_writer, config.writer, config.stats);
+   }
+
    cx_encoder_t enc = {
-      .writer = writer,
+      .writer = config.writer,
       .write_buffer = { 0 },
       .write_buffer_len = 0,
+      .flushed = 0,
    };
 
-   cifex_result_t result = cifex_ok;
-   cx_enc_try(cx_enc_dump_flags(&enc, image_info->flags));
-   cx_enc_try(cx_enc_dump_version(&enc, image_info->version));
-   cx_enc_try(cx_enc_dump_dimensions(&enc, image));
-   cx_enc_try(cx_enc_dump_metadata(&enc, image_info->metadata));
-   cx_enc_try(cx_enc_dump_pixels(&enc, image));
+   cifex_result_t result = cx_enc_dump_image(&enc, image, image_info, config.stats, config.index);
+   if (result != cifex_ok && config.stats != NULL) {
+      config.stats->error_position = config.stats->bytes_written + enc.write_buffer_len;
+   }
+
+   return result;
+}
+
+// The state of `cifex_canonicalize`. The header is written once the decoder has parsed it, and
+// every row is re-encoded as soon as it's decoded.
+typedef struct cx_canonicalizer
+{
+   cifex_row_sink_t sink;
+   cx_encoder_t enc;
+   uint32_t width;
+   cifex_channels_t channels;
+} cx_canonicalizer_t;
 
-   cx_enc_flush(&enc);
+static cifex_result_t
+cx_canon_begin(
+   cifex_row_sink_t *sink,
+   uint32_t width,
+   uint32_t height,
+   cifex_channels_t channels,
+   const cifex_image_info_t *image_info)
+{
+   cx_canonicalizer_t *canon = sink->user_data;
+   canon->width = width;
+   canon->channels = channels;
+
+   cifex_result_t result = cifex_ok;
+   cx_enc_try(cx_enc_dump_flags(&canon->enc, image_info->flags));
+   cx_enc_try(cx_enc_dump_version(&canon->enc, image_info->version));
+   cx_enc_try(cx_enc_dump_dimensions(&canon->enc, width, height, channels));
+   cx_enc_try(cx_enc_dump_metadata(&canon->enc, image_info->metadata));
 
    return cifex_ok;
 }
+
+static cifex_result_t
+cx_canon_row(cifex_row_sink_t *sink, uint32_t y, const uint8_t *row)
+{
+   (void)y;
+
+   cx_canonicalizer_t *canon = sink->user_data;
+   return cx_enc_dump_row(&canon->enc, row, canon->width, canon->channels);
+}
+
+cifex_decode_result_t
+cifex_canonicalize(cifex_decode_config_t config, cifex_writer_t *writer)
+{
+   cx_ensure(writer != NULL, "writer cannot be NULL");
+
+   cx_counting_writer_t counting_writer;
+   if (config.stats != NULL) {
+      writer = cx_counting_writer(&counting_writer, writer, config.stats);
+   }
+
+   cx_canonicalizer_t canon = {
+      .sink = {
+         .user_data = &canon,
+         .begin = cx_canon_begin,
+         .row = cx_canon_row,
+      },
+      .enc = {
+         .writer = writer,
+         .write_buffer = { 0 },
+         .write_buffer_len = 0,
+         .flushed = 0,
+      },
+   };
+
+   // The metadata has to be loaded to be preserved.
+   config.load_metadata = true;
+   cifex_image_info_t image_info = { 0 };
+   cifex_decode_result_t result = cifex_decode_rows(config, &canon.sink, &image_info);
+   if (result.result == cifex_ok) {
+      result.result = cx_enc_flush(&canon.enc);
+      cifex_free_image_info(&image_info);
+   }
+
+   return result;
+}
@@ -15,13 +15,22 @@ static const char *cx_result_strings[] = {
    [cifex_syntax_error] = "syntax error",
    [cifex_invalid_version] = "invalid format version (version cannot be zero)",
    [cifex_unsupported_version] = "unsupported format version. is the decoder too old?",
-   [cifex_invalid_bpp] = "invalid bits per pixel (must be 24 for RGBA or 32 for RGB)",
+   [cifex_invalid_bpp] = "invalid bits per pixel (must be 24 for RGB or 32 for RGBA)",
    [cifex_channel_out_of_range] = "channel is out of range (must be in 0..255)",
    [cifex_empty_metadata_key] = "metadata key must not be empty",
    [cifex_missing_language] = "no language flag was provided",
    [cifex_number_too_large] = "number was too large to be encoded",
    [cifex_invalid_metadata_key] = "metadata key cannot contain spaces",
    [cifex_invalid_metadata_value] = "metadata key cannot contain line feeds",
+   [cifex_image_too_large] = "image is too large to fit in memory",
+   [cifex_invalid_row_index] = "not a valid row index",
+   [cifex_row_index_mismatch] = "the row index does not match the image",
+   [cifex_end_of_stream] = "there are no more images in the stream",
+   [cifex_cancelled] = "the operation was cancelled",
+   [cifex_too_many_pixels] = "the image has more pixels than allowed",
+   [cifex_input_too_large] = "the input is larger than allowed",
+   [cifex_too_much_metadata] = "the image has more metadata than allowed",
+   [cifex_line_too_long] = "a line is longer than allowed",
 };
 
 static const char *cx_invalid_result = "<invalid result value>";
@@ -0,0 +1,486 @@
+#include "public/libcifex.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "cxensure.h"
+
+// Jobs are kept in a single queue shared by all threads. Jobs take milliseconds to run, so taking
+// them off the queue under a lock is cheap in comparison, and the queue keeps them in order.
+//
+// How much work a job is is estimated from the size of its input in bytes. Jobs below
+// `CX_SMALL_JOB_COST` are taken off the queue together with the small jobs following them, up to
+// `CX_BATCH_COST` in total, and run one after another by the same thread.
+
+#define CX_SMALL_JOB_COST ((uint64_t)64 << 10)
+#define CX_BATCH_COST ((uint64_t)256 << 10)
+
+// The cost of jobs whose input size is not known. These are never batched.
+#define CX_UNKNOWN_COST UINT64_MAX
+
+// A CIF file takes about this many bytes per byte of pixel data, which is used to estimate the
+// cost of encoding an image in terms of the decoding work it compares to. Channels take from 6
+// bytes (`zero; `) to over 25, and spelling every value from 0 to 255 once takes 22.9 bytes per
+// channel on average, as do the noise images of the benchmark corpus.
+#define CX_BYTES_PER_CHANNEL 23
+
+typedef enum cx_job_kind
+{
+   cx_job_decode,
+   cx_job_encode,
+} cx_job_kind_t;
+
+struct cifex_job
+{
+   cifex_executor_t *executor;
+   // The next job in the executor's queue, or in the batch being run.
+   cifex_job_t *next;
+
+   cx_job_kind_t kind;
+   union
+   {
+      struct
+      {
+         cifex_decode_config_t config;
+         cifex_image_t *out_image;
+         cifex_image_info_t *out_image_info;
+      } decode;
+      struct
+      {
+         cifex_encode_config_t config;
+         const cifex_image_t *image;
+         const cifex_image_info_t *image_info;
+      } encode;
+   };
+   uint64_t cost;
+
+   cifex_job_done_fn on_done;
+   void *user_data;
+   // Whether the job is freed as soon as it's done, as no one holds on to it.
+   bool detached;
+
+   cifex_decode_result_t result;
+   atomic_bool done;
+};
+
+struct cifex_executor
+{
+   cifex_allocator_t *allocator;
+   // When not `NULL`, every job submitted schedules one task with this scheduler, and no threads
+   // are started.
+   cifex_scheduler_t *scheduler;
+   pthread_t *threads;
+   uint32_t n_threads;
+
+   pthread_mutex_t mutex;
+   // Signalled when jobs are queued, or when the threads should stop.
+   pthread_cond_t work_available;
+   // Broadcast whenever a job is done.
+   pthread_cond_t job_done;
+   // Everything below is guarded by `mutex`.
+   cifex_job_t *head, *tail;
+   // The number of jobs submitted and not yet done.
+   size_t pending;
+   // The number of tasks given to the scheduler that haven't returned yet.
+   size_t scheduled;
+   bool stopping;
+};
+
+// The executor whose `on_done` callback the current thread is running, if any. Waiting for jobs
+// from a callback would deadlock, which this is used to catch.
+static _Thread_local const cifex_executor_t *cx_callback_executor;
+
+// Takes the next batch of jobs off the queue. The executor's mutex must be held.
+static cifex_job_t *
+cx_take_batch(cifex_executor_t *executor)
+{
+   cifex_job_t *first = executor->head;
+   if (first == NULL) {
+      return NULL;
+   }
+
+   cifex_job_t *last = first;
+   uint64_t total = first->cost;
+   if (first->cost < CX_SMALL_JOB_COST) {
+      while (
+         last->next != NULL && last->next->cost < CX_SMALL_JOB_COST &&
+         total + last->next->cost <= CX_BATCH_COST) {
+         last = last->next;
+         total += last->cost;
+      }
+   }
+
+   executor->head = last->next;
+   if (executor->head == NULL) {
+      executor->tail = NULL;
+   }
+   last->next = NULL;
+   return first;
+}
+
+static void
+cx_run_job(cifex_job_t *job)
+{
+   switch (job->kind) {
+      case cx_job_decode:
+         job->result =
+            cifex_decode(job->decode.config, job->decode.out_image, job->decode.out_image_info);
+         break;
+      case cx_job_encode:
+         job->result = (cifex_decode_result_t){
+            .result = cifex_encode_with_config(
+               job->encode.config, job->encode.image, job->encode.image_info),
+            .position = 0,
+            .line = 0,
+         };
+         break;
+   }
+}
+
+// Runs a batch of jobs, and marks each one done as soon as it finishes.
+static void
+cx_run_batch(cifex_executor_t *executor, cifex_job_t *batch)
+{
+   while (batch != NULL) {
+      cifex_job_t *job = batch;
+      batch = job->next;
+
+      cx_run_job(job);
+      if (job->on_done != NULL) {
+         cx_callback_executor = executor;
+         job->on_done(job->user_data, job->result);
+         cx_callback_executor = NULL;
+      }
+
+      // Once the job is marked done, its owner may free it at any moment, so nothing may touch it
+      // afterwards.
+      bool detached = job->detached;
+      pthread_mutex_lock(&executor->mutex);
+      atomic_store_explicit(&job->done, true, memory_order_release);
+      --executor->pending;
+      pthread_cond_broadcast(&executor->job_done);
+      pthread_mutex_unlock(&executor->mutex);
+      if (detached) {
+         cifex_free(executor->allocator, job);
+      }
+   }
+}
+
+static void *
+cx_executor_thread(void *user_data)
+{
+   cifex_executor_t *executor = user_data;
+
+   pthread_mutex_lock(&executor->mutex);
+   while (true) {
+      while (executor->head == NULL && !executor->stopping) {
+         pthread_cond_wait(&executor->work_available, &executor->mutex);
+      }
+      cifex_job_t *batch = cx_take_batch(executor);
+      if (batch == NULL) {
+         break;
+      }
+      pthread_mutex_unlock(&executor->mutex);
+      cx_run_batch(executor, batch);
+      pthread_mutex_lock(&executor->mutex);
+   }
+   pthread_mutex_unlock(&executor->mutex);
+
+   return NULL;
+}
+
+// A task given to the scheduler. There's one task per job, but since jobs may be batched, a task
+// may find the queue empty.
+static void
+cx_executor_task(void *task)
+{
+   cifex_executor_t *executor = task;
+
+   pthread_mutex_lock(&executor->mutex);
+   cifex_job_t *batch = cx_take_batch(executor);
+   pthread_mutex_unlock(&executor->mutex);
+   cx_run_batch(executor, batch);
+
+   pthread_mutex_lock(&executor->mutex);
+   --executor->scheduled;
+   pthread_cond_broadcast(&executor->job_done);
+   pthread_mutex_unlock(&executor->mutex);
+}
+
+static cifex_result_t
+cx_create_executor(
+   cifex_executor_t **out_executor,
+   cifex_allocator_t *allocator,
+   cifex_scheduler_t *scheduler)
+{
+   cx_ensure(out_executor != NULL, "output executor must not be NULL");
+   cx_ensure(allocator != NULL, "executor allocator must not be NULL");
+
+   cifex_executor_t *executor = cifex_alloc(allocator, sizeof(cifex_executor_t));
+   if (executor == NULL) {
+      return cifex_out_of_memory;
+   }
+   *executor = (cifex_executor_t){
+      .allocator = allocator,
+      .scheduler = scheduler,
+   };
+   pthread_mutex_init(&executor->mutex, NULL);
+   pthread_cond_init(&executor->work_available, NULL);
+   pthread_cond_init(&executor->job_done, NULL);
+
+   *out_executor = executor;
+   return cifex_ok;
+}
+
+cifex_result_t
+cifex_create_executor(
+   cifex_executor_t **out_executor,
+   cifex_allocator_t *allocator,
+   uint32_t threads)
+{
+   if (threads == 0) {
+      long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      threads = n_cpus > 0 ? (uint32_t)n_cpus : 1;
+   }
+
+   cifex_executor_t *executor;
+   cifex_result_t result = cx_create_executor(&executor, allocator, NULL);
+   if (result != cifex_ok) {
+      return result;
+   }
+   executor->threads = cifex_alloc(allocator, (size_t)threads * sizeof(pthread_t));
+   if (executor->threads == NULL) {
+      cifex_destroy_executor(executor);
+      return cifex_out_of_memory;
+   }
+
+   for (; executor->n_threads < threads; ++executor->n_threads) {
+      int err = pthread_create(
+         &executor->threads[executor->n_threads], NULL, cx_executor_thread, executor);
+      if (err != 0) {
+         // Whatever threads were started are enough to run the jobs; only having none is an error.
+         if (executor->n_threads == 0) {
+            cifex_destroy_executor(executor);
+            return cifex_errno_result(err);
+         }
+         break;
+      }
+   }
+
+   *out_executor = executor;
+   return cifex_ok;
+}
+
+cifex_result_t
+cifex_create_scheduled_executor(
+   cifex_executor_t **out_executor,
+   cifex_allocator_t *allocator,
+   cifex_scheduler_t *scheduler)
+{
+   cx_ensure(scheduler != NULL, "scheduler must not be NULL");
+   cx_ensure(scheduler->schedule != NULL, "scheduler must have a schedule function");
+
+   return cx_create_executor(out_executor, allocator, scheduler);
+}
+
+void
+cifex_destroy_executor(cifex_executor_t *executor)
+{
+   if (executor == NULL) {
+      return;
+   }
+   cx_ensure(
+      cx_callback_executor != executor, "an executor cannot be destroyed from its own callbacks");
+
+   // Scheduled tasks hold on to the executor even when there are no jobs left for them, so they
+   // have to be waited for too.
+   pthread_mutex_lock(&executor->mutex);
+   while (executor->pending > 0 || executor->scheduled > 0) {
+      pthread_cond_wait(&executor->job_done, &executor->mutex);
+   }
+   executor->stopping = true;
+   pthread_cond_broadcast(&executor->work_available);
+   pthread_mutex_unlock(&executor->mutex);
+
+   for (uint32_t i = 0; i < executor->n_threads; ++i) {
+      pthread_join(executor->threads[i], NULL);
+   }
+
+   pthread_mutex_destroy(&executor->mutex);
+   pthread_cond_destroy(&executor->work_available);
+   pthread_cond_destroy(&executor->job_done);
+   cifex_allocator_t *allocator = executor->allocator;
+   cifex_free(allocator, executor->threads);
+   cifex_free(allocator, executor);
+}
+
+// Gets the size of the rest of a seekable input, leaving the reader where it was. Returns
+// `CX_UNKNOWN_COST` if the reader can't tell.
+static uint64_t
+cx_remaining_input(cifex_reader_t *reader)
+{
+   if (reader->seek == NULL || reader->tell == NULL) {
+      return CX_UNKNOWN_COST;
+   }
+   long start = reader->tell(reader);
+   if (start < 0 || reader->seek(reader, 0, SEEK_END) != 0) {
+      return CX_UNKNOWN_COST;
+   }
+   long end = reader->tell(reader);
+   if (reader->seek(reader, start, SEEK_SET) != 0 || end < start) {
+      return CX_UNKNOWN_COST;
+   }
+   return (uint64_t)(end - start);
+}
+
+// Allocates a job, filled in with everything but what it's supposed to do.
+static cifex_job_t *
+cx_new_job(
+   cifex_executor_t *executor,
+   cifex_job_done_fn on_done,
+   void *user_data,
+   cifex_job_t **out_job)
+{
+   cifex_job_t *job = cifex_alloc(executor->allocator, sizeof(cifex_job_t));
+   if (job == NULL) {
+      return NULL;
+   }
+   *job = (cifex_job_t){
+      .executor = executor,
+      .next = NULL,
+      .on_done = on_done,
+      .user_data = user_data,
+      .detached = out_job == NULL,
+   };
+   atomic_init(&job->done, false);
+   if (out_job != NULL) {
+      *out_job = job;
+   }
+   return job;
+}
+
+// Queues a job, and wakes up a thread or schedules a task to run it.
+static void
+cx_submit(cifex_executor_t *executor, cifex_job_t *job)
+{
+   pthread_mutex_lock(&executor->mutex);
+   if (executor->tail != NULL) {
+      executor->tail->next = job;
+   } else {
+      executor->head = job;
+   }
+   executor->tail = job;
+   ++executor->pending;
+   if (executor->scheduler != NULL) {
+      ++executor->scheduled;
+   } else {
+      pthread_cond_signal(&executor->work_available);
+   }
+   pthread_mutex_unlock(&executor->mutex);
+
+   if (executor->scheduler != NULL) {
+      cifex_scheduler_t *scheduler = executor->scheduler;
+      if (!scheduler->schedule(scheduler, cx_executor_task, executor)) {
+         cx_executor_task(executor);
+      }
+   }
+}
+
+cifex_result_t
+cifex_decode_async(
+   cifex_executor_t *executor,
+   cifex_decode_config_t config,
+   cifex_image_t *out_image,
+   cifex_image_info_t *out_image_info,
+   cifex_job_done_fn on_done,
+   void *user_data,
+   cifex_job_t **out_job)
+{
+   cx_ensure(executor != NULL, "executor must not be NULL");
+   cx_ensure(config.reader != NULL, "decoding reader cannot be NULL");
+   cx_ensure(out_image != NULL, "output image cannot be NULL");
+
+   cifex_job_t *job = cx_new_job(executor, on_done, user_data, out_job);
+   if (job == NULL) {
+      return cifex_out_of_memory;
+   }
+   job->kind = cx_job_decode;
+   job->decode.config = config;
+   job->decode.out_image = out_image;
+   job->decode.out_image_info = out_image_info;
+   job->cost = cx_remaining_input(config.reader);
+
+   cx_submit(executor, job);
+   return cifex_ok;
+}
+
+cifex_result_t
+cifex_encode_async(
+   cifex_executor_t *executor,
+   cifex_encode_config_t config,
+   const cifex_image_t *image,
+   const cifex_image_info_t *image_info,
+   cifex_job_done_fn on_done,
+   void *user_data,
+   cifex_job_t **out_job)
+{
+   cx_ensure(executor != NULL, "executor must not be NULL");
+   cx_ensure(config.writer != NULL, "encoding writer cannot be NULL");
+   cx_ensure(image != NULL, "image cannot be NULL");
+
+   cifex_job_t *job = cx_new_job(executor, on_done, user_data, out_job);
+   if (job == NULL) {
+      return cifex_out_of_memory;
+   }
+   job->kind = cx_job_encode;
+   job->encode.config = config;
+   job->encode.image = image;
+   job->encode.image_info = image_info;
+   size_t storage_size = cifex_image_storage_size(image->width, image->height, image->channels);
+   job->cost = storage_size < CX_UNKNOWN_COST / CX_BYTES_PER_CHANNEL
+      ? (uint64_t)storage_size * CX_BYTES_PER_CHANNEL
+      : CX_UNKNOWN_COST;
+
+   cx_submit(executor, job);
+   return cifex_ok;
+}
+
+bool
+cifex_poll_job(const cifex_job_t *job)
+{
+   cx_ensure(job != NULL, "job must not be NULL");
+
+   return atomic_load_explicit(&job->done, memory_order_acquire);
+}
+
+cifex_decode_result_t
+cifex_wait_job(cifex_job_t *job)
+{
+   cx_ensure(job != NULL, "job must not be NULL");
+   cx_ensure(!job->detached, "jobs submitted without a handle cannot be waited for");
+   cx_ensure(
+      cx_callback_executor != job->executor,
+      "jobs cannot be waited for from their executor's callbacks");
+
+   if (!cifex_poll_job(job)) {
+      cifex_executor_t *executor = job->executor;
+      pthread_mutex_lock(&executor->mutex);
+      while (!atomic_load_explicit(&job->done, memory_order_acquire)) {
+         pthread_cond_wait(&executor->job_done, &executor->mutex);
+      }
+      pthread_mutex_unlock(&executor->mutex);
+   }
+   return job->result;
+}
+
+void
+cifex_free_job(cifex_job_t *job)
+{
+   if (job == NULL) {
+      return;
+   }
+   cifex_wait_job(job);
+   cifex_free(job->executor->allocator, job);
+}
@@ -1,11 +1,24 @@
 #include "public/libcifex.h"
 
+#include "cxalloc.h"
 #include "cxensure.h"
 #include <string.h>
 
 extern inline size_t
 cifex_image_storage_size(uint32_t width, uint32_t height, cifex_channels_t channels);
 
+// Allocates image storage. The storage is only aligned if the allocator can do it itself, so that
+// it can always be freed with `cifex_free`, like storage filled in by users is.
+static uint8_t *
+cx_alloc_image_storage(cifex_allocator_t *allocator, size_t size)
+{
+   cx_tag_next_alloc(allocator, cifex_tag_image);
+   if (allocator->aligned_alloc != NULL) {
+      return cifex_aligned_alloc(allocator, CIFEX_BUFFER_ALIGNMENT, size);
+   }
+   return cifex_alloc(allocator, size);
+}
+
 cifex_result_t
 cifex_alloc_image(
    cifex_image_t *image,
@@ -22,11 +35,14 @@ cifex_alloc_image(
       cifex_free_image(image);
       return cifex_ok;
    }
+   if (new_storage_size == SIZE_MAX) {
+      return cifex_image_too_large;
+   }
 
    size_t old_storage_size = cifex_image_storage_size(image->width, image->height, image->channels);
    if (new_storage_size > old_storage_size) {
       cifex_free(image->allocator, image->data);
-      uint8_t *data = cifex_alloc(allocator, new_storage_size);
+      uint8_t *data = cx_alloc_image_storage(allocator, new_storage_size);
       if (data == NULL) {
          cifex_free_image(image);
          return cifex_out_of_memory;
@@ -89,19 +105,30 @@ cifex_append_metadata_len(
    }
 
    // Allocate an extra byte for terminating NUL.
+   cx_tag_next_alloc(image_info->allocator, cifex_tag_metadata);
    char *key_buffer = cifex_alloc(image_info->allocator, key_len + 1);
    if (key_buffer == NULL) {
       return cifex_out_of_memory;
    }
    memcpy(key_buffer, key, key_len);
+   key_buffer[key_len] = '\0';
 
+   cx_tag_next_alloc(image_info->allocator, cifex_tag_metadata);
    char *value_buffer = cifex_alloc(image_info->allocator, value_len + 1);
    if (value_buffer == NULL) {
+      cifex_free(image_info->allocator, key_buffer);
       return cifex_out_of_memory;
    }
    memcpy(value_buffer, value, value_len);
+   value_buffer[value_len] = '\0';
 
+   cx_tag_next_alloc(image_info->allocator, cifex_tag_metadata);
    cifex_metadata_pair_t *node = cifex_alloc(image_info->allocator, sizeof(cifex_metadata_pair_t));
+   if (node == NULL) {
+      cifex_free(image_info->allocator, value_buffer);
+      cifex_free(image_info->allocator, key_buffer);
+      return cifex_out_of_memory;
+   }
    node->key = key_buffer;
    node->key_len = key_len;
    node->value = value_buffer;
@@ -0,0 +1,223 @@
+#include "public/libcifex.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "cxensure.h"
+#include "cxrowindex.h"
+
+// The `.cifidx` format. All numbers are little-endian.
+//
+//   magic              8 bytes, `CX_ROW_INDEX_MAGIC`
+//   version            u32, `CX_ROW_INDEX_VERSION`
+//   stride             u32
+//   file_size          u64
+//   width              u32
+//   height             u32
+//   channels           u32
+//   row_count          u32
+//   metadata_position  u64
+//   pixels_position    u64
+//   rows               row_count times: position u64, line u64
+
+#define CX_ROW_INDEX_MAGIC "CIFIDX\r\n"
+#define CX_ROW_INDEX_VERSION 1
+#define CX_ROW_INDEX_HEADER_SIZE 56
+#define CX_ROW_INDEX_ENTRY_SIZE 16
+
+// The number of entries read or written at a time.
+#define CX_ROW_INDEX_CHUNK 256
+
+static void
+cx_put_le32(uint8_t *out, uint32_t value)
+{
+   for (int i = 0; i < 4; ++i) {
+      out[i] = value >> (i * 8);
+   }
+}
+
+static void
+cx_put_le64(uint8_t *out, uint64_t value)
+{
+   for (int i = 0; i < 8; ++i) {
+      out[i] = value >> (i * 8);
+   }
+}
+
+static uint32_t
+cx_get_le32(const uint8_t *in)
+{
+   uint32_t value = 0;
+   for (int i = 0; i < 4; ++i) {
+      value |= (uint32_t)in[i] << (i * 8);
+   }
+   return value;
+}
+
+static uint64_t
+cx_get_le64(const uint8_t *in)
+{
+   uint64_t value = 0;
+   for (int i = 0; i < 8; ++i) {
+      value |= (uint64_t)in[i] << (i * 8);
+   }
+   return value;
+}
+
+void
+cifex_init_row_index(cifex_row_index_t *index, cifex_allocator_t *allocator, uint32_t stride)
+{
+   cx_ensure(index != NULL, "row index must not be NULL");
+   cx_ensure(allocator != NULL, "row index allocator must not be NULL");
+   cx_ensure(stride > 0, "row index stride must not be zero");
+
+   *index = (cifex_row_index_t){
+      .allocator = allocator,
+      .stride = stride,
+   };
+}
+
+void
+cifex_free_row_index(cifex_row_index_t *index)
+{
+   cx_ensure(index != NULL, "row index must not be NULL");
+
+   cifex_free(index->allocator, index->rows);
+   index->rows = NULL;
+   index->row_count = 0;
+}
+
+static cifex_result_t
+cx_write_all(cifex_writer_t *writer, const uint8_t *data, size_t len)
+{
+   errno = 0;
+   if (writer->write(writer, data, len) < len) {
+      return errno != 0 ? cifex_errno_result(errno) : cifex_errno_result(EIO);
+   }
+   return cifex_ok;
+}
+
+cifex_result_t
+cifex_write_row_index(cifex_writer_t *writer, const cifex_row_index_t *index)
+{
+   cx_ensure(writer != NULL, "writer must not be NULL");
+   cx_ensure(index != NULL, "row index must not be NULL");
+
+   uint8_t header[CX_ROW_INDEX_HEADER_SIZE];
+   memcpy(header, CX_ROW_INDEX_MAGIC, 8);
+   cx_put_le32(&header[8], CX_ROW_INDEX_VERSION);
+   cx_put_le32(&header[12], index->stride);
+   cx_put_le64(&header[16], index->file_size);
+   cx_put_le32(&header[24], index->width);
+   cx_put_le32(&header[28], index->height);
+   cx_put_le32(&header[32], index->channels);
+   cx_put_le32(&header[36], index->row_count);
+   cx_put_le64(&header[40], index->metadata_position);
+   cx_put_le64(&header[48], index->pixels_position);
+
+   cifex_result_t result;
+   if ((result = cx_write_all(writer, header, sizeof header)) != cifex_ok) {
+      return result;
+   }
+
+   uint8_t chunk[CX_ROW_INDEX_CHUNK * CX_ROW_INDEX_ENTRY_SIZE];
+   for (uint32_t first = 0; first < index->row_count; first += CX_ROW_INDEX_CHUNK) {
+      uint32_t n = index->row_count - first < CX_ROW_INDEX_CHUNK ? index->row_count - first
+                                                                 : CX_ROW_INDEX_CHUNK;
+      for (uint32_t i = 0; i < n; ++i) {
+         const cifex_row_offset_t *row = &index->rows[first + i];
+         cx_put_le64(&chunk[i * CX_ROW_INDEX_ENTRY_SIZE], row->position);
+         cx_put_le64(&chunk[i * CX_ROW_INDEX_ENTRY_SIZE + 8], row->line);
+      }
+      if ((result = cx_write_all(writer, chunk, n * CX_ROW_INDEX_ENTRY_SIZE)) != cifex_ok) {
+         return result;
+      }
+   }
+
+   return cifex_ok;
+}
+
+// Reads exactly `len` bytes. Running out of input is reported as an invalid index.
+static cifex_result_t
+cx_read_all_bytes(cifex_reader_t *reader, uint8_t *out, size_t len)
+{
+   size_t total = 0;
+   while (total < len) {
+      errno = 0;
+      size_t n_read = reader->read(reader, &out[total], len - total);
+      if (n_read == 0) {
+         return errno != 0 ? cifex_errno_result(errno) : cifex_invalid_row_index;
+      }
+      total += n_read;
+   }
+   return cifex_ok;
+}
+
+cifex_result_t
+cifex_read_row_index(
+   cifex_reader_t *reader,
+   cifex_allocator_t *allocator,
+   cifex_row_index_t *out_index)
+{
+   cx_ensure(reader != NULL, "reader must not be NULL");
+   cx_ensure(allocator != NULL, "allocator must not be NULL");
+   cx_ensure(out_index != NULL, "output row index must not be NULL");
+
+   uint8_t header[CX_ROW_INDEX_HEADER_SIZE];
+   cifex_result_t result;
+   if ((result = cx_read_all_bytes(reader, header, sizeof header)) != cifex_ok) {
+      return result;
+   }
+   uint32_t stride = cx_get_le32(&header[12]);
+   if (
+      memcmp(header, CX_ROW_INDEX_MAGIC, 8) != 0 ||
+      cx_get_le32(&header[8]) != CX_ROW_INDEX_VERSION || stride == 0) {
+      return cifex_invalid_row_index;
+   }
+
+   cifex_row_index_t index;
+   cifex_init_row_index(&index, allocator, stride);
+   index.file_size = cx_get_le64(&header[16]);
+   uint32_t width = cx_get_le32(&header[24]);
+   uint32_t height = cx_get_le32(&header[28]);
+   uint32_t channels = cx_get_le32(&header[32]);
+   index.metadata_position = cx_get_le64(&header[40]);
+   index.pixels_position = cx_get_le64(&header[48]);
+   if (
+      (channels != cifex_rgb && channels != cifex_rgba) ||
+      cx_get_le32(&header[36]) != cx_row_index_entries(height, stride) ||
+      index.metadata_position > index.pixels_position || index.pixels_position > index.file_size) {
+      return cifex_invalid_row_index;
+   }
+   if ((result = cx_begin_row_index(&index, width, height, channels)) != cifex_ok) {
+      return result;
+   }
+
+   // The entries must be in order and within the file, so that seeking to them is always sound.
+   uint64_t min_position = index.pixels_position, min_line = 1;
+   uint8_t chunk[CX_ROW_INDEX_CHUNK * CX_ROW_INDEX_ENTRY_SIZE];
+   for (uint32_t first = 0; first < index.row_count; first += CX_ROW_INDEX_CHUNK) {
+      uint32_t n = index.row_count - first < CX_ROW_INDEX_CHUNK ? index.row_count - first
+                                                                : CX_ROW_INDEX_CHUNK;
+      if ((result = cx_read_all_bytes(reader, chunk, n * CX_ROW_INDEX_ENTRY_SIZE)) != cifex_ok) {
+         cifex_free_row_index(&index);
+         return result;
+      }
+      for (uint32_t i = 0; i < n; ++i) {
+         cifex_row_offset_t *row = &index.rows[first + i];
+         row->position = cx_get_le64(&chunk[i * CX_ROW_INDEX_ENTRY_SIZE]);
+         row->line = cx_get_le64(&chunk[i * CX_ROW_INDEX_ENTRY_SIZE + 8]);
+         if (
+            row->position < min_position || row->position > index.file_size ||
+            row->line < min_line) {
+            cifex_free_row_index(&index);
+            return cifex_invalid_row_index;
+         }
+         min_position = row->position;
+         min_line = row->line;
+      }
+   }
+
+   *out_index = index;
+   return cifex_ok;
+}
@@ -2,6 +2,7 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include "cxensure.h"
 
@@ -14,6 +15,22 @@ cx_stdio_fread(cifex_reader_t *reader, void *out, size_t n_bytes)
    return fread(out, 1, n_bytes, file);
 }
 
+// Reads from a pipe or another stream that cannot be seeked in. Unlike `fread`, which waits until
+// it has all `n_bytes`, this returns whatever has arrived so far, so that the decoder doesn't wait
+// for the data following an image before returning it.
+static size_t
+cx_stdio_read_stream(cifex_reader_t *reader, void *out, size_t n_bytes)
+{
+   cx_ensure(reader->user_data != NULL, "attempt to read from closed reader");
+
+   FILE *file = reader->user_data;
+   ssize_t n_read;
+   do {
+      n_read = read(fileno(file), out, n_bytes);
+   } while (n_read < 0 && errno == EINTR);
+   return n_read > 0 ? (size_t)n_read : 0;
+}
+
 static int
 cx_stdio_fseek(cifex_reader_t *reader, long offset, int whence)
 {
@@ -48,6 +65,12 @@ cifex_fopen_read(cifex_reader_t *reader, const char *filename)
       .seek = cx_stdio_fseek,
       .tell = cx_stdio_ftell,
    };
+   // Pipes and other streams that cannot be seeked in are read like ones without `seek` and `tell`.
+   if (fseek(file, 0, SEEK_CUR) != 0) {
+      reader->read = cx_stdio_read_stream;
+      reader->seek = NULL;
+      reader->tell = NULL;
+   }
 
    return cifex_ok;
 }
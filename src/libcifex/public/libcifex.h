@@ -1,6 +1,7 @@
 #ifndef LIBCIFEX_H
 #define LIBCIFEX_H
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -44,6 +45,25 @@ typedef enum cifex_result
    cifex_invalid_metadata_key,
    /// A metadata value contained invalid characters.
    cifex_invalid_metadata_value,
+   /// The image's data would not fit in the address space.
+   cifex_image_too_large,
+   /// The file given to `cifex_read_row_index` is not a valid row index.
+   cifex_invalid_row_index,
+   /// The row index does not belong to the image being decoded, or the image changed since the
+   /// index was made.
+   cifex_row_index_mismatch,
+   /// There are no more images in the stream given to `cifex_decode_next`.
+   cifex_end_of_stream,
+   /// Decoding was cancelled through `cifex_decode_config_t.cancel`.
+   cifex_cancelled,
+   /// The image has more pixels than `cifex_decode_limits_t.max_pixels` allows.
+   cifex_too_many_pixels,
+   /// The input is larger than `cifex_decode_limits_t.max_input_size` allows.
+   cifex_input_too_large,
+   /// The image has more metadata than `cifex_decode_limits_t` allows.
+   cifex_too_much_metadata,
+   /// A line is longer than `cifex_decode_limits_t.max_line_length` allows.
+   cifex_line_too_long,
 
    cifex__last_own_result,
 
@@ -76,17 +96,67 @@ cifex_result_to_string(cifex_result_t result);
 
 struct cifex_allocator;
 
+/// Describes what an allocation made by the library is used for.
+typedef enum cifex_alloc_tag
+{
+   /// Allocations not covered by any other tag, including all allocations made by the user.
+   cifex_tag_other,
+   /// The decoder's input buffer.
+   cifex_tag_input_buffer,
+   /// Image data.
+   cifex_tag_image,
+   /// Metadata keys, values, and list nodes.
+   cifex_tag_metadata,
+
+   cifex__tag_count,
+} cifex_alloc_tag_t;
+
+/// Converts a `cifex_alloc_tag_t` to a string.
+const char *
+cifex_alloc_tag_to_string(cifex_alloc_tag_t tag);
+
 typedef void *(*cifex_malloc_fn)(struct cifex_allocator *allocator, size_t size);
 
 typedef void (*cifex_free_fn)(struct cifex_allocator *allocator, void *ptr);
 
+typedef void *(*cifex_realloc_fn)(
+   struct cifex_allocator *allocator,
+   void *ptr,
+   size_t old_size,
+   size_t new_size);
+
+typedef void *(*cifex_aligned_alloc_fn)(
+   struct cifex_allocator *allocator,
+   size_t alignment,
+   size_t size);
+
+typedef void (*cifex_tag_fn)(struct cifex_allocator *allocator, cifex_alloc_tag_t tag);
+
 /// An allocator.
 typedef struct cifex_allocator
 {
    cifex_malloc_fn malloc;
    cifex_free_fn free;
+
+   /// Optional. Resizes an allocation made with `malloc`, preserving its contents, preferably
+   /// in place. Must leave the original allocation intact on failure.
+   ///
+   /// If `NULL`, `cifex_realloc` falls back to allocating a new region and copying the data over.
+   cifex_realloc_fn realloc;
+   /// Optional. Allocates a memory region whose address is a multiple of `alignment`, which is
+   /// always a power of two. The region must be deallocatable with `free`.
+   ///
+   /// If `NULL`, `cifex_aligned_alloc` falls back to over-allocating with `malloc`.
+   cifex_aligned_alloc_fn aligned_alloc;
+   /// Optional. Called by the library right before it allocates memory, with a tag describing
+   /// what the memory is going to be used for. The tag only applies to the very next allocation.
+   cifex_tag_fn tag;
 } cifex_allocator_t;
 
+/// The alignment of the decoder's input buffer, and of image data allocated by `cifex_alloc_image`
+/// when the allocator has an `aligned_alloc`.
+#define CIFEX_BUFFER_ALIGNMENT 64
+
 /// Allocates a memory region using the allocator. Returns `NULL` if no more memory is available.
 void *
 cifex_alloc(cifex_allocator_t *allocator, size_t size);
@@ -96,10 +166,225 @@ cifex_alloc(cifex_allocator_t *allocator, size_t size);
 void
 cifex_free(cifex_allocator_t *allocator, void *ptr);
 
+/// Resizes a memory region allocated with `cifex_alloc`. Returns `NULL` if no more memory is
+/// available, in which case the original region is left untouched.
+///
+/// `old_size` must be the size the region was allocated with. If `ptr` is `NULL`, this behaves
+/// like `cifex_alloc`.
+void *
+cifex_realloc(cifex_allocator_t *allocator, void *ptr, size_t old_size, size_t new_size);
+
+/// Allocates a memory region aligned to `alignment` bytes, which must be a power of two. Returns
+/// `NULL` if no more memory is available.
+///
+/// Regions allocated with this function must be deallocated with `cifex_free_aligned` and cannot be
+/// resized with `cifex_realloc`.
+void *
+cifex_aligned_alloc(cifex_allocator_t *allocator, size_t alignment, size_t size);
+
+/// Deallocates a memory region allocated with `cifex_aligned_alloc`.
+void
+cifex_free_aligned(cifex_allocator_t *allocator, void *ptr);
+
 /// Returns the libc allocator.
 cifex_allocator_t
 cifex_libc_allocator(void);
 
+typedef struct cifex_arena_block cifex_arena_block_t;
+
+/// A bump allocator, which serves allocations out of large blocks of memory and releases them all
+/// at once with `cifex_reset_arena`.
+///
+/// `cifex_free` on memory allocated from an arena is a no-op, except for the most recent
+/// allocation, whose space is reclaimed immediately. This makes it safe to pass an arena to
+/// functions like `cifex_free_image` and `cifex_free_image_info`, and a good fit for workloads that
+/// decode an image, process it, and throw everything away before moving on to the next one.
+typedef struct cifex_arena
+{
+   /// The allocator interface of the arena. Pass `&arena.allocator` to the library.
+   ///
+   /// This must remain the first field, as the arena's callbacks cast the allocator pointer back
+   /// to the arena.
+   cifex_allocator_t allocator;
+
+   /// The allocator used for allocating new blocks once the arena runs out of space.
+   /// If `NULL`, the arena cannot grow and allocations fail once it is full.
+   cifex_allocator_t *backing;
+   /// The minimum capacity of blocks allocated from the backing allocator.
+   size_t block_size;
+
+   /// The block chain. Blocks are never released until the arena is freed, so that they can be
+   /// reused after a reset.
+   cifex_arena_block_t *first;
+   cifex_arena_block_t *current;
+   /// The most recent allocation, which can be undone by freeing it.
+   void *last_allocation;
+} cifex_arena_t;
+
+/// Creates an arena allocator.
+///
+/// If `buffer` is not `NULL`, the first `capacity` bytes of it are used as the arena's first
+/// block. The buffer is never freed by the arena. If `buffer` is `NULL`, `capacity` is only used as
+/// the size of blocks allocated from `backing`.
+///
+/// `backing` can be `NULL`, in which case the arena is limited to the provided buffer.
+cifex_arena_t
+cifex_arena_allocator(void *buffer, size_t capacity, cifex_allocator_t *backing);
+
+/// Invalidates all allocations made from the arena, making its memory available for reuse.
+///
+/// Images and image info allocated from the arena must not be used after this, and should be
+/// freed before resetting to prevent `cifex_alloc_image` from reusing their now stale storage.
+void
+cifex_reset_arena(cifex_arena_t *arena);
+
+/// Releases all blocks allocated from the arena's backing allocator.
+void
+cifex_free_arena(cifex_arena_t *arena);
+
+/// The number of buckets in an allocation size histogram. Bucket `i` counts allocations whose size
+/// is in the range `[2^i, 2^(i+1))`, except for bucket 0, which also counts zero-sized allocations.
+#define CIFEX_ALLOC_HISTOGRAM_BUCKETS 48
+
+/// Memory usage statistics of a group of allocations.
+typedef struct cifex_alloc_counters
+{
+   /// The number of bytes currently allocated.
+   size_t live_bytes;
+   /// The highest `live_bytes` has ever been.
+   size_t peak_bytes;
+   /// The sum of all allocation sizes, including memory that has since been freed.
+   size_t total_bytes;
+   size_t allocations;
+   size_t reallocations;
+   size_t deallocations;
+} cifex_alloc_counters_t;
+
+/// An allocator that forwards to another allocator, while keeping track of how much memory is
+/// allocated and what for.
+///
+/// This allocator is not thread-safe. Use one instance per thread.
+typedef struct cifex_tracking_allocator
+{
+   /// The allocator interface of the tracking allocator. Pass `&tracking.allocator` to the library.
+   ///
+   /// This must remain the first field, as the tracking allocator's callbacks cast the allocator
+   /// pointer back to the tracking allocator.
+   cifex_allocator_t allocator;
+   /// The allocator that does the actual work.
+   cifex_allocator_t *inner;
+
+   /// Statistics of all allocations.
+   cifex_alloc_counters_t total;
+   /// Statistics of allocations, grouped by their tag.
+   cifex_alloc_counters_t by_tag[cifex__tag_count];
+   /// Histogram of allocation sizes. Reallocations are counted under their new size.
+   size_t histogram[CIFEX_ALLOC_HISTOGRAM_BUCKETS];
+
+   /// The tag that will be applied to the next allocation.
+   cifex_alloc_tag_t next_tag;
+} cifex_tracking_allocator_t;
+
+/// Creates a tracking allocator wrapping the `inner` allocator.
+///
+/// Note that this adds a small header to every allocation, so memory allocated with a tracking
+/// allocator must be deallocated with the same tracking allocator.
+cifex_tracking_allocator_t
+cifex_tracking_allocator(cifex_allocator_t *inner);
+
+/// A sensible default threshold for `cifex_huge_page_allocator`.
+#define CIFEX_DEFAULT_HUGE_PAGE_THRESHOLD ((size_t)4 << 20)
+
+/// An allocator that maps large allocations directly from the operating system and asks for them
+/// to be backed by transparent huge pages, which greatly reduces the number of page faults and TLB
+/// misses when working with large images. Smaller allocations are forwarded to another allocator.
+///
+/// Huge pages are currently only supported on Linux. On other systems, all allocations are
+/// forwarded to the inner allocator.
+typedef struct cifex_huge_page_allocator
+{
+   /// The allocator interface of the huge page allocator. Pass `&huge.allocator` to the library.
+   ///
+   /// This must remain the first field, as the huge page allocator's callbacks cast the allocator
+   /// pointer back to the huge page allocator.
+   cifex_allocator_t allocator;
+   /// The allocator used for allocations smaller than the threshold.
+   cifex_allocator_t *inner;
+
+   /// Allocations of at least this many bytes are backed by huge pages.
+   size_t threshold;
+   /// Whether to fault in huge page backed memory right away, rather than on first access.
+   bool populate;
+
+   /// The tag that will be applied to the next allocation.
+   cifex_alloc_tag_t next_tag;
+} cifex_huge_page_allocator_t;
+
+/// Creates a huge page allocator wrapping the `inner` allocator.
+///
+/// Like with the tracking allocator, every allocation is prefixed with a small header, so memory
+/// allocated with a huge page allocator must be deallocated with the same huge page allocator.
+cifex_huge_page_allocator_t
+cifex_huge_page_allocator(cifex_allocator_t *inner, size_t threshold, bool populate);
+
+/// The number of size classes in a pool allocator. Allocations from 64 KiB up to 256 TiB are
+/// pooled, with four size classes for every power of two.
+#define CIFEX_POOL_SIZE_CLASSES 128
+
+/// A thread-safe allocator that keeps freed buffers around and hands them out again, so that
+/// repeatedly allocating same-sized image and input buffers doesn't go to the system allocator,
+/// and the memory stays faulted in.
+///
+/// Allocations are rounded up to the size class they fall into, and smaller than 64 KiB are
+/// forwarded to the inner allocator without pooling.
+typedef struct cifex_pool cifex_pool_t;
+
+/// Creates a pool allocating from `inner`, which must be thread-safe.
+///
+/// At most `max_retained` bytes of free buffers are kept in the pool; buffers freed past that are
+/// returned to the inner allocator.
+cifex_result_t
+cifex_create_pool(cifex_pool_t **out_pool, cifex_allocator_t *inner, size_t max_retained);
+
+/// Frees all buffers retained by the pool, as well as the pool itself.
+///
+/// All memory allocated from the pool, as well as all of its caches, must be freed before the pool
+/// is destroyed.
+void
+cifex_destroy_pool(cifex_pool_t *pool);
+
+/// Returns the allocator interface of the pool. The allocator can be shared between threads.
+cifex_allocator_t *
+cifex_pool_allocator(cifex_pool_t *pool);
+
+/// A cache in front of a pool, holding on to one free buffer per size class.
+///
+/// Caches are meant to be owned by a single thread. A thread that keeps decoding images of the same
+/// size gets its buffers back from the cache without touching any of the pool's shared state.
+typedef struct cifex_pool_cache
+{
+   /// The allocator interface of the cache. Pass `&cache.allocator` to the library.
+   ///
+   /// This must remain the first field, as the cache's callbacks cast the allocator pointer back
+   /// to the cache.
+   cifex_allocator_t allocator;
+   cifex_pool_t *pool;
+
+   /// Cached free buffers, indexed by size class.
+   void *slots[CIFEX_POOL_SIZE_CLASSES];
+   /// The tag that will be applied to the next allocation.
+   cifex_alloc_tag_t next_tag;
+} cifex_pool_cache_t;
+
+/// Creates a cache for the given pool. Memory allocated from a cache may be freed using another
+/// cache of the same pool, or the pool itself.
+cifex_pool_cache_t
+cifex_pool_cache(cifex_pool_t *pool);
+
+/// Returns all buffers held by the cache to its pool.
+void
+cifex_free_pool_cache(cifex_pool_cache_t *cache);
+
 /* --------------
    I/O facilities
    -------------- */
@@ -116,6 +401,8 @@ typedef long (*cifex_ftell_fn)(cifex_reader_t *reader);
 ///
 /// The functions in this reader are expected to exhibit behavior similar to that of libc functions,
 /// that is, they should use errno and sentinel values for error handling.
+///
+/// `seek` and `tell` can be `NULL` for streams that don't support seeking, such as pipes.
 struct cifex_reader
 {
    void *user_data;
@@ -135,7 +422,8 @@ struct cifex_writer
    cifex_fwrite_fn write;
 };
 
-/// `fopen`s a file reader.
+/// `fopen`s a file reader. The reader has no `seek` and `tell` if the file is a pipe, or anything
+/// else that cannot be seeked in. Reads from such files return whatever has arrived so far.
 cifex_result_t
 cifex_fopen_read(cifex_reader_t *reader, const char *filename);
 
@@ -180,6 +468,10 @@ typedef struct cifex_image
    ///
    /// - for `cifex_rgb`, it's 3 bytes per pixel.
    /// - for `cifex_rgba`, it's 4 bytes per pixel.
+   ///
+   /// Rows are tightly packed. The data is freed with `cifex_free`, so images filled in by hand
+   /// must be allocated with `cifex_alloc`. When allocated by `cifex_alloc_image` with an allocator
+   /// that has an `aligned_alloc`, the data is aligned to `CIFEX_BUFFER_ALIGNMENT` bytes.
    uint8_t *data;
 } cifex_image_t;
 
@@ -216,14 +508,23 @@ typedef struct cifex_image_info
 } cifex_image_info_t;
 
 /// Calculates the amount of storage needed to store the given image's data.
+///
+/// Returns `SIZE_MAX` if the size does not fit in a `size_t`.
 inline size_t
 cifex_image_storage_size(uint32_t width, uint32_t height, cifex_channels_t channels)
 {
-   return width * height * channels;
+   // A row is at most 2^32 * 4 bytes, which always fits in 64 bits.
+   uint64_t row_size = (uint64_t)width * (uint64_t)channels;
+   if (height != 0 && row_size > SIZE_MAX / height) {
+      return SIZE_MAX;
+   }
+   return (size_t)(row_size * height);
 }
 
 /// Allocates memory for the image and clears it with zeroes.
 ///
+/// Returns `cifex_image_too_large` if the image's storage size does not fit in a `size_t`.
+///
 /// This will only allocate a new image if the existing storage size does not match the provided
 /// storage size.
 ///
@@ -274,6 +575,90 @@ cifex_free_image_info(cifex_image_info_t *image_info);
    Image decoding
    -------------- */
 
+/// Statistics gathered while decoding or encoding an image.
+///
+/// Times are measured with a monotonic clock, in nanoseconds. When streaming, reading the input is
+/// interleaved with parsing, so the time spent reading is included in the phase that needed the
+/// data, and `read_ns` only covers filling the first window.
+///
+/// The counters only cover the calls the library makes through the reader, writer, and allocator
+/// it was given for the run.
+typedef struct cifex_stats
+{
+   /// Reading the input into memory. Always `0` when encoding.
+   uint64_t read_ns;
+   /// Parsing or writing the header: the flags, version, and dimensions.
+   uint64_t header_ns;
+   /// Parsing or writing the metadata.
+   uint64_t metadata_ns;
+   /// Allocating the image and parsing the pixel data, or writing the pixel data.
+   uint64_t pixels_ns;
+   /// The time spent inside the writer. This overlaps with the phases above.
+   uint64_t write_ns;
+
+   /// The amount of bytes returned by the reader, and the number of calls to it.
+   uint64_t bytes_read, read_calls;
+   /// The amount of bytes accepted by the writer, and the number of calls to it.
+   uint64_t bytes_written, write_calls;
+   /// The number of allocations and reallocations made, and the amount of bytes they requested.
+   uint64_t alloc_count, alloc_bytes;
+
+   /// The number of pixels in the image, at its full size. This is filled in as soon as the
+   /// dimensions are known, even if the run fails later.
+   uint64_t pixel_count;
+
+   /// The byte and line on which the run failed, or `0` if it succeeded or the position is not
+   /// applicable. When decoding, these are the same as in the `cifex_decode_result_t`; when
+   /// encoding, `error_position` is the offset in the output, and `error_line` is always `0`.
+   size_t error_position, error_line;
+} cifex_stats_t;
+
+typedef struct cifex_progress cifex_progress_t;
+
+typedef cifex_result_t (*cifex_progress_fn)(
+   cifex_progress_t *progress,
+   uint32_t rows_done,
+   uint32_t row_count,
+   uint64_t bytes_consumed);
+
+/// Receives reports of how far decoding has gotten.
+///
+/// Returning anything other than `cifex_ok` from `report` stops decoding, and the returned result
+/// is reported by the decoding function. The image being decoded into is then handled as it is
+/// when decoding is cancelled.
+struct cifex_progress
+{
+   void *user_data;
+   /// Called after every `interval` rows of pixels, and after the last row. `rows_done` counts the
+   /// rows parsed out of the `row_count` to be parsed, which for downscaled images are the rows of
+   /// the image at its full size. `bytes_consumed` is the offset in the input the decoder is at.
+   cifex_progress_fn report;
+   /// The number of rows between reports. Must not be `0`.
+   uint32_t interval;
+};
+
+/// Limits on the resources decoding a single image may use, for decoding untrusted input. Inputs
+/// going over a limit are rejected before any memory is allocated for them. A limit of `0` means
+/// there is no limit.
+typedef struct cifex_decode_limits
+{
+   /// The largest number of pixels an image may have. This applies to the full size of the image,
+   /// even if it's downscaled or only some of its rows are decoded.
+   uint64_t max_pixels;
+   /// The largest number of bytes an image may take up in the input. When the input is not
+   /// streamed, the whole input must not be larger than this, as it's read into memory at once.
+   /// Stream decoders apply the limit to every image separately instead, so without a window,
+   /// they read the whole stream into memory however large it is.
+   size_t max_input_size;
+   /// The largest number of metadata fields, and the largest total size of their keys and values
+   /// in bytes. These apply even when the metadata is not loaded.
+   size_t max_metadata_fields, max_metadata_size;
+   /// The length of the longest line allowed, including its keyword. Only metadata lines are not
+   /// bounded in length by the format itself, and in streaming mode they grow the window as
+   /// needed, so this mainly applies to them.
+   size_t max_line_length;
+} cifex_decode_limits_t;
+
 /// The decoding configuration.
 typedef struct cifex_decode_config
 {
@@ -285,8 +670,44 @@ typedef struct cifex_decode_config
    ///
    /// Default: `true`
    bool load_metadata;
+
+   /// When nonzero, the input is streamed through a window of about this many bytes instead of
+   /// being read into memory all at once, which bounds the decoder's memory usage regardless of the
+   /// input's size. Metadata lines longer than the window grow it as needed.
+   ///
+   /// The whole-file mode is slightly faster, and is preferable when the input fits in memory.
+   ///
+   /// Default: `0`
+   size_t stream_buffer_size;
+
+   /// When not `NULL`, this is filled in with statistics about the decoding run. Gathering them
+   /// takes a few clock reads per image, and an extra indirection per read and allocation.
+   ///
+   /// Default: `NULL`
+   cifex_stats_t *stats;
+
+   /// When not `NULL`, progress is reported to this after every few rows of pixels.
+   ///
+   /// Default: `NULL`
+   cifex_progress_t *progress;
+
+   /// When not `NULL`, this flag is checked after every row of pixels, and once it's set, decoding
+   /// stops with `cifex_cancelled`. The flag may be set from any thread, or from a signal handler.
+   ///
+   /// If the storage of the image being decoded into was allocated or resized by the call, it's
+   /// freed. Otherwise the image keeps the storage it was passed in with, such as that of a stream
+   /// decoder's previous image, though its pixels may have been partially overwritten.
+   ///
+   /// Default: `NULL`
+   const atomic_bool *cancel;
+
+   /// Limits on the size of the image being decoded.
+   ///
+   /// Default: no limits
+   cifex_decode_limits_t limits;
 } cifex_decode_config_t;
 
+/// Returns the default decoding configuration for the given allocator and reader.
 cifex_decode_config_t
 cifex_default_decode_config(cifex_allocator_t *allocator, cifex_reader_t *reader);
 
@@ -295,6 +716,8 @@ typedef struct cifex_decode_result
 {
    cifex_result_t result;
    /// Populated with the byte on which the error occured, or `0` if not applicable.
+   ///
+   /// When `cifex_decode_next` succeeds, this is the byte right after the decoded image instead.
    size_t position;
    /// Populated with the line on which the error occured, or `0` if not applicable.
    size_t line;
@@ -309,10 +732,243 @@ cifex_decode(
    cifex_image_t *out_image,
    cifex_image_info_t *out_image_info);
 
+/// How `cifex_decode_downscaled` reduces blocks of pixels into single pixels.
+typedef enum cifex_downscale_filter
+{
+   /// Each output pixel is the average of the block of input pixels it covers.
+   cifex_downscale_box,
+   /// Each output pixel is the top left pixel of the block it covers.
+   ///
+   /// The other pixels are skipped by scanning for the ends of their lines, without parsing them.
+   /// This makes subsampling a lot faster than box filtering, but it also means that the skipped
+   /// pixels are not validated.
+   cifex_downscale_subsample,
+} cifex_downscale_filter_t;
+
+/// The downscaling configuration.
+typedef struct cifex_downscale_config
+{
+   /// The factor by which the image's width and height are divided, rounding up. Blocks of
+   /// `factor` by `factor` pixels are reduced into a single pixel each.
+   ///
+   /// If `0`, the smallest factor which makes the image fit within `max_width` by `max_height` is
+   /// used instead.
+   uint32_t factor;
+
+   /// The maximum size of the output image when `factor` is `0`. A maximum of `0` means that the
+   /// given dimension is not constrained.
+   uint32_t max_width, max_height;
+
+   cifex_downscale_filter_t filter;
+} cifex_downscale_config_t;
+
+/// Decodes a downscaled version of an image into `out_image`, without ever holding the image at
+/// its full resolution in memory. Apart from the output image, box filtering only needs one row of
+/// accumulators.
+///
+/// Combined with `stream_buffer_size`, this lets thumbnails of images much larger than the
+/// available memory be generated.
+///
+/// `out_image_info` can be NULL if CIF-specific metadata isn't needed.
+cifex_decode_result_t
+cifex_decode_downscaled(
+   cifex_decode_config_t config,
+   cifex_downscale_config_t downscale,
+   cifex_image_t *out_image,
+   cifex_image_info_t *out_image_info);
+
+typedef struct cifex_row_sink cifex_row_sink_t;
+
+typedef cifex_result_t (*cifex_begin_rows_fn)(
+   cifex_row_sink_t *sink,
+   uint32_t width,
+   uint32_t height,
+   cifex_channels_t channels,
+   const cifex_image_info_t *image_info);
+
+typedef cifex_result_t (*cifex_row_fn)(cifex_row_sink_t *sink, uint32_t y, const uint8_t *row);
+
+/// Receives an image from `cifex_decode_rows`, one row at a time.
+///
+/// Returning anything other than `cifex_ok` from either function stops decoding, and the returned
+/// result is reported by `cifex_decode_rows`.
+struct cifex_row_sink
+{
+   void *user_data;
+   /// Called once the header and metadata have been parsed, before any rows are decoded.
+   /// `image_info` is only valid during the call.
+   cifex_begin_rows_fn begin;
+   /// Called for every row of pixels, from top to bottom. The row is tightly packed like the data
+   /// of a `cifex_image_t`, and is only valid during the call.
+   cifex_row_fn row;
+};
+
+/// Decodes an image row by row into `sink`, so that only a single row of pixels is held in memory
+/// at a time.
+///
+/// Decoding stops at the first row containing an error, so the rows passed to the sink up to that
+/// point are always valid.
+///
+/// `out_image_info` can be NULL if CIF-specific metadata isn't needed.
+cifex_decode_result_t
+cifex_decode_rows(
+   cifex_decode_config_t config,
+   cifex_row_sink_t *sink,
+   cifex_image_info_t *out_image_info);
+
+/// A decoder for several images written back to back into a single input, such as a stream of
+/// video frames. Images may be separated by blank lines.
+///
+/// The decoder keeps its input buffer from one image to the next, and the images are decoded into
+/// the same `cifex_image_t`, whose storage is reused as long as their size doesn't change. Without
+/// metadata, decoding an image then makes no allocations at all.
+typedef struct cifex_stream_decoder cifex_stream_decoder_t;
+
+/// Creates a stream decoder for the given configuration.
+///
+/// If `config.stream_buffer_size` is `0`, the whole input is read into memory right away, so
+/// streams that don't end, such as live feeds, must be decoded with a window. When streaming, an
+/// image is returned as soon as its last line has been read, without waiting for the input after
+/// it, as long as the reader returns whatever has arrived rather than waiting for a full read.
+/// Readers opened with `cifex_fopen_read` do that for pipes.
+cifex_result_t
+cifex_create_stream_decoder(cifex_stream_decoder_t **out_decoder, cifex_decode_config_t config);
+
+/// Decodes the next image of the stream into `inout_image`, which must be initialized with `= {0}`
+/// before the first image. On success, the result's `position` is the byte right after the image.
+///
+/// Returns `cifex_end_of_stream` when there are no images left. After that, or after an error, the
+/// stream cannot be decoded any further, and every call returns the same result. Error positions
+/// count from the beginning of the stream, and error lines from the beginning of the image.
+///
+/// If `config.stats` was given, it's filled in anew for every image.
+cifex_decode_result_t
+cifex_decode_next(
+   cifex_stream_decoder_t *decoder,
+   cifex_image_t *inout_image,
+   cifex_image_info_t *out_image_info);
+
+/// Frees the decoder and its input buffer. The reader is left open.
+void
+cifex_destroy_stream_decoder(cifex_stream_decoder_t *decoder);
+
+/* -----------
+   Row indices
+   ----------- */
+
+/// The default number of rows between the entries of a row index.
+#define CIFEX_DEFAULT_ROW_INDEX_STRIDE 64
+
+/// Where a row of pixels starts in an encoded image.
+typedef struct cifex_row_offset
+{
+   /// The byte offset of the row's first pixel.
+   uint64_t position;
+   /// The line the row's first pixel is on, counting from `1`.
+   uint64_t line;
+} cifex_row_offset_t;
+
+/// An index of where the rows of an encoded image start, which lets bands of rows be decoded
+/// without parsing the rows above them. Indices are usually stored next to the image they belong
+/// to, in `.cifidx` sidecar files.
+///
+/// Indices are filled in by `cifex_encode_with_config` at no extra cost, and can be built for
+/// existing images with `cifex_build_row_index`.
+typedef struct cifex_row_index
+{
+   /// The allocator used for `rows`.
+   cifex_allocator_t *allocator;
+
+   /// The number of rows between successive entries of `rows`.
+   uint32_t stride;
+
+   /// The size of the indexed file, which is checked to catch indices that are out of date.
+   uint64_t file_size;
+   /// The dimensions of the indexed image.
+   uint32_t width, height;
+   cifex_channels_t channels;
+
+   /// The byte offsets of the first metadata line, and of the first pixel.
+   uint64_t metadata_position, pixels_position;
+
+   /// Where rows `0`, `stride`, `2 * stride`, and so on start.
+   cifex_row_offset_t *rows;
+   uint32_t row_count;
+} cifex_row_index_t;
+
+/// Initializes an empty row index, which will record every `stride`th row.
+void
+cifex_init_row_index(cifex_row_index_t *index, cifex_allocator_t *allocator, uint32_t stride);
+
+/// Frees a row index's entries.
+///
+/// It is safe to call this on an already freed row index.
+void
+cifex_free_row_index(cifex_row_index_t *index);
+
+/// Builds the row index of an existing image, which must have been initialized with
+/// `cifex_init_row_index`. The whole image is decoded and validated in the process, but it is
+/// streamed through a window and never held in memory all at once.
+///
+/// The reader must support seeking, so that the size of the file can be recorded.
+cifex_decode_result_t
+cifex_build_row_index(cifex_decode_config_t config, cifex_row_index_t *inout_index);
+
+/// Writes a row index in the `.cifidx` format.
+cifex_result_t
+cifex_write_row_index(cifex_writer_t *writer, const cifex_row_index_t *index);
+
+/// Reads a row index in the `.cifidx` format, allocating its entries with `allocator`.
+///
+/// Returns `cifex_invalid_row_index` if the file is not a row index.
+cifex_result_t
+cifex_read_row_index(
+   cifex_reader_t *reader,
+   cifex_allocator_t *allocator,
+   cifex_row_index_t *out_index);
+
+/// Decodes `row_count` rows of an image starting at `first_row` into `out_image`, seeking straight
+/// to the closest indexed row above them. Apart from the header, at most `stride - 1` rows are
+/// skipped over before the requested ones, without checking them for validity.
+///
+/// The reader must support seeking. The input is always streamed, through a window of
+/// `stream_buffer_size` bytes, or of a default size if that is `0`.
+///
+/// Returns `cifex_row_index_mismatch` if the index does not match the image's size or dimensions.
+cifex_decode_result_t
+cifex_decode_band(
+   cifex_decode_config_t config,
+   const cifex_row_index_t *index,
+   uint32_t first_row,
+   uint32_t row_count,
+   cifex_image_t *out_image);
+
 /* --------------
    Image encoding
    -------------- */
 
+/// The encoding configuration.
+typedef struct cifex_encode_config
+{
+   cifex_writer_t *writer;
+
+   /// When not `NULL`, this is filled in with statistics about the encoding run. Gathering them
+   /// takes two clock reads per call to the writer, which is called every few hundred bytes.
+   ///
+   /// Default: `NULL`
+   cifex_stats_t *stats;
+
+   /// When not `NULL`, this row index is filled in with the offsets of the encoded image's rows.
+   /// It must have been initialized with `cifex_init_row_index`.
+   ///
+   /// Default: `NULL`
+   cifex_row_index_t *index;
+} cifex_encode_config_t;
+
+/// Returns the default encoding configuration for the given writer.
+cifex_encode_config_t
+cifex_default_encode_config(cifex_writer_t *writer);
+
 /// Encodes an image into the given writer using a canonical representation.
 /// This canonical representation uses the minimum possible amount of space while still remaining
 /// valid CIF.
@@ -328,4 +984,129 @@ cifex_encode(
    const cifex_image_t *image,
    const cifex_image_info_t *image_info);
 
+/// Same as `cifex_encode`, but with a configuration.
+cifex_result_t
+cifex_encode_with_config(
+   cifex_encode_config_t config,
+   const cifex_image_t *image,
+   const cifex_image_info_t *image_info);
+
+/// Rewrites the CIF image read by the decoder into `writer`, in the canonical representation
+/// produced by `cifex_encode`. The version, flags, and metadata of the image are preserved.
+///
+/// The image is decoded and re-encoded one row at a time, so together with `stream_buffer_size`
+/// this runs in memory bounded by the image's width and metadata, no matter how tall it is.
+/// `load_metadata` is ignored, since the metadata is always needed. If `stats` is set, the writer
+/// is counted in them too.
+///
+/// Note that in case of error, this leaves `writer` with incomplete output.
+cifex_decode_result_t
+cifex_canonicalize(cifex_decode_config_t config, cifex_writer_t *writer);
+
+/* ----------------------------------
+   Asynchronous decoding and encoding
+   ---------------------------------- */
+
+/// A task run by a `cifex_scheduler_t`.
+typedef void (*cifex_task_fn)(void *task);
+
+typedef struct cifex_scheduler cifex_scheduler_t;
+
+/// Hands a task over to the scheduler, which must call `run(task)` exactly once, on any thread.
+/// Returns `false` if the task cannot be scheduled, in which case it is run on the calling thread.
+typedef bool (*cifex_schedule_fn)(cifex_scheduler_t *scheduler, cifex_task_fn run, void *task);
+
+/// A hook for running the executor's work on the application's own threads.
+struct cifex_scheduler
+{
+   void *user_data;
+   cifex_schedule_fn schedule;
+};
+
+/// Runs decoding and encoding jobs in the background, either on a pool of threads of its own, or
+/// through the application's scheduler.
+///
+/// Jobs are run in the order they're submitted. Jobs with small inputs are run several at a time
+/// by the same thread, so that handing them over doesn't cost more than running them.
+typedef struct cifex_executor cifex_executor_t;
+
+/// Creates an executor running jobs on `threads` threads of its own, or one per online CPU if
+/// `threads` is `0`. The executor's own memory is allocated with `allocator`, which must be
+/// thread-safe.
+cifex_result_t
+cifex_create_executor(
+   cifex_executor_t **out_executor,
+   cifex_allocator_t *allocator,
+   uint32_t threads);
+
+/// Creates an executor which runs jobs through `scheduler` instead of starting threads. The
+/// scheduler must stay valid until the executor is destroyed.
+cifex_result_t
+cifex_create_scheduled_executor(
+   cifex_executor_t **out_executor,
+   cifex_allocator_t *allocator,
+   cifex_scheduler_t *scheduler);
+
+/// Waits for all submitted jobs to finish, then frees the executor and stops its threads. Jobs
+/// must be freed before the executor is destroyed.
+void
+cifex_destroy_executor(cifex_executor_t *executor);
+
+/// A job submitted to an executor.
+typedef struct cifex_job cifex_job_t;
+
+/// Called on the thread that ran a job once it's finished, before the job counts as done.
+///
+/// Since the job isn't done until this returns, and the thread running it may be needed to run
+/// other jobs, this must not wait for or free the executor's jobs, or destroy the executor. Calling
+/// `cifex_wait_job`, `cifex_free_job`, or `cifex_destroy_executor` from here deadlocks. Submitting
+/// new jobs is fine.
+///
+/// For encoding jobs, only the `result` of the result is set.
+typedef void (*cifex_job_done_fn)(void *user_data, cifex_decode_result_t result);
+
+/// Decodes an image in the background, as if by `cifex_decode`.
+///
+/// Everything the configuration points to, as well as `out_image` and `out_image_info`, must stay
+/// valid until the job is done, and must not be used by other jobs at the same time. The
+/// configuration's allocator must be thread-safe unless it's only used by this job.
+///
+/// `on_done` may be `NULL`. If `out_job` is `NULL`, the job is freed as soon as it's done, and its
+/// result is only available to `on_done`. Otherwise the job must be freed with `cifex_free_job`.
+///
+/// Returns `cifex_out_of_memory` if the job cannot be allocated, in which case nothing is run.
+cifex_result_t
+cifex_decode_async(
+   cifex_executor_t *executor,
+   cifex_decode_config_t config,
+   cifex_image_t *out_image,
+   cifex_image_info_t *out_image_info,
+   cifex_job_done_fn on_done,
+   void *user_data,
+   cifex_job_t **out_job);
+
+/// Encodes an image in the background, as if by `cifex_encode_with_config`. The same rules as for
+/// `cifex_decode_async` apply, and the image must not change until the job is done.
+cifex_result_t
+cifex_encode_async(
+   cifex_executor_t *executor,
+   cifex_encode_config_t config,
+   const cifex_image_t *image,
+   const cifex_image_info_t *image_info,
+   cifex_job_done_fn on_done,
+   void *user_data,
+   cifex_job_t **out_job);
+
+/// Returns whether the job is done, without blocking.
+bool
+cifex_poll_job(const cifex_job_t *job);
+
+/// Blocks until the job is done, and returns its result.
+cifex_decode_result_t
+cifex_wait_job(cifex_job_t *job);
+
+/// Waits for the job to be done, and frees it.
+void
+cifex_free_job(cifex_job_t *job);
+
 #endif
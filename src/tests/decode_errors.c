@@ -0,0 +1,326 @@
+// Decodes invalid images and images going over the decoding limits, both from memory and streamed
+// through a small window, checking that every one of them fails with the expected result on the
+// expected line.
+//
+// usage: decode_errors
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libcifex.h"
+
+// The window images are streamed through, which is the smallest one the decoder allows.
+#define CXT_STREAM_BUFFER_SIZE 1024
+
+// Reads from a string in memory.
+typedef struct cxt_memory
+{
+   const char *data;
+   size_t len, position;
+} cxt_memory_t;
+
+static size_t
+cxt_memory_read(cifex_reader_t *reader, void *out, size_t n_bytes)
+{
+   cxt_memory_t *memory = reader->user_data;
+   size_t n_left = memory->len - memory->position;
+   size_t n_read = n_bytes < n_left ? n_bytes : n_left;
+   memcpy(out, &memory->data[memory->position], n_read);
+   memory->position += n_read;
+   return n_read;
+}
+
+static int
+cxt_memory_seek(cifex_reader_t *reader, long offset, int whence)
+{
+   cxt_memory_t *memory = reader->user_data;
+   size_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? memory->position : memory->len;
+   if ((offset < 0 && (size_t)-offset > base) || base + offset > memory->len) {
+      return -1;
+   }
+   memory->position = base + offset;
+   return 0;
+}
+
+static long
+cxt_memory_tell(cifex_reader_t *reader)
+{
+   cxt_memory_t *memory = reader->user_data;
+   return (long)memory->position;
+}
+
+// An allocator that fails every allocation tagged with `fail_tag`.
+typedef struct cxt_failing
+{
+   cifex_allocator_t allocator;
+   cifex_alloc_tag_t fail_tag;
+   cifex_alloc_tag_t next_tag;
+} cxt_failing_t;
+
+static void *
+cxt_failing_malloc(cifex_allocator_t *allocator, size_t size)
+{
+   cxt_failing_t *failing = (cxt_failing_t *)allocator;
+   bool fail = failing->next_tag == failing->fail_tag;
+   failing->next_tag = cifex_tag_other;
+   return fail ? NULL : malloc(size);
+}
+
+static void
+cxt_failing_free(cifex_allocator_t *allocator, void *ptr)
+{
+   (void)allocator;
+   free(ptr);
+}
+
+static void
+cxt_failing_tag(cifex_allocator_t *allocator, cifex_alloc_tag_t tag)
+{
+   cxt_failing_t *failing = (cxt_failing_t *)allocator;
+   failing->next_tag = tag;
+}
+
+static cxt_failing_t
+cxt_failing_allocator(cifex_alloc_tag_t fail_tag)
+{
+   return (cxt_failing_t){
+      .allocator = {
+         .malloc = cxt_failing_malloc,
+         .free = cxt_failing_free,
+         .tag = cxt_failing_tag,
+      },
+      .fail_tag = fail_tag,
+      .next_tag = cifex_tag_other,
+   };
+}
+
+#define CXT_HEADER(bpp) \
+   "CIF: polish\n" \
+   "WERSJA jeden\n" \
+   "ROZMIAR szerokość: dwa, wysokość: jeden, bitów_na_piksel: " bpp "\n"
+
+#define CXT_PIXELS \
+   "zero; jeden; dwa\n" \
+   "trzy; cztery; pięć\n"
+
+typedef struct cxt_case
+{
+   const char *name;
+   const char *input;
+   // When not `cifex_tag_other`, allocations with this tag fail.
+   cifex_alloc_tag_t fail_tag;
+   cifex_decode_limits_t limits;
+   cifex_result_t result;
+   size_t line;
+   // The line expected when streaming, if it's different.
+   size_t stream_line;
+} cxt_case_t;
+
+static const cxt_case_t cxt_cases[] = {
+   {
+      .name = "valid",
+      .input = CXT_HEADER("dwadzieścia cztery") "METADANE klucz wartość\n" CXT_PIXELS,
+      .result = cifex_ok,
+   },
+   {
+      .name = "16 bits per pixel",
+      .input = CXT_HEADER("szesnaście") CXT_PIXELS,
+      .result = cifex_invalid_bpp,
+      .line = 3,
+   },
+   {
+      .name = "0 bits per pixel",
+      .input = CXT_HEADER("zero") CXT_PIXELS,
+      .result = cifex_invalid_bpp,
+      .line = 3,
+   },
+   {
+      .name = "out of memory for metadata",
+      .input = CXT_HEADER("dwadzieścia cztery") "METADANE klucz wartość\n" CXT_PIXELS,
+      .fail_tag = cifex_tag_metadata,
+      .result = cifex_out_of_memory,
+      .line = 4,
+   },
+   {
+      .name = "too many pixels",
+      .input = CXT_HEADER("dwadzieścia cztery") CXT_PIXELS,
+      .limits = { .max_pixels = 1 },
+      .result = cifex_too_many_pixels,
+      .line = 3,
+   },
+   {
+      .name = "exactly as many pixels as allowed",
+      .input = CXT_HEADER("dwadzieścia cztery") CXT_PIXELS,
+      .limits = { .max_pixels = 2 },
+      .result = cifex_ok,
+   },
+   {
+      // Whole inputs are rejected before they're read, and streamed ones once reading stops.
+      .name = "input too large",
+      .input = CXT_HEADER("dwadzieścia cztery") CXT_PIXELS,
+      .limits = { .max_input_size = 100 },
+      .result = cifex_input_too_large,
+      .line = 0,
+      .stream_line = 3,
+   },
+   {
+      .name = "input exactly as large as allowed",
+      .input = CXT_HEADER("dwadzieścia cztery") CXT_PIXELS,
+      .limits = { .max_input_size = sizeof(CXT_HEADER("dwadzieścia cztery") CXT_PIXELS) - 1 },
+      .result = cifex_ok,
+   },
+   {
+      .name = "too many metadata fields",
+      .input = CXT_HEADER("dwadzieścia cztery") "METADANE a b\n" "METADANE c d\n" CXT_PIXELS,
+      .limits = { .max_metadata_fields = 1 },
+      .result = cifex_too_much_metadata,
+      .line = 5,
+   },
+   {
+      // The limit applies even when the metadata isn't loaded.
+      .name = "too much metadata",
+      .input = CXT_HEADER("dwadzieścia cztery") "METADANE klucz wartość\n" CXT_PIXELS,
+      .limits = { .max_metadata_size = 5 },
+      .result = cifex_too_much_metadata,
+      .line = 4,
+   },
+   {
+      .name = "exactly as many metadata fields as allowed",
+      .input = CXT_HEADER("dwadzieścia cztery") "METADANE a b\n" "METADANE c d\n" CXT_PIXELS,
+      .limits = { .max_metadata_fields = 2 },
+      .result = cifex_ok,
+   },
+   {
+      .name = "exactly as much metadata as allowed",
+      .input = CXT_HEADER("dwadzieścia cztery") "METADANE klucz wartość\n" CXT_PIXELS,
+      .limits = { .max_metadata_size = sizeof("klucz" "wartość") - 1 },
+      .result = cifex_ok,
+   },
+   {
+      .name = "line exactly as long as allowed",
+      .input = CXT_HEADER("dwadzieścia cztery") "METADANE klucz wartość\n" CXT_PIXELS,
+      .limits = { .max_line_length = sizeof("METADANE klucz wartość") - 1 },
+      .result = cifex_ok,
+   },
+   {
+      .name = "line too long",
+      .input = CXT_HEADER("dwadzieścia cztery") "METADANE klucz wartość\n" CXT_PIXELS,
+      .limits = { .max_line_length = 16 },
+      .result = cifex_line_too_long,
+      .line = 4,
+   },
+};
+
+static bool
+cxt_run_case(const cxt_case_t *test, size_t stream_buffer_size)
+{
+   cxt_memory_t memory = { .data = test->input, .len = strlen(test->input) };
+   cifex_reader_t reader = {
+      .user_data = &memory,
+      .read = cxt_memory_read,
+      .seek = cxt_memory_seek,
+      .tell = cxt_memory_tell,
+   };
+   cifex_allocator_t libc = cifex_libc_allocator();
+   cxt_failing_t failing = cxt_failing_allocator(test->fail_tag);
+   cifex_allocator_t *allocator = test->fail_tag != cifex_tag_other ? &failing.allocator : &libc;
+
+   cifex_decode_config_t config = cifex_default_decode_config(allocator, &reader);
+   config.stream_buffer_size = stream_buffer_size;
+   config.limits = test->limits;
+   cifex_image_t image = { 0 };
+   cifex_image_info_t info;
+   cifex_init_image_info(&info, allocator);
+   cifex_decode_result_t result = cifex_decode(config, &image, &info);
+   cifex_free_image(&image);
+   cifex_free_image_info(&info);
+
+   size_t line = stream_buffer_size != 0 && test->stream_line != 0 ? test->stream_line : test->line;
+   if (result.result != test->result || result.line != line) {
+      fprintf(
+         stderr,
+         "error: %s (window of %zu): expected %s on line %zu, got %s on line %zu\n",
+         test->name,
+         stream_buffer_size,
+         cifex_result_to_string(test->result),
+         line,
+         cifex_result_to_string(result.result),
+         result.line);
+      return false;
+   }
+   return true;
+}
+
+// Decodes a stream of two images with an input size limit, which applies to each image separately.
+// Every result up to the end of the stream must match `results`.
+static bool
+cxt_run_stream(size_t max_input_size, const cifex_result_t *results, size_t stream_buffer_size)
+{
+   static const char input[] =
+      CXT_HEADER("dwadzieścia cztery") CXT_PIXELS CXT_HEADER("dwadzieścia cztery") CXT_PIXELS;
+   cxt_memory_t memory = { .data = input, .len = sizeof input - 1 };
+   cifex_reader_t reader = {
+      .user_data = &memory,
+      .read = cxt_memory_read,
+      .seek = cxt_memory_seek,
+      .tell = cxt_memory_tell,
+   };
+   cifex_allocator_t libc = cifex_libc_allocator();
+   cifex_decode_config_t config = cifex_default_decode_config(&libc, &reader);
+   config.stream_buffer_size = stream_buffer_size;
+   config.limits.max_input_size = max_input_size;
+
+   bool ok = true;
+   cifex_stream_decoder_t *decoder;
+   cifex_result_t created = cifex_create_stream_decoder(&decoder, config);
+   if (created != cifex_ok) {
+      fprintf(
+         stderr,
+         "error: stream (window of %zu): %s\n",
+         stream_buffer_size,
+         cifex_result_to_string(created));
+      return false;
+   }
+   cifex_image_t image = { 0 };
+   for (size_t i = 0; ok; ++i) {
+      cifex_decode_result_t result = cifex_decode_next(decoder, &image, NULL);
+      if (result.result != results[i]) {
+         fprintf(
+            stderr,
+            "error: stream limited to %zu bytes (window of %zu): image %zu: expected %s, got %s\n",
+            max_input_size,
+            stream_buffer_size,
+            i,
+            cifex_result_to_string(results[i]),
+            cifex_result_to_string(result.result));
+         ok = false;
+      }
+      if (result.result != cifex_ok) {
+         break;
+      }
+   }
+   cifex_free_image(&image);
+   cifex_destroy_stream_decoder(decoder);
+   return ok;
+}
+
+int
+main(void)
+{
+   unsigned failures = 0;
+   for (size_t i = 0; i < sizeof(cxt_cases) / sizeof(cxt_cases[0]); ++i) {
+      failures += !cxt_run_case(&cxt_cases[i], 0);
+      failures += !cxt_run_case(&cxt_cases[i], CXT_STREAM_BUFFER_SIZE);
+   }
+
+   // Each image fits in the limit exactly, even though the whole stream doesn't.
+   static const cifex_result_t fitting[] = { cifex_ok, cifex_ok, cifex_end_of_stream };
+   static const cifex_result_t too_large[] = { cifex_input_too_large };
+   size_t image_size = sizeof(CXT_HEADER("dwadzieścia cztery") CXT_PIXELS) - 1;
+   for (size_t window = 0; window <= CXT_STREAM_BUFFER_SIZE; window += CXT_STREAM_BUFFER_SIZE) {
+      failures += !cxt_run_stream(image_size, fitting, window);
+      failures += !cxt_run_stream(image_size - 1, too_large, window);
+   }
+   return failures != 0;
+}
@@ -0,0 +1,243 @@
+// Stops decoding through the cancellation flag and through the progress callback, both from memory
+// and streamed through a small window, and checks what's left of the image being decoded into.
+// Storage allocated for the image by the stopped call must be freed, and storage the caller passed
+// in must be kept.
+//
+// usage: decode_stop
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libcifex.h"
+
+// The window images are streamed through, which is the smallest one the decoder allows.
+#define CXT_STREAM_BUFFER_SIZE 1024
+
+#define CXT_WIDTH 16
+#define CXT_HEIGHT 16
+
+// Reads from a string in memory.
+typedef struct cxt_memory
+{
+   const uint8_t *data;
+   size_t len, position;
+} cxt_memory_t;
+
+static size_t
+cxt_memory_read(cifex_reader_t *reader, void *out, size_t n_bytes)
+{
+   cxt_memory_t *memory = reader->user_data;
+   size_t n_left = memory->len - memory->position;
+   size_t n_read = n_bytes < n_left ? n_bytes : n_left;
+   memcpy(out, &memory->data[memory->position], n_read);
+   memory->position += n_read;
+   return n_read;
+}
+
+// Writes into a growing buffer in memory.
+typedef struct cxt_buffer
+{
+   uint8_t *data;
+   size_t len, capacity;
+} cxt_buffer_t;
+
+static size_t
+cxt_buffer_write(cifex_writer_t *writer, const void *in, size_t n_bytes)
+{
+   cxt_buffer_t *buffer = writer->user_data;
+   if (buffer->len + n_bytes > buffer->capacity) {
+      size_t capacity = buffer->capacity * 2 + n_bytes;
+      uint8_t *grown = realloc(buffer->data, capacity);
+      if (grown == NULL) {
+         return 0;
+      }
+      buffer->data = grown;
+      buffer->capacity = capacity;
+   }
+   memcpy(&buffer->data[buffer->len], in, n_bytes);
+   buffer->len += n_bytes;
+   return n_bytes;
+}
+
+// How a decoding run is stopped.
+typedef enum cxt_stop
+{
+   // The flag is set before decoding starts, so the image is never allocated.
+   cxt_stop_cancel_early,
+   // The progress callback sets the flag after a few rows.
+   cxt_stop_cancel_rows,
+   // The progress callback returns an error after a few rows.
+   cxt_stop_progress_error,
+} cxt_stop_t;
+
+// The result the progress callback stops decoding with.
+#define CXT_PROGRESS_ERROR cifex_errno_result(ECANCELED)
+
+// The row after which decoding is stopped.
+#define CXT_STOP_ROW 4
+
+typedef struct cxt_progress
+{
+   cifex_progress_t progress;
+   cxt_stop_t stop;
+   atomic_bool cancel;
+} cxt_progress_t;
+
+static cifex_result_t
+cxt_report(cifex_progress_t *progress, uint32_t rows_done, uint32_t row_count, uint64_t consumed)
+{
+   (void)row_count, (void)consumed;
+   cxt_progress_t *p = (cxt_progress_t *)progress;
+   if (rows_done == CXT_STOP_ROW) {
+      if (p->stop == cxt_stop_progress_error) {
+         return CXT_PROGRESS_ERROR;
+      }
+      atomic_store(&p->cancel, true);
+   }
+   return cifex_ok;
+}
+
+static const char *const cxt_stop_names[] = {
+   [cxt_stop_cancel_early] = "cancelled before decoding",
+   [cxt_stop_cancel_rows] = "cancelled after a few rows",
+   [cxt_stop_progress_error] = "stopped by the progress callback",
+};
+
+// Decodes `text` into `image`, stopping as `stop` says, and checks the result and what's left of
+// the image. If `reuse` is set, the image is passed in with storage of the right size.
+static unsigned
+cxt_run(const cxt_buffer_t *text, cxt_stop_t stop, bool reuse, size_t stream_buffer_size)
+{
+   cifex_allocator_t libc = cifex_libc_allocator();
+   cxt_memory_t memory = { .data = text->data, .len = text->len };
+   cifex_reader_t reader = { .user_data = &memory, .read = cxt_memory_read };
+   cxt_progress_t progress = {
+      .progress = { .report = cxt_report, .interval = 1 },
+      .stop = stop,
+   };
+   atomic_init(&progress.cancel, stop == cxt_stop_cancel_early);
+
+   cifex_decode_config_t config = cifex_default_decode_config(&libc, &reader);
+   config.stream_buffer_size = stream_buffer_size;
+   config.progress = &progress.progress;
+   config.cancel = &progress.cancel;
+
+   cifex_image_t image = { 0 };
+   uint8_t *storage = NULL;
+   if (reuse) {
+      if (cifex_alloc_image(&image, &libc, CXT_WIDTH, CXT_HEIGHT, cifex_rgb) != cifex_ok) {
+         fprintf(stderr, "error: out of memory\n");
+         return 1;
+      }
+      storage = image.data;
+   }
+   cifex_decode_result_t result = cifex_decode(config, &image, NULL);
+
+   cifex_result_t expected = stop == cxt_stop_progress_error ? CXT_PROGRESS_ERROR : cifex_cancelled;
+   const char *error = NULL;
+   if (result.result != expected) {
+      error = "wrong result";
+   } else if (reuse && image.data != storage) {
+      error = "the caller's storage was not kept";
+   } else if (!reuse && image.data != NULL) {
+      error = "the storage allocated for the image was not freed";
+   }
+   cifex_free_image(&image);
+
+   if (error != NULL) {
+      fprintf(
+         stderr,
+         "error: %s, %s (window of %zu): %s: got %s\n",
+         cxt_stop_names[stop],
+         reuse ? "reusing storage" : "allocating storage",
+         stream_buffer_size,
+         error,
+         cifex_result_to_string(result.result));
+      return 1;
+   }
+   return 0;
+}
+
+// Decodes the first of two images from a stream, and cancels decoding the second one before it
+// starts. The first image's storage must survive.
+static unsigned
+cxt_run_stream(const cxt_buffer_t *text)
+{
+   cifex_allocator_t libc = cifex_libc_allocator();
+   cxt_buffer_t stream = { 0 };
+   cifex_writer_t writer = { .user_data = &stream, .write = cxt_buffer_write };
+   writer.write(&writer, text->data, text->len);
+   writer.write(&writer, text->data, text->len);
+
+   cxt_memory_t memory = { .data = stream.data, .len = stream.len };
+   cifex_reader_t reader = { .user_data = &memory, .read = cxt_memory_read };
+   atomic_bool cancel;
+   atomic_init(&cancel, false);
+   cifex_decode_config_t config = cifex_default_decode_config(&libc, &reader);
+   config.stream_buffer_size = CXT_STREAM_BUFFER_SIZE;
+   config.cancel = &cancel;
+
+   unsigned failures = 0;
+   cifex_stream_decoder_t *decoder;
+   if (cifex_create_stream_decoder(&decoder, config) != cifex_ok) {
+      fprintf(stderr, "error: cannot create the stream decoder\n");
+      free(stream.data);
+      return 1;
+   }
+   cifex_image_t image = { 0 };
+   cifex_decode_result_t result = cifex_decode_next(decoder, &image, NULL);
+   uint8_t *storage = image.data;
+   if (result.result != cifex_ok) {
+      fprintf(stderr, "error: stream: %s\n", cifex_result_to_string(result.result));
+      ++failures;
+   } else {
+      atomic_store(&cancel, true);
+      result = cifex_decode_next(decoder, &image, NULL);
+      if (result.result != cifex_cancelled || image.data != storage) {
+         fprintf(
+            stderr,
+            "error: stream: expected the previous image to be kept, got %s\n",
+            cifex_result_to_string(result.result));
+         ++failures;
+      }
+   }
+   cifex_free_image(&image);
+   cifex_destroy_stream_decoder(decoder);
+   free(stream.data);
+   return failures;
+}
+
+int
+main(void)
+{
+   cifex_allocator_t libc = cifex_libc_allocator();
+   cifex_image_t source = { 0 };
+   if (cifex_alloc_image(&source, &libc, CXT_WIDTH, CXT_HEIGHT, cifex_rgb) != cifex_ok) {
+      fprintf(stderr, "error: out of memory\n");
+      return 1;
+   }
+   for (size_t i = 0; i < (size_t)CXT_WIDTH * CXT_HEIGHT * 3; ++i) {
+      source.data[i] = (uint8_t)(i * 13);
+   }
+   cxt_buffer_t text = { 0 };
+   cifex_writer_t writer = { .user_data = &text, .write = cxt_buffer_write };
+   if (cifex_encode(&writer, &source, NULL) != cifex_ok) {
+      fprintf(stderr, "error: cannot encode the image\n");
+      return 1;
+   }
+   cifex_free_image(&source);
+
+   unsigned failures = 0;
+   for (int stop = cxt_stop_cancel_early; stop <= cxt_stop_progress_error; ++stop) {
+      for (int reuse = 0; reuse < 2; ++reuse) {
+         failures += cxt_run(&text, stop, reuse, 0);
+         failures += cxt_run(&text, stop, reuse, CXT_STREAM_BUFFER_SIZE);
+      }
+   }
+   failures += cxt_run_stream(&text);
+
+   free(text.data);
+   return failures != 0;
+}
@@ -0,0 +1,327 @@
+// Submits a mix of decoding and encoding jobs to an executor, half of them detached and half of
+// them waited for through their handles, and checks that every job ran exactly once with the right
+// output. This is done with both an executor running its own threads and one running its jobs
+// through a scheduler. Build with `-Db_sanitize=thread` to have data races reported.
+//
+// usage: executor_jobs
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libcifex.h"
+
+#define CXT_JOB_COUNT 64
+
+// Reads from a string in memory.
+typedef struct cxt_memory
+{
+   const uint8_t *data;
+   size_t len, position;
+} cxt_memory_t;
+
+static size_t
+cxt_memory_read(cifex_reader_t *reader, void *out, size_t n_bytes)
+{
+   cxt_memory_t *memory = reader->user_data;
+   size_t n_left = memory->len - memory->position;
+   size_t n_read = n_bytes < n_left ? n_bytes : n_left;
+   memcpy(out, &memory->data[memory->position], n_read);
+   memory->position += n_read;
+   return n_read;
+}
+
+static int
+cxt_memory_seek(cifex_reader_t *reader, long offset, int whence)
+{
+   cxt_memory_t *memory = reader->user_data;
+   size_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? memory->position : memory->len;
+   if ((offset < 0 && (size_t)-offset > base) || base + offset > memory->len) {
+      return -1;
+   }
+   memory->position = base + offset;
+   return 0;
+}
+
+static long
+cxt_memory_tell(cifex_reader_t *reader)
+{
+   cxt_memory_t *memory = reader->user_data;
+   return (long)memory->position;
+}
+
+// Writes into a growing buffer in memory.
+typedef struct cxt_buffer
+{
+   uint8_t *data;
+   size_t len, capacity;
+} cxt_buffer_t;
+
+static size_t
+cxt_buffer_write(cifex_writer_t *writer, const void *in, size_t n_bytes)
+{
+   cxt_buffer_t *buffer = writer->user_data;
+   if (buffer->len + n_bytes > buffer->capacity) {
+      size_t capacity = buffer->capacity * 2 + n_bytes;
+      uint8_t *grown = realloc(buffer->data, capacity);
+      if (grown == NULL) {
+         return 0;
+      }
+      buffer->data = grown;
+      buffer->capacity = capacity;
+   }
+   memcpy(&buffer->data[buffer->len], in, n_bytes);
+   buffer->len += n_bytes;
+   return n_bytes;
+}
+
+// A scheduler running every task on a thread of its own. Every few tasks are refused instead, so
+// that they're run on the thread submitting them.
+typedef struct cxt_scheduler
+{
+   cifex_scheduler_t scheduler;
+   atomic_uint scheduled;
+} cxt_scheduler_t;
+
+typedef struct cxt_task
+{
+   cifex_task_fn run;
+   void *task;
+} cxt_task_t;
+
+static void *
+cxt_run_task(void *user_data)
+{
+   cxt_task_t *task = user_data;
+   task->run(task->task);
+   free(task);
+   return NULL;
+}
+
+static bool
+cxt_schedule(cifex_scheduler_t *scheduler, cifex_task_fn run, void *task)
+{
+   cxt_scheduler_t *s = (cxt_scheduler_t *)scheduler;
+   if (atomic_fetch_add(&s->scheduled, 1) % 8 == 7) {
+      return false;
+   }
+
+   cxt_task_t *thread_task = malloc(sizeof(cxt_task_t));
+   if (thread_task == NULL) {
+      return false;
+   }
+   *thread_task = (cxt_task_t){ .run = run, .task = task };
+   pthread_attr_t attributes;
+   pthread_attr_init(&attributes);
+   pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+   pthread_t thread;
+   bool started = pthread_create(&thread, &attributes, cxt_run_task, thread_task) == 0;
+   pthread_attr_destroy(&attributes);
+   if (!started) {
+      free(thread_task);
+   }
+   return started;
+}
+
+// An image, and its encoding as produced by `cifex_encode`.
+typedef struct cxt_source
+{
+   cifex_image_t image;
+   cxt_buffer_t text;
+} cxt_source_t;
+
+typedef struct cxt_job
+{
+   const cxt_source_t *source;
+   bool encode;
+   bool detached;
+
+   cxt_memory_t input;
+   cifex_reader_t reader;
+   cifex_image_t image;
+   cxt_buffer_t output;
+   cifex_writer_t writer;
+
+   cifex_job_t *handle;
+   atomic_uint done_calls;
+   cifex_result_t done_result;
+} cxt_job_t;
+
+static void
+cxt_job_done(void *user_data, cifex_decode_result_t result)
+{
+   cxt_job_t *job = user_data;
+   job->done_result = result.result;
+   atomic_fetch_add(&job->done_calls, 1);
+}
+
+// Makes images of a few sizes. Most of them are small enough for their jobs to be batched.
+static bool
+cxt_make_sources(cifex_allocator_t *allocator, cxt_source_t *sources, size_t count)
+{
+   for (size_t i = 0; i < count; ++i) {
+      uint32_t size = i % 5 == 0 ? 64 : 2 + i % 7;
+      cifex_channels_t channels = i % 2 == 0 ? cifex_rgb : cifex_rgba;
+      sources[i] = (cxt_source_t){ .image = { 0 } };
+      if (cifex_alloc_image(&sources[i].image, allocator, size, size, channels) != cifex_ok) {
+         return false;
+      }
+      for (size_t j = 0; j < (size_t)size * size * channels; ++j) {
+         sources[i].image.data[j] = (uint8_t)(j * 31 + i * 7);
+      }
+      cifex_writer_t writer = { .user_data = &sources[i].text, .write = cxt_buffer_write };
+      if (cifex_encode(&writer, &sources[i].image, NULL) != cifex_ok) {
+         return false;
+      }
+   }
+   return true;
+}
+
+static unsigned
+cxt_check_job(const char *mode, size_t i, const cxt_job_t *job, cifex_result_t result)
+{
+   unsigned calls = atomic_load(&job->done_calls);
+   if (calls != 1) {
+      fprintf(stderr, "error: %s: job %zu finished %u times\n", mode, i, calls);
+      return 1;
+   }
+   if (result != cifex_ok || job->done_result != cifex_ok) {
+      fprintf(
+         stderr,
+         "error: %s: job %zu failed with %s\n",
+         mode,
+         i,
+         cifex_result_to_string(result != cifex_ok ? result : job->done_result));
+      return 1;
+   }
+
+   const cxt_source_t *source = job->source;
+   bool same;
+   if (job->encode) {
+      same = job->output.len == source->text.len &&
+         memcmp(job->output.data, source->text.data, source->text.len) == 0;
+   } else {
+      const cifex_image_t *image = &source->image;
+      same = job->image.width == image->width && job->image.height == image->height &&
+         job->image.channels == image->channels &&
+         memcmp(
+            job->image.data,
+            image->data,
+            cifex_image_storage_size(image->width, image->height, image->channels)) == 0;
+   }
+   if (!same) {
+      fprintf(stderr, "error: %s: job %zu produced the wrong output\n", mode, i);
+      return 1;
+   }
+   return 0;
+}
+
+static unsigned
+cxt_run_jobs(
+   const char *mode,
+   cifex_executor_t *executor,
+   cifex_allocator_t *allocator,
+   const cxt_source_t *sources)
+{
+   static cxt_job_t jobs[CXT_JOB_COUNT];
+   unsigned failures = 0;
+
+   for (size_t i = 0; i < CXT_JOB_COUNT; ++i) {
+      cxt_job_t *job = &jobs[i];
+      *job = (cxt_job_t){
+         .source = &sources[i],
+         .encode = i % 3 == 0,
+         .detached = i % 2 == 1,
+      };
+      atomic_init(&job->done_calls, 0);
+      job->input = (cxt_memory_t){ .data = sources[i].text.data, .len = sources[i].text.len };
+      job->reader = (cifex_reader_t){
+         .user_data = &job->input,
+         .read = cxt_memory_read,
+         .seek = cxt_memory_seek,
+         .tell = cxt_memory_tell,
+      };
+      job->writer = (cifex_writer_t){ .user_data = &job->output, .write = cxt_buffer_write };
+
+      cifex_job_t **out_job = job->detached ? NULL : &job->handle;
+      cifex_result_t result;
+      if (job->encode) {
+         result = cifex_encode_async(
+            executor,
+            cifex_default_encode_config(&job->writer),
+            &sources[i].image,
+            NULL,
+            cxt_job_done,
+            job,
+            out_job);
+      } else {
+         result = cifex_decode_async(
+            executor,
+            cifex_default_decode_config(allocator, &job->reader),
+            &job->image,
+            NULL,
+            cxt_job_done,
+            job,
+            out_job);
+      }
+      if (result != cifex_ok) {
+         fprintf(stderr, "error: %s: cannot submit job %zu\n", mode, i);
+         return failures + 1;
+      }
+   }
+
+   // `on_done` runs before a job counts as done, so its effects must be visible once waiting for
+   // the job returns.
+   for (size_t i = 0; i < CXT_JOB_COUNT; ++i) {
+      if (!jobs[i].detached) {
+         cifex_decode_result_t result = cifex_wait_job(jobs[i].handle);
+         failures += cxt_check_job(mode, i, &jobs[i], result.result);
+         cifex_free_job(jobs[i].handle);
+      }
+   }
+   // Detached jobs can only be waited for by destroying the executor.
+   cifex_destroy_executor(executor);
+   for (size_t i = 0; i < CXT_JOB_COUNT; ++i) {
+      if (jobs[i].detached) {
+         failures += cxt_check_job(mode, i, &jobs[i], cifex_ok);
+      }
+      cifex_free_image(&jobs[i].image);
+      free(jobs[i].output.data);
+   }
+   return failures;
+}
+
+int
+main(void)
+{
+   cifex_allocator_t libc = cifex_libc_allocator();
+   static cxt_source_t sources[CXT_JOB_COUNT];
+   if (!cxt_make_sources(&libc, sources, CXT_JOB_COUNT)) {
+      fprintf(stderr, "error: cannot make the images\n");
+      return 1;
+   }
+
+   unsigned failures = 0;
+   cifex_executor_t *executor;
+   if (cifex_create_executor(&executor, &libc, 4) != cifex_ok) {
+      fprintf(stderr, "error: cannot create the executor\n");
+      return 1;
+   }
+   failures += cxt_run_jobs("pool", executor, &libc, sources);
+
+   cxt_scheduler_t scheduler = { .scheduler = { .schedule = cxt_schedule } };
+   atomic_init(&scheduler.scheduled, 0);
+   if (cifex_create_scheduled_executor(&executor, &libc, &scheduler.scheduler) != cifex_ok) {
+      fprintf(stderr, "error: cannot create the scheduled executor\n");
+      return 1;
+   }
+   failures += cxt_run_jobs("scheduler", executor, &libc, sources);
+
+   for (size_t i = 0; i < CXT_JOB_COUNT; ++i) {
+      cifex_free_image(&sources[i].image);
+      free(sources[i].text.data);
+   }
+   return failures != 0;
+}
@@ -0,0 +1,422 @@
+// Compares the two-stage pixel parser against the regular one, which tries every word in turn, on
+// randomly generated pixel data. Most of the pixels are written the usual way, in runs of repeated
+// pixels and in noise, and some are written in the lenient or invalid ways the two-stage parser
+// leaves to the regular one. Both parsers must produce the same pixels, fail with the same result
+// on the same line, and stop at the same place, both when decoding from memory and when streaming.
+//
+// usage: pixel_parsers [images]
+//
+// The library's sources are included directly, so that its internal functions can be called.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../libcifex/decode.c"
+
+// The window the pixels are streamed through. Small windows make the pixels cross the window's end
+// often.
+#define CXT_STREAM_BUFFER_SIZE 1024
+
+#define CXT_MAX_WIDTH 48
+#define CXT_MAX_HEIGHT 32
+
+static uint32_t
+cxt_random(uint64_t *rng)
+{
+   *rng ^= *rng << 13;
+   *rng ^= *rng >> 7;
+   *rng ^= *rng << 17;
+   return (uint32_t)(*rng >> 32);
+}
+
+// Returns whether an event with a probability of 1 in `n` happened.
+static bool
+cxt_chance(uint64_t *rng, uint32_t n)
+{
+   return n != 0 && cxt_random(rng) % n == 0;
+}
+
+// A growable string.
+typedef struct cxt_text
+{
+   char *data;
+   size_t len, capacity;
+} cxt_text_t;
+
+static void
+cxt_append(cxt_text_t *text, const char *str)
+{
+   size_t len = strlen(str);
+   if (text->len + len > text->capacity) {
+      text->capacity = (text->len + len) * 2;
+      text->data = realloc(text->data, text->capacity);
+      if (text->data == NULL) {
+         fprintf(stderr, "error: out of memory\n");
+         exit(1);
+      }
+   }
+   memcpy(&text->data[text->len], str, len);
+   text->len += len;
+}
+
+static const char *cxt_ones[] = {
+   "", "jeden", "dwa", "trzy", "cztery", "pięć", "sześć", "siedem", "osiem", "dziewięć",
+};
+static const char *cxt_teens[] = {
+   "dziesięć",    "jedenaście",   "dwanaście",     "trzynaście",   "czternaście",
+   "piętnaście",  "szesnaście",   "siedemnaście",  "osiemnaście",  "dziewiętnaście",
+};
+static const char *cxt_tens[] = {
+   "",
+   "",
+   "dwadzieścia",
+   "trzydzieści",
+   "czterdzieści",
+   "pięćdziesiąt",
+   "sześćdziesiąt",
+   "siedemdziesiąt",
+   "osiemdziesiąt",
+   "dziewięćdziesiąt",
+};
+static const char *cxt_hundreds[] = {
+   "",        "sto",      "dwieście", "trzysta",   "czterysta",
+   "pięćset", "sześćset", "siedemset", "osiemset", "dziewięćset",
+};
+
+// Words that aren't numbers, or are numbers the pixel parser doesn't accept.
+static const char *cxt_bad_words[] = {
+   "zer", "zeroo", "dwą", "sto\tdwa", "tysiąc", "milion", "Jeden", "jeden;", "",
+};
+
+// How the pixels of an image are written.
+typedef struct cxt_style
+{
+   // A new pixel is picked with a probability of 1 in `repeats`, and the last one is repeated
+   // otherwise.
+   uint32_t repeats;
+
+   // The rest are the kinds of unusual pixels written in an image. Each is written with a
+   // probability of 1 in its field, or never if the field is `0`.
+   // Words separated by more than one space.
+   uint32_t extra_spaces;
+   // Pixels followed by more than one line feed.
+   uint32_t extra_lfs;
+   // Channels separated by a semicolon without a space, or with more than one.
+   uint32_t odd_semicolons;
+   // Spaces at the end of the line.
+   uint32_t trailing_spaces;
+   // Words that aren't numbers.
+   uint32_t bad_words;
+   // Words in the wrong order, such as "jeden sto".
+   uint32_t misordered;
+   // Channels above 255.
+   uint32_t out_of_range;
+   // Channels that are missing.
+   uint32_t missing_channels;
+} cxt_style_t;
+
+// Picks a random style. A quarter of the images are written the usual way, and the rest have some
+// pixels written differently, most of them rarely enough that many blocks are still written the
+// usual way.
+static cxt_style_t
+cxt_random_style(uint64_t *rng, bool usual)
+{
+   static const uint32_t repeats[] = { 1, 2, 8, 200 };
+   uint32_t odds[8] = { 0 };
+   for (size_t i = 0; i < 8 && !usual; ++i) {
+      odds[i] = cxt_chance(rng, 3) ? 50 + cxt_random(rng) % 2000 : 0;
+   }
+   return (cxt_style_t){
+      .repeats = repeats[cxt_random(rng) % 4],
+      .extra_spaces = odds[0],
+      .extra_lfs = odds[1],
+      .odd_semicolons = odds[2],
+      .trailing_spaces = odds[3],
+      .bad_words = odds[4],
+      .misordered = odds[5],
+      .out_of_range = odds[6],
+      .missing_channels = odds[7],
+   };
+}
+
+// Spells out a channel, applying the style's word-level changes.
+static void
+cxt_write_channel(cxt_text_t *text, uint32_t value, const cxt_style_t *style, uint64_t *rng)
+{
+   if (cxt_chance(rng, style->bad_words)) {
+      cxt_append(text, cxt_bad_words[cxt_random(rng) % (sizeof(cxt_bad_words) / sizeof(char *))]);
+      return;
+   }
+   if (cxt_chance(rng, style->out_of_range)) {
+      value = 256 + cxt_random(rng) % 744;
+   }
+   if (value == 0) {
+      cxt_append(text, "zero");
+      return;
+   }
+
+   const char *words[3];
+   size_t count = 0;
+   if (value >= 100) {
+      words[count++] = cxt_hundreds[value / 100];
+   }
+   if (value % 100 >= 10 && value % 100 < 20) {
+      words[count++] = cxt_teens[value % 10];
+   } else {
+      if (value % 100 >= 20) {
+         words[count++] = cxt_tens[value % 100 / 10];
+      }
+      if (value % 10 != 0) {
+         words[count++] = cxt_ones[value % 10];
+      }
+   }
+   if (count > 1 && cxt_chance(rng, style->misordered)) {
+      const char *first = words[0];
+      words[0] = words[count - 1];
+      words[count - 1] = first;
+   }
+
+   for (size_t i = 0; i < count; ++i) {
+      if (i != 0) {
+         cxt_append(text, cxt_chance(rng, style->extra_spaces) ? "   " : " ");
+      }
+      cxt_append(text, words[i]);
+   }
+}
+
+// Writes the pixels of a `width` by `height` image.
+static void
+cxt_write_pixels(
+   cxt_text_t *text,
+   uint32_t width,
+   uint32_t height,
+   cifex_channels_t channels,
+   const cxt_style_t *style,
+   uint64_t *rng)
+{
+   uint32_t pixel[4] = { 0 };
+   for (uint64_t i = 0; i < (uint64_t)width * height; ++i) {
+      if (i == 0 || cxt_chance(rng, style->repeats)) {
+         for (int c = 0; c < channels; ++c) {
+            // Mostly small values, so that the words are short and many of them fit in a block.
+            pixel[c] = cxt_chance(rng, 4) ? cxt_random(rng) % 256 : cxt_random(rng) % 4;
+         }
+      }
+      for (int c = 0; c < channels; ++c) {
+         if (c != 0) {
+            if (cxt_chance(rng, style->missing_channels)) {
+               break;
+            }
+            if (cxt_chance(rng, style->odd_semicolons)) {
+               cxt_append(text, cxt_chance(rng, 2) ? ";" : ";  ");
+            } else {
+               cxt_append(text, "; ");
+            }
+         }
+         cxt_write_channel(text, pixel[c], style, rng);
+      }
+      if (cxt_chance(rng, style->trailing_spaces)) {
+         cxt_append(text, " ");
+      }
+      cxt_append(text, cxt_chance(rng, style->extra_lfs) ? "\n\n\n" : "\n");
+   }
+}
+
+// Reads from a string in memory.
+typedef struct cxt_memory
+{
+   const char *data;
+   size_t len, position;
+} cxt_memory_t;
+
+static size_t
+cxt_memory_read(cifex_reader_t *reader, void *out, size_t n_bytes)
+{
+   cxt_memory_t *memory = reader->user_data;
+   size_t n_left = memory->len - memory->position;
+   size_t n_read = n_bytes < n_left ? n_bytes : n_left;
+   memcpy(out, &memory->data[memory->position], n_read);
+   memory->position += n_read;
+   return n_read;
+}
+
+static int
+cxt_memory_seek(cifex_reader_t *reader, long offset, int whence)
+{
+   cxt_memory_t *memory = reader->user_data;
+   size_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? memory->position : memory->len;
+   if ((offset < 0 && (size_t)-offset > base) || base + offset > memory->len) {
+      return -1;
+   }
+   memory->position = base + offset;
+   return 0;
+}
+
+static long
+cxt_memory_tell(cifex_reader_t *reader)
+{
+   cxt_memory_t *memory = reader->user_data;
+   return (long)memory->position;
+}
+
+// The allocator used for everything. Images keep a pointer to it, so it must outlive them.
+static cifex_allocator_t cxt_allocator;
+
+// The outcome of parsing an image's pixels.
+typedef struct cxt_outcome
+{
+   cifex_result_t result;
+   size_t error_line;
+   // Where the parser stopped.
+   size_t position, line;
+   cifex_image_t image;
+} cxt_outcome_t;
+
+// Parses the pixels of an image with the regular parser only, like `cx_dec_parse_pixels__inline`
+// does with the two-stage one.
+static cifex_result_t
+cxt_parse_pixels_scalar(
+   cx_decoder_t *dec,
+   cifex_image_t *inout_image,
+   bool streaming,
+   size_t *out_error_line)
+{
+   size_t syntax_error = 0;
+   size_t range_error = 0;
+   cifex_channels_t channels = inout_image->channels;
+   uint8_t *out = inout_image->data;
+   for (uint64_t i = 0; i < (uint64_t)inout_image->width * inout_image->height; ++i) {
+      uint32_t pixel[4];
+      if (streaming) {
+         --dec->pixels_left;
+      }
+      if (!cx_dec_parse_pixel_scalar(dec, channels, pixel, streaming)) {
+         syntax_error = dec->line;
+      }
+      if (!cx_pixel_in_range(channels, pixel)) {
+         range_error = dec->line;
+      }
+      for (int c = 0; c < channels; ++c) {
+         *out++ = pixel[c];
+      }
+   }
+   return cx_dec_pixel_errors(syntax_error, range_error, out_error_line);
+}
+
+static cxt_outcome_t
+cxt_parse(
+   const cxt_text_t *text,
+   uint32_t width,
+   uint32_t height,
+   cifex_channels_t channels,
+   size_t stream_buffer_size,
+   bool scalar)
+{
+   cxt_memory_t memory = { .data = text->data, .len = text->len };
+   cifex_reader_t reader = {
+      .user_data = &memory,
+      .read = cxt_memory_read,
+      .seek = cxt_memory_seek,
+      .tell = cxt_memory_tell,
+   };
+   cifex_decode_config_t config = cifex_default_decode_config(&cxt_allocator, &reader);
+   config.stream_buffer_size = stream_buffer_size;
+
+   cxt_outcome_t outcome = { 0 };
+   cx_decoder_t dec;
+   bool aligned;
+   outcome.result = cx_dec_open(&dec, config, &aligned);
+   if (outcome.result == cifex_ok) {
+      outcome.result =
+         cifex_alloc_image(&outcome.image, &cxt_allocator, width, height, channels);
+   }
+   if (outcome.result != cifex_ok) {
+      fprintf(stderr, "error: %s\n", cifex_result_to_string(outcome.result));
+      exit(1);
+   }
+
+   dec.pixels_left = (uint64_t)width * height;
+   outcome.result = scalar
+      ? cxt_parse_pixels_scalar(&dec, &outcome.image, cx_dec_streaming(&dec), &outcome.error_line)
+      : cx_dec_parse_pixels(&dec, &outcome.image, &outcome.error_line);
+   outcome.position = dec.consumed + dec.position;
+   outcome.line = dec.line;
+   cx_free_input(&cxt_allocator, dec.buffer, aligned);
+   return outcome;
+}
+
+// Parses an image's pixels with both parsers, and reports any difference between them.
+static bool
+cxt_compare(
+   const cxt_text_t *text,
+   uint32_t width,
+   uint32_t height,
+   cifex_channels_t channels,
+   size_t stream_buffer_size,
+   uint32_t seed)
+{
+   cxt_outcome_t expected = cxt_parse(text, width, height, channels, stream_buffer_size, true);
+   cxt_outcome_t actual = cxt_parse(text, width, height, channels, stream_buffer_size, false);
+
+   const char *difference = NULL;
+   if (actual.result != expected.result || actual.error_line != expected.error_line) {
+      difference = "result";
+   } else if (actual.position != expected.position || actual.line != expected.line) {
+      difference = "end position";
+   } else if (
+      memcmp(
+         actual.image.data,
+         expected.image.data,
+         cifex_image_storage_size(width, height, channels)) != 0) {
+      difference = "pixels";
+   }
+   if (difference != NULL) {
+      fprintf(
+         stderr,
+         "error: image %u (%ux%u, %d channels, window of %zu): the %s differs: expected %s on line "
+         "%zu, got %s on line %zu\n",
+         seed,
+         width,
+         height,
+         channels,
+         stream_buffer_size,
+         difference,
+         cifex_result_to_string(expected.result),
+         expected.error_line,
+         cifex_result_to_string(actual.result),
+         actual.error_line);
+   }
+
+   cifex_free_image(&expected.image);
+   cifex_free_image(&actual.image);
+   return difference == NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+   uint32_t image_count = argc > 1 ? (uint32_t)atoi(argv[1]) : 2000;
+   cxt_allocator = cifex_libc_allocator();
+
+   unsigned failures = 0;
+   for (uint32_t seed = 0; seed < image_count; ++seed) {
+      uint64_t rng = 0x9E3779B97F4A7C15u * (seed + 1);
+      uint32_t width = 1 + cxt_random(&rng) % CXT_MAX_WIDTH;
+      uint32_t height = 1 + cxt_random(&rng) % CXT_MAX_HEIGHT;
+      cifex_channels_t channels = cxt_chance(&rng, 2) ? cifex_rgb : cifex_rgba;
+      cxt_style_t style = cxt_random_style(&rng, seed % 4 == 0);
+
+      cxt_text_t text = { 0 };
+      cxt_write_pixels(&text, width, height, channels, &style, &rng);
+      // Some of the images are cut short.
+      if (cxt_chance(&rng, 10)) {
+         text.len = cxt_random(&rng) % (text.len + 1);
+      }
+
+      failures += !cxt_compare(&text, width, height, channels, 0, seed);
+      failures += !cxt_compare(&text, width, height, channels, CXT_STREAM_BUFFER_SIZE, seed);
+      free(text.data);
+   }
+
+   return failures != 0;
+}
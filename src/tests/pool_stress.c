@@ -0,0 +1,196 @@
+// Allocates, resizes, and frees buffers from a pool on several threads at once, passing buffers
+// between the threads so that they're freed through other caches than the ones they came from.
+// Every buffer is filled with a pattern naming its owner, and checked before it's freed, so a
+// buffer handed out twice shows up as a corrupted pattern.
+//
+// usage: pool_stress [threads] [iterations]
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libcifex.h"
+
+// The number of buffers passed between the threads.
+#define CXT_SHARED_SLOTS 16
+
+typedef struct cxt_buffer
+{
+   uint8_t *data;
+   size_t size;
+   // The byte the buffer is filled with.
+   uint8_t fill;
+} cxt_buffer_t;
+
+typedef struct cxt_shared
+{
+   cifex_pool_t *pool;
+   uint32_t iterations;
+   // Buffers waiting to be picked up by another thread.
+   _Atomic(cxt_buffer_t *) slots[CXT_SHARED_SLOTS];
+   atomic_uint failures;
+} cxt_shared_t;
+
+typedef struct cxt_thread
+{
+   cxt_shared_t *shared;
+   pthread_t thread;
+   uint32_t index;
+   uint64_t rng;
+} cxt_thread_t;
+
+static uint32_t
+cxt_random(uint64_t *rng)
+{
+   *rng ^= *rng << 13;
+   *rng ^= *rng >> 7;
+   *rng ^= *rng << 17;
+   return (uint32_t)(*rng >> 32);
+}
+
+// Picks a buffer size. Most sizes are pooled, and a few are small enough to bypass the pool.
+static size_t
+cxt_random_size(uint64_t *rng)
+{
+   uint32_t roll = cxt_random(rng);
+   if (roll % 8 == 0) {
+      return 1 + roll % 4096;
+   }
+   return ((size_t)64 << 10) + roll % ((size_t)1 << 20);
+}
+
+static bool
+cxt_check_buffer(const cxt_buffer_t *buffer)
+{
+   for (size_t i = 0; i < buffer->size; ++i) {
+      if (buffer->data[i] != buffer->fill) {
+         return false;
+      }
+   }
+   return true;
+}
+
+static void
+cxt_free_buffer(cxt_shared_t *shared, cifex_allocator_t *allocator, cxt_buffer_t *buffer)
+{
+   if (!cxt_check_buffer(buffer)) {
+      atomic_fetch_add(&shared->failures, 1);
+   }
+   cifex_free(allocator, buffer->data);
+   free(buffer);
+}
+
+static void *
+cxt_run_thread(void *user_data)
+{
+   cxt_thread_t *thread = user_data;
+   cxt_shared_t *shared = thread->shared;
+   cifex_pool_cache_t cache = cifex_pool_cache(shared->pool);
+
+   for (uint32_t i = 0; i < shared->iterations; ++i) {
+      // Every other buffer comes straight from the pool instead of the thread's cache.
+      cifex_allocator_t *allocator =
+         i % 2 == 0 ? &cache.allocator : cifex_pool_allocator(shared->pool);
+
+      cxt_buffer_t *buffer = malloc(sizeof(cxt_buffer_t));
+      if (buffer == NULL) {
+         atomic_fetch_add(&shared->failures, 1);
+         break;
+      }
+      buffer->size = cxt_random_size(&thread->rng);
+      buffer->fill = (uint8_t)(thread->index * 37 + i);
+      buffer->data = cifex_alloc(allocator, buffer->size);
+      if (buffer->data == NULL) {
+         atomic_fetch_add(&shared->failures, 1);
+         free(buffer);
+         break;
+      }
+      memset(buffer->data, buffer->fill, buffer->size);
+
+      if (i % 5 == 0) {
+         size_t new_size = cxt_random_size(&thread->rng);
+         uint8_t *grown = cifex_realloc(allocator, buffer->data, buffer->size, new_size);
+         if (grown == NULL) {
+            atomic_fetch_add(&shared->failures, 1);
+         } else {
+            buffer->data = grown;
+            if (new_size > buffer->size) {
+               memset(&buffer->data[buffer->size], buffer->fill, new_size - buffer->size);
+            }
+            buffer->size = new_size;
+         }
+      }
+
+      // Swap the buffer with one left behind by some other thread, and free that one instead.
+      uint32_t slot = cxt_random(&thread->rng) % CXT_SHARED_SLOTS;
+      cxt_buffer_t *other = atomic_exchange(&shared->slots[slot], buffer);
+      if (other != NULL) {
+         cxt_free_buffer(shared, &cache.allocator, other);
+      }
+   }
+
+   cifex_free_pool_cache(&cache);
+   return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+   uint32_t thread_count = argc > 1 ? (uint32_t)atoi(argv[1]) : 4;
+   uint32_t iterations = argc > 2 ? (uint32_t)atoi(argv[2]) : 2000;
+   if (thread_count == 0) {
+      fprintf(stderr, "error: at least one thread is needed\n");
+      return 1;
+   }
+
+   cifex_allocator_t libc = cifex_libc_allocator();
+   cxt_shared_t shared = { .iterations = iterations };
+   for (size_t slot = 0; slot < CXT_SHARED_SLOTS; ++slot) {
+      atomic_init(&shared.slots[slot], NULL);
+   }
+   atomic_init(&shared.failures, 0);
+   // Retain less than the threads keep in flight, so that buffers are also returned to the inner
+   // allocator.
+   if (cifex_create_pool(&shared.pool, &libc, (size_t)8 << 20) != cifex_ok) {
+      fprintf(stderr, "error: could not create the pool\n");
+      return 1;
+   }
+
+   cxt_thread_t *threads = calloc(thread_count, sizeof(cxt_thread_t));
+   if (threads == NULL) {
+      fprintf(stderr, "error: out of memory\n");
+      return 1;
+   }
+   for (uint32_t i = 0; i < thread_count; ++i) {
+      threads[i] = (cxt_thread_t){
+         .shared = &shared,
+         .index = i,
+         .rng = 0x9E3779B97F4A7C15u * (i + 1),
+      };
+      if (pthread_create(&threads[i].thread, NULL, cxt_run_thread, &threads[i]) != 0) {
+         fprintf(stderr, "error: could not start thread %u\n", i);
+         return 1;
+      }
+   }
+   for (uint32_t i = 0; i < thread_count; ++i) {
+      pthread_join(threads[i].thread, NULL);
+   }
+   free(threads);
+
+   for (size_t slot = 0; slot < CXT_SHARED_SLOTS; ++slot) {
+      cxt_buffer_t *buffer = atomic_load(&shared.slots[slot]);
+      if (buffer != NULL) {
+         cxt_free_buffer(&shared, cifex_pool_allocator(shared.pool), buffer);
+      }
+   }
+   cifex_destroy_pool(shared.pool);
+
+   unsigned failures = atomic_load(&shared.failures);
+   if (failures != 0) {
+      fprintf(stderr, "error: %u buffers were corrupted or could not be allocated\n", failures);
+      return 1;
+   }
+   return 0;
+}
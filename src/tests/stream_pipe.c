@@ -0,0 +1,350 @@
+// Streams two images through a pipe, holding the second one back until the first one is decoded.
+// A decoder that waits for the input following an image before returning it never gets to decode
+// the first image, and the writer gives up on waiting after a few seconds.
+//
+// How a pipe splits its input depends on timing, so the images are also streamed through a reader
+// handing them out in chunks of a few bytes, which cut lines and words in half. Those must decode
+// the same as when the whole input is read at once.
+//
+// usage: stream_pipe
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libcifex.h"
+
+// The window images are streamed through. The images are several times larger.
+#define CXT_STREAM_BUFFER_SIZE 1024
+
+// How long the writer waits for the first image to be decoded, in seconds.
+#define CXT_TIMEOUT 5
+
+#define CXT_WIDTH 40
+#define CXT_HEIGHT 30
+
+// Reads from a string in memory, at most `chunk_size` bytes at a time.
+typedef struct cxt_chunked
+{
+   const uint8_t *data;
+   size_t len, position;
+   size_t chunk_size;
+} cxt_chunked_t;
+
+static size_t
+cxt_chunked_read(cifex_reader_t *reader, void *out, size_t n_bytes)
+{
+   cxt_chunked_t *chunked = reader->user_data;
+   size_t n_left = chunked->len - chunked->position;
+   size_t n_read = n_bytes < n_left ? n_bytes : n_left;
+   n_read = n_read < chunked->chunk_size ? n_read : chunked->chunk_size;
+   memcpy(out, &chunked->data[chunked->position], n_read);
+   chunked->position += n_read;
+   return n_read;
+}
+
+// Writes into a growing buffer in memory.
+typedef struct cxt_buffer
+{
+   uint8_t *data;
+   size_t len, capacity;
+} cxt_buffer_t;
+
+static size_t
+cxt_buffer_write(cifex_writer_t *writer, const void *in, size_t n_bytes)
+{
+   cxt_buffer_t *buffer = writer->user_data;
+   if (buffer->len + n_bytes > buffer->capacity) {
+      size_t capacity = buffer->capacity * 2 + n_bytes;
+      uint8_t *grown = realloc(buffer->data, capacity);
+      if (grown == NULL) {
+         return 0;
+      }
+      buffer->data = grown;
+      buffer->capacity = capacity;
+   }
+   memcpy(&buffer->data[buffer->len], in, n_bytes);
+   buffer->len += n_bytes;
+   return n_bytes;
+}
+
+typedef struct cxt_shared
+{
+   int fd;
+   const cifex_image_t *images;
+   pthread_mutex_t mutex;
+   pthread_cond_t decoded_cond;
+   bool decoded;
+   bool timed_out;
+   cifex_result_t write_result;
+} cxt_shared_t;
+
+static size_t
+cxt_pipe_write(cifex_writer_t *writer, const void *in, size_t n_bytes)
+{
+   cxt_shared_t *shared = writer->user_data;
+   const char *bytes = in;
+   size_t n_written = 0;
+   while (n_written < n_bytes) {
+      ssize_t n = write(shared->fd, &bytes[n_written], n_bytes - n_written);
+      if (n < 0 && errno == EINTR) {
+         continue;
+      }
+      if (n <= 0) {
+         break;
+      }
+      n_written += n;
+   }
+   return n_written;
+}
+
+static void *
+cxt_run_writer(void *user_data)
+{
+   cxt_shared_t *shared = user_data;
+   cifex_writer_t writer = { .user_data = shared, .write = cxt_pipe_write };
+
+   shared->write_result = cifex_encode(&writer, &shared->images[0], NULL);
+
+   struct timespec deadline;
+   clock_gettime(CLOCK_REALTIME, &deadline);
+   deadline.tv_sec += CXT_TIMEOUT;
+   pthread_mutex_lock(&shared->mutex);
+   while (!shared->decoded && !shared->timed_out) {
+      shared->timed_out =
+         pthread_cond_timedwait(&shared->decoded_cond, &shared->mutex, &deadline) == ETIMEDOUT;
+   }
+   pthread_mutex_unlock(&shared->mutex);
+
+   // A blank line between the images, which belongs to neither of them.
+   if (shared->write_result == cifex_ok && cxt_pipe_write(&writer, "\n", 1) != 1) {
+      shared->write_result = cifex_errno_result(errno);
+   }
+   if (shared->write_result == cifex_ok) {
+      shared->write_result = cifex_encode(&writer, &shared->images[1], NULL);
+   }
+   close(shared->fd);
+   return NULL;
+}
+
+static bool
+cxt_same_image(const cifex_image_t *a, const cifex_image_t *b)
+{
+   return a->width == b->width && a->height == b->height && a->channels == b->channels &&
+      memcmp(a->data, b->data, (size_t)a->width * a->height * a->channels) == 0;
+}
+
+// Decodes `len` bytes of `text` with `cifex_decode`, `chunk_size` bytes at a time. A chunk size of
+// `0` reads the whole input at once.
+static cifex_decode_result_t
+cxt_decode_chunked(
+   cifex_allocator_t *allocator,
+   const uint8_t *text,
+   size_t len,
+   size_t chunk_size,
+   cifex_image_t *out_image)
+{
+   cxt_chunked_t chunked = {
+      .data = text,
+      .len = len,
+      .chunk_size = chunk_size != 0 ? chunk_size : SIZE_MAX,
+   };
+   cifex_reader_t reader = { .user_data = &chunked, .read = cxt_chunked_read };
+   cifex_decode_config_t config = cifex_default_decode_config(allocator, &reader);
+   config.stream_buffer_size = chunk_size != 0 ? CXT_STREAM_BUFFER_SIZE : 0;
+   return cifex_decode(config, out_image, NULL);
+}
+
+// Streams the encoded images in `text`, `text_len[i]` bytes each, in chunks of `chunk_size` bytes,
+// and checks that they decode the same as `expected`, both one at a time with `cifex_decode` and
+// all together through a stream decoder.
+static unsigned
+cxt_run_chunked(
+   cifex_allocator_t *allocator,
+   const cxt_buffer_t *text,
+   const size_t *text_len,
+   const cifex_image_t *expected,
+   size_t chunk_size)
+{
+   unsigned failures = 0;
+   cifex_image_t image = { 0 };
+   size_t offset = 0;
+   for (int i = 0; i < 2; ++i) {
+      cifex_decode_result_t decoded =
+         cxt_decode_chunked(allocator, &text->data[offset], text_len[i], chunk_size, &image);
+      if (decoded.result != cifex_ok) {
+         fprintf(
+            stderr,
+            "error: image %d in chunks of %zu: %s on line %zu\n",
+            i,
+            chunk_size,
+            cifex_result_to_string(decoded.result),
+            decoded.line);
+         ++failures;
+      } else if (!cxt_same_image(&image, &expected[i])) {
+         fprintf(stderr, "error: image %d in chunks of %zu was decoded wrong\n", i, chunk_size);
+         ++failures;
+      }
+      offset += text_len[i];
+   }
+
+   cxt_chunked_t chunked = { .data = text->data, .len = text->len, .chunk_size = chunk_size };
+   cifex_reader_t reader = { .user_data = &chunked, .read = cxt_chunked_read };
+   cifex_decode_config_t config = cifex_default_decode_config(allocator, &reader);
+   config.stream_buffer_size = CXT_STREAM_BUFFER_SIZE;
+   cifex_stream_decoder_t *decoder;
+   if (cifex_create_stream_decoder(&decoder, config) != cifex_ok) {
+      fprintf(stderr, "error: cannot create the stream decoder\n");
+      cifex_free_image(&image);
+      return failures + 1;
+   }
+   for (int i = 0; i < 3; ++i) {
+      cifex_decode_result_t decoded = cifex_decode_next(decoder, &image, NULL);
+      cifex_result_t expected_result = i < 2 ? cifex_ok : cifex_end_of_stream;
+      if (decoded.result != expected_result) {
+         fprintf(
+            stderr,
+            "error: streamed image %d in chunks of %zu: expected %s, got %s on line %zu\n",
+            i,
+            chunk_size,
+            cifex_result_to_string(expected_result),
+            cifex_result_to_string(decoded.result),
+            decoded.line);
+         ++failures;
+         break;
+      } else if (i < 2 && !cxt_same_image(&image, &expected[i])) {
+         fprintf(
+            stderr, "error: streamed image %d in chunks of %zu was decoded wrong\n", i, chunk_size);
+         ++failures;
+      }
+   }
+   cifex_destroy_stream_decoder(decoder);
+   cifex_free_image(&image);
+   return failures;
+}
+
+int
+main(void)
+{
+   cifex_allocator_t libc = cifex_libc_allocator();
+   cifex_image_t images[2] = { { 0 }, { 0 } };
+   for (int i = 0; i < 2; ++i) {
+      cifex_channels_t channels = i == 0 ? cifex_rgb : cifex_rgba;
+      if (cifex_alloc_image(&images[i], &libc, CXT_WIDTH, CXT_HEIGHT, channels) != cifex_ok) {
+         fprintf(stderr, "error: out of memory\n");
+         return 1;
+      }
+      for (size_t j = 0; j < (size_t)CXT_WIDTH * CXT_HEIGHT * channels; ++j) {
+         images[i].data[j] = (uint8_t)(j * 37 + i * 101);
+      }
+   }
+
+   int fds[2];
+   if (pipe(fds) != 0) {
+      perror("error: pipe");
+      return 1;
+   }
+   cxt_shared_t shared = {
+      .fd = fds[1],
+      .images = images,
+      .mutex = PTHREAD_MUTEX_INITIALIZER,
+      .decoded_cond = PTHREAD_COND_INITIALIZER,
+   };
+   pthread_t writer;
+   if (pthread_create(&writer, NULL, cxt_run_writer, &shared) != 0) {
+      fprintf(stderr, "error: could not start the writer\n");
+      return 1;
+   }
+
+   // Going through `cifex_fopen_read` checks that pipes are read without waiting for full reads.
+   char path[64];
+   snprintf(path, sizeof path, "/dev/fd/%d", fds[0]);
+   cifex_reader_t reader;
+   cifex_result_t result = cifex_fopen_read(&reader, path);
+   if (result != cifex_ok) {
+      fprintf(stderr, "error: cannot open %s: %s\n", path, cifex_result_to_string(result));
+      return 1;
+   }
+   cifex_decode_config_t config = cifex_default_decode_config(&libc, &reader);
+   config.stream_buffer_size = CXT_STREAM_BUFFER_SIZE;
+   cifex_stream_decoder_t *decoder;
+   if ((result = cifex_create_stream_decoder(&decoder, config)) != cifex_ok) {
+      fprintf(stderr, "error: %s\n", cifex_result_to_string(result));
+      return 1;
+   }
+
+   unsigned failures = 0;
+   cifex_image_t image = { 0 };
+   for (int i = 0; i < 3; ++i) {
+      cifex_decode_result_t decoded = cifex_decode_next(decoder, &image, NULL);
+      if (i == 0) {
+         pthread_mutex_lock(&shared.mutex);
+         shared.decoded = true;
+         pthread_cond_signal(&shared.decoded_cond);
+         pthread_mutex_unlock(&shared.mutex);
+      }
+
+      cifex_result_t expected = i < 2 ? cifex_ok : cifex_end_of_stream;
+      if (decoded.result != expected) {
+         fprintf(
+            stderr,
+            "error: image %d: expected %s, got %s on line %zu\n",
+            i,
+            cifex_result_to_string(expected),
+            cifex_result_to_string(decoded.result),
+            decoded.line);
+         ++failures;
+      } else if (i < 2 && !cxt_same_image(&image, &images[i])) {
+         fprintf(stderr, "error: image %d was decoded wrong\n", i);
+         ++failures;
+      }
+   }
+   cifex_free_image(&image);
+   cifex_destroy_stream_decoder(decoder);
+   cifex_fclose_read(&reader);
+
+   pthread_join(writer, NULL);
+   if (shared.timed_out) {
+      fprintf(stderr, "error: the first image was not decoded until the second one was sent\n");
+      ++failures;
+   }
+   if (shared.write_result != cifex_ok) {
+      fprintf(stderr, "error: writing: %s\n", cifex_result_to_string(shared.write_result));
+      ++failures;
+   }
+
+   // The images as they decode from the whole input, which the chunked decodes are checked against.
+   cxt_buffer_t text = { 0 };
+   size_t text_len[2];
+   cifex_image_t whole[2] = { { 0 }, { 0 } };
+   cifex_writer_t buffer_writer = { .user_data = &text, .write = cxt_buffer_write };
+   for (int i = 0; i < 2; ++i) {
+      size_t start = text.len;
+      if (cifex_encode(&buffer_writer, &images[i], NULL) != cifex_ok) {
+         fprintf(stderr, "error: cannot encode image %d\n", i);
+         return 1;
+      }
+      text_len[i] = text.len - start;
+      cifex_decode_result_t decoded =
+         cxt_decode_chunked(&libc, &text.data[start], text_len[i], 0, &whole[i]);
+      if (decoded.result != cifex_ok || !cxt_same_image(&whole[i], &images[i])) {
+         fprintf(stderr, "error: image %d does not decode from memory\n", i);
+         return 1;
+      }
+   }
+   static const size_t chunk_sizes[] = { 1, 3, 17 };
+   for (size_t i = 0; i < sizeof chunk_sizes / sizeof chunk_sizes[0]; ++i) {
+      failures += cxt_run_chunked(&libc, &text, text_len, whole, chunk_sizes[i]);
+   }
+
+   free(text.data);
+   cifex_free_image(&whole[0]);
+   cifex_free_image(&whole[1]);
+   cifex_free_image(&images[0]);
+   cifex_free_image(&images[1]);
+   return failures != 0;
+}
@@ -0,0 +1,77 @@
+#!/bin/sh
+# Builds cifex with profile-guided and link-time optimization, and compares it against a plain
+# release build.
+#
+# usage: util/pgo-build.sh [build-dir]
+#
+# A plain release build is made in <build-dir>-release first. It generates the synthetic benchmark
+# corpus, which the instrumented build in <build-dir> is trained on before being rebuilt with the
+# collected profile. Both builds are then benchmarked over the corpus. The optimized binary ends up
+# in <build-dir>/src/cifex-cli/cifex.
+
+set -eu
+
+build=${1:-build-pgo}
+release=$build-release
+source_dir=$(cd "$(dirname "$0")/.." && pwd)
+iterations=${CIFEX_PGO_ITERATIONS:-5}
+
+# Sets up a build directory from scratch.
+setup() {
+   dir=$1
+   shift
+   if [ -d "$dir" ]; then
+      meson setup --wipe "$dir" "$source_dir" "$@" >/dev/null
+   else
+      meson setup "$dir" "$source_dir" "$@" >/dev/null
+   fi
+}
+
+echo "== release build in $release"
+setup "$release" -Dbuildtype=release
+ninja -C "$release" >/dev/null
+ninja -C "$release" bench-corpus >/dev/null
+corpus=$(ls "$release"/src/bench/*.cif)
+
+echo "== instrumented build in $build"
+setup "$build" -Dbuildtype=release -Db_lto=true -Db_pgo=generate
+ninja -C "$build" >/dev/null
+
+echo "== training"
+# Clang writes its raw profiles wherever this points; GCC writes them next to the object files.
+LLVM_PROFILE_FILE="$(cd "$build" && pwd)/cifex-%p.profraw"
+export LLVM_PROFILE_FILE
+for file in $corpus; do
+   "$build/src/cifex-cli/cifex" bench "$file" --iterations 1 --warmup 0 >/dev/null
+   "$build/src/cifex-cli/cifex" bench "$file" --iterations 1 --warmup 0 --only decode --stream \
+      >/dev/null
+done
+if ls "$build"/*.profraw >/dev/null 2>&1; then
+   llvm-profdata merge -output="$build/default.profdata" "$build"/*.profraw
+fi
+
+echo "== optimized build in $build"
+meson setup --reconfigure "$build" "$source_dir" -Db_pgo=use >/dev/null
+ninja -C "$build" >/dev/null
+
+# Prints the median time of a phase, in milliseconds.
+median_ms() {
+   "$1/src/cifex-cli/cifex" bench "$2" --iterations "$iterations" --only "$3" |
+      awk -v phase="$3" '$1 == phase { print $3 }'
+}
+
+echo "== median times in ms, release vs. pgo+lto, $iterations iterations"
+printf '%-28s %10s %10s %8s %10s %10s %8s\n' \
+   file decode pgo+lto delta encode pgo+lto delta
+for file in $corpus; do
+   decode_release=$(median_ms "$release" "$file" decode)
+   decode_pgo=$(median_ms "$build" "$file" decode)
+   encode_release=$(median_ms "$release" "$file" encode)
+   encode_pgo=$(median_ms "$build" "$file" encode)
+   awk -v file="$(basename "$file")" \
+      -v dr="$decode_release" -v dp="$decode_pgo" -v er="$encode_release" -v ep="$encode_pgo" \
+      'BEGIN {
+         printf "%-28s %10.3f %10.3f %7.1f%% %10.3f %10.3f %7.1f%%\n",
+            file, dr, dp, (dp - dr) / dr * 100, er, ep, (ep - er) / er * 100
+      }'
+done